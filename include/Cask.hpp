@@ -4,34 +4,107 @@
 #include "../src/runtime/SparseMatrix.hpp"
 #include <unordered_map>
 #include <sstream>
+#include <stdexcept>
+#include <string>
 #include <Spmv.hpp>
 #include "../src/runtime/GeneratedImplSupport.hpp"
 #include "../src/runtime/Cg.hpp"
+#include "../src/runtime/Dse.hpp"
+#include "../src/runtime/FormatTuner.hpp"
+#include <memory>
+#include <vector>
 
 namespace cask {
 
-/** A thin wrapper around various implementation managers */
+/**
+ * A thin wrapper around various implementation managers, which is the API of
+ * the library: clients, e.g. the Python bindings, pass matrices in memory
+ * (a CsrView can point to storage the caller owns) rather than as files.
+ */
 class CaskContext {
 
   cask::runtime::SpmvImplementationLoader spmvManager;
+  cask::cpu::FormatTuner formatTuner;
+  cask::dse::SparkDse dseTool;
+
+  // the fastest implementation on the matrix, by the cycle model
+  const cask::runtime::GeneratedSpmvImplementation& implementationFor(const CsrView& matrix) {
+    auto impl = spmvManager.fastestFor(matrix);
+    if (!impl)
+      throw std::runtime_error("No SpMV implementation supports " + std::to_string(matrix.n) + " rows");
+    return *impl;
+  }
 
  public:
 
-  void preprocess(const SymCsrMatrix& matrix) {
+  /** With the generated implementations which are linked in */
+  CaskContext() {}
+
+  /** With the given implementations, e.g. simulated ones, which must
+   * outlive the context */
+  explicit CaskContext(std::vector<cask::runtime::GeneratedSpmvImplementation*> impls) :
+    spmvManager(impls) {}
+
+  /** The matrix preprocessed for the fastest implementation on it, ready to
+   * multiply; the matrix can be released once this returns */
+  std::shared_ptr<cask::spmv::Spmv> preprocess(const CsrView& matrix) {
+    std::shared_ptr<cask::spmv::Spmv> s(new spmv::Spmv(implementationFor(matrix)));
+    s->preprocess(matrix);
+    return s;
+  }
+
+  /** As above, for a symmetric matrix of which the lower triangle is
+   * stored; the implementation is chosen on the expanded matrix, as by
+   * getSpmv() */
+  std::shared_ptr<cask::spmv::Spmv> preprocess(const SymCsrMatrix& matrix) {
+    std::shared_ptr<cask::spmv::Spmv> s(new spmv::Spmv(implementationFor(matrix.explicitSymmetric())));
+    s->preprocess(matrix);
+    return s;
+  }
+
+  /** The clock cycles of an SpMV by the fastest implementation on the
+   * matrix, estimated without building its streams (see Spmv::analyse()) */
+  double estimateClockCycles(const CsrView& matrix) {
+    spmv::Spmv s(implementationFor(matrix));
+    s.analyse(matrix);
+    return s.getEstimatedClockCycles();
+  }
+
+  /** Explores the design space for the matrices of the benchmark (see
+   * dse::SparkDse::run()); the family and sharded designs of the last
+   * exploration are those of getDse() */
+  std::vector<cask::dse::DseResult> explore(
+      const cask::dse::Benchmark& benchmark,
+      const cask::dse::DseParameters& params,
+      const cask::model::DeviceModel& deviceModel) {
+    return dseTool.run(benchmark, params, deviceModel);
+  }
+
+  const cask::dse::SparkDse& getDse() const {
+    return dseTool;
   }
 
   cask::spmv::Spmv getSpmv(SymCsrMatrix& matrix) {
-    // TODO should choose between the various implementtation types
-    return spmv::Spmv(spmvManager.architectureWithParams(matrix.n));
+    return spmv::Spmv(implementationFor(matrix.explicitSymmetric()));
   }
 
   cask::spmv::Spmv getSpmv(CsrMatrix& matrix) {
-    // TODO should choose between the various implementtation types
-    return spmv::Spmv(spmvManager.architectureWithParams(matrix.n));
+    return spmv::Spmv(implementationFor(matrix));
   }
 
   cask::solvers::Cg getCg(SymCsrMatrix& matrix) {
+    return solvers::Cg(getSpmv(matrix));
+  }
+
+  /** A CPU SpMV in the format fastest on the matrix (see cpu::FormatTuner),
+   * which must outlive it; the choice is kept for matrices of the same
+   * structure */
+  cask::cpu::TunedSpmv getCpuSpmv(const CsrMatrix& matrix) {
+    return formatTuner.tune(matrix);
+  }
 
+  cask::cpu::FormatTuner& getFormatTuner() {
+    return formatTuner;
   }
 
 };
@@ -0,0 +1,137 @@
+// Runs the registered solver / preconditioner pairs (see
+// runtime/SolverBenchmark.hpp) over a set of symmetric systems, under the
+// same conditions, and writes their setup and solve times, iterations and
+// time to tolerance as JSON:
+//
+//   ./bench_solvers test/systems --solvers cg/ilu0 pipelined_cg/ilu0 > solvers.json
+//
+// The right hand side of foo.mtx is foo_b.mtx if it exists, otherwise A * 1.
+#include "runtime/IO.hpp"
+#include "runtime/SolverBenchmark.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+namespace bfs = boost::filesystem;
+
+namespace {
+
+// the right hand sides and solutions of systems share their directory
+bool isVector(const bfs::path& p) {
+  string stem = p.stem().string();
+  for (string suffix : {"_b", "_sol", "_x"})
+    if (stem.size() > suffix.size() && stem.compare(stem.size() - suffix.size(), suffix.size(), suffix) == 0)
+      return true;
+  return false;
+}
+
+vector<double> rightHandSide(const bfs::path& matrix, const cask::SymCsrMatrix& a) {
+  bfs::path rhs = matrix.parent_path() / (matrix.stem().string() + "_b.mtx");
+  if (bfs::is_regular_file(rhs))
+    return cask::io::readVector(rhs.string()).data;
+  return a.dot(cask::Vector(vector<double>(a.n, 1.0))).data;
+}
+
+}
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+
+  int repetitions;
+  string benchPath, output;
+  vector<string> solvers;
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "Print this help message")
+    ("solvers", po::value<vector<string>>(&solvers)->multitoken(),
+     "Solver/preconditioner pairs to run, e.g. cg/ilu0; by default all registered pairs")
+    ("repetitions", po::value<int>(&repetitions)->default_value(3),
+     "Runs of each pair on each system, of which the fastest is reported")
+    ("output", po::value<string>(&output), "Write the JSON results to this file, not stdout")
+    ("list", "List the registered solver/preconditioner pairs");
+
+  po::options_description required_options("Required arguments");
+  required_options.add_options()
+    ("bench-path", po::value<string>(&benchPath), "Path to a directory of systems, or a matrix");
+  po::positional_options_description p;
+  p.add("bench-path", 1);
+
+  po::options_description cmdline_options;
+  cmdline_options.add(desc).add(required_options);
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+  } catch (std::exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  const vector<cask::benchmark::SolverVariant>& registry = cask::benchmark::solverRegistry();
+  if (vm.count("list")) {
+    for (const auto& v : registry)
+      cout << v.name() << endl;
+    return 0;
+  }
+  if (vm.count("help") || benchPath.empty()) {
+    cout << "Usage: ./bench_solvers bench-path [options]" << endl << endl;
+    cout << required_options << endl;
+    cout << desc << endl;
+    return benchPath.empty() && !vm.count("help");
+  }
+
+  vector<cask::benchmark::SolverVariant> variants;
+  for (const auto& v : registry)
+    if (solvers.empty() || find(solvers.begin(), solvers.end(), v.name()) != solvers.end())
+      variants.push_back(v);
+  for (const auto& name : solvers) {
+    auto known = [&name](const cask::benchmark::SolverVariant& v) { return v.name() == name; };
+    if (none_of(variants.begin(), variants.end(), known)) {
+      cerr << "Error: unknown solver " << name << ", see --list" << endl;
+      return 1;
+    }
+  }
+
+  bfs::path dirp{benchPath};
+  vector<bfs::path> matrices;
+  if (bfs::is_directory(dirp)) {
+    for (bfs::directory_iterator end, it = bfs::directory_iterator(dirp); it != end; it++)
+      if (it->path().extension() == ".mtx" && !isVector(it->path()))
+        matrices.push_back(it->path());
+    sort(matrices.begin(), matrices.end());
+  } else if (bfs::is_regular_file(dirp)) {
+    matrices.push_back(dirp);
+  } else {
+    cerr << "Error: '" << benchPath << "' not a directory or valid file" << endl;
+    return 1;
+  }
+
+  vector<cask::benchmark::SolverRun> runs;
+  int status = 0;
+  for (const auto& path : matrices) {
+    try {
+      cask::SymCsrMatrix a = cask::io::readSymMatrix(path.string());
+      vector<double> rhs = rightHandSide(path, a);
+      for (const auto& v : variants) {
+        cerr << "Running " << v.name() << " on " << path.string() << endl;
+        runs.push_back(cask::benchmark::runSolver(v, a, rhs, path.stem().string(), repetitions));
+      }
+    } catch (std::exception& e) {
+      cerr << "Error: " << path.string() << ": " << e.what() << endl;
+      status = 1;
+    }
+  }
+
+  if (output.empty()) {
+    cask::benchmark::writeJson(runs, cout);
+  } else {
+    ofstream f(output);
+    cask::benchmark::writeJson(runs, f);
+  }
+  return status;
+}
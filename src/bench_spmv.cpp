@@ -0,0 +1,232 @@
+// Measures the end to end throughput of SpMV on the device, for each matrix
+// of a directory and each of the given generated implementations:
+//
+//   ./bench_spmv test/test-benchmark 0 2 --iterations 50 --output bench.json
+//
+// Each multiplication is split in the upload of x, the run of the design and
+// the readback of y (see Spmv::getMultiplyTimes()); the median and 99th
+// percentile of each phase over the timed iterations are written as JSON,
+// which src/frontend/render_graphs.py plots. Without implementation IDs, the
+// fastest implementation for each matrix is used.
+#include "runtime/CpuSpmv.hpp"
+#include "runtime/DfeSimulator.hpp"
+#include "runtime/GeneratedImplSupport.hpp"
+#include "runtime/IO.hpp"
+#include "runtime/Spmv.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Percentiles {
+  double median, p99;
+};
+
+// nearest rank percentiles of the samples
+Percentiles percentiles(vector<double> samples) {
+  sort(samples.begin(), samples.end());
+  auto rank = [&samples](double q) {
+    size_t r = (size_t)ceil(q * samples.size());
+    return samples[max<size_t>(r, 1) - 1];
+  };
+  return Percentiles{rank(0.5), rank(0.99)};
+}
+
+struct BenchResult {
+  string matrix, design;
+  int implId, rows, cols;
+  int64_t nnzs;
+  // read from device DRAM and transferred over the host link, by each
+  // multiplication
+  int64_t bytes;
+  Percentiles upload, kernel, readback, total;
+  double maxError;
+};
+
+void writePercentiles(ostream& s, const string& name, const Percentiles& p) {
+  s << ",\"" << name << "\":{\"median\":" << p.median << ",\"p99\":" << p.p99 << "}";
+}
+
+void writeJson(ostream& s, const vector<BenchResult>& results, int warmup, int iterations) {
+  s << "{\"warmup\":" << warmup << ",\"iterations\":" << iterations << ",\n\"results\":[";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult& r = results[i];
+    double flops = 2.0 * r.nnzs;
+    s << (i == 0 ? "\n" : ",\n")
+      << "{\"matrix\":\"" << r.matrix << "\",\"impl_id\":" << r.implId
+      << ",\"design\":\"" << r.design << "\",\"rows\":" << r.rows << ",\"cols\":" << r.cols
+      << ",\"nnzs\":" << r.nnzs << ",\"bytes\":" << r.bytes;
+    writePercentiles(s, "upload_seconds", r.upload);
+    writePercentiles(s, "kernel_seconds", r.kernel);
+    writePercentiles(s, "readback_seconds", r.readback);
+    writePercentiles(s, "total_seconds", r.total);
+    // of the median multiplication, end to end and of the design alone
+    s << ",\"gflops\":" << flops / r.total.median / 1E9
+      << ",\"kernel_gflops\":" << flops / r.kernel.median / 1E9
+      << ",\"gbps\":" << r.bytes / r.total.median / 1E9
+      << ",\"max_error\":" << r.maxError << "}";
+  }
+  s << "]}\n";
+}
+
+BenchResult bench(const string& path, cask::runtime::GeneratedSpmvImplementation& impl,
+                  int warmup, int iterations, bool simulate) {
+  cask::io::LoadedMatrix loaded(path);
+  const cask::CsrView& a = loaded.view();
+  cask::spmv::Spmv s(impl);
+  if (simulate)
+    cask::runtime::simulate(s.impl);
+  s.preprocess(a);
+
+  cask::Vector x(a.m), y(a.n), exp(a.n);
+  for (int j = 0; j < a.m; j++)
+    x[j] = 1 + j % 7;
+  cask::cpu::spmv(a, x.data.data(), exp.data.data());
+
+  // the first multiplication also loads the matrix
+  for (int i = 0; i < warmup; i++)
+    s.multiply(x.data.data(), y.data.data());
+  double maxError = 0;
+  for (int i = 0; i < a.n; i++)
+    maxError = max(maxError, abs(y[i] - exp[i]) / max(1.0, abs(exp[i])));
+
+  vector<double> upload, kernel, readback, total;
+  for (int i = 0; i < iterations; i++) {
+    s.multiply(x.data.data(), y.data.data());
+    const cask::spmv::MultiplyTimes& t = s.getMultiplyTimes();
+    upload.push_back(t.uploadSeconds);
+    kernel.push_back(t.kernelSeconds);
+    readback.push_back(t.readbackSeconds);
+    total.push_back(t.uploadSeconds + t.kernelSeconds + t.readbackSeconds);
+  }
+
+  BenchResult r;
+  r.matrix = boost::filesystem::path(path).stem().string();
+  r.design = s.get_name() + " " + to_string(impl.cache_size) + " " + to_string(impl.input_width) +
+      " " + to_string(impl.num_pipes) + " " + to_string(impl.num_controllers);
+  r.implId = impl.id;
+  r.rows = a.n;
+  r.cols = a.m;
+  r.nnzs = a.nnzs;
+  r.bytes = int64_t(a.n + a.m) * sizeof(double);
+  for (const auto& p : s.getPartitions())
+    r.bytes += p.streamBytes();
+  r.upload = percentiles(upload);
+  r.kernel = percentiles(kernel);
+  r.readback = percentiles(readback);
+  r.total = percentiles(total);
+  r.maxError = maxError;
+  return r;
+}
+
+}
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  namespace bfs = boost::filesystem;
+
+  int warmup, iterations;
+  string benchPath, output;
+  vector<int> implIds;
+  po::options_description desc("Allowed options");
+  desc.add_options()
+    ("help", "Print this help message")
+    ("warmup", po::value<int>(&warmup)->default_value(3),
+     "Untimed multiplications before the timed ones, at least one")
+    ("iterations", po::value<int>(&iterations)->default_value(20), "Timed multiplications")
+    ("output", po::value<string>(&output), "Write the JSON results to this file, not stdout")
+    ("simulate", "Run the designs on the software simulator (for mock builds)");
+
+  po::options_description required_options("Required arguments");
+  required_options.add_options()
+    ("bench-path", po::value<string>(&benchPath),
+     "Path to a directory of matrices, or a matrix")
+    ("impl-ids", po::value<vector<int>>(&implIds),
+     "IDs of the generated implementations to run, by default the fastest for each matrix");
+  po::positional_options_description p;
+  p.add("bench-path", 1);
+  p.add("impl-ids", -1);
+
+  po::options_description cmdline_options;
+  cmdline_options.add(desc).add(required_options);
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(cmdline_options).positional(p).run(), vm);
+    po::notify(vm);
+  } catch (std::exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  if (vm.count("help") || benchPath.empty()) {
+    cout << "Usage: ./bench_spmv bench-path [impl-id...] [options]" << endl << endl;
+    cout << required_options << endl;
+    cout << desc << endl;
+    return benchPath.empty() && !vm.count("help");
+  }
+  if (warmup < 1 || iterations < 1) {
+    cerr << "Error: warmup and iterations must be positive" << endl;
+    return 1;
+  }
+
+  bfs::path dirp{benchPath};
+  vector<string> matrices;
+  if (bfs::is_directory(dirp)) {
+    for (bfs::directory_iterator end, it = bfs::directory_iterator(dirp); it != end; it++)
+      if (it->path().extension() == ".mtx")
+        matrices.push_back(it->path().string());
+    sort(matrices.begin(), matrices.end());
+  } else if (bfs::is_regular_file(dirp)) {
+    matrices.push_back(dirp.string());
+  } else {
+    cerr << "Error: '" << benchPath << "' not a directory or valid file" << endl;
+    return 1;
+  }
+
+  cask::runtime::SpmvImplementationLoader loader;
+  vector<BenchResult> results;
+  int status = 0;
+  for (const auto& path : matrices) {
+    vector<cask::runtime::GeneratedSpmvImplementation*> impls;
+    try {
+      if (implIds.empty())
+        impls.push_back(loader.fastestFor(cask::io::LoadedMatrix(path).view()));
+      for (int id : implIds)
+        impls.push_back(loader.architectureWithId(id));
+    } catch (std::exception& e) {
+      cerr << "Error: " << path << ": " << e.what() << endl;
+      status = 1;
+      continue;
+    }
+    for (auto* impl : impls) {
+      if (!impl) {
+        cerr << "Error: " << path << ": no implementations to run" << endl;
+        status = 1;
+        continue;
+      }
+      cerr << "Running " << path << " on implementation " << impl->id << endl;
+      try {
+        results.push_back(bench(path, *impl, warmup, iterations, vm.count("simulate")));
+      } catch (std::exception& e) {
+        cerr << "Error: " << path << " on implementation " << impl->id << ": " << e.what() << endl;
+        status = 1;
+      }
+    }
+  }
+
+  if (output.empty()) {
+    writeJson(cout, results, warmup, iterations);
+  } else {
+    ofstream f(output);
+    writeJson(f, results, warmup, iterations);
+  }
+  return status;
+}
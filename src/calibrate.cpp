@@ -0,0 +1,52 @@
+// Fits the kernel costs of a device model to the resource usage of measured
+// builds, by least squares, and prints the calibrated device descriptor:
+//
+//   ./calibrate_model Max4 builds.json > max4-calibrated.json
+//
+// The device is a name (Max4, Max4MoreMemory, Max5) or a JSON descriptor; see
+// runtime/DeviceModels.hpp for the formats of descriptors and builds.
+#include "runtime/DeviceModels.hpp"
+#include "runtime/Spmv.hpp"
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+using namespace cask::model;
+
+int main(int argc, char** argv) {
+  if (argc != 3) {
+    cout << "Usage: ./calibrate_model device builds.json" << endl;
+    return 1;
+  }
+
+  try {
+    std::shared_ptr<DeviceModel> device = makeDeviceModel(argv[1]);
+    ifstream f(argv[2]);
+    if (!f) {
+      cerr << "Error: could not open " << argv[2] << endl;
+      return 1;
+    }
+    vector<BuildMeasurement> builds = readBuildMeasurements(f);
+
+    JsonDeviceModel calibrated;
+    calibrated.id = device->getId();
+    calibrated.frequencyHz = device->frequency();
+    calibrated.bramEntries = device->entriesPerBram(64);
+    calibrated.limits = device->maxParams();
+    calibrated.costs = fitKernelCosts(*device, builds);
+
+    // the residuals of the fit, per build
+    for (const auto& b : builds) {
+      cask::spmv::Spmv s(b.cacheSize, b.inputWidth, b.numPipes, b.maxRows, 1,
+          cask::spmv::ValueFormat::Fp64, b.indexBits);
+      LogicResourceUsage est = s.getEstimatedHardwareModel(calibrated, b.maxRows).ru;
+      cerr << "Build " << b.cacheSize << " " << b.inputWidth << " " << b.numPipes
+           << " measured " << b.usage.to_string() << " estimated " << est.to_string() << endl;
+    }
+    writeDeviceModel(calibrated, cout);
+  } catch (std::exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -63,6 +63,8 @@ def output_path(path=''):
 def preProcessBenchmark(benchDirPath):
   entries = []
   for f in os.listdir(benchDirPath):
+    if not f.endswith('.mtx'):
+      continue
     info = io.mminfo(os.path.join(benchDirPath, f))
     if info[0] == info[1]:
       info = list(info[1:])
@@ -100,6 +102,14 @@ def runDse(benchFile, paramsFile, target, skipExecution=False):
     data = json.load(f)
     for arch in data['best_architectures']:
       ps = arch['architecture_params']
+      # the kernel reads 32 bit column offsets, narrower ones are only
+      # decoded by the simulator behind the mock
+      index_bits = ps.pop('index_bits', '32')
+      if target == TARGET_DFE_MOCK:
+        ps['index_bits'] = index_bits
+      elif int(index_bits) != 32:
+        raise ValueError('index_bits {0} of {1} is only supported by the {2} target'.format(
+            index_bits, arch['matrices'][0], TARGET_DFE_MOCK))
       est_impl_ps = arch['estimated_impl_params']
       matrix = arch['matrices'][0]
       params.append(ps)
@@ -249,6 +259,8 @@ class Spark:
 
       # Defines struct formats
       f.write('#include "{0}"\n'.format('GeneratedImplSupport.hpp'))
+      if self.target == TARGET_DFE_MOCK:
+        f.write('#include "{0}"\n'.format('DfeSimulator.hpp'))
 
       f.write('using namespace cask::runtime;\n')
 
@@ -268,8 +280,16 @@ class Spark:
             writeFunction = 'cask::runtime::spmvWriteMock'
             readFunction = 'cask::runtime::spmvReadMock'
             dramReductionEnabled = 'false'
+        # the symmetric kernel and narrow column offsets are only modelled by
+        # the simulator so far
+        symmetric = 'false'
+        index_bits = '32'
+        if self.target == TARGET_DFE_MOCK:
+            symmetric = p.params.get('symmetric', 'false')
+            index_bits = p.params.get('index_bits', '32')
         f.write(
-              'new GeneratedSpmvImplementation({0}, {1}, {2}, {3}, {4}, {5}, {6}, {7}, {8}, {9}));'.format(
+              'new GeneratedSpmvImplementation({0}, {1}, {2}, {3}, {4}, {5}, {6}, {7}, {8}, {9}, '
+              'cask::spmv::parseValueFormat("{10}"), {11}, {12}));'.format(
                 p.prj_id,
                 runFunction,
                 writeFunction,
@@ -279,7 +299,13 @@ class Spark:
                 p.getParam('cache_size'),
                 p.getParam('input_width'),
                 dramReductionEnabled,
-                p.getParam('num_controllers')))
+                p.getParam('num_controllers'),
+                p.params.get('value_format', 'fp64'),
+                index_bits,
+                symmetric))
+        # mock runs multiply on a software model of the design
+        if self.target == TARGET_DFE_MOCK:
+          f.write('cask::runtime::simulate(*this->impls.back());\n')
       f.write('\n}')
 
   def runBuilds(self):
@@ -493,7 +519,7 @@ def main():
   print merged_df
 
   p = os.path.abspath(args.benchmark_dir)
-  benchmark = [ join(p, f) for f in listdir(p) if isfile(join(p,f)) ]
+  benchmark = [ join(p, f) for f in listdir(p) if isfile(join(p,f)) and f.endswith('.mtx') ]
   if args.benchmark_start != None and args.benchmark_end != None:
     benchmark = benchmark[args.benchmark_start:args.benchmark_end]
 
@@ -1,5 +1,7 @@
 import re
 import os
+import sys
+import json
 import pprint
 import pandas as pd
 import numpy as np
@@ -40,7 +42,35 @@ class RunResult:
     return self.__str__()
 
 
+def loadBenchResults(paths):
+  """The results of bench_spmv runs, as a frame of measured GFLOPS with a
+  row per matrix and a column per design."""
+  rows = []
+  for path in paths:
+    with open(path, 'r') as f:
+      for r in json.load(f)['results']:
+        rows.append([r['design'], r['matrix'], r['gflops']])
+  df = pd.DataFrame(rows, columns=['design', 'matrix', 'gflops'])
+  return df.pivot_table(index='matrix', columns='design', values='gflops')
+
+
+def plot(df, fileName):
+  sns.set_style("white")
+  sns.set_palette(sns.color_palette("cubehelix", 13))
+  bar = df.plot(kind='bar')
+  sns.despine()
+  fig = bar.get_figure()
+  fig.set_size_inches(15, 15)
+  fig.tight_layout()
+  fig.savefig(fileName)
+
+
 def main():
+  # the JSON outputs of bench_spmv, if given, are plotted instead
+  if len(sys.argv) > 1:
+    plot(loadBenchResults(sys.argv[1:]), 'bench_gflops.pdf')
+    return
+
   runResults = []
   # Traverse files, extract matrix, architecture and params
   for f in [f for f in os.listdir('.') if os.path.isfile(f)]:
@@ -60,14 +90,7 @@ def main():
   new_df = pd.concat(groups, axis=1)
   new_df.columns = names
 
-  sns.set_style("white")
-  sns.set_palette(sns.color_palette("cubehelix", 13))
-  bar = new_df.plot(kind='bar')
-  sns.despine()
-  fig = bar.get_figure()
-  fig.set_size_inches(15, 15)
-  fig.tight_layout()
-  fig.savefig('est_gflops.pdf')
+  plot(new_df, 'est_gflops.pdf')
   # plt.show()
 
 
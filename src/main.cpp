@@ -3,8 +3,10 @@
 #include <boost/program_options.hpp>
 #include <boost/property_tree/json_parser.hpp>
 #include <Model.hpp>
+#include <DeviceModels.hpp>
 #include <boost/property_tree/ptree.hpp>
 #include <iostream>
+#include <map>
 #include <string>
 #include <chrono>
 #include <sstream>
@@ -12,6 +14,22 @@
 using namespace std;
 namespace pt = boost::property_tree;
 
+std::vector<std::map<std::string, int>> loadSeeds(const std::string& path) {
+  pt::ptree tree;
+  pt::read_json(path, tree);
+  std::vector<std::map<std::string, int>> seeds;
+  for (const auto& best : tree.get_child("best_architectures")) {
+    const pt::ptree& params = best.second.get_child("architecture_params");
+    seeds.push_back({
+        {"cacheSize", params.get<int>("cache_size")},
+        {"inputWidth", params.get<int>("input_width")},
+        {"numPipes", params.get<int>("num_pipes")},
+        {"numControllers", params.get<int>("num_controllers")},
+        {"indexBits", params.get<int>("index_bits", 32)}});
+  }
+  return seeds;
+}
+
 cask::dse::DseParameters loadParams(const boost::filesystem::path& parf) {
   std::cout << "Using " << parf << " as param file" << std::endl;
   pt::ptree tree;
@@ -45,6 +63,34 @@ cask::dse::DseParameters loadParams(const boost::filesystem::path& parf) {
         tree.get<int>("dse_params.num_controllers.stop"),
         tree.get<int>("dse_params.num_controllers.step"),
     };
+  dsep.indexBits =
+    cask::utils::Parameter<int>{
+        "indexBits",
+        tree.get<int>("dse_params.index_bits.start", 32),
+        tree.get<int>("dse_params.index_bits.stop", 32),
+        tree.get<int>("dse_params.index_bits.step", 1),
+    };
+  dsep.numShards =
+    cask::utils::Parameter<int>{
+        "numShards",
+        tree.get<int>("dse_params.num_shards.start", 1),
+        tree.get<int>("dse_params.num_shards.stop", 1),
+        tree.get<int>("dse_params.num_shards.step", 1),
+    };
+  dsep.reordering = cask::reordering::parseMethod(tree.get<std::string>("dse_params.reordering", "none"));
+  // e.g. the measured_calibration of the output of a previous run
+  dsep.calibration.cycleScale = tree.get<double>("dse_params.calibration.cycle_scale", 1.0);
+  dsep.calibration.hostBandwidth = tree.get<double>("dse_params.calibration.host_bandwidth", 0.0);
+  dsep.reportPerformance = tree.get<bool>("dse_params.report_performance", false);
+  dsep.cacheDirectory = tree.get<std::string>("dse_params.cache_directory", "");
+  dsep.search.engine = tree.get<std::string>("dse_params.search.engine", "exhaustive");
+  dsep.search.budget = tree.get<int>("dse_params.search.budget", dsep.search.budget);
+  dsep.search.randomSeed = tree.get<unsigned>("dse_params.search.random_seed", dsep.search.randomSeed);
+  // the best architectures of a previous run (its dse_out.json) are the
+  // starting points of local searches
+  std::string seedResults = tree.get<std::string>("dse_params.search.seed_results", "");
+  if (!seedResults.empty())
+    dsep.search.seeds = loadSeeds(seedResults);
   return dsep;
 }
 
@@ -53,7 +99,9 @@ cask::dse::Benchmark loadBenchmark(const boost::filesystem::path& p) {
   std::cout << "Using " << p << " as benchmark directory" << std::endl;
   cask::dse::Benchmark benchmark{};
   for (directory_iterator end, it = directory_iterator(p); it != end; it++) {
-    benchmark.add_matrix_path(it->path().string());
+    // skip anything else that may live in the directory, e.g. matrix caches
+    if (it->path().extension() == ".mtx")
+      benchmark.add_matrix_path(it->path().string());
   }
   return benchmark;
 }
@@ -75,13 +123,39 @@ boost::property_tree::ptree write_params(const cask::runtime::GeneratedSpmvImple
   tree.put("input_width", impl.input_width);
   tree.put("max_rows", impl.max_rows);
   tree.put("num_controllers", impl.num_controllers);
+  tree.put("index_bits", impl.index_bits);
+  return tree;
+}
+
+boost::property_tree::ptree write_calibration(const cask::model::Calibration& c) {
+  boost::property_tree::ptree tree;
+  tree.put("cycle_scale", c.cycleScale);
+  tree.put("host_bandwidth", c.hostBandwidth);
+  tree.put("runs", c.runs);
   return tree;
 }
 
+boost::property_tree::ptree write_architecture(
+    cask::spmv::Spmv& arch,
+    const cask::model::DeviceModel& deviceModel) {
+  pt::ptree archJson;
+  archJson.put("name", arch.get_name());
+  archJson.put("estimated_gflops", arch.getEstimatedGFlops(deviceModel));
+  archJson.put("estimated_clock_cycles", arch.getEstimatedClockCycles());
+  archJson.add_child("architecture_params", write_params(arch.impl));
+  archJson.add_child("estimated_impl_params",
+      write_est_impl_params(arch.getEstimatedHardwareModel(deviceModel)));
+  return archJson;
+}
+
+// the measured calibration is written if not null
 void write_dse_results(
     const std::vector<cask::dse::DseResult>& results,
+    const cask::dse::FamilyDesign& family,
+    const std::vector<cask::dse::ShardedDesign>& sharded,
     double took,
-    const cask::model::DeviceModel& deviceModel
+    const cask::model::DeviceModel& deviceModel,
+    const cask::model::Calibration* measured
     ) {
   pt::ptree tree, children;
   stringstream ss;
@@ -90,17 +164,10 @@ void write_dse_results(
   ss << std::ctime(&end_time);
   tree.put("date", ss.str());
   tree.put("took", took);
+  pt::ptree fronts;
   for (const auto& dseResult : results) {
     auto arch = dseResult.bestArchitecture;
-    std::string arch_name = arch->get_name();
-    pt::ptree archJson;
-    archJson.put("name", arch_name);
-    archJson.put("estimated_gflops", arch->getEstimatedGFlops(deviceModel));
-    archJson.put("estimated_clock_cycles", arch->getEstimatedClockCycles());
-
-    archJson.add_child("architecture_params", write_params(arch->impl));
-    archJson.add_child("estimated_impl_params",
-        write_est_impl_params(arch->getEstimatedHardwareModel(deviceModel)));
+    pt::ptree archJson = write_architecture(*arch, deviceModel);
 
     pt::ptree matrices;
     for (int i = 0; i < dseResult.matrices.size(); i++) {
@@ -111,8 +178,48 @@ void write_dse_results(
     archJson.add_child("matrices", matrices);
 
     children.push_back(std::make_pair("", archJson));
+
+    pt::ptree front, designs;
+    front.put("matrix", dseResult.matrices.empty() ? "" : dseResult.matrices[0]);
+    for (const auto& a : dseResult.paretoFront)
+      designs.push_back(std::make_pair("", write_architecture(*a, deviceModel)));
+    front.add_child("designs", designs);
+    fronts.push_back(std::make_pair("", front));
   }
   tree.add_child("best_architectures", children);
+  tree.add_child("pareto_fronts", fronts);
+  if (family.architecture) {
+    pt::ptree familyJson, matrices;
+    familyJson.put("name", family.architecture->get_name());
+    familyJson.put("geomean_estimated_gflops", family.geomeanGflops);
+    familyJson.add_child("architecture_params", write_params(family.architecture->impl));
+    familyJson.add_child("estimated_impl_params", write_est_impl_params(family.hardwareModel));
+    for (size_t i = 0; i < family.matrices.size(); i++) {
+      pt::ptree matrix;
+      matrix.put("matrix", family.matrices[i]);
+      matrix.put("estimated_gflops", family.gflops[i]);
+      matrices.push_back(std::make_pair("", matrix));
+    }
+    familyJson.add_child("matrices", matrices);
+    tree.add_child("family_design", familyJson);
+  }
+  if (!sharded.empty()) {
+    pt::ptree designs;
+    for (const auto& d : sharded) {
+      pt::ptree design;
+      design.put("matrix", d.matrix);
+      design.put("num_shards", d.numShards);
+      design.put("name", d.architecture->get_name());
+      design.put("estimated_gflops", d.gflops);
+      design.put("estimated_clock_cycles", d.clockCycles);
+      design.add_child("architecture_params", write_params(d.architecture->impl));
+      design.add_child("estimated_impl_params", write_est_impl_params(d.hardwareModel));
+      designs.push_back(std::make_pair("", design));
+    }
+    tree.add_child("sharded_designs", designs);
+  }
+  if (measured)
+    tree.add_child("measured_calibration", write_calibration(*measured));
   pt::write_json("dse_out.json", tree);
 }
 
@@ -125,8 +232,12 @@ int main(int argc, char** argv) {
 
   // options to display in the help message
   po::options_description desc("Allowed options");
+  string deviceName;
   desc.add_options()
-    ("help", "Print this help message");
+    ("help", "Print this help message")
+    ("device-model",
+     po::value<string>(&deviceName)->default_value("Max4"),
+     "Device to explore for: Max4, Max4MoreMemory, Max5 or a JSON device descriptor");
 
   // required options, not displayed in help message
   string benchPath, dseparams;
@@ -189,16 +300,22 @@ int main(int argc, char** argv) {
 
   // -- setup device model
   auto start = std::chrono::high_resolution_clock::now();
-  cask::model::Max4Model deviceModel;
-  //cask::model::Max4ModelMoreMemory deviceModel;
-  //cask::model::Max5Model deviceModel;
+  std::shared_ptr<cask::model::DeviceModel> device;
+  try {
+    device = cask::model::makeDeviceModel(deviceName);
+  } catch (std::exception& e) {
+    std::cout << "Error: could not load device model '" << deviceName << "': " << e.what() << std::endl;
+    return 1;
+  }
+  const cask::model::DeviceModel& deviceModel = *device;
   std::cout << "Device Model " << deviceModel << std::endl;
   auto results = dseTool.run(
       benchmark,
       params,
       deviceModel);
   auto diff = dfesnippets::timing::clock_diff(start);
-  write_dse_results(results, diff, deviceModel);
+  write_dse_results(results, dseTool.getFamilyDesign(), dseTool.getShardedDesigns(), diff, deviceModel,
+      params.reportPerformance ? &dseTool.getMeasuredCalibration() : nullptr);
 
   // Executables exes = buildTool.buildExecutables(Hardware Designs)
   // PerfResults results = perfTool.runDesigns(exes)
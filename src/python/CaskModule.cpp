@@ -0,0 +1,276 @@
+// Python bindings of the library API (see CaskContext), so that clients such
+// as notebooks pass SciPy matrices and NumPy vectors in memory, rather than
+// through .mtx files and runs of main:
+//
+//   import cask_native, scipy.sparse
+//   a = scipy.sparse.random(1000, 1000, density=0.01, format='csr')
+//   ctx = cask_native.Context()
+//   spmv = ctx.preprocess(a)
+//   y = spmv.multiply(x)
+//   results = ctx.explore({'random': a}, json.load(open('params.json'))['dse_params'])
+
+#include <Cask.hpp>
+#include <CpuSpmv.hpp>
+#include <DeviceModels.hpp>
+#include <Reordering.hpp>
+
+#include <pybind11/numpy.h>
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace py = pybind11;
+using namespace cask;
+
+namespace {
+
+// converted, i.e. copied, only if not already of this type and contiguous
+using IndexArray = py::array_t<int32_t, py::array::c_style | py::array::forcecast>;
+using ValueArray = py::array_t<double, py::array::c_style | py::array::forcecast>;
+
+/** A view of the arrays of a scipy.sparse CSR matrix, which it keeps alive.
+ * SciPy stores matrices of less than 2^31 entries with int32 indices and
+ * float64 values by default, which are then not copied. */
+struct SciPyCsr {
+  IndexArray indptr, indices;
+  ValueArray data;
+  CsrView view;
+
+  explicit SciPyCsr(const py::object& m) {
+    if (!py::hasattr(m, "indptr") || !py::hasattr(m, "indices") || !py::hasattr(m, "data"))
+      throw std::invalid_argument("expected a scipy.sparse CSR matrix");
+    if (py::hasattr(m, "format") && m.attr("format").cast<std::string>() != "csr")
+      throw std::invalid_argument("expected a CSR matrix, got one in format " +
+                                  m.attr("format").cast<std::string>());
+    std::pair<int64_t, int64_t> shape = m.attr("shape").cast<std::pair<int64_t, int64_t>>();
+    if (shape.first > std::numeric_limits<int>::max() || shape.second > std::numeric_limits<int>::max())
+      throw std::invalid_argument("the matrix has more than 2^31 rows or columns");
+    indptr = m.attr("indptr").cast<IndexArray>();
+    indices = m.attr("indices").cast<IndexArray>();
+    data = m.attr("data").cast<ValueArray>();
+
+    int n = int(shape.first);
+    if (indptr.ndim() != 1 || indptr.size() != n + 1)
+      throw std::invalid_argument("indptr has " + std::to_string(indptr.size()) + " entries, expected " +
+                                  std::to_string(n + 1));
+    if (indptr.at(0) < 0 || indices.size() < indptr.at(n) || data.size() < indptr.at(n))
+      throw std::invalid_argument("indices and data have fewer entries than indptr[-1]");
+    view = CsrView(n, int(shape.second), indptr.data(), indices.data(), data.data());
+  }
+};
+
+void checkSize(const py::array& x, int size, const std::string& what) {
+  if (x.ndim() != 1 || x.size() != size)
+    throw std::invalid_argument(what + " has " + std::to_string(x.size()) + " entries, expected " +
+                                std::to_string(size));
+}
+
+// a (start, stop, step) range of params.json, e.g. {"start": 1, "stop": 4,
+// "step": 1}, or a single value
+utils::Parameter<int> parameter(const py::dict& d, const char* key, const utils::Parameter<int>& otherwise) {
+  if (!d.contains(key))
+    return otherwise;
+  py::object v = d[key];
+  if (py::isinstance<py::int_>(v))
+    return utils::Parameter<int>{otherwise.name, v.cast<int>()};
+  py::dict range = v.cast<py::dict>();
+  return utils::Parameter<int>{
+      otherwise.name,
+      range["start"].cast<int>(),
+      range["stop"].cast<int>(),
+      range.contains("step") ? range["step"].cast<int>() : 1};
+}
+
+/** The dse_params of a params.json, as a dict; missing keys keep the
+ * defaults of DseParameters */
+dse::DseParameters dseParameters(const py::dict& d) {
+  dse::DseParameters p;
+  p.numPipes = parameter(d, "num_pipes", p.numPipes);
+  p.cacheSize = parameter(d, "cache_size", p.cacheSize);
+  p.inputWidth = parameter(d, "input_width", p.inputWidth);
+  p.numControllers = parameter(d, "num_controllers", p.numControllers);
+  p.numShards = parameter(d, "num_shards", p.numShards);
+  p.indexBits = parameter(d, "index_bits", p.indexBits);
+  if (d.contains("reordering"))
+    p.reordering = reordering::parseMethod(d["reordering"].cast<std::string>());
+  if (d.contains("calibration")) {
+    py::dict c = d["calibration"].cast<py::dict>();
+    if (c.contains("cycle_scale"))
+      p.calibration.cycleScale = c["cycle_scale"].cast<double>();
+    if (c.contains("host_bandwidth"))
+      p.calibration.hostBandwidth = c["host_bandwidth"].cast<double>();
+  }
+  if (d.contains("report_performance"))
+    p.reportPerformance = d["report_performance"].cast<bool>();
+  if (d.contains("cache_directory"))
+    p.cacheDirectory = d["cache_directory"].cast<std::string>();
+  if (d.contains("search")) {
+    py::dict s = d["search"].cast<py::dict>();
+    if (s.contains("engine"))
+      p.search.engine = s["engine"].cast<std::string>();
+    if (s.contains("budget"))
+      p.search.budget = s["budget"].cast<int>();
+    if (s.contains("random_seed"))
+      p.search.randomSeed = s["random_seed"].cast<unsigned>();
+  }
+  return p;
+}
+
+// as written to dse_out.json by main
+py::dict architecture(spmv::Spmv& a, const model::DeviceModel& device) {
+  py::dict params;
+  params["num_pipes"] = a.impl.num_pipes;
+  params["cache_size"] = a.impl.cache_size;
+  params["input_width"] = a.impl.input_width;
+  params["max_rows"] = a.impl.max_rows;
+  params["num_controllers"] = a.impl.num_controllers;
+  params["index_bits"] = a.impl.index_bits;
+  py::dict d;
+  d["name"] = a.get_name();
+  d["estimated_gflops"] = a.getEstimatedGFlops(device);
+  d["estimated_clock_cycles"] = a.getEstimatedClockCycles();
+  d["architecture_params"] = params;
+  return d;
+}
+
+/** A matrix preprocessed for the device; like Spmv, not to be used by several
+ * threads at once */
+class PySpmv {
+  std::shared_ptr<spmv::Spmv> s;
+
+ public:
+  explicit PySpmv(std::shared_ptr<spmv::Spmv> _s) : s(std::move(_s)) {}
+
+  ValueArray multiply(const ValueArray& x) {
+    checkSize(x, s->getMatrixCols(), "x");
+    ValueArray y(s->getMatrixRows());
+    s->multiply(x.data(), y.mutable_data());
+    return y;
+  }
+
+  // y is bound without conversion, so that the product is never written to
+  // a temporary copy of it: arrays of another type or not contiguous raise
+  // TypeError
+  void multiplyInto(const ValueArray& x, py::array_t<double, py::array::c_style> y) {
+    checkSize(x, s->getMatrixCols(), "x");
+    checkSize(y, s->getMatrixRows(), "y");
+    if (!y.writeable())
+      throw std::invalid_argument("y is not writeable");
+    s->multiply(x.data(), y.mutable_data());
+  }
+
+  int rows() const {
+    return s->getMatrixRows();
+  }
+
+  int cols() const {
+    return s->getMatrixCols();
+  }
+
+  int nnzs() const {
+    return s->getMatrixNnzs();
+  }
+
+  double estimatedClockCycles() {
+    return s->getEstimatedClockCycles();
+  }
+
+  std::string name() {
+    return s->get_name();
+  }
+};
+
+class PyContext {
+  CaskContext cc;
+
+ public:
+  PySpmv preprocess(const py::object& m) {
+    SciPyCsr a(m);
+    return PySpmv(cc.preprocess(a.view));
+  }
+
+  double estimateClockCycles(const py::object& m) {
+    SciPyCsr a(m);
+    return cc.estimateClockCycles(a.view);
+  }
+
+  /** Explores the designs for the matrices, by name: each is a SciPy CSR
+   * matrix, which is copied once for the exploration, or the path of a .mtx
+   * file, which is read and reported under its path */
+  py::list explore(const py::dict& matrices, const py::dict& params, const std::string& device) {
+    dse::Benchmark benchmark;
+    for (const auto& item : matrices) {
+      std::string name = item.first.cast<std::string>();
+      if (py::isinstance<py::str>(item.second))
+        benchmark.add_matrix_path(item.second.cast<std::string>());
+      else
+        benchmark.add_matrix(name, std::make_shared<const CsrMatrix>(
+            SciPyCsr(py::reinterpret_borrow<py::object>(item.second)).view.toCsr()));
+    }
+    std::shared_ptr<model::DeviceModel> deviceModel = model::makeDeviceModel(device);
+    dse::DseParameters p = dseParameters(params);
+    std::vector<dse::DseResult> results;
+    {
+      // the matrices are copied, so other Python threads can run meanwhile
+      py::gil_scoped_release release;
+      results = cc.explore(benchmark, p, *deviceModel);
+    }
+
+    py::list out;
+    for (const auto& r : results) {
+      py::dict d = architecture(*r.bestArchitecture, *deviceModel);
+      d["matrices"] = py::cast(r.matrices);
+      py::list front;
+      for (const auto& a : r.paretoFront)
+        front.append(architecture(*a, *deviceModel));
+      d["pareto_front"] = front;
+      out.append(d);
+    }
+    return out;
+  }
+};
+
+}
+
+PYBIND11_MODULE(cask_native, m) {
+  m.doc() = "Preprocessing, cycle estimates, design space exploration and SpMV of CASK, on matrices in memory";
+
+  py::class_<PySpmv>(m, "Spmv", "A matrix preprocessed for the fastest implementation on it")
+      .def("multiply", &PySpmv::multiply, py::arg("x"), "y = A x")
+      .def("multiply_into", &PySpmv::multiplyInto, py::arg("x"), py::arg("y").noconvert(),
+           "y = A x, into a writeable contiguous float64 array of the rows of A, which is not converted")
+      .def_property_readonly("rows", &PySpmv::rows)
+      .def_property_readonly("cols", &PySpmv::cols)
+      .def_property_readonly("nnzs", &PySpmv::nnzs)
+      .def_property_readonly("estimated_clock_cycles", &PySpmv::estimatedClockCycles)
+      .def_property_readonly("name", &PySpmv::name);
+
+  py::class_<PyContext>(m, "Context", "The generated implementations linked in, and the DSE")
+      .def(py::init<>())
+      .def("preprocess", &PyContext::preprocess, py::arg("a"),
+           "Preprocesses a scipy.sparse CSR matrix for the fastest implementation on it")
+      .def("estimate_clock_cycles", &PyContext::estimateClockCycles, py::arg("a"),
+           "The estimated clock cycles of an SpMV by the fastest implementation, without preprocessing")
+      .def("explore", &PyContext::explore, py::arg("matrices"), py::arg("params"), py::arg("device") = "Max4",
+           "Explores the design space for a dict of CSR matrices (or .mtx paths) by name, with the "
+           "dse_params of a params.json; returns the best architecture of each, as in dse_out.json");
+
+  m.def("cpu_spmv", [](const py::object& a, const ValueArray& x) {
+    SciPyCsr csr(a);
+    checkSize(x, csr.view.m, "x");
+    ValueArray y(csr.view.n);
+    double* out = y.mutable_data();
+    {
+      py::gil_scoped_release release;
+      cpu::spmv(csr.view, x.data(), out);
+    }
+    return y;
+  }, py::arg("a"), py::arg("x"), "y = A x on the host, by the multithreaded CPU kernel");
+}
@@ -0,0 +1,256 @@
+#include "BlockingCache.hpp"
+#include "MatrixProfile.hpp"
+#include "Spmv.hpp"
+#include "Parallel.hpp"
+#include "IndexCoding.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cask::spmv;
+
+namespace {
+
+// calls f(block, row, length, escapes) for each row in [s, e) and each block
+// in which the row has length > 0 entries, escapes of which are escaped
+template<typename F>
+void forEachBlockRow(const cask::CsrView& mat, int blockSize, int indexBits, int64_t s, int64_t e, F f) {
+  int nBlocks = mat.m / blockSize + (mat.m % blockSize == 0 ? 0 : 1);
+  std::vector<int> rowLength(nBlocks, 0), rowEscapes(nBlocks, 0), touched;
+  EscapeCounter escapes(indexBits, blockSize, nBlocks);
+  for (int64_t i = s; i < e; i++) {
+    for (int k = mat.row_ptr[i]; k < mat.row_ptr[i + 1]; k++) {
+      int b = mat.col_ind[k] / blockSize;
+      if (rowLength[b]++ == 0)
+        touched.push_back(b);
+      if (escapes.enabled())
+        rowEscapes[b] += escapes.count(i, b, mat.col_ind[k] - b * blockSize);
+    }
+    for (int b : touched) {
+      f(b, i, rowLength[b], rowEscapes[b]);
+      rowLength[b] = 0;
+      rowEscapes[b] = 0;
+    }
+    touched.clear();
+  }
+}
+
+}
+
+BlockRowLengths::BlockRowLengths(const CsrView& mat, int _blockSize, int _indexBits) :
+  n(mat.n), m(mat.m), blockSize(_blockSize),
+  nBlocks(mat.m / _blockSize + (mat.m % _blockSize == 0 ? 0 : 1)),
+  indexBits(_indexBits)
+{
+  bool countEscapes = IndexCoding(indexBits, blockSize).usesDeltas();
+  // the (row, block) pairs of each chunk of rows are counted, then written
+  // in place, so that the pairs of each block stay in row order
+  std::vector<std::vector<int64_t>> chunkCounts;
+  std::vector<int64_t> chunkBounds;
+  int nChunks = std::max(1, cask::parallel::numThreads());
+  chunkCounts.assign(nChunks, std::vector<int64_t>(nBlocks, 0));
+  chunkBounds.assign(nChunks + 1, n);
+  for (int c = 0; c < nChunks; c++)
+    chunkBounds[c] = int64_t(n) * c / nChunks;
+
+  cask::parallel::ThreadPool::global().run(nChunks, [&](int c) {
+    std::vector<int64_t>& counts = chunkCounts[c];
+    forEachBlockRow(mat, blockSize, 32, chunkBounds[c], chunkBounds[c + 1],
+                    [&](int b, int, int, int) { counts[b]++; });
+  });
+
+  // chunkCounts become the positions where each chunk writes its pairs
+  blockStart.assign(nBlocks + 1, 0);
+  int64_t pos = 0;
+  for (int b = 0; b < nBlocks; b++) {
+    blockStart[b] = pos;
+    for (int c = 0; c < nChunks; c++) {
+      int64_t count = chunkCounts[c][b];
+      chunkCounts[c][b] = pos;
+      pos += count;
+    }
+  }
+  blockStart[nBlocks] = pos;
+  rows.resize(pos);
+  lengths.resize(pos);
+  if (countEscapes)
+    escapes.resize(pos);
+
+  cask::parallel::ThreadPool::global().run(nChunks, [&](int c) {
+    std::vector<int64_t>& cursor = chunkCounts[c];
+    forEachBlockRow(mat, blockSize, indexBits, chunkBounds[c], chunkBounds[c + 1],
+                    [&](int b, int row, int length, int rowEscapes) {
+                  rows[cursor[b]] = row;
+                  lengths[cursor[b]] = length;
+                  if (countEscapes)
+                    escapes[cursor[b]] = rowEscapes;
+                  cursor[b]++;
+                });
+  });
+}
+
+std::pair<int64_t, int64_t> BlockRowLengths::rowRange(int b, int startRow, int endRow) const {
+  auto first = rows.begin() + blockStart[b];
+  auto last = rows.begin() + blockStart[b + 1];
+  auto s = std::lower_bound(first, last, startRow);
+  auto e = std::lower_bound(s, last, endRow);
+  return std::make_pair(s - rows.begin(), e - rows.begin());
+}
+
+std::shared_ptr<const BlockRowLengths> BlockingCache::rowLengths(int blockSize, int indexBits) {
+  std::shared_ptr<Slot> slot;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    std::shared_ptr<Slot>& s = rowLengthsByBlockSize[std::make_pair(blockSize, indexBits)];
+    if (!s)
+      s = std::make_shared<Slot>();
+    slot = s;
+  }
+  std::lock_guard<std::mutex> lock(slot->m);
+  if (!slot->value)
+    slot->value = std::make_shared<const BlockRowLengths>(mat, blockSize, indexBits);
+  return slot->value;
+}
+
+std::vector<Partition> BlockingCache::partitions(
+    const std::string& key,
+    const std::function<std::vector<Partition>()>& compute) {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    auto it = partitionsByKey.find(key);
+    if (it != partitionsByKey.end())
+      return *it->second;
+  }
+  // may be computed more than once if requested concurrently, but the
+  // results are the same
+  auto value = std::make_shared<const std::vector<Partition>>(compute());
+  std::lock_guard<std::mutex> lock(m);
+  computed++;
+  partitionsByKey.insert(std::make_pair(key, value));
+  return *value;
+}
+
+size_t BlockingCache::computedPartitions() {
+  std::lock_guard<std::mutex> lock(m);
+  return computed;
+}
+
+namespace {
+
+const char* analysisCacheMagic = "cask-analysis-cache";
+
+// identifies the matrix and the model of a file of saved partitions
+std::string analysisCacheHeader(const cask::CsrView& mat, uint64_t hash) {
+  std::stringstream s;
+  s << analysisCacheMagic << " " << BlockingCache::MODEL_VERSION << " "
+    << std::hex << hash << std::dec << " " << mat.n << " " << mat.m << " " << mat.nnzs;
+  return s.str();
+}
+
+// the statistics of analyse(); partitions of the DSE hold no streams
+void writePartition(std::ostream& s, const Partition& p) {
+  s << p.nBlocks << " " << p.n << " " << p.paddingCycles << " " << p.totalCycles << " "
+    << p.vector_load_cycles << " " << p.outSize << " " << p.reductionCycles << " "
+    << p.emptyCycles << " " << p.m_colptr_unpaddedLength << " "
+    << p.m_indptr_values_unpaddedLength << " " << p.escapes << " " << p.firstRow << " "
+    << p.reflectedSize << "\n";
+}
+
+bool readPartition(std::istream& s, Partition& p) {
+  return bool(s >> p.nBlocks >> p.n >> p.paddingCycles >> p.totalCycles
+                >> p.vector_load_cycles >> p.outSize >> p.reductionCycles
+                >> p.emptyCycles >> p.m_colptr_unpaddedLength
+                >> p.m_indptr_values_unpaddedLength >> p.escapes >> p.firstRow
+                >> p.reflectedSize);
+}
+
+}
+
+uint64_t cask::spmv::structureHash(const CsrView& mat) {
+  return MatrixProfile(mat).structureHash;
+}
+
+BlockingCache::BlockingCache(const CsrView& _mat) : mat(_mat), hash(structureHash(_mat)) {}
+
+BlockingCache::BlockingCache(const CsrView& _mat, const MatrixProfile& profile) :
+  mat(_mat), hash(profile.structureHash) {}
+
+std::string cask::spmv::analysisCachePath(const std::string& directory, const CsrView& mat) {
+  return analysisCachePath(directory, structureHash(mat));
+}
+
+std::string cask::spmv::analysisCachePath(const std::string& directory, uint64_t hash) {
+  std::stringstream s;
+  s << directory << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".dse";
+  return s.str();
+}
+
+size_t BlockingCache::load(const std::string& path) {
+  std::ifstream f(path);
+  std::string header;
+  if (!f || !std::getline(f, header) || header != analysisCacheHeader(mat, hash))
+    return 0;
+
+  // each architecture is its key, on a line, then its partitions
+  std::map<std::string, std::shared_ptr<const std::vector<Partition>>> loaded;
+  std::string key;
+  while (std::getline(f, key)) {
+    size_t n;
+    if (!(f >> n))
+      break;
+    std::vector<Partition> partitions(n);
+    bool valid = true;
+    for (auto& p : partitions)
+      valid = valid && readPartition(f, p);
+    f.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    if (!valid)
+      break;
+    loaded[key] = std::make_shared<const std::vector<Partition>>(partitions);
+  }
+
+  std::lock_guard<std::mutex> lock(m);
+  for (const auto& e : loaded)
+    partitionsByKey.insert(e);
+  return loaded.size();
+}
+
+void BlockingCache::save(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  if (slash != std::string::npos && ::mkdir(path.substr(0, slash).c_str(), 0777) != 0 && errno != EEXIST)
+    throw std::runtime_error("Could not create " + path.substr(0, slash) + ": " + std::strerror(errno));
+
+  // written to a temporary file first, so concurrent explorations of the
+  // same matrix never read a partially written file
+  std::stringstream tmp;
+  tmp << path << ".tmp" << ::getpid() << "." << this;
+  std::string tmpPath = tmp.str();
+  {
+    std::ofstream f{tmpPath, std::ios::trunc};
+    if (!f)
+      throw std::runtime_error("Could not open " + tmpPath + " for writing");
+    f << analysisCacheHeader(mat, hash) << "\n";
+    std::lock_guard<std::mutex> lock(m);
+    for (const auto& e : partitionsByKey) {
+      f << e.first << "\n" << e.second->size() << "\n";
+      for (const auto& p : *e.second)
+        writePartition(f, p);
+    }
+    if (!f) {
+      ::unlink(tmpPath.c_str());
+      throw std::runtime_error("Could not write " + tmpPath);
+    }
+  }
+  if (::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    ::unlink(tmpPath.c_str());
+    throw std::runtime_error("Could not create " + path + ": " + std::strerror(errno));
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef BLOCKINGCACHE_HPP_V3N8TQ4D
+#define BLOCKINGCACHE_HPP_V3N8TQ4D
+
+#include "SparseMatrix.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace cask {
+namespace spmv {
+
+struct Partition;
+struct MatrixProfile;
+
+/**
+ * The blocked structure of a matrix for a given block size (the columns of
+ * block b are [b * blockSize, (b + 1) * blockSize)): for each block, the non
+ * empty rows and the number of entries the block has on them, in row order.
+ *
+ * This is all the cycle model needs, for any input width and any range of
+ * rows, so it is shared by all design points with the same cache size; the
+ * rows of block b are [blockStart[b], blockStart[b + 1]) in rows / lengths.
+ * If the column offsets are delta coded in indexBits bits, escapes holds the
+ * escaped entries of each row of a block (see IndexCoding), otherwise it is
+ * empty.
+ */
+struct BlockRowLengths {
+  int n, m, blockSize, nBlocks, indexBits;
+  std::vector<int64_t> blockStart;
+  std::vector<int> rows, lengths, escapes;
+
+  BlockRowLengths(const CsrView& mat, int blockSize, int indexBits = 32);
+
+  /** Positions, in rows / lengths, of the entries of block b which fall in
+   * the row range [startRow, endRow) */
+  std::pair<int64_t, int64_t> rowRange(int b, int startRow, int endRow) const;
+};
+
+/** A hash of the dimensions and the sparsity pattern (not the values) of a
+ * matrix, which is all the partitions of analyse() depend on; that of
+ * MatrixProfile, which saves the pass if the matrix has a profile */
+uint64_t structureHash(const CsrView& mat);
+
+/**
+ * Memoises the results of the design space exploration which do not depend
+ * on every design parameter, for one matrix:
+ * - the blocked row lengths, which depend only on the block (cache) size
+ *   and the index coding;
+ * - the analysed partitions of an architecture, which do not depend on the
+ *   number of memory controllers.
+ *
+ * The partitions can also be saved to and loaded from a file, so that later
+ * explorations of the same matrix only analyse the architectures they add.
+ *
+ * All methods are thread safe; the matrix must outlive the cache.
+ */
+class BlockingCache {
+
+  struct Slot {
+    std::mutex m;
+    std::shared_ptr<const BlockRowLengths> value;
+  };
+
+  CsrView mat;
+  uint64_t hash;
+  std::mutex m;
+  std::map<std::pair<int, int>, std::shared_ptr<Slot>> rowLengthsByBlockSize;
+  std::map<std::string, std::shared_ptr<const std::vector<Partition>>> partitionsByKey;
+  size_t computed = 0;
+
+ public:
+  // of the cycle model; saved partitions of other versions are not loaded
+  static const int MODEL_VERSION = 2;
+
+  explicit BlockingCache(const CsrView& _mat);
+
+  /** For a matrix whose profile is known, which saves hashing it */
+  BlockingCache(const CsrView& _mat, const MatrixProfile& profile);
+
+  const CsrView& matrix() const {
+    return mat;
+  }
+
+  uint64_t matrixHash() const {
+    return hash;
+  }
+
+  /** Row lengths for the given block size and index bits, computed on first use */
+  std::shared_ptr<const BlockRowLengths> rowLengths(int blockSize, int indexBits = 32);
+
+  /** Returns the partitions stored for key, otherwise computes and stores them */
+  std::vector<Partition> partitions(
+      const std::string& key,
+      const std::function<std::vector<Partition>()>& compute);
+
+  /** The number of partitionings computed, rather than found in the cache */
+  size_t computedPartitions();
+
+  /** Adds the partitions saved at path; returns the number of architectures
+   * loaded, 0 if the file is missing or was saved for another matrix or
+   * model version */
+  size_t load(const std::string& path);
+
+  /** Saves all partitions to path, atomically */
+  void save(const std::string& path);
+};
+
+/** The file of the saved partitions of mat in directory, named by its
+ * structureHash() */
+std::string analysisCachePath(const std::string& directory, const CsrView& mat);
+
+/** As above, for the matrix of the given structureHash() */
+std::string analysisCachePath(const std::string& directory, uint64_t hash);
+
+}
+}
+
+#endif /* end of include guard: BLOCKINGCACHE_HPP_V3N8TQ4D */
@@ -1 +1,79 @@
+#include "Cg.hpp"
+#include "CpuSpmv.hpp"
+#include "Trace.hpp"
 
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+void cask::solvers::Cg::load(const CsrView& a) {
+  CASK_TRACE_SCOPE("cg:preprocess");
+  if (a.n != a.m)
+    throw std::invalid_argument("Cg requires a square matrix, got " +
+        std::to_string(a.n) + " x " + std::to_string(a.m));
+  spmv.preprocess(a);
+  spmv.loadMatrix();
+  n = a.n;
+}
+
+void cask::solvers::Cg::preprocess(const SymCsrMatrix& a) {
+  if (!spmv.impl.symmetric) {
+    preprocess(a.explicitSymmetric());
+    return;
+  }
+  load(a.matrix.view());
+  hostMatrix = refines() ? a.matrix : CsrMatrix();
+}
+
+void cask::solvers::Cg::preprocess(const CsrMatrix& a) {
+  load(a);
+  hostMatrix = refines() ? a : CsrMatrix();
+}
+
+void cask::solvers::Cg::preprocess(CsrMatrix&& a) {
+  load(a);
+  hostMatrix = refines() ? std::move(a) : CsrMatrix();
+}
+
+void cask::solvers::Cg::preprocess(const CsrView& a) {
+  load(a);
+  hostMatrix = refines() ? a.toCsr() : CsrMatrix();
+}
+
+cask::Vector cask::solvers::Cg::solve(const Vector& b) {
+  CASK_TRACE_SCOPE("cg:solve");
+  if (n == -1)
+    throw std::runtime_error("Cg::solve called before preprocess");
+  if (b.size() != n)
+    throw std::invalid_argument("Cg right hand side length " + std::to_string(b.size()) +
+        " != matrix rows " + std::to_string(n));
+
+  Vector x(n);
+  DfeSpmvOperator op{spmv};
+  sparse_linear_solvers::IdentityPreconditioner precon{n};
+  iterations = 0;
+  refinements = 0;
+  if (!refines()) {
+    converged = sparse_linear_solvers::pipelinedCg(
+        op, precon, n, b.data.data(), x.data.data(), iterations, maxIterations, tolerance);
+    return x;
+  }
+
+  CsrView a = hostMatrix.view();
+  bool lower = spmv.impl.symmetric;
+  auto residual = [&](const double* v, double* y) {
+    if (lower)
+      cpu::symSpmv(a, v, y);
+    else
+      cpu::spmv(a, v, y);
+  };
+  auto correction = [&](const double* r, double* d, double rnorm) {
+    int its = 0;
+    sparse_linear_solvers::pipelinedCg(
+        op, precon, n, r, d, its, maxIterations, innerTolerance * rnorm);
+    iterations += its;
+  };
+  converged = sparse_linear_solvers::iterativeRefinement(
+      residual, correction, n, b.data.data(), x.data.data(), refinements, maxRefinements, tolerance);
+  return x;
+}
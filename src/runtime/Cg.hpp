@@ -1,17 +1,91 @@
+#ifndef CG_HPP_P3W8ZK2D
+#define CG_HPP_P3W8ZK2D
+
+#include "SparseLinearSolvers.hpp"
+#include "SparseMatrix.hpp"
+#include "Spmv.hpp"
+
 namespace cask {
 namespace solvers {
 
-class Cg {
+/** y = A * x on the device of an Spmv, as an operator for the Krylov
+ * solvers of sparse_linear_solvers */
+class DfeSpmvOperator {
+  spmv::Spmv& s;
 
  public:
+  explicit DfeSpmvOperator(spmv::Spmv& _s) : s(_s) {}
 
-  void preprocess(cask::SymCsrMatrix& a) {
+  void operator()(const double* x, double* y) {
+    s.multiply(x, y);
   }
+};
 
-  Vector solve(Vector& v) {
-    return v;
+/**
+ * Conjugate gradient with the SpMV on a DFE.
+ *
+ * preprocess() partitions the matrix and uploads it to device DRAM once;
+ * each iteration then only transfers the vector to multiply and the result.
+ * The pipelined iteration is used (see sparse_linear_solvers::pipelinedCg),
+ * so the inner products and vector updates of an iteration run on the host
+ * while the device multiplies.
+ *
+ * If the device stores matrix values in reduced precision, the solve is
+ * wrapped in fp64 iterative refinement (see
+ * sparse_linear_solvers::iterativeRefinement): the host keeps a copy of the
+ * matrix to compute residuals and each correction is solved on the device to
+ * innerTolerance, relative to the residual.
+ *
+ * Symmetric designs only take the lower triangle of the matrix, as stored
+ * by SymCsrMatrix: the partitioning and the stream read by each iteration
+ * are about half those of the explicit matrix.
+ */
+class Cg {
+  spmv::Spmv spmv;
+  int n = -1;
+  // for fp64 residuals, if the device values are in reduced precision; only
+  // the lower triangle for symmetric designs
+  CsrMatrix hostMatrix;
+
+  bool refines() const {
+    return spmv.impl.value_format != spmv::ValueFormat::Fp64;
   }
+
+  void load(const CsrView& a);
+
+ public:
+  int maxIterations = 2000;
+  // converged if (r, r) <= tolerance^2
+  double tolerance = 1E-5;
+  double innerTolerance = 1E-2;
+  int maxRefinements = 50;
+  // of the last solve; iterations is the total over all refinements
+  int iterations = 0;
+  int refinements = 0;
+  bool converged = false;
+
+  explicit Cg(const spmv::Spmv& _spmv) : spmv(_spmv) {}
+
+  /** Symmetric designs (see GeneratedSpmvImplementation::symmetric) take
+   * the lower triangle of a as is, others all its entries */
+  void preprocess(const SymCsrMatrix& a);
+
+  /** As above, for a symmetric matrix whose entries are all stored */
+  void preprocess(const CsrMatrix& a);
+
+  /** As above, keeping the storage of a if the host needs a copy */
+  void preprocess(CsrMatrix&& a);
+
+  /** As above, for a view of a matrix (e.g. in the storage of an Eigen
+   * matrix, see converters::asCsrView()), which is only copied if the host
+   * needs a copy */
+  void preprocess(const CsrView& a);
+
+  /** Solves A x = b starting from x = 0; requires preprocess() */
+  Vector solve(const Vector& b);
 };
 
 }
-}
\ No newline at end of file
+}
+
+#endif /* end of include guard: CG_HPP_P3W8ZK2D */
@@ -9,13 +9,18 @@
 namespace cask {
   namespace converters {
 
-    using EigenSparseMatrix = std::unique_ptr<Eigen::SparseMatrix<double, Eigen::RowMajor, int32_t>>;
+    using EigenCsrMatrix = Eigen::SparseMatrix<double, Eigen::RowMajor, int32_t>;
+    using EigenSparseMatrix = std::unique_ptr<EigenCsrMatrix>;
+
+    /** A CSR matrix in the storage of a CsrView, which must outlive it */
+    using EigenCsrMap = Eigen::Map<const EigenCsrMatrix>;
 
     // convert a Spark COO matrix to an Eigen Sparse Matrix
-    inline EigenSparseMatrix tripletToEigen(cask::sparse::SparkCooMatrix<double> mat) {
-      auto coo = mat.data;
-      EigenSparseMatrix m(new Eigen::SparseMatrix<double, Eigen::RowMajor, int32_t>(mat.n, mat.m));
+    inline EigenSparseMatrix tripletToEigen(const cask::sparse::SparkCooMatrix<double>& mat) {
+      const auto& coo = mat.data;
+      EigenSparseMatrix m(new EigenCsrMatrix(mat.n, mat.m));
       std::vector<Eigen::Triplet<double>> trips;
+      trips.reserve(coo.size());
       for (size_t i = 0; i < coo.size(); i++)
         trips.push_back(
             Eigen::Triplet<double>(
@@ -26,18 +31,36 @@ namespace cask {
       return m;
     }
 
-    inline Eigen::VectorXd stdvectorToEigen(std::vector<double> v) {
-      Eigen::VectorXd m(v.size());
-      for (size_t i = 0; i < v.size(); i++)
-        m[i] = v[i];
-      return m;
+    inline Eigen::VectorXd stdvectorToEigen(const std::vector<double>& v) {
+      return Eigen::Map<const Eigen::VectorXd>(v.data(), v.size());
     }
 
     inline std::vector<double> eigenVectorToStdVector(const Eigen::VectorXd& v) {
-      std::vector<double> m(v.size());
-      for (int i = 0; i < v.size(); i++)
-        m[i] = v[i];
-      return m;
+      return std::vector<double>(v.data(), v.data() + v.size());
+    }
+
+    /** The matrix of a view as an Eigen matrix, without copying it; e.g.
+     * asEigen(a) * x or the Eigen solvers run on the storage of a CsrMatrix */
+    inline EigenCsrMap asEigen(const CsrView& a) {
+      return EigenCsrMap(a.n, a.m, a.nnzs, a.row_ptr, a.col_ind, a.values);
+    }
+
+    /** Vector::data as an Eigen vector, without copying it */
+    inline Eigen::Map<Eigen::VectorXd> asEigen(Vector& v) {
+      return Eigen::Map<Eigen::VectorXd>(v.data.data(), v.size());
+    }
+
+    inline Eigen::Map<const Eigen::VectorXd> asEigen(const Vector& v) {
+      return Eigen::Map<const Eigen::VectorXd>(v.data.data(), v.size());
+    }
+
+    /** The runtime view of a compressed Eigen CSR matrix, which must outlive it */
+    template<typename M>
+    CsrView asCsrView(const M& m) {
+      static_assert(M::IsRowMajor, "asCsrView requires a row major matrix");
+      if (!m.isCompressed())
+        throw std::invalid_argument("asCsrView requires a compressed matrix, call makeCompressed()");
+      return CsrView(m.rows(), m.cols(), m.outerIndexPtr(), m.innerIndexPtr(), m.valuePtr());
     }
 
   }
@@ -0,0 +1,159 @@
+#include "CpuBlas1.hpp"
+#include "Parallel.hpp"
+
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// a term of a sum over the entries: term(i), and the terms of 4 (AVX2) or
+// 8 (AVX-512) consecutive entries from i
+struct DotTerm {
+  const double* x;
+  const double* y;
+
+  double operator()(int64_t i) const {
+    return x[i] * y[i];
+  }
+#if defined(__AVX512F__)
+  __m512d avx512(int64_t i, __m512d acc) const {
+    return _mm512_fmadd_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i), acc);
+  }
+#elif defined(__AVX2__)
+  __m256d avx2(int64_t i, __m256d acc) const {
+    __m256d p = _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+    return _mm256_add_pd(p, acc);
+  }
+#endif
+};
+
+struct SquaredDifferenceTerm {
+  const double* x;
+  const double* y;
+
+  double operator()(int64_t i) const {
+    double d = x[i] - y[i];
+    return d * d;
+  }
+#if defined(__AVX512F__)
+  __m512d avx512(int64_t i, __m512d acc) const {
+    __m512d d = _mm512_sub_pd(_mm512_loadu_pd(x + i), _mm512_loadu_pd(y + i));
+    return _mm512_fmadd_pd(d, d, acc);
+  }
+#elif defined(__AVX2__)
+  __m256d avx2(int64_t i, __m256d acc) const {
+    __m256d d = _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i));
+    return _mm256_add_pd(_mm256_mul_pd(d, d), acc);
+  }
+#endif
+};
+
+// the sum of the terms of [begin, end)
+template<typename Term>
+double sumRange(const Term& term, int64_t begin, int64_t end) {
+  int64_t i = begin;
+  double sum = 0;
+#if defined(__AVX512F__)
+  if (end - i >= 16) {
+    __m512d acc0 = _mm512_setzero_pd(), acc1 = _mm512_setzero_pd();
+    for (; i + 16 <= end; i += 16) {
+      acc0 = term.avx512(i, acc0);
+      acc1 = term.avx512(i + 8, acc1);
+    }
+    sum = _mm512_reduce_add_pd(_mm512_add_pd(acc0, acc1));
+  }
+#elif defined(__AVX2__)
+  if (end - i >= 8) {
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    for (; i + 8 <= end; i += 8) {
+      acc0 = term.avx2(i, acc0);
+      acc1 = term.avx2(i + 4, acc1);
+    }
+    __m256d acc = _mm256_add_pd(acc0, acc1);
+    __m128d lo = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    sum = _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+  }
+#endif
+  // independent accumulators, so the additions need not wait on each
+  // other; short ranges are summed in order, as by the reference BLAS
+  double s[4] = {0, 0, 0, 0};
+  for (; i + 16 <= end; i += 4) {
+    s[0] += term(i);
+    s[1] += term(i + 1);
+    s[2] += term(i + 2);
+    s[3] += term(i + 3);
+  }
+  for (; i < end; i++)
+    s[0] += term(i);
+  return sum + ((s[0] + s[1]) + (s[2] + s[3]));
+}
+
+// sum(begin, end) over [0, n), in chunks of the thread pool above the
+// serial threshold, whose sums are added in order
+template<typename F>
+double reduce(int64_t n, F sum) {
+  if (n < cask::cpu::minParallelEntries || cask::parallel::numThreads() == 1)
+    return sum(0, n);
+  std::vector<double> partial(cask::parallel::numThreads(), 0.0);
+  int nChunks = cask::parallel::parallelForChunks(0, n, [&](int c, int64_t b, int64_t e) {
+    partial[c] = sum(b, e);
+  }, cask::cpu::minParallelEntries / 4);
+  double total = 0;
+  for (int c = 0; c < nChunks; c++)
+    total += partial[c];
+  return total;
+}
+
+// f(begin, end) over [0, n), in parallel above the serial threshold
+template<typename F>
+void update(int64_t n, F f) {
+  if (n < cask::cpu::minParallelEntries || cask::parallel::numThreads() == 1) {
+    f(0, n);
+    return;
+  }
+  cask::parallel::parallelForChunks(0, n, [&](int, int64_t b, int64_t e) { f(b, e); },
+                                    cask::cpu::minParallelEntries / 4);
+}
+
+}
+
+double cask::cpu::dot(int64_t n, const double* x, const double* y) {
+  DotTerm term{x, y};
+  return reduce(n, [&](int64_t b, int64_t e) { return sumRange(term, b, e); });
+}
+
+double cask::cpu::nrm2(int64_t n, const double* x) {
+  return std::sqrt(dot(n, x, x));
+}
+
+double cask::cpu::distance(int64_t n, const double* x, const double* y) {
+  SquaredDifferenceTerm term{x, y};
+  return std::sqrt(reduce(n, [&](int64_t b, int64_t e) { return sumRange(term, b, e); }));
+}
+
+void cask::cpu::axpy(int64_t n, double a, const double* x, double* y) {
+  update(n, [&](int64_t b, int64_t e) {
+    for (int64_t i = b; i < e; i++)
+      y[i] += a * x[i];
+  });
+}
+
+void cask::cpu::axpby(int64_t n, double a, const double* x, double b, double* y) {
+  update(n, [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++)
+      y[i] = a * x[i] + b * y[i];
+  });
+}
+
+double cask::cpu::residualFromProduct(int64_t n, const double* b, double* r) {
+  return reduce(n, [&](int64_t begin, int64_t end) {
+    for (int64_t i = begin; i < end; i++)
+      r[i] = b[i] - r[i];
+    DotTerm term{r, r};
+    return sumRange(term, begin, end);
+  });
+}
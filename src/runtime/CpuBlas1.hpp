@@ -0,0 +1,47 @@
+#ifndef CPUBLAS1_HPP_M4R8VK2T
+#define CPUBLAS1_HPP_M4R8VK2T
+
+#include <cstdint>
+
+namespace cask {
+namespace cpu {
+
+/**
+ * BLAS-1 kernels on arrays of doubles, which solvers can use instead of the
+ * cblas_* of MKL, e.g. on nodes with Eigen only. None allocates:
+ * - the reductions use AVX-512 or AVX2 when the library is compiled for a
+ *   target that supports them, with several scalar accumulators otherwise;
+ *   the updates are plain loops, which compilers vectorise;
+ * - above minParallelEntries, the arrays are split in contiguous chunks
+ *   across the runtime thread pool (see Parallel.hpp); partial sums are
+ *   added in chunk order, so results are reproducible for a given number
+ *   of threads.
+ */
+
+/** Below this many entries the kernels run serially */
+const int64_t minParallelEntries = 1 << 16;
+
+/** (x, y) */
+double dot(int64_t n, const double* x, const double* y);
+
+/** ||x||_2, as the square root of (x, x): unlike the BLAS nrm2, entries
+ * beyond about 1E154 overflow */
+double nrm2(int64_t n, const double* x);
+
+/** ||x - y||_2 */
+double distance(int64_t n, const double* x, const double* y);
+
+/** y += a x */
+void axpy(int64_t n, double a, const double* x, double* y);
+
+/** y = a x + b y */
+void axpby(int64_t n, double a, const double* x, double b, double* y);
+
+/** r = b - r, where r holds A x on entry (e.g. from symSpmv()); returns
+ * (r, r), in the same pass */
+double residualFromProduct(int64_t n, const double* b, double* r);
+
+}
+}
+
+#endif /* end of include guard: CPUBLAS1_HPP_M4R8VK2T */
@@ -0,0 +1,309 @@
+#include "CpuSpmv.hpp"
+#include "SparseMatrix.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+#if defined(__AVX2__)
+inline double hsum(__m256d v) {
+  __m128d lo = _mm256_castpd256_pd128(v);
+  __m128d hi = _mm256_extractf128_pd(v, 1);
+  lo = _mm_add_pd(lo, hi);
+  return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+inline __m256d fmadd(__m256d a, __m256d b, __m256d c) {
+#if defined(__FMA__)
+  return _mm256_fmadd_pd(a, b, c);
+#else
+  return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+#endif
+
+// sum_k values[k] * x[col_ind[k]] for k in [begin, end)
+inline double rowDot(const double* values, const int* col_ind, int64_t begin, int64_t end, const double* x) {
+  double sum = 0;
+  int64_t k = begin;
+#if defined(__AVX512F__)
+  if (end - k >= 8) {
+    __m512d acc = _mm512_setzero_pd();
+    for (; k + 8 <= end; k += 8) {
+      __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col_ind + k));
+      __m512d xv = _mm512_i32gather_pd(idx, x, 8);
+      acc = _mm512_fmadd_pd(_mm512_loadu_pd(values + k), xv, acc);
+    }
+    sum = _mm512_reduce_add_pd(acc);
+  }
+#elif defined(__AVX2__)
+  if (end - k >= 4) {
+    __m256d acc = _mm256_setzero_pd();
+    for (; k + 4 <= end; k += 4) {
+      __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(col_ind + k));
+      __m256d xv = _mm256_i32gather_pd(x, idx, 8);
+      acc = fmadd(_mm256_loadu_pd(values + k), xv, acc);
+    }
+    sum = hsum(acc);
+  }
+#endif
+  for (; k < end; k++)
+    sum += values[k] * x[col_ind[k]];
+  return sum;
+}
+
+void serialSpmv(const cask::CsrView& a, const double* x, double* y) {
+  for (int i = 0; i < a.n; i++)
+    y[i] = rowDot(a.values, a.col_ind, a.row_ptr[i], a.row_ptr[i + 1], x);
+}
+
+// the rows [rowBegin, rowEnd) of y = A * x
+void blockedRows(const cask::BlockedCsrMatrix& a, const double* x, double* y, int rowBegin, int rowEnd) {
+  std::fill(y + rowBegin, y + rowEnd, 0.0);
+  for (int b = 0; b < a.nBlocks; b++) {
+    const int* first = a.rows.data() + a.block_ptr[b];
+    const int* last = a.rows.data() + a.block_ptr[b + 1];
+    const double* xb = x + int64_t(b) * a.blockSize;
+    for (const int* r = std::lower_bound(first, last, rowBegin); r != last && *r < rowEnd; r++) {
+      int k = r - a.rows.data();
+      y[*r] += rowDot(a.values.data(), a.col_ind.data(), a.row_ptr[k], a.row_ptr[k + 1], xb);
+    }
+  }
+}
+
+// the rows of chunk c of y = A * x
+inline void sellChunk(const cask::SellMatrix& a, int c, const double* x, double* y) {
+  const int C = a.chunkHeight;
+  const double* values = a.values.data() + a.chunk_ptr[c];
+  const int* col_ind = a.col_ind.data() + a.chunk_ptr[c];
+  const int* rows = a.rows.data() + int64_t(c) * C;
+  int len = a.chunk_len[c];
+  int rowsInChunk = std::min(C, a.n - c * C);
+  double sums[cask::SellMatrix::maxChunkHeight];
+#if defined(__AVX512F__)
+  if (C == 8) {
+    __m512d acc = _mm512_setzero_pd();
+    for (int j = 0; j < len; j++) {
+      __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(col_ind + j * 8));
+      __m512d xv = _mm512_i32gather_pd(idx, x, 8);
+      acc = _mm512_fmadd_pd(_mm512_loadu_pd(values + j * 8), xv, acc);
+    }
+    _mm512_storeu_pd(sums, acc);
+    for (int r = 0; r < rowsInChunk; r++)
+      y[rows[r]] = sums[r];
+    return;
+  }
+#endif
+#if defined(__AVX2__)
+  if (C % 4 == 0) {
+    for (int l = 0; l < C; l += 4) {
+      __m256d acc = _mm256_setzero_pd();
+      for (int j = 0; j < len; j++) {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(col_ind + int64_t(j) * C + l));
+        __m256d xv = _mm256_i32gather_pd(x, idx, 8);
+        acc = fmadd(_mm256_loadu_pd(values + int64_t(j) * C + l), xv, acc);
+      }
+      _mm256_storeu_pd(sums + l, acc);
+    }
+    for (int r = 0; r < rowsInChunk; r++)
+      y[rows[r]] = sums[r];
+    return;
+  }
+#endif
+  std::fill(sums, sums + C, 0.0);
+  for (int j = 0; j < len; j++)
+    for (int r = 0; r < C; r++)
+      sums[r] += values[int64_t(j) * C + r] * x[col_ind[int64_t(j) * C + r]];
+  for (int r = 0; r < rowsInChunk; r++)
+    y[rows[r]] = sums[r];
+}
+
+void serialSymSpmv(const cask::CsrView& l, const double* x, double* y) {
+  std::fill(y, y + l.n, 0.0);
+  for (int i = 0; i < l.n; i++) {
+    double sum = 0;
+    double xi = x[i];
+    for (int k = l.row_ptr[i]; k < l.row_ptr[i + 1]; k++) {
+      int j = l.col_ind[k];
+      double v = l.values[k];
+      sum += v * x[j];
+      if (j != i)
+        y[j] += v * xi;
+    }
+    y[i] += sum;
+  }
+}
+
+}
+
+void cask::cpu::mergePathSearch(int64_t diagonal, const CsrView& a, int& row, int64_t& nz) {
+  // merges the list of row end offsets with the list of nonzero indices
+  int base = a.offset();
+  int64_t lo = std::max<int64_t>(diagonal - a.nnzs, 0);
+  int64_t hi = std::min<int64_t>(diagonal, a.n);
+  while (lo < hi) {
+    int64_t pivot = (lo + hi) / 2;
+    if (a.row_ptr[pivot + 1] - base <= diagonal - pivot - 1)
+      lo = pivot + 1;
+    else
+      hi = pivot;
+  }
+  row = lo;
+  nz = diagonal - lo;
+}
+
+void cask::cpu::spmv(const CsrView& a, const double* x, double* y) {
+  int nThreads = parallel::numThreads();
+  if (nThreads == 1 || a.nnzs < minParallelNnzs) {
+    serialSpmv(a, x, y);
+    return;
+  }
+
+  // each thread consumes an equal share of the merge path of rows + nonzeros;
+  // a row split between threads is completed by adding the partial sum of
+  // its beginning (the carry) once all threads finish
+  int base = a.offset();
+  int64_t pathLength = int64_t(a.n) + a.nnzs;
+  std::vector<int> carryRow(nThreads, -1);
+  std::vector<double> carryValue(nThreads, 0);
+  parallel::ThreadPool::global().run(nThreads, [&](int t) {
+    int64_t d0 = pathLength * t / nThreads;
+    int64_t d1 = pathLength * (t + 1) / nThreads;
+    int row, endRow;
+    int64_t nz, endNz;
+    mergePathSearch(d0, a, row, nz);
+    mergePathSearch(d1, a, endRow, endNz);
+    nz += base;
+    endNz += base;
+    for (; row < endRow; row++) {
+      y[row] = rowDot(a.values, a.col_ind, nz, a.row_ptr[row + 1], x);
+      nz = a.row_ptr[row + 1];
+    }
+    if (endRow < a.n) {
+      carryRow[t] = endRow;
+      carryValue[t] = rowDot(a.values, a.col_ind, nz, endNz, x);
+    }
+  });
+
+  for (int t = 0; t < nThreads; t++)
+    if (carryRow[t] != -1)
+      y[carryRow[t]] += carryValue[t];
+}
+
+void cask::cpu::symSpmv(const CsrView& l, const double* x, double* y) {
+  int nThreads = parallel::numThreads();
+  if (nThreads == 1 || l.nnzs < minParallelNnzs) {
+    serialSymSpmv(l, x, y);
+    return;
+  }
+
+  // Split rows into nnz balanced, contiguous ranges. The transpose
+  // contribution of entry (i, j), j < i, goes to y[j]: if j falls in the
+  // thread's own range it is added to y directly, otherwise it is collected
+  // in a private buffer covering rows [0, rangeStart), reduced at the end.
+  int base = l.offset();
+  std::vector<int> bounds(nThreads + 1, l.n);
+  bounds[0] = 0;
+  for (int t = 1; t < nThreads; t++) {
+    int64_t target = base + int64_t(l.nnzs) * t / nThreads;
+    bounds[t] = std::max<int>(bounds[t - 1],
+        std::lower_bound(l.row_ptr, l.row_ptr + l.n + 1, target) - l.row_ptr);
+    bounds[t] = std::min(bounds[t], l.n);
+  }
+  std::vector<std::vector<double>> buffers(nThreads);
+  std::atomic<bool> upperEntries{false};
+
+  parallel::ThreadPool::global().run(nThreads, [&](int t) {
+    int r0 = bounds[t], r1 = bounds[t + 1];
+    std::vector<double>& buf = buffers[t];
+    buf.assign(r0, 0.0);
+    std::fill(y + r0, y + r1, 0.0);
+    for (int i = r0; i < r1; i++) {
+      double sum = 0;
+      double xi = x[i];
+      for (int k = l.row_ptr[i]; k < l.row_ptr[i + 1]; k++) {
+        int j = l.col_ind[k];
+        double v = l.values[k];
+        sum += v * x[j];
+        if (j == i)
+          continue;
+        if (j > i)
+          upperEntries = true;
+        else if (j >= r0)
+          y[j] += v * xi;
+        else
+          buf[j] += v * xi;
+      }
+      y[i] += sum;
+    }
+  });
+
+  if (upperEntries) {
+    // not a lower triangular matrix, the buffers do not cover all rows
+    serialSymSpmv(l, x, y);
+    return;
+  }
+
+  parallel::parallelForChunks(0, l.n, [&](int, int64_t s, int64_t e) {
+    for (int t = 1; t < nThreads; t++) {
+      const std::vector<double>& buf = buffers[t];
+      int64_t end = std::min<int64_t>(e, buf.size());
+      for (int64_t j = s; j < end; j++)
+        y[j] += buf[j];
+    }
+  }, 4096);
+}
+
+void cask::cpu::blockedSpmv(const BlockedCsrMatrix& a, const double* x, double* y) {
+  if (parallel::numThreads() == 1 || a.nnzs < minParallelNnzs) {
+    blockedRows(a, x, y, 0, a.n);
+    return;
+  }
+  // each thread owns its rows of y, in all blocks
+  parallel::parallelForChunks(0, a.n, [&](int, int64_t rowBegin, int64_t rowEnd) {
+    blockedRows(a, x, y, rowBegin, rowEnd);
+  }, 1024);
+}
+
+void cask::cpu::sellSpmv(const SellMatrix& a, const double* x, double* y) {
+  if (parallel::numThreads() == 1 || a.nnzs < minParallelNnzs) {
+    for (int c = 0; c < a.nChunks; c++)
+      sellChunk(a, c, x, y);
+    return;
+  }
+  // each thread takes consecutive chunks with an equal share of the stored
+  // entries (plus one per chunk); chunks write disjoint rows of y
+  int nThreads = parallel::numThreads();
+  int64_t total = a.storedEntries() + a.nChunks;
+  auto firstChunk = [&](int t) {
+    int64_t target = total * t / nThreads;
+    int lo = 0, hi = a.nChunks;
+    while (lo < hi) {
+      int mid = (lo + hi) / 2;
+      if (a.chunk_ptr[mid] + mid < target)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  };
+  parallel::ThreadPool::global().run(nThreads, [&](int t) {
+    for (int c = firstChunk(t), end = firstChunk(t + 1); c < end; c++)
+      sellChunk(a, c, x, y);
+  });
+}
+
+int cask::cpu::sellChunkHeight() {
+#if defined(__AVX512F__)
+  return 8;
+#else
+  return 4;
+#endif
+}
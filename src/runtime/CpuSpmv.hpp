@@ -0,0 +1,64 @@
+#ifndef CPUSPMV_HPP_7RJ2WQXE
+#define CPUSPMV_HPP_7RJ2WQXE
+
+#include <cstdint>
+
+namespace cask {
+
+class CsrView;
+class BlockedCsrMatrix;
+class SellMatrix;
+
+/**
+ * Multithreaded CPU kernels for sparse matrix vector multiplication. These
+ * are used as the software reference for the hardware designs and by the
+ * iterative solvers.
+ *
+ * - work is split across the runtime thread pool (see Parallel.hpp) using a
+ *   merge path decomposition, which assigns each thread an equal share of
+ *   rows + nonzeros, so that a few very long rows do not serialise the
+ *   multiplication;
+ * - the inner product of each row uses AVX-512 or AVX2 gathers when the
+ *   library is compiled for a target that supports them (e.g. -march=native),
+ *   with a scalar fallback otherwise;
+ * - small matrices are multiplied serially, where threading does not pay off.
+ *
+ * Results may differ from a strictly sequential implementation in the last
+ * bits, due to the different order of floating point additions.
+ */
+namespace cpu {
+
+/** Below this many nonzeros the kernels run serially */
+const int64_t minParallelNnzs = 1 << 15;
+
+/** y = A * x, where y has a.n entries and x has a.m entries */
+void spmv(const CsrView& a, const double* x, double* y);
+
+/** y = A * x, where A is symmetric and only its lower triangle (including the
+ * diagonal) is stored in lower. Contributions of the implicit upper triangle
+ * are accumulated without races, in per thread buffers. */
+void symSpmv(const CsrView& lower, const double* x, double* y);
+
+/** y = A * x, one block of columns at a time, so that the entries of x a
+ * block reads stay in cache; threads multiply contiguous ranges of rows.
+ * This only pays off if x does not fit in cache: otherwise spmv() is about
+ * twice as fast, as it writes each entry of y once. */
+void blockedSpmv(const BlockedCsrMatrix& a, const double* x, double* y);
+
+/** y = A * x for a matrix in SELL-C-sigma format, with AVX-512 or AVX2
+ * gathers for chunks of 8 or a multiple of 4 rows when compiled for them;
+ * chunks are split across threads */
+void sellSpmv(const SellMatrix& a, const double* x, double* y);
+
+/** The chunk height of SELL-C-sigma that fills a SIMD register of doubles
+ * on the target the library is compiled for: 8 for AVX-512, otherwise 4 */
+int sellChunkHeight();
+
+/** Finds the merge path split point for the given diagonal: on return, row is
+ * the number of rows and nz the number of nonzeros which precede it. */
+void mergePathSearch(int64_t diagonal, const CsrView& a, int& row, int64_t& nz);
+
+}
+}
+
+#endif /* end of include guard: CPUSPMV_HPP_7RJ2WQXE */
@@ -0,0 +1,196 @@
+#include "CpuTriangular.hpp"
+#include "SparseMatrix.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// levels with fewer rows are processed serially
+const int64_t minParallelRows = 256;
+
+void sortRows(cask::CsrMatrix& a) {
+  std::vector<std::pair<int, double>> row;
+  for (int i = 0; i < a.n; i++) {
+    int b = a.row_ptr[i], e = a.row_ptr[i + 1];
+    if (std::is_sorted(a.col_ind.begin() + b, a.col_ind.begin() + e))
+      continue;
+    row.clear();
+    for (int k = b; k < e; k++)
+      row.emplace_back(a.col_ind[k], a.values[k]);
+    std::sort(row.begin(), row.end(),
+              [](const std::pair<int, double>& x, const std::pair<int, double>& y) {
+                return x.first < y.first;
+              });
+    for (int k = b; k < e; k++) {
+      a.col_ind[k] = row[k - b].first;
+      a.values[k] = row[k - b].second;
+    }
+  }
+}
+
+// IKJ elimination of row i, using the (final) rows k < i of its pattern
+inline void factorRow(int i, const int* row_ptr, const int* col_ind, const int* diag, double* values) {
+  int end = row_ptr[i + 1];
+  for (int p = row_ptr[i]; p < end; p++) {
+    int k = col_ind[p];
+    if (k >= i)
+      break;
+    int dk = diag[k];
+    if (dk < 0 || values[dk] == 0)
+      continue;
+    values[p] = values[p] / values[dk];
+    double beta = values[p];
+
+    // a(i, j) -= a(k, j) * a(i, k) for j > k in the pattern of both rows
+    int q = p + 1, r = dk + 1, kEnd = row_ptr[k + 1];
+    while (q < end && r < kEnd) {
+      if (col_ind[q] < col_ind[r]) {
+        q++;
+      } else if (col_ind[q] > col_ind[r]) {
+        r++;
+      } else {
+        if (values[r] != 0)
+          values[q] = values[q] - values[r] * beta;
+        q++;
+        r++;
+      }
+    }
+  }
+}
+
+// runs f(row) on each row, level by level
+template<typename F>
+void forEachRowByLevel(const cask::cpu::LevelSchedule& s, F f) {
+  for (int l = 0; l < s.numLevels(); l++) {
+    int64_t b = s.levelPtr[l], e = s.levelPtr[l + 1];
+    if (e - b < minParallelRows) {
+      for (int64_t r = b; r < e; r++)
+        f(s.rows[r]);
+      continue;
+    }
+    cask::parallel::parallelFor(b, e, [&](int64_t r) {
+      f(s.rows[r]);
+    }, minParallelRows / 4);
+  }
+}
+
+// groups rows by level, given the level of each row
+cask::cpu::LevelSchedule fromLevels(const std::vector<int>& level, int numLevels) {
+  cask::cpu::LevelSchedule s;
+  int n = level.size();
+  s.levelPtr.assign(numLevels + 1, 0);
+  for (int i = 0; i < n; i++)
+    s.levelPtr[level[i] + 1]++;
+  std::partial_sum(s.levelPtr.begin(), s.levelPtr.end(), s.levelPtr.begin());
+  std::vector<int> pos(s.levelPtr.begin(), s.levelPtr.end() - 1);
+  s.rows.resize(n);
+  for (int i = 0; i < n; i++)
+    s.rows[pos[level[i]]++] = i;
+  return s;
+}
+
+}
+
+cask::cpu::LevelSchedule cask::cpu::LevelSchedule::lower(const CsrView& a) {
+  std::vector<int> level(a.n, 0);
+  int numLevels = a.n > 0 ? 1 : 0;
+  for (int i = 0; i < a.n; i++) {
+    int l = 0;
+    for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+      int j = a.col_ind[k];
+      if (j < i)
+        l = std::max(l, level[j] + 1);
+    }
+    level[i] = l;
+    numLevels = std::max(numLevels, l + 1);
+  }
+  return fromLevels(level, numLevels);
+}
+
+cask::cpu::LevelSchedule cask::cpu::LevelSchedule::upper(const CsrView& a) {
+  std::vector<int> level(a.n, 0);
+  int numLevels = a.n > 0 ? 1 : 0;
+  for (int i = a.n - 1; i >= 0; i--) {
+    int l = 0;
+    for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+      int j = a.col_ind[k];
+      if (j > i)
+        l = std::max(l, level[j] + 1);
+    }
+    level[i] = l;
+    numLevels = std::max(numLevels, l + 1);
+  }
+  return fromLevels(level, numLevels);
+}
+
+std::vector<int> cask::cpu::diagonalPositions(const CsrView& a) {
+  std::vector<int> diag(a.n, -1);
+  parallel::parallelFor(0, a.n, [&](int64_t i) {
+    const int* b = a.col_ind + a.row_ptr[i];
+    const int* e = a.col_ind + a.row_ptr[i + 1];
+    const int* d = std::lower_bound(b, e, i);
+    if (d != e && *d == i)
+      diag[i] = d - a.col_ind;
+  }, 4096);
+  return diag;
+}
+
+void cask::cpu::ilu0(CsrMatrix& a) {
+  sortRows(a);
+  CsrView v = a.view();
+  std::vector<int> diag = diagonalPositions(v);
+  const int* row_ptr = a.row_ptr.data();
+  const int* col_ind = a.col_ind.data();
+  double* values = a.values.data();
+
+  if (parallel::numThreads() == 1 || a.n < minParallelRows) {
+    for (int i = 0; i < a.n; i++)
+      factorRow(i, row_ptr, col_ind, diag.data(), values);
+    return;
+  }
+
+  forEachRowByLevel(LevelSchedule::lower(v), [&](int i) {
+    factorRow(i, row_ptr, col_ind, diag.data(), values);
+  });
+}
+
+cask::cpu::TriangularSolver::TriangularSolver(const CsrView& _a) :
+    a(_a), split(_a.n), diag(diagonalPositions(_a)),
+    lowerLevels(LevelSchedule::lower(_a)), upperLevels(LevelSchedule::upper(_a)) {
+  for (int i = 0; i < a.n; i++)
+    split[i] = std::lower_bound(a.col_ind + a.row_ptr[i], a.col_ind + a.row_ptr[i + 1], i) - a.col_ind;
+}
+
+void cask::cpu::TriangularSolver::solveLower(const double* b, double* x) const {
+  auto solveRow = [&](int i) {
+    double sum = b[i];
+    for (int k = a.row_ptr[i]; k < split[i]; k++)
+      sum -= a.values[k] * x[a.col_ind[k]];
+    x[i] = diag[i] < 0 ? sum : sum / a.values[diag[i]];
+  };
+  if (parallel::numThreads() == 1 || a.n < minParallelRows) {
+    for (int i = 0; i < a.n; i++)
+      solveRow(i);
+    return;
+  }
+  forEachRowByLevel(lowerLevels, solveRow);
+}
+
+void cask::cpu::TriangularSolver::solveUpper(const double* b, double* x) const {
+  auto solveRow = [&](int i) {
+    double sum = b[i];
+    for (int k = diag[i] < 0 ? split[i] : diag[i] + 1; k < a.row_ptr[i + 1]; k++)
+      sum -= a.values[k] * x[a.col_ind[k]];
+    x[i] = diag[i] < 0 ? sum : sum / a.values[diag[i]];
+  };
+  if (parallel::numThreads() == 1 || a.n < minParallelRows) {
+    for (int i = a.n - 1; i >= 0; i--)
+      solveRow(i);
+    return;
+  }
+  forEachRowByLevel(upperLevels, solveRow);
+}
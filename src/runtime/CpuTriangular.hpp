@@ -0,0 +1,84 @@
+#ifndef CPUTRIANGULAR_HPP_4MCX8TLA
+#define CPUTRIANGULAR_HPP_4MCX8TLA
+
+#include "SparseMatrix.hpp"
+
+#include <vector>
+
+namespace cask {
+
+/**
+ * Multithreaded CPU kernels for sparse triangular factorisations and solves,
+ * used by the preconditioners of the iterative solvers.
+ *
+ * Work is scheduled by dependency level: rows are grouped so that each row
+ * only depends on rows of earlier levels, and the rows of a level are
+ * processed in parallel on the runtime thread pool (see Parallel.hpp). Levels
+ * with few rows are processed serially. Since every row is computed by the
+ * same sequence of operations as in a serial sweep, results do not depend on
+ * the number of threads.
+ */
+namespace cpu {
+
+/** A partition of the rows of a sparse triangular system into dependency levels. */
+struct LevelSchedule {
+  // rows of level l are rows[levelPtr[l]] ... rows[levelPtr[l + 1] - 1], in increasing order
+  std::vector<int> levelPtr;
+  std::vector<int> rows;
+
+  int numLevels() const {
+    return levelPtr.size() - 1;
+  }
+
+  /** Row i depends on all rows j < i such that (i, j) is stored in a. */
+  static LevelSchedule lower(const CsrView& a);
+
+  /** Row i depends on all rows j > i such that (i, j) is stored in a. */
+  static LevelSchedule upper(const CsrView& a);
+};
+
+/** Returns the positions in a.col_ind and a.values of the diagonal entries, or
+ * -1 for rows without a stored diagonal; columns must be sorted in each row. */
+std::vector<int> diagonalPositions(const CsrView& a);
+
+/** Incomplete LU factorisation with zero fill in, ILU(0), computed in place:
+ * on return the strictly lower triangle of a holds the multipliers of L, whose
+ * unit diagonal is not stored, and the upper triangle (including the diagonal)
+ * holds U. Eliminations by a zero or missing pivot are skipped. Rows whose
+ * columns are not sorted are sorted first.
+ *
+ * NB TriangularSolver::solveLower() divides by the stored diagonal, i.e. that
+ * of U, so on these factors it solves with L diag(U), not L; the ILU
+ * preconditioner relies on this, as it did on the non-unit ('N') lower solve
+ * of MklLayer. */
+void ilu0(CsrMatrix& a);
+
+/** Solves with the lower and upper triangles of a square matrix whose columns
+ * are sorted in each row, e.g. the factors computed in place by ilu0(). Both
+ * triangles include the stored diagonal (neither solve assumes a unit one); a
+ * row without a stored diagonal is treated as having a unit diagonal.
+ *
+ * The dependency levels of both triangles are computed once, on construction,
+ * and solves do not allocate. The matrix must outlive the solver. */
+class TriangularSolver {
+  CsrView a;
+  // position of the first entry of row i with column >= i
+  std::vector<int> split;
+  std::vector<int> diag;
+  LevelSchedule lowerLevels, upperLevels;
+
+ public:
+  explicit TriangularSolver(const CsrView& a);
+
+  /** Solves L x = b, for L the lower triangle including the stored
+   * diagonal; b and x may be the same array. */
+  void solveLower(const double* b, double* x) const;
+
+  /** Solves U x = b; b and x may be the same array. */
+  void solveUpper(const double* b, double* x) const;
+};
+
+}
+}
+
+#endif /* end of include guard: CPUTRIANGULAR_HPP_4MCX8TLA */
@@ -0,0 +1,166 @@
+#ifndef CYCLECOUNTING_HPP_R7N2KD4W
+#define CYCLECOUNTING_HPP_R7N2KD4W
+
+#include <cstdint>
+
+namespace cask {
+  namespace spmv {
+
+/**
+ * The input width of the cycle counts, as a compile time constant for the
+ * widths the DSE sweeps (see withInputWidth()) or a runtime value for the
+ * others. Counts are written against get(), so that the divisions and
+ * modulos by the widths of FixedInputWidth compile to multiplications and
+ * shifts, and their loops vectorise.
+ */
+template<int W>
+struct FixedInputWidth {
+  static constexpr uint32_t get() {
+    return W;
+  }
+};
+
+struct InputWidth {
+  uint32_t width;
+
+  uint32_t get() const {
+    return width;
+  }
+};
+
+/** The widest input width with a FixedInputWidth specialisation */
+const int maxFixedInputWidth = 16;
+
+/**
+ * Calls f(w) once, with w a FixedInputWidth<inputWidth> if inputWidth is at
+ * most maxFixedInputWidth, an InputWidth otherwise; f has a template call
+ * operator over the width type. Counts dispatch once per candidate or
+ * partition, not per row.
+ */
+template<typename F>
+void withInputWidth(int inputWidth, F& f) {
+  switch (inputWidth) {
+#define CASK_INPUT_WIDTH_CASE(W) case W: f(FixedInputWidth<W>()); return;
+    CASK_INPUT_WIDTH_CASE(1)  CASK_INPUT_WIDTH_CASE(2)  CASK_INPUT_WIDTH_CASE(3)
+    CASK_INPUT_WIDTH_CASE(4)  CASK_INPUT_WIDTH_CASE(5)  CASK_INPUT_WIDTH_CASE(6)
+    CASK_INPUT_WIDTH_CASE(7)  CASK_INPUT_WIDTH_CASE(8)  CASK_INPUT_WIDTH_CASE(9)
+    CASK_INPUT_WIDTH_CASE(10) CASK_INPUT_WIDTH_CASE(11) CASK_INPUT_WIDTH_CASE(12)
+    CASK_INPUT_WIDTH_CASE(13) CASK_INPUT_WIDTH_CASE(14) CASK_INPUT_WIDTH_CASE(15)
+    CASK_INPUT_WIDTH_CASE(16)
+#undef CASK_INPUT_WIDTH_CASE
+  }
+  f(InputWidth{uint32_t(inputWidth)});
+}
+
+/**
+ * The columns of blocks of blockSize columns, as a shift for the power of
+ * two block (cache) sizes of the generated designs, a division otherwise;
+ * see withBlocking().
+ */
+struct PowerOfTwoBlocks {
+  int shift;
+
+  int block(int col) const {
+    return col >> shift;
+  }
+
+  int offset(int col) const {
+    return col & ((1 << shift) - 1);
+  }
+};
+
+struct Blocks {
+  int blockSize;
+
+  int block(int col) const {
+    return col / blockSize;
+  }
+
+  int offset(int col) const {
+    return col % blockSize;
+  }
+};
+
+namespace detail {
+template<typename F>
+struct BlockingDispatch {
+  F& f;
+  int blockSize;
+
+  template<typename Width>
+  void operator()(Width w) {
+    if (blockSize > 0 && (blockSize & (blockSize - 1)) == 0) {
+      int shift = 0;
+      while ((1 << shift) < blockSize)
+        shift++;
+      f(w, PowerOfTwoBlocks{shift});
+    } else {
+      f(w, Blocks{blockSize});
+    }
+  }
+};
+}
+
+/** Calls f(w, blocks) once, with the width type of withInputWidth() and
+ * PowerOfTwoBlocks or Blocks for blockSize */
+template<typename F>
+void withBlocking(int inputWidth, int blockSize, F& f) {
+  detail::BlockingDispatch<F> d{f, blockSize};
+  withInputWidth(inputWidth, d);
+}
+
+/**
+ * Cycles to read the entries of n consecutive rows of a block, rowEnds[i]
+ * being the end of row i and 0 the start of row 0: a row takes one cycle
+ * per input of width entries it touches, an empty row one cycle. In closed
+ * form, as the inputs are aligned to the start of the block.
+ */
+template<typename Width>
+int countRowCycles(const int32_t* rowEnds, int n, Width w) {
+  if (n == 0)
+    return 0;
+  uint32_t cycles = rowEnds[0] == 0 ? 1 : (uint32_t(rowEnds[0]) - 1) / w.get() + 1;
+  for (int i = 1; i < n; i++) {
+    uint32_t start = rowEnds[i - 1], end = rowEnds[i];
+    // branch free, so the loop vectorises: for an empty row, the last
+    // input touched is taken before the first, which gives 1
+    uint32_t last = end == start ? start / w.get() : (end - 1) / w.get();
+    cycles += last - start / w.get() + 1;
+  }
+  return cycles;
+}
+
+/** Cycles of a row of length entries, starting at an input boundary */
+template<typename Width>
+int rowCycles(int length, Width w) {
+  return (uint32_t(length) + w.get() - 1) / w.get();
+}
+
+/** Per block state of a row by row scan, as done by Spmv::analyse_blocking() */
+struct BlockStatistics {
+  int64_t nnzs = 0, escapes = 0;
+  int cycles = 0, crtPos = 0;
+  int nonEmptyRows = 0, emptyRuns = 0, lastNonEmptyRow = -1;
+
+  /** Accounts for a non empty row, same as countRowCycles() */
+  template<typename Width>
+  void addRow(int row, int length, Width w) {
+    nnzs += length;
+    // the row spans the inputs from crtPos to crtPos + length - 1
+    cycles += (uint32_t(crtPos) + length - 1) / w.get() + 1;
+    crtPos = (uint32_t(crtPos) + length) % w.get();
+    if (row - lastNonEmptyRow > 1)
+      emptyRuns++;
+    lastNonEmptyRow = row;
+    nonEmptyRows++;
+  }
+
+  void addRow(int row, int length, int inputWidth) {
+    addRow(row, length, InputWidth{uint32_t(inputWidth)});
+  }
+};
+
+  }
+}
+
+#endif /* end of include guard: CYCLECOUNTING_HPP_R7N2KD4W */
@@ -0,0 +1,223 @@
+#include "DeviceModels.hpp"
+#include "IndexCoding.hpp"
+#include "Utils.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+using namespace cask::model;
+namespace pt = boost::property_tree;
+
+namespace {
+
+const char* const resourceNames[] = {"luts", "ffs", "brams", "dsps"};
+
+int& resource(LogicResourceUsage& ru, int k) {
+  switch (k) {
+    case 0: return ru.luts;
+    case 1: return ru.ffs;
+    case 2: return ru.brams;
+    default: return ru.dsps;
+  }
+}
+
+int resource(const LogicResourceUsage& ru, int k) {
+  return resource(const_cast<LogicResourceUsage&>(ru), k);
+}
+
+LogicResourceUsage readUsage(const pt::ptree& t, const LogicResourceUsage& defaults) {
+  LogicResourceUsage ru = defaults;
+  for (int k = 0; k < 4; k++)
+    resource(ru, k) = t.get<int>(resourceNames[k], resource(ru, k));
+  return ru;
+}
+
+pt::ptree usageTree(LogicResourceUsage ru) {
+  pt::ptree t;
+  for (int k = 0; k < 4; k++)
+    t.put(resourceNames[k], resource(ru, k));
+  return t;
+}
+
+// the cost entries of a descriptor, by name
+struct CostEntry {
+  const char* name;
+  LogicResourceUsage KernelCostModel::*usage;
+};
+
+const CostEntry costEntries[] = {
+  {"per_pipe", &KernelCostModel::perPipe},
+  {"per_input", &KernelCostModel::perInput},
+  {"fixed", &KernelCostModel::fixed},
+  {"decoder_per_input_bit", &KernelCostModel::decoderPerInputBit},
+  {"escape_stream_per_pipe", &KernelCostModel::escapeStreamPerPipe},
+  {"reflection_per_input", &KernelCostModel::reflectionPerInput},
+  {"reflection_per_pipe", &KernelCostModel::reflectionPerPipe},
+};
+
+// solves the 3 x 3 system a x = b by Gaussian elimination with partial
+// pivoting; returns false if it is (nearly) singular
+bool solve3(double a[3][3], double b[3], double x[3]) {
+  double scale = 0;
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      scale = std::max(scale, std::abs(a[i][j]));
+  for (int c = 0; c < 3; c++) {
+    int pivot = c;
+    for (int r = c + 1; r < 3; r++)
+      if (std::abs(a[r][c]) > std::abs(a[pivot][c]))
+        pivot = r;
+    if (std::abs(a[pivot][c]) <= 1E-9 * scale)
+      return false;
+    std::swap(a[c], a[pivot]);
+    std::swap(b[c], b[pivot]);
+    for (int r = c + 1; r < 3; r++) {
+      double f = a[r][c] / a[c][c];
+      for (int j = c; j < 3; j++)
+        a[r][j] -= f * a[c][j];
+      b[r] -= f * b[c];
+    }
+  }
+  for (int c = 2; c >= 0; c--) {
+    double s = b[c];
+    for (int j = c + 1; j < 3; j++)
+      s -= a[c][j] * x[j];
+    x[c] = s / a[c][c];
+  }
+  return true;
+}
+
+}
+
+std::shared_ptr<JsonDeviceModel> cask::model::readDeviceModel(std::istream& s) {
+  pt::ptree t;
+  pt::read_json(s, t);
+  auto m = std::make_shared<JsonDeviceModel>();
+  m->id = t.get<std::string>("id");
+  m->frequencyHz = t.get<double>("frequency_mhz", 200) * 1E6;
+  m->bramEntries = t.get<int>("entries_per_bram", 256);
+  m->limits = HardwareModel{readUsage(t.get_child("resources"), LogicResourceUsage{}),
+                            t.get<double>("memory_bandwidth")};
+  if (m->frequencyHz <= 0 || m->bramEntries <= 0 || m->limits.memoryBandwidth <= 0)
+    throw std::invalid_argument("Device model " + m->id +
+        ": frequency, entries per BRAM and memory bandwidth must be positive");
+  if (auto costs = t.get_child_optional("kernel_costs")) {
+    for (const CostEntry& e : costEntries)
+      if (auto c = costs->get_child_optional(e.name))
+        m->costs.*e.usage = readUsage(*c, m->costs.*e.usage);
+  }
+  return m;
+}
+
+std::shared_ptr<JsonDeviceModel> cask::model::loadDeviceModel(const std::string& path) {
+  std::ifstream f(path);
+  if (!f)
+    throw std::invalid_argument("Could not open device model " + path);
+  return readDeviceModel(f);
+}
+
+void cask::model::writeDeviceModel(const DeviceModel& m, std::ostream& s) {
+  pt::ptree t;
+  HardwareModel limits = m.maxParams();
+  t.put("id", m.getId());
+  t.put("frequency_mhz", m.frequency() / 1E6);
+  t.put("entries_per_bram", m.entriesPerBram(64));
+  t.put("memory_bandwidth", limits.memoryBandwidth);
+  t.add_child("resources", usageTree(limits.ru));
+  KernelCostModel costs;
+  try {
+    costs = m.kernelCosts();
+  } catch (std::invalid_argument&) {
+    // e.g. Max3, which has no cost model; the defaults are written
+  }
+  pt::ptree c;
+  for (const CostEntry& e : costEntries)
+    c.add_child(e.name, usageTree(costs.*e.usage));
+  t.add_child("kernel_costs", c);
+  pt::write_json(s, t);
+}
+
+std::shared_ptr<DeviceModel> cask::model::makeDeviceModel(const std::string& nameOrPath) {
+  if (nameOrPath == "Max3")
+    return std::make_shared<Max3Model>();
+  if (nameOrPath == "Max4")
+    return std::make_shared<Max4Model>();
+  if (nameOrPath == "Max4MoreMemory")
+    return std::make_shared<Max4ModelMoreMemory>();
+  if (nameOrPath == "Max5")
+    return std::make_shared<Max5Model>();
+  return loadDeviceModel(nameOrPath);
+}
+
+std::vector<BuildMeasurement> cask::model::readBuildMeasurements(std::istream& s) {
+  pt::ptree t;
+  pt::read_json(s, t);
+  std::vector<BuildMeasurement> builds;
+  for (const auto& b : t) {
+    BuildMeasurement m;
+    m.cacheSize = b.second.get<int>("cache_size");
+    m.inputWidth = b.second.get<int>("input_width");
+    m.numPipes = b.second.get<int>("num_pipes");
+    m.maxRows = b.second.get<int>("max_rows");
+    m.indexBits = b.second.get<int>("index_bits", 32);
+    m.symmetric = b.second.get<bool>("symmetric", false);
+    m.usage = readUsage(b.second, LogicResourceUsage{});
+    builds.push_back(m);
+  }
+  return builds;
+}
+
+KernelCostModel cask::model::fitKernelCosts(
+    const DeviceModel& device,
+    const std::vector<BuildMeasurement>& builds) {
+  if (builds.size() < 3)
+    throw std::invalid_argument("Fitting kernel costs requires at least 3 builds, got " +
+        std::to_string(builds.size()));
+  KernelCostModel costs = device.kernelCosts();
+  int entriesPerBram = device.entriesPerBram(64);
+
+  // usage = numPipes * perPipe + numPipes * inputWidth * perInput + fixed,
+  // once the parts which do not depend on the fitted costs are removed
+  double ata[4][3][3] = {}, atb[4][3] = {};
+  for (const BuildMeasurement& b : builds) {
+    int maxRowsPerPipe = cask::utils::ceilDivide(b.maxRows, b.numPipes);
+    LogicResourceUsage known{0, 0,
+        b.numPipes * (cask::utils::ceilDivide(maxRowsPerPipe, entriesPerBram) +
+                      b.inputWidth * (b.cacheSize / entriesPerBram)), 0};
+    if (cask::spmv::IndexCoding(b.indexBits, b.cacheSize).usesDeltas())
+      known = known + (costs.decoderPerInputBit * (b.indexBits * b.inputWidth) +
+                       costs.escapeStreamPerPipe) * b.numPipes;
+    if (b.symmetric) {
+      LogicResourceUsage buffers{0, 0, cask::utils::ceilDivide(maxRowsPerPipe, entriesPerBram) +
+                                 b.inputWidth * (2 * b.cacheSize / entriesPerBram), 0};
+      known = known + (buffers + costs.reflectionPerPipe + costs.reflectionPerInput * b.inputWidth) *
+          b.numPipes;
+    }
+    double x[3] = {double(b.numPipes), double(b.numPipes) * b.inputWidth, 1.0};
+    for (int k = 0; k < 4; k++) {
+      double y = resource(b.usage, k) - resource(known, k);
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++)
+          ata[k][i][j] += x[i] * x[j];
+        atb[k][i] += x[i] * y;
+      }
+    }
+  }
+
+  for (int k = 0; k < 4; k++) {
+    double c[3];
+    if (!solve3(ata[k], atb[k], c))
+      throw std::invalid_argument("Fitting kernel costs requires builds which differ "
+          "in their number of pipes and of inputs per pipe");
+    resource(costs.perPipe, k) = std::lround(c[0]);
+    resource(costs.perInput, k) = std::lround(c[1]);
+    resource(costs.fixed, k) = std::lround(c[2]);
+  }
+  return costs;
+}
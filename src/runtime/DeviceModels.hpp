@@ -0,0 +1,95 @@
+#ifndef DEVICEMODELS_HPP_K2R8VBNA
+#define DEVICEMODELS_HPP_K2R8VBNA
+
+#include "Model.hpp"
+
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cask {
+  namespace model {
+
+    /** A device described by a JSON descriptor, e.g.
+     *
+     *  {
+     *    "id": "Max5",
+     *    "frequency_mhz": 200,
+     *    "entries_per_bram": 256,
+     *    "memory_bandwidth": 208,
+     *    "resources": {"luts": 2099200, "ffs": 4198400, "brams": 11721, "dsps": 11520},
+     *    "kernel_costs": {
+     *      "per_pipe": {"luts": 18584, "ffs": 28557, "brams": 189, "dsps": 0},
+     *      ...
+     *    }
+     *  }
+     *
+     * where entries_per_bram is that of 64 bit entries and kernel_costs, or
+     * any of its entries (per_pipe, per_input, fixed, decoder_per_input_bit,
+     * escape_stream_per_pipe), default to those of KernelCostModel.
+     */
+    class JsonDeviceModel : public DeviceModel {
+      public:
+        std::string id;
+        double frequencyHz = 200.0 * 1E6;
+        int bramEntries = 256;
+        HardwareModel limits{LogicResourceUsage{}, 0};
+        KernelCostModel costs;
+
+        int entriesPerBram(int bitwidth) const override {
+          if (bitwidth == 64)
+            return bramEntries;
+          throw std::invalid_argument("Only bitwidth == 64 supported for now");
+        }
+        std::string getId() const override {
+          return id;
+        }
+        HardwareModel maxParams() const override {
+          return limits;
+        }
+        double frequency() const override {
+          return frequencyHz;
+        }
+        KernelCostModel kernelCosts() const override {
+          return costs;
+        }
+    };
+
+    std::shared_ptr<JsonDeviceModel> readDeviceModel(std::istream& s);
+    std::shared_ptr<JsonDeviceModel> loadDeviceModel(const std::string& path);
+
+    /** Writes the descriptor of a device, so that any device model can be
+     * saved and edited */
+    void writeDeviceModel(const DeviceModel& m, std::ostream& s);
+
+    /** The device model of the given name (Max3, Max4, Max4MoreMemory,
+     * Max5) or, otherwise, of the JSON descriptor at the given path */
+    std::shared_ptr<DeviceModel> makeDeviceModel(const std::string& nameOrPath);
+
+    /** The resource usage reported by the build of a design */
+    struct BuildMeasurement {
+      int cacheSize, inputWidth, numPipes, maxRows;
+      int indexBits;
+      LogicResourceUsage usage;
+      bool symmetric;
+    };
+
+    /** Reads a JSON array of builds:
+     *  [{"cache_size": 1024, "input_width": 8, "num_pipes": 4,
+     *    "max_rows": 200000, "index_bits": 32, "symmetric": false,
+     *    "luts": ..., "ffs": ..., "brams": ..., "dsps": ...}, ...] */
+    std::vector<BuildMeasurement> readBuildMeasurements(std::istream& s);
+
+    /** Fits the per pipe, per input and fixed costs of the device to the
+     * measured builds by least squares, separately for each resource; the
+     * costs of delta coded indices and of symmetric designs are kept.
+     * Requires at least three builds which differ in their number of pipes
+     * and of inputs per pipe. */
+    KernelCostModel fitKernelCosts(
+        const DeviceModel& device,
+        const std::vector<BuildMeasurement>& builds);
+  }
+}
+
+#endif /* end of include guard: DEVICEMODELS_HPP_K2R8VBNA */
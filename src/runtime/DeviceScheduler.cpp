@@ -0,0 +1,197 @@
+#include "DeviceScheduler.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace cask::spmv;
+
+SpmvPlan::SpmvPlan(const DeviceScheduler* _owner, int64_t _planId, std::unique_ptr<Spmv> _spmv) :
+  owner(_owner), planId(_planId), spmv(std::move(_spmv)) {
+  n = spmv->getMatrixRows();
+  m = spmv->getMatrixCols();
+  nnzs = spmv->getMatrixNnzs();
+  cycles = spmv->getEstimatedClockCycles();
+  DramLayout layout = spmv->planDeviceLayout();
+  for (int64_t end : layout.end)
+    bytes.push_back(end - layout.base);
+}
+
+DeviceScheduler::DeviceScheduler(const runtime::GeneratedSpmvImplementation& impl,
+                                 int64_t dramBytesPerController, int _maxBatch) :
+  device(impl), dramBytes(dramBytesPerController), maxBatch(_maxBatch) {
+  if (dramBytes <= 0 || maxBatch < 1)
+    throw std::invalid_argument("DeviceScheduler needs DRAM and batches of at least one request");
+  worker = std::thread([this] { serve(); });
+}
+
+DeviceScheduler::~DeviceScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(m);
+    stopping = true;
+  }
+  queued.notify_all();
+  worker.join();
+}
+
+std::shared_ptr<const SpmvPlan> DeviceScheduler::plan(const CsrView& a) {
+  CASK_TRACE_SCOPE("scheduler:plan");
+  // the regions of the plans do not overlap, so each tracks its own
+  // residency on the device
+  runtime::GeneratedSpmvImplementation impl = device;
+  impl.residentMatrix = std::make_shared<int64_t>(-1);
+  std::unique_ptr<Spmv> s(new Spmv(impl));
+  s->preprocess(a);
+  std::shared_ptr<const SpmvPlan> p(new SpmvPlan(this, nextPlanId++, std::move(s)));
+  int64_t size = alignAddress(*std::max_element(p->deviceBytes().begin(), p->deviceBytes().end()));
+  if (size > dramBytes)
+    throw std::invalid_argument("DeviceScheduler: the plan needs " + std::to_string(size) +
+        " bytes of DRAM per controller, the device has " + std::to_string(dramBytes));
+  return p;
+}
+
+std::future<cask::Vector> DeviceScheduler::submit(const std::shared_ptr<const SpmvPlan>& plan, Vector x) {
+  std::vector<Vector> xs;
+  xs.push_back(std::move(x));
+  return std::move(submit(plan, std::move(xs)).front());
+}
+
+std::vector<std::future<cask::Vector>> DeviceScheduler::submit(
+    const std::shared_ptr<const SpmvPlan>& plan,
+    std::vector<Vector> xs) {
+  if (!plan || plan->owner != this)
+    throw std::invalid_argument("DeviceScheduler::submit a plan of another scheduler");
+  for (const auto& x : xs)
+    if (x.size() != plan->cols())
+      throw std::invalid_argument("DeviceScheduler::submit vector length " + std::to_string(x.size()) +
+          " != matrix columns " + std::to_string(plan->cols()));
+
+  std::vector<std::future<Vector>> results;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    if (stopping)
+      throw std::runtime_error("DeviceScheduler::submit on a stopped scheduler");
+    for (auto& x : xs) {
+      queue.push_back(Request{plan, std::move(x), std::promise<Vector>()});
+      results.push_back(queue.back().result.get_future());
+    }
+  }
+  queued.notify_one();
+  return results;
+}
+
+SchedulerStats DeviceScheduler::getStats() const {
+  std::lock_guard<std::mutex> lock(m);
+  return stats;
+}
+
+void DeviceScheduler::serve() {
+  std::unique_lock<std::mutex> lock(m);
+  while (true) {
+    queued.wait(lock, [this] { return stopping || !queue.empty(); });
+    if (queue.empty())
+      return;
+    std::deque<Request> pending;
+    pending.swap(queue);
+    lock.unlock();
+
+    // the requests of each plan, in order of their first, in batches
+    std::vector<std::vector<Request*>> batches;
+    std::map<int64_t, size_t> open;
+    for (auto& r : pending) {
+      auto it = open.find(r.plan->id());
+      if (it == open.end() || int(batches[it->second].size()) == maxBatch) {
+        open[r.plan->id()] = batches.size();
+        batches.emplace_back();
+      }
+      batches[open[r.plan->id()]].push_back(&r);
+    }
+    for (auto& batch : batches)
+      runBatch(batch);
+    lock.lock();
+  }
+}
+
+void DeviceScheduler::runBatch(std::vector<Request*>& batch) {
+  const SpmvPlan& plan = *batch.front()->plan;
+  CASK_TRACE_SCOPE("scheduler:batch", plan.id());
+  try {
+    makeResident(batch.front()->plan);
+    std::vector<Vector> ys;
+    if (batch.size() == 1) {
+      ys.push_back(Vector(plan.rows()));
+      plan.spmv->multiply(batch.front()->x.data.data(), ys.front().data.data());
+    } else {
+      std::vector<Vector> xs;
+      for (Request* r : batch)
+        xs.push_back(std::move(r->x));
+      ys = plan.spmv->spmm(xs);
+    }
+    {
+      // counted before the results are, so their clients see the counts
+      std::lock_guard<std::mutex> lock(m);
+      stats.requests += batch.size();
+      stats.batches++;
+    }
+    for (size_t i = 0; i < batch.size(); i++)
+      batch[i]->result.set_value(std::move(ys[i]));
+  } catch (...) {
+    for (Request* r : batch)
+      r->result.set_exception(std::current_exception());
+  }
+}
+
+void DeviceScheduler::makeResident(const std::shared_ptr<const SpmvPlan>& p) {
+  const SpmvPlan& plan = *p;
+  auto it = regions.find(plan.id());
+  if (it != regions.end()) {
+    it->second.lastUse = ++useClock;
+    return;
+  }
+  // the regions of released plans are free
+  for (it = regions.begin(); it != regions.end(); )
+    it = it->second.plan.expired() ? regions.erase(it) : std::next(it);
+
+  int64_t size = alignAddress(*std::max_element(plan.deviceBytes().begin(), plan.deviceBytes().end()));
+  int64_t base;
+  while (true) {
+    // first fit, between the resident regions by address
+    std::vector<std::pair<int64_t, int64_t>> used;
+    for (const auto& r : regions)
+      used.push_back(std::make_pair(r.second.base, r.second.size));
+    std::sort(used.begin(), used.end());
+    int64_t start = 0;
+    for (const auto& u : used) {
+      if (u.first - start >= size)
+        break;
+      start = u.first + u.second;
+    }
+    if (dramBytes - start >= size) {
+      base = start;
+      break;
+    }
+
+    // evict the least recently used plan
+    auto lru = std::min_element(regions.begin(), regions.end(),
+        [](const std::pair<const int64_t, Region>& a, const std::pair<const int64_t, Region>& b) {
+          return a.second.lastUse < b.second.lastUse;
+        });
+    if (lru == regions.end())
+      throw std::runtime_error("DeviceScheduler: the plan needs " + std::to_string(size) +
+          " bytes of DRAM per controller, the device has " + std::to_string(dramBytes));
+    if (std::shared_ptr<const SpmvPlan> evicted = lru->second.plan.lock())
+      *evicted->spmv->impl.residentMatrix = -1;
+    regions.erase(lru);
+    std::lock_guard<std::mutex> lock(m);
+    stats.evictions++;
+  }
+
+  // the matrix is loaded in its region by the next multiplication
+  DramLayoutOptions o;
+  o.baseAddress = base;
+  plan.spmv->setDramLayoutOptions(o);
+  regions[plan.id()] = Region{base, size, ++useClock, p};
+  std::lock_guard<std::mutex> lock(m);
+  stats.loads++;
+}
@@ -0,0 +1,155 @@
+#ifndef DEVICESCHEDULER_HPP_T2K7RM9B
+#define DEVICESCHEDULER_HPP_T2K7RM9B
+
+#include "Spmv.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cask {
+  namespace spmv {
+
+    class DeviceScheduler;
+
+    /**
+     * A matrix preprocessed for the device of a DeviceScheduler, which runs
+     * all its multiplications. A plan does not change once built, so any
+     * number of threads can share it and submit multiplications by it.
+     */
+    class SpmvPlan {
+      friend class DeviceScheduler;
+
+      const DeviceScheduler* owner;
+      int64_t planId;
+      int n, m;
+      int64_t nnzs;
+      double cycles;
+      // the DRAM each controller holds the streams and buffers in
+      std::vector<int64_t> bytes;
+      // used by the worker of the scheduler only
+      std::unique_ptr<Spmv> spmv;
+
+      SpmvPlan(const DeviceScheduler* _owner, int64_t _planId, std::unique_ptr<Spmv> _spmv);
+
+      public:
+        int64_t id() const {
+          return planId;
+        }
+
+        int rows() const {
+          return n;
+        }
+
+        int cols() const {
+          return m;
+        }
+
+        int64_t numNnzs() const {
+          return nnzs;
+        }
+
+        double estimatedClockCycles() const {
+          return cycles;
+        }
+
+        /** The DRAM of each controller the plan needs while resident */
+        const std::vector<int64_t>& deviceBytes() const {
+          return bytes;
+        }
+    };
+
+    /** Counts of the requests served by a DeviceScheduler, the batches
+     * (multiply() or spmm() calls) that ran them, and the matrices loaded
+     * and evicted */
+    struct SchedulerStats {
+      int64_t requests, batches, loads, evictions;
+    };
+
+    /**
+     * Serves the multiplications of any number of threads on one device.
+     * Requests are queued and run in order by a worker thread, which alone
+     * drives the device: the queued requests of a plan are batched into one
+     * Spmv::spmm(), whose transfers overlap the runs of the design.
+     *
+     * Each plan resident on the device has a region of the DRAM of every
+     * controller, at the same base address on all, so several matrices can
+     * stay resident at once; when a plan does not fit, the least recently
+     * used plans are evicted and reloaded from the host when used again.
+     * The scheduler must be the only user of its device.
+     */
+    class DeviceScheduler {
+      struct Request {
+        std::shared_ptr<const SpmvPlan> plan;
+        Vector x;
+        std::promise<Vector> result;
+      };
+
+      struct Region {
+        int64_t base, size;
+        uint64_t lastUse;
+        std::weak_ptr<const SpmvPlan> plan;
+      };
+
+      runtime::GeneratedSpmvImplementation device;
+      int64_t dramBytes;
+      int maxBatch;
+      std::atomic<int64_t> nextPlanId{0};
+
+      // guards the queue, stopping and the statistics
+      mutable std::mutex m;
+      std::condition_variable queued;
+      std::deque<Request> queue;
+      bool stopping = false;
+
+      SchedulerStats stats{0, 0, 0, 0};
+
+      // of the resident plans, by id; used by the worker only
+      std::map<int64_t, Region> regions;
+      uint64_t useClock = 0;
+      std::thread worker;
+
+      void serve();
+      // runs requests of the same plan, at most maxBatch
+      void runBatch(std::vector<Request*>& batch);
+      // assigns the plan a region of DRAM, evicting others if needed
+      void makeResident(const std::shared_ptr<const SpmvPlan>& plan);
+
+      public:
+        /** Schedules multiplications on the device of impl, each of whose
+         * controllers has dramBytesPerController of DRAM; at most maxBatch
+         * requests are run by one spmm() */
+        DeviceScheduler(const runtime::GeneratedSpmvImplementation& impl, int64_t dramBytesPerController,
+                        int maxBatch = 8);
+
+        /** Serves the queued requests, then stops the worker */
+        ~DeviceScheduler();
+
+        DeviceScheduler(const DeviceScheduler&) = delete;
+        DeviceScheduler& operator=(const DeviceScheduler&) = delete;
+
+        /** Preprocesses a for the device (see Spmv::preprocess()), on the
+         * calling thread; a can be released once this returns. Throws
+         * std::invalid_argument if the plan exceeds the DRAM of the device */
+        std::shared_ptr<const SpmvPlan> plan(const CsrView& a);
+
+        /** Queues y = A x, for the plan of A */
+        std::future<Vector> submit(const std::shared_ptr<const SpmvPlan>& plan, Vector x);
+
+        /** Queues the multiplications of A by each of xs together, so they
+         * are batched */
+        std::vector<std::future<Vector>> submit(const std::shared_ptr<const SpmvPlan>& plan,
+                                                std::vector<Vector> xs);
+
+        SchedulerStats getStats() const;
+    };
+  }
+}
+
+#endif /* end of include guard: DEVICESCHEDULER_HPP_T2K7RM9B */
@@ -0,0 +1,351 @@
+#include "DfeSimulator.hpp"
+#include "Parallel.hpp"
+#include "Trace.hpp"
+#include "Utils.hpp"
+#include "ValueFormat.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace cask::runtime;
+
+namespace {
+
+// of the result streams, as in SpmvManager
+const int burstSizeBytes = 384;
+// cycles from a read of the reduction BRAM to the write of its sum, the
+// floating point latency of SpmvManager
+const int reductionLatency = 16;
+
+// entries, rounded up to whole bursts
+int64_t alignBurst(int64_t entries) {
+  int64_t perBurst = burstSizeBytes / sizeof(double);
+  return (entries + perBurst - 1) / perBurst * perBurst;
+}
+
+std::string pipeError(int pipe, const std::string& what) {
+  return "DfeSimulator: pipe " + std::to_string(pipe) + " " + what;
+}
+
+// a row length of the colptr stream with the top bit set encodes a run of
+// empty rows (see SkipEmptyRowsSpmv)
+const uint32_t emptyRunFlag = 1u << 31;
+
+// the multiply add tree of the kernel: lanes are added pairwise, in place
+double addTree(double* lanes, int n) {
+  while (n > 1) {
+    int half = n / 2;
+    for (int i = 0; i < half; i++)
+      lanes[i] = lanes[2 * i] + lanes[2 * i + 1];
+    if (n % 2 == 1)
+      lanes[half] = lanes[n - 1];
+    n = half + n % 2;
+  }
+  return lanes[0];
+}
+
+// the streams of a pipe, in device DRAM
+struct PipeStreams {
+  const uint32_t* colptr;
+  int64_t colptrEntries;
+  const uint8_t* indptrValues;
+  int64_t indptrValuesBytes;
+  const double* vector;
+  int64_t vectorEntries;
+  double* out;
+  int64_t outEntries;
+  // symmetric designs only: the x of the rows of the pipe, and the reflected
+  // sums, of each column of the vector, which follow the rows in its output
+  const double* rowVector;
+  double* reflected;
+  int64_t reflectedEntries;
+};
+
+// simulates one iteration of a pipe, whose entries hold values of type V
+struct PipeRun {
+  const PipeStreams& s;
+  PipeSimulation& sim;
+  int nPartitions, vectorLoadCycles, cacheSize, inputWidth;
+  bool symmetric;
+
+  template<typename V>
+  void operator()(V) {
+    typedef cask::spmv::packed_entry<V> Entry;
+    const int n = sim.rows;
+    const int64_t inputs = s.indptrValuesBytes / int64_t(sizeof(Entry) * inputWidth);
+    const Entry* entries = reinterpret_cast<const Entry*>(s.indptrValues);
+
+    std::vector<double> cache(cacheSize, 0), bram(n, 0), lanes(inputWidth);
+    std::vector<int64_t> lastWrite(n, -reductionLatency);
+    int64_t colptrPos = 0, input = -1, vectorPos = 0, reductionTick = 0, outputs = 0;
+    int64_t reductionAddress = 0;
+    // the accumulators of the reflected sums of a block, of each lane
+    std::vector<double> reflection(symmetric ? inputWidth * cacheSize : 0, 0);
+    std::vector<int64_t> lastReflection(reflection.size(), -reductionLatency);
+    // the kernel first loads the x of its rows
+    if (symmetric)
+      sim.kernelCycles += n;
+
+    // the reduction kernel: adds the partial sum of a row of block b to
+    // those of the previous blocks; a run of skip empty rows is not written
+    auto reduce = [&](double partial, int skip) {
+      int64_t t = reductionTick++;
+      int64_t address = t == 0 ? 0 : reductionAddress;
+      if (address >= n)
+        throw std::runtime_error(pipeError(sim.pipe, "reduction address " + std::to_string(address) +
+                                           " is past its " + std::to_string(n) + " rows"));
+      double sum = partial;
+      if (t >= n) {
+        if (t - lastWrite[address] < reductionLatency)
+          sim.reductionHazards++;
+        sum += bram[address];
+      }
+      if (skip == 0) {
+        bram[address] = sum;
+        lastWrite[address] = t;
+      }
+      if (sim.expectedReductionCycles - t <= n && outputs < n)
+        s.out[outputs++] = sum;
+      int64_t next = address + (skip == 0 ? 1 : skip);
+      reductionAddress = next == n ? 0 : next;
+    };
+
+    for (int block = 0; block < nPartitions; block++) {
+      // the read control first loads the vector cache of the block
+      for (int k = 0; k < vectorLoadCycles; k++) {
+        if (vectorPos >= s.vectorEntries)
+          throw std::runtime_error(pipeError(sim.pipe, "vector stream ends in block " + std::to_string(block)));
+        cache[k % cacheSize] = s.vector[vectorPos++];
+        sim.kernelCycles++;
+        sim.controlCycles++;
+      }
+
+      int rows = 0, crtPos = 0;
+      uint32_t prevData = 0;
+      while (rows < n) {
+        if (colptrPos >= s.colptrEntries)
+          throw std::runtime_error(pipeError(sim.pipe, "colptr stream ends in block " + std::to_string(block)));
+        // a cycle to pull the length, which is ready the next
+        sim.controlCycles++;
+        uint32_t length = s.colptr[colptrPos++];
+        if (length & emptyRunFlag) {
+          int emptyRows = length & ~emptyRunFlag;
+          if (emptyRows == 0 || rows + emptyRows > n)
+            throw std::runtime_error(pipeError(sim.pipe, "run of " + std::to_string(emptyRows) +
+                                               " empty rows overflows block " + std::to_string(block)));
+          sim.kernelCycles++;
+          sim.controlCycles++;
+          reduce(0, emptyRows);
+          rows += emptyRows;
+          continue;
+        }
+
+        int toread = length - prevData;
+        int rowLength = toread;
+        prevData = length;
+        double accumulated = 0;
+        do {
+          int canread = std::min(inputWidth - crtPos, toread);
+          if (crtPos == 0 && rowLength != 0) {
+            if (++input >= inputs)
+              throw std::runtime_error(pipeError(sim.pipe, "indptr / values stream ends in block " +
+                                                 std::to_string(block)));
+          }
+          std::fill(lanes.begin(), lanes.end(), 0.0);
+          for (int i = crtPos; i < crtPos + canread; i++) {
+            const Entry& e = entries[input * inputWidth + i];
+            uint32_t offset = uint32_t(e.indptr) % cacheSize;
+            double value = V::decode(e.value, 0);
+            lanes[i] = value * cache[offset];
+            if (symmetric) {
+              // the entry (row, column) also adds to the row of its column
+              int64_t a = int64_t(i) * cacheSize + offset;
+              if (sim.kernelCycles - lastReflection[a] < reductionLatency)
+                sim.reflectionHazards++;
+              reflection[a] += value * s.rowVector[rows];
+              lastReflection[a] = sim.kernelCycles;
+            }
+          }
+          accumulated += addTree(lanes.data(), inputWidth);
+          crtPos = crtPos + canread >= inputWidth ? 0 : crtPos + canread;
+          toread -= canread;
+          sim.kernelCycles++;
+          sim.controlCycles++;
+        } while (toread > 0);
+        reduce(accumulated, 0);
+        rows++;
+      }
+
+      // the reflected sums of the block are written after it, while the
+      // next block loads its vector cache
+      if (symmetric) {
+        for (int o = 0; o < cacheSize; o++) {
+          double sum = 0;
+          for (int lane = 0; lane < inputWidth; lane++)
+            sum += reflection[lane * cacheSize + o];
+          s.reflected[int64_t(block) * cacheSize + o] = sum;
+        }
+        std::fill(reflection.begin(), reflection.end(), 0.0);
+      }
+    }
+    // the flush of the last block
+    if (symmetric && nPartitions > 0)
+      sim.kernelCycles += vectorLoadCycles;
+
+    sim.reductionInputs = reductionTick;
+    if (colptrPos != s.colptrEntries || input + 1 != inputs || vectorPos != s.vectorEntries)
+      throw std::runtime_error(pipeError(sim.pipe, "did not read all its streams"));
+    // the padding kernel fills the last burst with zeros
+    std::fill(s.out + n, s.out + s.outEntries, 0.0);
+    if (symmetric)
+      std::fill(s.reflected + int64_t(nPartitions) * cacheSize, s.reflected + s.reflectedEntries, 0.0);
+  }
+};
+
+}
+
+DfeSimulator::DfeSimulator(const GeneratedSpmvImplementation& impl) :
+  numPipes(impl.num_pipes),
+  numControllers(impl.num_controllers),
+  cacheSize(impl.cache_size),
+  inputWidth(impl.input_width),
+  valueFormat(impl.value_format),
+  symmetric(impl.symmetric),
+  dram(impl.num_controllers)
+{
+  if (impl.dram_reduction_enabled)
+    throw std::invalid_argument("DfeSimulator does not model the DRAM reduction");
+  if (impl.value_format == spmv::ValueFormat::Fixed16 || impl.index_bits != 32)
+    throw std::invalid_argument("DfeSimulator: the kernel only supports fp64, fp32 and bf16 values "
+                                "with 32 bit indices");
+  if (numControllers <= 0 || numPipes % numControllers != 0)
+    throw std::invalid_argument("DfeSimulator: numPipes must be a multiple of numControllers");
+}
+
+int DfeSimulator::controller(const int64_t* sizes) const {
+  for (int c = 0; c < numControllers; c++)
+    if (sizes[c] != 0)
+      return c;
+  return 0;
+}
+
+uint8_t* DfeSimulator::region(int ctrl, int64_t address, int64_t size, bool grow) {
+  auto& d = dram[ctrl];
+  if (d.size() < size_t(address + size)) {
+    if (!grow)
+      throw std::runtime_error("DfeSimulator: read of controller " + std::to_string(ctrl) +
+                               " past the data written to it");
+    d.resize(address + size);
+  }
+  return d.data() + address;
+}
+
+void DfeSimulator::write(int64_t sizeBytes, const int64_t* sizes, const int64_t* addresses,
+    const uint8_t* data, const char*) {
+  std::lock_guard<std::mutex> lock(m);
+  int c = controller(sizes);
+  std::memcpy(region(c, addresses[c], sizeBytes, true), data, sizeBytes);
+}
+
+void DfeSimulator::read(int64_t sizeBytes, const int64_t* sizes, const int64_t* addresses,
+    uint8_t* data, const char*) {
+  std::lock_guard<std::mutex> lock(m);
+  int c = controller(sizes);
+  std::memcpy(data, region(c, addresses[c], sizeBytes, true), sizeBytes);
+}
+
+void DfeSimulator::run(int64_t nIterations, int64_t nPartitions, int64_t vectorLoadCycles,
+    const int64_t* colptrAddresses, const int32_t* colptrSizes,
+    const int64_t* indptrValuesAddresses, const int32_t* indptrValuesSizes,
+    const int32_t* nrows, const int64_t* outAddresses,
+    const int32_t* reductionCycles, const int32_t* totalCycles,
+    const int64_t* vectorAddresses) {
+  CASK_TRACE_SCOPE("simulator:run");
+  std::lock_guard<std::mutex> lock(m);
+  int pipesPerController = numPipes / numControllers;
+
+  // the streams are sized first, since outputs may grow the DRAM
+  std::vector<PipeStreams> streams(numPipes);
+  pipes.assign(numPipes, PipeSimulation());
+  for (int p = 0; p < numPipes; p++) {
+    int c = p / pipesPerController;
+    PipeSimulation& sim = pipes[p];
+    sim.pipe = p;
+    sim.controller = c;
+    sim.rows = nrows[p];
+    sim.expectedKernelCycles = totalCycles[p];
+    sim.expectedReductionCycles = reductionCycles[p];
+    int64_t outEntries = cask::utils::ceilDivide(nrows[p] * int(sizeof(double)), burstSizeBytes) *
+      burstSizeBytes / sizeof(double);
+    int64_t vectorEntries = nPartitions * vectorLoadCycles;
+    streams[p].reflectedEntries = symmetric ? alignBurst(vectorEntries) : 0;
+    region(c, outAddresses[p], (outEntries + streams[p].reflectedEntries) * sizeof(double), true);
+    streams[p].outEntries = outEntries;
+  }
+  for (int p = 0; p < numPipes; p++) {
+    int c = p / pipesPerController;
+    PipeStreams& s = streams[p];
+    s.colptrEntries = colptrSizes[p] / sizeof(uint32_t);
+    s.colptr = reinterpret_cast<const uint32_t*>(region(c, colptrAddresses[p], colptrSizes[p], false));
+    s.indptrValuesBytes = indptrValuesSizes[p];
+    s.indptrValues = region(c, indptrValuesAddresses[p], indptrValuesSizes[p], false);
+    s.vectorEntries = nPartitions * vectorLoadCycles;
+    s.vector = reinterpret_cast<const double*>(
+        region(c, vectorAddresses[p], s.vectorEntries * sizeof(double), false));
+    s.out = reinterpret_cast<double*>(region(c, outAddresses[p], s.outEntries * sizeof(double), false));
+    s.rowVector = nullptr;
+    s.reflected = nullptr;
+    if (symmetric) {
+      // the x of the rows follows the burst aligned vector
+      s.rowVector = reinterpret_cast<const double*>(
+          region(c, vectorAddresses[p] + alignBurst(s.vectorEntries) * sizeof(double),
+                 nrows[p] * sizeof(double), false));
+      s.reflected = s.out + s.outEntries;
+    }
+  }
+
+  // each iteration replays the same streams, so one is simulated
+  cask::parallel::ThreadPool::global().run(numPipes, [&](int p) {
+    PipeRun r{streams[p], pipes[p], int(nPartitions), int(vectorLoadCycles), cacheSize, inputWidth, symmetric};
+    spmv::withValueType(valueFormat, r);
+  });
+  runs += nIterations;
+
+  for (const auto& sim : pipes) {
+    if (sim.kernelCycles != sim.expectedKernelCycles)
+      throw std::runtime_error(pipeError(sim.pipe, "issued " + std::to_string(sim.kernelCycles) +
+                                         " kernel cycles, the host expects " +
+                                         std::to_string(sim.expectedKernelCycles)));
+    if (sim.reductionInputs != sim.expectedReductionCycles)
+      throw std::runtime_error(pipeError(sim.pipe, "reduced " + std::to_string(sim.reductionInputs) +
+                                         " partial sums, the host expects " +
+                                         std::to_string(sim.expectedReductionCycles)));
+  }
+}
+
+std::shared_ptr<DfeSimulator> cask::runtime::simulate(GeneratedSpmvImplementation& impl) {
+  std::shared_ptr<DfeSimulator> s = std::make_shared<DfeSimulator>(impl);
+  impl.write = [s](int64_t size, const int64_t* sizes, const int64_t* addresses,
+                   const uint8_t* data, const char* routing) {
+    s->write(size, sizes, addresses, data, routing);
+  };
+  impl.read = [s](int64_t size, const int64_t* sizes, const int64_t* addresses,
+                  uint8_t* data, const char* routing) {
+    s->read(size, sizes, addresses, data, routing);
+  };
+  impl.Spmv = [s](int64_t nIterations, int64_t nPartitions, int64_t vectorLoadCycles,
+                  const int64_t* colptrAddresses, const int32_t* colptrSizes,
+                  const int64_t* indptrValuesAddresses, const int32_t* indptrValuesSizes,
+                  const int32_t* nrows, const int64_t* outAddresses,
+                  const int32_t* reductionCycles, const int32_t* totalCycles,
+                  const int64_t* vectorAddresses) {
+    s->run(nIterations, nPartitions, vectorLoadCycles, colptrAddresses, colptrSizes,
+           indptrValuesAddresses, indptrValuesSizes, nrows, outAddresses,
+           reductionCycles, totalCycles, vectorAddresses);
+  };
+  // the matrix has to be written again to the DRAM of the simulator
+  *impl.residentMatrix = -1;
+  return s;
+}
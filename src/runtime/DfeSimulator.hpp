@@ -0,0 +1,108 @@
+#ifndef DFESIMULATOR_HPP_Q8N2XV6T
+#define DFESIMULATOR_HPP_Q8N2XV6T
+
+#include "GeneratedImplSupport.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cask {
+  namespace runtime {
+
+    /** What the simulator counted for the pipe of a partition, in one
+     * iteration of the last run */
+    struct PipeSimulation {
+      int pipe, controller, rows;
+      // commands issued by the read control, i.e. ticks of the compute
+      // kernel; the device runs the kernel for the totalCycles of the host
+      // model, so the two must match
+      int64_t kernelCycles, expectedKernelCycles;
+      // inputs of the reduction kernel, and the reductionCycles of the host
+      int64_t reductionInputs, expectedReductionCycles;
+      // cycles the read control takes to issue its commands, including the
+      // cycle it waits for each row length it pulls (not in the host model)
+      int64_t controlCycles;
+      // reads of the reduction BRAM less than its write latency after the
+      // write of the same row, which would return a stale sum on the device
+      int64_t reductionHazards;
+      // symmetric designs: updates of a reflected sum accumulator less than
+      // the floating point latency after the previous one of the same lane
+      // and column, which the kernel would have to stall or interleave
+      int64_t reflectionHazards;
+    };
+
+    /**
+     * A functional and cycle level model of the design of
+     * src/spmv/src/SpmvKernel.java and SpmvManager.java, for mock runs
+     * without MaxCompiler: the DRAM of each memory controller holds what the
+     * host writes; a run replays, for each pipe, the commands of
+     * ParallelCsrReadControl over its colptr stream, the reads of the vector
+     * cache and the multiply add tree of the kernel, and the BRAM reduction
+     * of the partial sums of each block, then writes the burst padded result
+     * back to DRAM.
+     *
+     * For symmetric designs, each entry is also multiplied by the x of its
+     * row (loaded after the vector stream) and added to per lane
+     * accumulators of its column, flushed after the rows of each block;
+     * see Spmv::addReflectedSums().
+     *
+     * Runs throw std::runtime_error where the device would stop early or
+     * hang: if the commands or reductions differ from the cycle counts given
+     * by the host, or a stream ends before its consumer. Only the formats the
+     * kernel supports are modelled: Fp64, Fp32 and Bf16 values, 32 bit
+     * indices and the BRAM reduction.
+     */
+    class DfeSimulator {
+      const int numPipes, numControllers, cacheSize, inputWidth;
+      const spmv::ValueFormat valueFormat;
+      const bool symmetric;
+      std::vector<std::vector<uint8_t>> dram;
+      std::vector<PipeSimulation> pipes;
+      int64_t runs = 0;
+      std::mutex m;
+
+      // the controller of a transfer, the one it moves any bytes to or from
+      int controller(const int64_t* sizes) const;
+      uint8_t* region(int ctrl, int64_t address, int64_t size, bool grow);
+
+      public:
+        /** Of the architecture of impl; throws std::invalid_argument for
+         * formats or reductions the kernel does not support */
+        explicit DfeSimulator(const GeneratedSpmvImplementation& impl);
+
+        /** Writes to and reads from device DRAM, as the dramWrite and dramRead
+         * functions of a generated implementation */
+        void write(int64_t sizeBytes, const int64_t* sizes, const int64_t* addresses,
+            const uint8_t* data, const char* routing);
+        void read(int64_t sizeBytes, const int64_t* sizes, const int64_t* addresses,
+            uint8_t* data, const char* routing);
+
+        /** Runs the design, with the arguments of the Spmv function of a
+         * generated implementation; pipes are simulated in parallel */
+        void run(int64_t nIterations, int64_t nPartitions, int64_t vectorLoadCycles,
+            const int64_t* colptrAddresses, const int32_t* colptrSizes,
+            const int64_t* indptrValuesAddresses, const int32_t* indptrValuesSizes,
+            const int32_t* nrows, const int64_t* outAddresses,
+            const int32_t* reductionCycles, const int32_t* totalCycles,
+            const int64_t* vectorAddresses);
+
+        /** Of each pipe, in the last run */
+        const std::vector<PipeSimulation>& lastRun() const {
+          return pipes;
+        }
+
+        int64_t numRuns() const {
+          return runs;
+        }
+    };
+
+    /** Replaces the device functions of impl by those of a new simulator of
+     * its architecture, which is shared by the copies of impl (e.g. the one
+     * of an Spmv built from it) and returned to inspect its runs */
+    std::shared_ptr<DfeSimulator> simulate(GeneratedSpmvImplementation& impl);
+  }
+}
+
+#endif /* end of include guard: DFESIMULATOR_HPP_Q8N2XV6T */
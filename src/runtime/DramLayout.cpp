@@ -0,0 +1,144 @@
+#include "DramLayout.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace cask::spmv;
+
+namespace {
+
+// the first burst aligned address from offset which is in the given bank
+int64_t inBank(int64_t offset, int bank, const DramLayoutOptions& o) {
+  int64_t address = alignAddress(offset);
+  if (o.banks == 1 || address / o.bankBytes % o.banks == bank)
+    return address;
+  int64_t period = o.bankBytes * o.banks;
+  int64_t target = address / period * period + bank * o.bankBytes;
+  if (target < address)
+    target += period;
+  return alignAddress(target);
+}
+
+}
+
+DramLayout cask::spmv::planDramLayout(
+    const std::vector<PartitionStreamSizes>& partitions,
+    int numControllers,
+    int numBuffers,
+    const DramLayoutOptions& o) {
+  if (o.banks < 1 || (o.banks > 1 && o.bankBytes < burst_size_bytes))
+    throw std::invalid_argument("planDramLayout: banks must hold at least a burst");
+
+  DramLayout l;
+  l.partitions.resize(partitions.size());
+  l.writesVector.assign(partitions.size(), !o.shareVector);
+  l.base = alignAddress(o.baseAddress);
+  std::vector<int64_t> offset(numControllers, l.base);
+  // the streams placed so far on each controller, which give their banks
+  std::vector<int> streams(numControllers, 0);
+  auto place = [&](int c, int64_t size) {
+    // empty streams take no bank
+    int64_t address = size == 0 ? alignAddress(offset[c]) : inBank(offset[c], streams[c]++ % o.banks, o);
+    offset[c] = address + alignAddress(size);
+    return address;
+  };
+
+  for (size_t i = 0; i < partitions.size(); i++) {
+    const PartitionStreamSizes& s = partitions[i];
+    int c = s.controller;
+    if (c < 0 || c >= numControllers)
+      throw std::invalid_argument("planDramLayout: partition " + std::to_string(i) + " on controller " +
+          std::to_string(c) + " of " + std::to_string(numControllers));
+    PartitionWriteResult& r = l.partitions[i];
+    r.indptrValuesStartAddress = place(c, s.indptrValues);
+    r.indptrValuesSize = alignAddress(s.indptrValues);
+    r.colptrStartAddress = place(c, s.colptr);
+    r.colptrSize = alignAddress(s.colptr);
+    r.scalesStartAddress = place(c, s.scales);
+    r.scalesSize = alignAddress(s.scales);
+    r.escapesStartAddress = place(c, s.escapes);
+    r.escapesSize = alignAddress(s.escapes);
+  }
+  for (int c = 0; c < numControllers; c++)
+    offset[c] = alignAddress(offset[c]);
+  l.matrixEnd = offset;
+
+  // XXX, it may not be safe to pad the vector arbitrarily, if the hardware
+  // cannot support unpadding it at runtime
+  std::vector<int64_t> sharedSize(numControllers, 0);
+  std::vector<int> first(numControllers, -1);
+  for (size_t i = 0; i < partitions.size(); i++) {
+    int c = partitions[i].controller;
+    sharedSize[c] = std::max(sharedSize[c], alignAddress(partitions[i].vector));
+    if (first[c] == -1)
+      first[c] = i;
+  }
+  for (size_t i = 0; i < partitions.size(); i++) {
+    int c = partitions[i].controller;
+    PartitionWriteResult& r = l.partitions[i];
+    if (o.shareVector) {
+      r.vStartAddress = l.matrixEnd[c];
+      r.vSize = sharedSize[c];
+      l.writesVector[i] = first[c] == int(i);
+    } else {
+      r.vStartAddress = offset[c];
+      r.vSize = alignAddress(partitions[i].vector);
+      offset[c] += numBuffers * r.vSize;
+    }
+  }
+  if (o.shareVector)
+    for (int c = 0; c < numControllers; c++)
+      offset[c] += numBuffers * sharedSize[c];
+
+  for (size_t i = 0; i < partitions.size(); i++) {
+    int c = partitions[i].controller;
+    PartitionWriteResult& r = l.partitions[i];
+    r.outStartAddr = alignAddress(offset[c]);
+    r.outSize = partitions[i].out;
+    offset[c] = r.outStartAddr + numBuffers * r.outSize;
+  }
+  l.end = offset;
+  return l;
+}
+
+int cask::spmv::writeRegion(
+    std::vector<DramPiece> pieces,
+    int64_t begin,
+    int64_t end,
+    int64_t maxWriteBytes,
+    const std::function<void(int64_t, const uint8_t*, int64_t)>& write) {
+  // chunks start on a burst
+  int64_t chunk = std::max<int64_t>(burst_size_bytes, maxWriteBytes / burst_size_bytes * burst_size_bytes);
+  pieces.erase(std::remove_if(pieces.begin(), pieces.end(), [](const DramPiece& p) { return p.size == 0; }),
+               pieces.end());
+  std::sort(pieces.begin(), pieces.end(),
+            [](const DramPiece& a, const DramPiece& b) { return a.address < b.address; });
+  for (size_t k = 0; k < pieces.size(); k++) {
+    if (pieces[k].address < begin || pieces[k].address + pieces[k].size > end)
+      throw std::runtime_error("writeRegion: a piece at " + std::to_string(pieces[k].address) +
+          " is outside the region [" + std::to_string(begin) + ", " + std::to_string(end) + ")");
+    if (k > 0 && pieces[k - 1].address + pieces[k - 1].size > pieces[k].address)
+      throw std::runtime_error("writeRegion: pieces overlap at " + std::to_string(pieces[k].address));
+  }
+
+  std::vector<uint8_t> staged;
+  int writes = 0;
+  size_t firstPiece = 0;
+  for (int64_t start = begin; start < end; start += chunk) {
+    int64_t size = std::min(chunk, end - start);
+    staged.assign(size, 0);
+    for (size_t k = firstPiece; k < pieces.size() && pieces[k].address < start + size; k++) {
+      const DramPiece& p = pieces[k];
+      int64_t from = std::max(p.address, start), to = std::min(p.address + p.size, start + size);
+      if (from < to)
+        std::memcpy(&staged[from - start], p.data + (from - p.address), to - from);
+    }
+    while (firstPiece < pieces.size() && pieces[firstPiece].address + pieces[firstPiece].size <= start + size)
+      firstPiece++;
+    write(start, staged.data(), size);
+    writes++;
+  }
+  return writes;
+}
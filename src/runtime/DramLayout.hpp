@@ -0,0 +1,114 @@
+#ifndef DRAMLAYOUT_HPP_Q8M4XW2C
+#define DRAMLAYOUT_HPP_Q8M4XW2C
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace cask {
+namespace spmv {
+
+/** Device DRAM is read and written in bursts; every stream starts on one */
+const int burst_size_bytes = 384;
+
+inline int64_t alignAddress(int64_t address) {
+  return (address + burst_size_bytes - 1) / burst_size_bytes * burst_size_bytes;
+}
+
+/* Location in device DRAM of the streams of a partition. Several vector and
+ output buffers are reserved: buffer b starts at vStartAddress + b * vSize and
+ outStartAddr + b * outSize respectively. The block scales of Fixed16 values
+ and the escape stream of delta coded indices follow colptr, in this order
+ (their sizes are 0 if not used). */
+struct PartitionWriteResult {
+  int64_t outStartAddr, outSize, colptrStartAddress, colptrSize;
+  int64_t vStartAddress, vSize, indptrValuesStartAddress, indptrValuesSize;
+  int64_t scalesStartAddress, scalesSize, escapesStartAddress, escapesSize;
+
+  int64_t vAddress(int buffer) const {
+    return vStartAddress + buffer * vSize;
+  }
+
+  int64_t outAddress(int buffer) const {
+    return outStartAddr + buffer * outSize;
+  }
+};
+
+/** The unpadded sizes in bytes of the streams of a partition, and of one of
+ * its vector and output buffers */
+struct PartitionStreamSizes {
+  int controller;
+  int64_t indptrValues, colptr, scales, escapes;
+  int64_t vector, out;
+};
+
+/**
+ * Placement of the streams in the DRAM of a controller. The address mapping
+ * of the memory controllers is not known to the runtime, so the streams are
+ * packed by default. For a controller which maps successive rows of
+ * bankBytes to successive banks (the bank bits above the column bits, as is
+ * common for DDR3 / DDR4), banks > 1 starts successive matrix streams in
+ * successive banks, so that the pipes reading them concurrently do not
+ * share one; the cost is up to banks rows of zeros written before each.
+ */
+struct DramLayoutOptions {
+  // all partitions of a controller read one copy of each vector buffer,
+  // which is only possible if the design reads nothing else from them
+  bool shareVector = true;
+  int banks = 1;
+  int64_t bankBytes = 8192;
+  // the regions of all controllers start here (rounded up to a burst), so
+  // that the streams of several matrices can be resident at once
+  int64_t baseAddress = 0;
+};
+
+/**
+ * The addresses of all streams of all partitions, planned before any is
+ * written. In the DRAM of each controller, the matrix streams of its
+ * partitions come first, each burst aligned, so that they can be written
+ * together (see writeRegion()); the vector buffers and the output buffers
+ * follow.
+ */
+struct DramLayout {
+  std::vector<PartitionWriteResult> partitions;
+  // for each controller, the matrix streams are in [base, matrixEnd) and
+  // all its buffers in [base, end)
+  int64_t base;
+  std::vector<int64_t> matrixEnd, end;
+  // whether each partition writes the vector buffers it reads: all do,
+  // unless they share those of their controller, which its first writes
+  std::vector<bool> writesVector;
+};
+
+/** Lays out the streams of partitions, in order, with numBuffers vector and
+ * output buffers each */
+DramLayout planDramLayout(
+    const std::vector<PartitionStreamSizes>& partitions,
+    int numControllers,
+    int numBuffers,
+    const DramLayoutOptions& options = DramLayoutOptions());
+
+/** A piece of a stream to be written to DRAM at address */
+struct DramPiece {
+  int64_t address;
+  const uint8_t* data;
+  int64_t size;
+};
+
+/**
+ * Writes [begin, end) of a DRAM, begin burst aligned, with write(address,
+ * data, size) calls of at most maxWriteBytes each, staged from the pieces,
+ * which must not overlap, and zeros between them; a region of at most
+ * maxWriteBytes is one write. Returns the number of writes.
+ */
+int writeRegion(
+    std::vector<DramPiece> pieces,
+    int64_t begin,
+    int64_t end,
+    int64_t maxWriteBytes,
+    const std::function<void(int64_t, const uint8_t*, int64_t)>& write);
+
+}
+}
+
+#endif /* end of include guard: DRAMLAYOUT_HPP_Q8M4XW2C */
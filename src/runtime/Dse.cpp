@@ -1,8 +1,15 @@
 #include <iostream>
 #include "Dse.hpp"
+#include "DseSearch.hpp"
+#include "ShardedSpmv.hpp"
+#include "MatrixProfile.hpp"
 #include <unordered_map>
 #include "Converters.hpp"
 #include <Utils.hpp>
+#include <Parallel.hpp>
+#include <cmath>
+#include <mutex>
+#include <sstream>
 
 using namespace cask::spmv;
 using namespace cask::utils;
@@ -29,48 +36,379 @@ better(
   return a2;
 }
 
-std::shared_ptr<Spmv> dse_run(
+namespace {
+
+// a point of the design space, ordered as in the parameter range
+struct DsePoint {
+  int cacheSize, inputWidth, numPipes, maxRows, numControllers, indexBits;
+};
+
+DsePoint pointAt(const DesignSpace& space, int64_t point) {
+  return DsePoint{space.value(point, "cacheSize"),
+                  space.value(point, "inputWidth"),
+                  space.value(point, "numPipes"),
+                  space.value(point, "maxRows"),
+                  space.value(point, "numControllers"),
+                  space.value(point, "indexBits")};
+}
+
+// the objectives of the Pareto front: maximum GFlops, minimum resources
+struct Objectives {
+  double gflops, bandwidth;
+  int luts, brams;
+
+  bool dominates(const Objectives& o) const {
+    bool noWorse = gflops >= o.gflops && luts <= o.luts && brams <= o.brams && bandwidth <= o.bandwidth;
+    bool better = gflops > o.gflops || luts < o.luts || brams < o.brams || bandwidth < o.bandwidth;
+    return noWorse && better;
+  }
+};
+
+// the exploration of a matrix, by point of the design space
+struct DseRun {
+  std::shared_ptr<Spmv> best;
+  std::vector<std::shared_ptr<Spmv>> front;
+  std::vector<DsePoint> points;
+  // estimated GFlops of each point, 0 if it does not fit the device or
+  // was not evaluated by the search engine
+  std::vector<double> gflops;
+};
+
+// the exploration of one benchmark matrix, kept until it is reported
+struct MatrixDse {
+  std::stringstream log;
+  // the matrix explored: added in memory to the benchmark, or read from
+  // its path, mapped from its binary cache if it has one
+  std::shared_ptr<const cask::CsrMatrix> owned;
+  std::unique_ptr<cask::io::LoadedMatrix> loaded;
+  cask::CsrView matrix;
+  DseRun run;
+  std::vector<ShardedDesign> sharded;
+  int rows = 0;
+  bool done = false;
+};
+
+}
+
+/** Reports the estimates of the architecture on the reordered matrix, next
+ * to those on the matrix as read */
+void reportReordering(
+    const std::string& basename,
+    const Spmv& best,
+    const cask::CsrView& mat,
+    cask::reordering::Method method,
+    const cask::model::DeviceModel& deviceModel,
+    std::ostream& out)
+{
+  const auto& impl = best.impl;
+  SkipEmptyRowsSpmv spmv(impl.cache_size, impl.input_width, impl.num_pipes, impl.max_rows, impl.num_controllers,
+                         impl.value_format, impl.index_bits);
+  spmv.setCalibration(best.getCalibration());
+  spmv.analyse(mat);
+  double cycles = spmv.getEstimatedClockCycles();
+  double gflops = spmv.getEstimatedGFlops(deviceModel);
+  spmv.setReordering(method);
+  spmv.analyse(mat);
+  out << basename << " Reordering " << cask::reordering::to_string(method)
+      << " EstClockCycles " << cycles << " -> " << spmv.getEstimatedClockCycles()
+      << " EstGflops " << gflops << " -> " << spmv.getEstimatedGFlops(deviceModel) << std::endl;
+}
+
+/** Evaluates the points of the space chosen by the search engine, each
+ * batch in parallel. The reduction through better() is deterministic:
+ * candidates are compared in the order of the space, so the result is the
+ * one of a sequential exploration of the evaluated points. */
+DseRun dse_run(
     std::string basename,
-    ChainedParameterRange<int>& af,
-    const cask::CsrMatrix& mat,
+    const DesignSpace& space,
+    const cask::CsrView& mat,
+    const cask::spmv::MatrixProfile& profile,
     const DseParameters& params,
-    const cask::model::DeviceModel& deviceModel)
+    const cask::model::DeviceModel& deviceModel,
+    std::ostream& out)
 {
-  std::shared_ptr<Spmv> bestArchitecture, a;
-  while (af.hasNext()) {
-    a = std::make_shared<cask::spmv::SkipEmptyRowsSpmv>(af.getParam("cacheSize").value,
-                                           af.getParam("inputWidth").value,
-                                           af.getParam("numPipes").value,
-                                           af.getParam("maxRows").value,
-                                           af.getParam("numControllers").value);
-
-    af.next();
-    auto start = std::chrono::high_resolution_clock::now();
-    if (!a->isValid()) {
-      continue;
-    }
-    if (!(a->getEstimatedHardwareModel(deviceModel, mat.n).ru < deviceModel.maxParams().ru)) {
-      continue;
+  DseRun run;
+  for (int64_t i = 0; i < space.points(); i++)
+    run.points.push_back(pointAt(space, i));
+  const std::vector<DsePoint>& points = run.points;
+  std::vector<std::string> lines(points.size());
+  std::vector<std::shared_ptr<Spmv>> candidates(points.size());
+  std::vector<Objectives> objectives(points.size());
+  run.gflops.assign(points.size(), 0);
+  // shared by all points, most of which differ only in a few parameters
+  BlockingCache cache(mat, profile);
+  std::string cachePath;
+  size_t loaded = 0;
+  if (!params.cacheDirectory.empty()) {
+    cachePath = analysisCachePath(params.cacheDirectory, profile.structureHash);
+    loaded = cache.load(cachePath);
+  }
+
+  auto evaluate = [&](const std::vector<int64_t>& batch) {
+    cask::parallel::ThreadPool::global().run(batch.size(), [&](int k) {
+      int64_t i = batch[k];
+      const DsePoint& p = points[i];
+      std::shared_ptr<Spmv> a = std::make_shared<cask::spmv::SkipEmptyRowsSpmv>(
+          p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+      a->setCalibration(params.calibration);
+
+      if (!a->isValid()) {
+        return;
+      }
+      cask::model::HardwareModel hw = a->getEstimatedHardwareModel(deviceModel, mat.n);
+      if (!(hw.ru < deviceModel.maxParams().ru)) {
+        return;
+      }
+      a->analyse(cache);
+      lines[i] = basename + " " + a->to_string(deviceModel) + " " + hw.to_string();
+      double gflops = a->getEstimatedGFlops(deviceModel);
+      candidates[i] = a;
+      objectives[i] = Objectives{gflops, hw.memoryBandwidth + a->getEscapeBandwidth(deviceModel.frequency()),
+                                 hw.ru.luts, hw.ru.brams};
+      run.gflops[i] = gflops;
+    });
+    std::vector<double> scores;
+    for (int64_t i : batch)
+      scores.push_back(run.gflops[i]);
+    return scores;
+  };
+
+  // without preprocessing: each pipe takes at most input width values per
+  // cycle, and each value needs bytesPerEntry() of memory bandwidth
+  auto bound = [&](int64_t i) {
+    const DsePoint& p = points[i];
+    SkipEmptyRowsSpmv a(p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+    if (!a.isValid())
+      return 0.0;
+    if (!(a.getEstimatedHardwareModel(deviceModel, mat.n).ru < deviceModel.maxParams().ru))
+      return 0.0;
+    double compute = 2.0 * p.numPipes * p.inputWidth * deviceModel.frequency() / 1E9 /
+        params.calibration.cycleScale;
+    double memory = 2.0 * deviceModel.maxParams().memoryBandwidth / a.bytesPerEntry();
+    return std::min(compute, memory);
+  };
+
+  std::vector<int64_t> seeds;
+  for (const auto& s : params.search.seeds)
+    seeds.push_back(space.nearest(s));
+
+  std::unique_ptr<SearchEngine> engine = makeSearchEngine(params.search, cask::parallel::numThreads());
+  engine->search(space, evaluate, bound, seeds);
+
+  if (!cachePath.empty()) {
+    size_t computed = cache.computedPartitions();
+    try {
+      if (computed > 0)
+        cache.save(cachePath);
+    } catch (std::runtime_error& e) {
+      // not an error, the points are analysed again next time
+      std::cerr << "Warning! Could not save analyses: " << e.what() << std::endl;
     }
-    a->preprocess(mat); // do spmv?
-    //dfesnippets::timing::print_clock_diff("Took: ", start);
-    std::cout << basename << " " << a->to_string(deviceModel) << " " << a->getEstimatedHardwareModel(deviceModel, mat.n).to_string() << std::endl;
-    bestArchitecture = better(bestArchitecture, a, deviceModel, mat.n);
+    out << basename << " Analyses cached in " << cachePath << ": " << loaded
+        << " loaded, " << computed << " computed" << std::endl;
   }
 
+  std::shared_ptr<Spmv> bestArchitecture;
+  for (const auto& a : candidates)
+    if (a)
+      bestArchitecture = better(bestArchitecture, a, deviceModel, mat.n);
+
+  for (const auto& l : lines)
+    if (!l.empty())
+      out << l << std::endl;
+
   if (!bestArchitecture)
-    return nullptr;
+    return run;
+  run.best = bestArchitecture;
 
-  std::cout << basename << " ";
+  // of points with the same objectives, only the first is kept
+  for (size_t i = 0; i < points.size(); i++) {
+    if (!candidates[i])
+      continue;
+    bool dominated = false;
+    for (size_t j = 0; j < points.size() && !dominated; j++) {
+      if (!candidates[j] || j == i)
+        continue;
+      const Objectives& a = objectives[j];
+      const Objectives& b = objectives[i];
+      dominated = a.dominates(b) ||
+          (j < i && a.gflops == b.gflops && a.luts == b.luts && a.brams == b.brams && a.bandwidth == b.bandwidth);
+    }
+    if (!dominated)
+      run.front.push_back(candidates[i]);
+  }
+
+  out << basename << " ";
   if (params.gflopsOnly) {
-    std::cout << bestArchitecture->getEstimatedGFlops(deviceModel);
-    std::cout << bestArchitecture->getEstimatedClockCycles();
+    out << bestArchitecture->getEstimatedGFlops(deviceModel);
+    out << bestArchitecture->getEstimatedClockCycles();
   } else {
-    std::cout << bestArchitecture->to_string(deviceModel);
-    std::cout << " " << bestArchitecture->getEstimatedHardwareModel(deviceModel, mat.n).to_string();
+    out << bestArchitecture->to_string(deviceModel);
+    out << " " << bestArchitecture->getEstimatedHardwareModel(deviceModel, mat.n).to_string();
+  }
+  out << " Best " << std::endl;
+  return run;
+}
+
+/** For each number of shards above one, the architecture of highest
+ * estimated GFlops (then of least resources) of the devices the matrix is
+ * split over, each sized for its largest shard; the space is explored by
+ * the search engine, as that of a single device */
+std::vector<ShardedDesign> shardedDesigns(
+    const std::string& basename,
+    const std::string& path,
+    const cask::CsrView& mat,
+    const DseParameters& params,
+    const cask::model::DeviceModel& deviceModel,
+    std::ostream& out)
+{
+  std::vector<ShardedDesign> designs;
+  const Parameter<int>& shards = params.numShards;
+  if (shards.end > 1 && shards.step <= 0)
+    throw std::invalid_argument("Invalid range of parameter " + shards.name);
+  for (int numShards = std::max(2, shards.start); numShards <= shards.end; numShards += shards.step) {
+    std::vector<int> splits = cask::spmv::shardRowSplits(mat, numShards);
+    int rows = 0;
+    for (int s = 0; s < numShards; s++)
+      rows = std::max(rows, splits[s + 1] - splits[s]);
+    int maxRows = cask::utils::ceilDivide(std::max(rows, 1), 512) * 512;
+    DesignSpace space{{
+        params.numPipes,
+        params.inputWidth,
+        params.cacheSize,
+        params.numControllers,
+        Parameter<int>{"maxRows", maxRows, maxRows, 1},
+        params.indexBits
+    }};
+
+    std::vector<double> gflops(space.points(), 0), cycles(space.points(), 0);
+    auto fits = [&](const DsePoint& p) {
+      SkipEmptyRowsSpmv a(p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+      return a.isValid() && a.getEstimatedHardwareModel(deviceModel, rows).ru < deviceModel.maxParams().ru;
+    };
+    auto evaluate = [&](const std::vector<int64_t>& batch) {
+      cask::parallel::ThreadPool::global().run(batch.size(), [&](int k) {
+        DsePoint p = pointAt(space, batch[k]);
+        if (!fits(p))
+          return;
+        std::vector<std::unique_ptr<Spmv>> devices;
+        for (int s = 0; s < numShards; s++) {
+          devices.emplace_back(new SkipEmptyRowsSpmv(
+                p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits));
+          devices.back()->setCalibration(params.calibration);
+        }
+        cask::spmv::ShardedSpmv sharded(std::move(devices));
+        sharded.analyse(mat);
+        gflops[batch[k]] = sharded.getEstimatedGFlops(deviceModel);
+        cycles[batch[k]] = sharded.getEstimatedClockCycles();
+      });
+      std::vector<double> scores;
+      for (int64_t i : batch)
+        scores.push_back(gflops[i]);
+      return scores;
+    };
+    // as that of a single device, for each of the devices
+    auto bound = [&](int64_t i) {
+      DsePoint p = pointAt(space, i);
+      if (!fits(p))
+        return 0.0;
+      SkipEmptyRowsSpmv a(p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+      double compute = 2.0 * p.numPipes * p.inputWidth * deviceModel.frequency() / 1E9 /
+          params.calibration.cycleScale;
+      double memory = 2.0 * deviceModel.maxParams().memoryBandwidth / a.bytesPerEntry();
+      return numShards * std::min(compute, memory);
+    };
+    std::vector<int64_t> seeds;
+    for (const auto& s : params.search.seeds)
+      seeds.push_back(space.nearest(s));
+    makeSearchEngine(params.search, cask::parallel::numThreads())->search(space, evaluate, bound, seeds);
+
+    ShardedDesign best;
+    for (int64_t i = 0; i < space.points(); i++) {
+      if (gflops[i] <= 0)
+        continue;
+      DsePoint p = pointAt(space, i);
+      auto a = std::make_shared<SkipEmptyRowsSpmv>(
+          p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+      a->setCalibration(params.calibration);
+      cask::model::HardwareModel hw = a->getEstimatedHardwareModel(deviceModel, rows);
+      if (!best.architecture || gflops[i] > best.gflops ||
+          (gflops[i] == best.gflops && hw.ru < best.hardwareModel.ru)) {
+        best.architecture = a;
+        best.hardwareModel = hw;
+        best.gflops = gflops[i];
+        best.clockCycles = cycles[i];
+      }
+    }
+    if (!best.architecture)
+      continue;
+    best.matrix = path;
+    best.numShards = numShards;
+    const auto& impl = best.architecture->impl;
+    out << basename << " Shards " << numShards << " " << best.architecture->get_name()
+        << " " << impl.cache_size << " " << impl.input_width << " " << impl.num_pipes
+        << " " << impl.num_controllers << " " << best.clockCycles << " " << best.gflops
+        << " " << best.hardwareModel.to_string() << " BestSharded" << std::endl;
+    designs.push_back(best);
   }
-  std::cout << " Best " << std::endl;
-  return bestArchitecture;
+  return designs;
+}
+
+/** The point of highest geometric mean GFlops over all matrices, among
+ * those which fit the device for the largest matrix */
+FamilyDesign familyDesign(
+    const Benchmark& benchmark,
+    const std::vector<MatrixDse>& explorations,
+    const DseParameters& params,
+    const cask::model::DeviceModel& deviceModel)
+{
+  FamilyDesign family;
+  if (explorations.empty())
+    return family;
+  int largest = 0;
+  for (size_t k = 0; k < explorations.size(); k++)
+    if (explorations[k].rows > explorations[largest].rows)
+      largest = k;
+  const std::vector<DsePoint>& points = explorations[largest].run.points;
+  int n = explorations[largest].rows;
+
+  int bestPoint = -1;
+  double bestLogGflops = 0;
+  for (size_t i = 0; i < points.size(); i++) {
+    double logGflops = 0;
+    bool valid = true;
+    for (const auto& e : explorations) {
+      if (e.run.gflops.size() != points.size() || e.run.gflops[i] <= 0) {
+        valid = false;
+        break;
+      }
+      logGflops += std::log(e.run.gflops[i]);
+    }
+    if (!valid)
+      continue;
+    const DsePoint& p = points[i];
+    SkipEmptyRowsSpmv a(p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+    if (!(a.getEstimatedHardwareModel(deviceModel, n).ru < deviceModel.maxParams().ru))
+      continue;
+    if (bestPoint == -1 || logGflops > bestLogGflops) {
+      bestPoint = i;
+      bestLogGflops = logGflops;
+    }
+  }
+  if (bestPoint == -1)
+    return family;
+
+  const DsePoint& p = points[bestPoint];
+  family.architecture = std::make_shared<SkipEmptyRowsSpmv>(
+      p.cacheSize, p.inputWidth, p.numPipes, p.maxRows, p.numControllers, ValueFormat::Fp64, p.indexBits);
+  family.architecture->setCalibration(params.calibration);
+  family.hardwareModel = family.architecture->getEstimatedHardwareModel(deviceModel, n);
+  family.geomeanGflops = std::exp(bestLogGflops / explorations.size());
+  for (size_t k = 0; k < explorations.size(); k++) {
+    family.matrices.push_back(benchmark.get_matrix_path(k));
+    family.gflops.push_back(explorations[k].run.gflops[bestPoint]);
+  }
+  return family;
 }
 
 std::vector<DseResult> cask::dse::SparkDse::run (
@@ -78,63 +416,124 @@ std::vector<DseResult> cask::dse::SparkDse::run (
     const cask::dse::DseParameters& params,
     const cask::model::DeviceModel& deviceModel)
 {
+  int nMatrices = benchmark.get_benchmark_size();
+  std::vector<MatrixDse> explorations(nMatrices);
+  measured = cask::model::Calibration();
 
-  std::vector<DseResult> bestArchitectures;
+  // the design space of every matrix is explored in parallel, reports are
+  // printed in benchmark order, as soon as all previous matrices are done
+  std::mutex reportMutex;
+  int nextReport = 0;
+  auto report = [&](int i) {
+    MatrixDse& e = explorations[i];
+    std::cout << e.log.str();
+    if (!e.run.best)
+      return;
 
-  for (int i = 0; i < benchmark.get_benchmark_size(); i++) {
+    // do SpmvFor this architecture, to check the results for profiling
+    cask::Vector lhs(e.matrix.n);
+    // reported on the explored device, which the caller keeps (so it is not
+    // owned here)
+    e.run.best->setDeviceModel(std::shared_ptr<const DeviceModel>(
+        std::shared_ptr<const DeviceModel>(), &deviceModel));
+    e.run.best->preprocess(e.matrix);
+    try {
+      auto result = e.run.best->spmv(lhs);
+    } catch (std::exception& ex) {
+      std::cout << "Could not run design " << ex.what() << std::endl;
+      return;
+    }
 
+    const PerformanceReport& r = e.run.best->getPerformanceReport();
+    measured.addRun(r.kernelSeconds, r.runSeconds);
+    for (const auto& c : r.controllers) {
+      measured.addTransfer(c.bytesWritten, c.writeSeconds);
+      measured.addTransfer(c.bytesRead, c.readSeconds);
+    }
+    if (params.reportPerformance) {
+      std::cout << "Performance report " << benchmark.get_matrix_path(i) << std::endl;
+      r.writeJson(std::cout);
+    }
+  };
+
+  cask::parallel::ThreadPool::global().run(nMatrices, [&](int i) {
+    MatrixDse& e = explorations[i];
+    std::ostream& out = e.log;
     std::string path = benchmark.get_matrix_path(i);
 
     std::size_t pos = path.find_last_of("/");
-    std::string basename(path.substr(pos, path.size() - pos));
-    std::cout << basename << std::endl;
+    std::string basename(pos == std::string::npos ? path : path.substr(pos, path.size() - pos));
+    out << basename << std::endl;
 
-    cask::io::MmReader<double> m(path);
     auto start = std::chrono::high_resolution_clock::now();
-    // auto eigenMatrix = cask::converters::tripletToEigen(m.mmreadMatrix(path));
-    CsrMatrix matrix = cask::io::readMatrix(path);
-    dfesnippets::timing::print_clock_diff("Reading took: ", start);
+    e.owned = benchmark.get_matrix(i);
+    if (e.owned) {
+      e.matrix = e.owned->view();
+    } else {
+      e.loaded.reset(new cask::io::LoadedMatrix(path));
+      e.matrix = e.loaded->view();
+    }
+    const CsrView& matrix = e.matrix;
+    out << "Reading took: " << dfesnippets::timing::clock_diff(start) << std::endl;
 
     // XXX this assumes a virtex device with 512 entries per BRAM
     int maxRows = matrix.n;
     if (maxRows % 512 != 0)
       maxRows = (maxRows / 512 + 1) * 512;
 
-    ChainedParameterRange<int> cpr{
+    DesignSpace space{{
         params.numPipes,
         params.inputWidth,
         params.cacheSize,
         params.numControllers,
-        Parameter<int>{"maxRows", maxRows, maxRows, 1}
-    };
+        Parameter<int>{"maxRows", maxRows, maxRows, 1},
+        params.indexBits
+    }};
 
-    std::cout << "File Architecture CacheSize InputWidth NumPipes EstClockCycles EstGflops LUTS FFs DSPs BRAMs MemBandwidth Observation" << std::endl;
-    std::shared_ptr<Spmv> bestOverall = dse_run(basename, cpr, matrix, params, deviceModel);
+    out << "File Architecture CacheSize InputWidth NumPipes EstClockCycles EstGflops LUTS FFs DSPs BRAMs MemBandwidth Observation" << std::endl;
+    cask::spmv::MatrixProfile profile(matrix);
+    e.run = dse_run(basename, space, matrix, profile, params, deviceModel, out);
+    e.sharded = shardedDesigns(basename, path, matrix, params, deviceModel, out);
+    e.rows = matrix.n;
+    std::shared_ptr<Spmv> bestOverall = e.run.best;
 
-    if (!bestOverall)
-      continue;
-
-    std::cout  << basename << " ";
-    if (params.gflopsOnly) {
-      std::cout << bestOverall->getEstimatedGFlops(deviceModel);
-      std::cout << bestOverall->getEstimatedClockCycles();
-    } else {
-      std::cout << bestOverall->to_string(deviceModel);
-      std::cout << " "  << bestOverall->getEstimatedHardwareModel(deviceModel, matrix.n).to_string();
+    if (bestOverall) {
+      out  << basename << " ";
+      if (params.gflopsOnly) {
+        out << bestOverall->getEstimatedGFlops(deviceModel);
+        out << bestOverall->getEstimatedClockCycles();
+      } else {
+        out << bestOverall->to_string(deviceModel);
+        out << " "  << bestOverall->getEstimatedHardwareModel(deviceModel, matrix.n).to_string();
+      }
+      out << " BestOverall " << std::endl;
+      out << "Matrix: " << basename << " Best architecture: " << bestOverall->to_string(deviceModel) << " "  << bestOverall->getEstimatedHardwareModel(deviceModel, matrix.n).to_string() << std::endl;
+      if (params.reordering != cask::reordering::Method::None)
+        reportReordering(basename, *bestOverall, matrix, params.reordering, deviceModel, out);
     }
-    std::cout << " BestOverall " << std::endl;
-    std::cout << "Matrix: " << basename << " Best architecture: " << bestOverall->to_string(deviceModel) << " "  << bestOverall->getEstimatedHardwareModel(deviceModel, matrix.n).to_string() << std::endl;
 
-    // do SpmvFor this architecture, to check the results for profiling
-    cask::Vector lhs(matrix.n);
-    bestOverall->preprocess(matrix);
-    try {
-      auto result = bestOverall->spmv(lhs);
-    } catch (std::exception& e) {
-      std::cout << "Could not run design " << e.what() << std::endl;
+    std::lock_guard<std::mutex> lock(reportMutex);
+    e.done = true;
+    while (nextReport < nMatrices && explorations[nextReport].done) {
+      report(nextReport);
+      explorations[nextReport].owned.reset();
+      explorations[nextReport].loaded.reset();
+      explorations[nextReport].matrix = CsrView();
+      nextReport++;
     }
-    bestArchitectures.push_back(DseResult{path, bestOverall});
-  }
+  });
+
+  family = familyDesign(benchmark, explorations, params, deviceModel);
+  sharded.clear();
+  for (const auto& e : explorations)
+    sharded.insert(sharded.end(), e.sharded.begin(), e.sharded.end());
 
+  std::vector<DseResult> bestArchitectures;
+  for (int i = 0; i < nMatrices; i++) {
+    if (!explorations[i].run.best)
+      continue;
+    bestArchitectures.push_back(DseResult{benchmark.get_matrix_path(i), explorations[i].run.best});
+    bestArchitectures.back().paretoFront = explorations[i].run.front;
+  }
   return bestArchitectures;
 }
@@ -3,6 +3,7 @@
 
 #include <memory>
 #include "Spmv.hpp"
+#include "DseSearch.hpp"
 #include "Utils.hpp"
 #include "IO.hpp"
 #include <chrono>
@@ -12,9 +13,12 @@
 namespace cask {
   namespace dse {
 
-    // a benchmark to use for the DSE
+    // a benchmark to use for the DSE: paths of .mtx files, which are read
+    // when explored, or matrices already in memory
     class Benchmark {
       std::vector<std::string> paths;
+      // null for the matrices read from their path
+      std::vector<std::shared_ptr<const CsrMatrix>> matrices;
       public:
         std::string get_matrix_path(int id) const {
           if (id < paths.size())
@@ -24,8 +28,24 @@ namespace cask {
           throw std::invalid_argument(ss.str());
         }
 
+        /** The matrix added in memory, null if it is read from its path */
+        std::shared_ptr<const CsrMatrix> get_matrix(int id) const {
+          get_matrix_path(id);
+          return matrices[id];
+        }
+
         void add_matrix_path(std::string path) {
           paths.push_back(path);
+          matrices.push_back(nullptr);
+        }
+
+        /** Explores the matrix as is, e.g. one built by a client of the
+         * library; name stands for its path in the results */
+        void add_matrix(std::string name, std::shared_ptr<const CsrMatrix> matrix) {
+          if (!matrix)
+            throw std::invalid_argument("Benchmark::add_matrix no matrix for " + name);
+          paths.push_back(name);
+          matrices.push_back(matrix);
         }
 
         int get_benchmark_size() const {
@@ -49,6 +69,26 @@ namespace cask {
         cask::utils::Parameter<> inputWidth{"inputWidth", 1, 3, 1};
         cask::utils::Parameter<> cacheSize{"cacheSize", 1024, 2048, 1024};
         cask::utils::Parameter<> numControllers{"numControllers", 1, 6, 1};
+        // bits of the column offsets of the matrix stream, see IndexCoding;
+        // narrower offsets save bandwidth for extra decode logic, but only
+        // the simulator reads them so far
+        cask::utils::Parameter<> indexBits{"indexBits", 32, 32, 1};
+        // devices a matrix is split over; the designs of more than one shard
+        // are explored after those of a single device
+        cask::utils::Parameter<> numShards{"numShards", 1, 1, 1};
+        // if set, the best architecture of each matrix is also analysed on
+        // the reordered matrix, to report the gain of the reordering
+        cask::reordering::Method reordering = cask::reordering::Method::None;
+        // applied to the estimates of all architectures
+        cask::model::Calibration calibration;
+        // if set, the performance report of the run of the best architecture
+        // of each matrix is printed
+        bool reportPerformance = false;
+        // how the design space is explored, exhaustively by default
+        SearchParameters search;
+        // if set, the analyses of each matrix are saved in this directory
+        // and reused by later explorations of the same matrix structure
+        std::string cacheDirectory;
     };
 
     inline std::ostream& operator<<(std::ostream& s, DseParameters& d) {
@@ -57,6 +97,18 @@ namespace cask {
       s << "  inputWidth = " << d.inputWidth << std::endl;
       s << "  cacheSize  = " << d.cacheSize << std::endl;
       s << "  numControllers  = " << d.numControllers << std::endl;
+      if (d.indexBits.start != 32 || d.indexBits.end != 32)
+        s << "  indexBits  = " << d.indexBits << std::endl;
+      if (d.numShards.end > 1)
+        s << "  numShards  = " << d.numShards << std::endl;
+      if (d.reordering != cask::reordering::Method::None)
+        s << "  reordering = " << cask::reordering::to_string(d.reordering) << std::endl;
+      if (d.search.engine != "exhaustive")
+        s << "  search = " << d.search.engine << std::endl;
+      if (!d.cacheDirectory.empty())
+        s << "  cacheDirectory = " << d.cacheDirectory << std::endl;
+      if (d.calibration.cycleScale != 1.0)
+        s << "  cycleScale = " << d.calibration.cycleScale << std::endl;
       s << ")" << std::endl;
       return s;
     }
@@ -65,6 +117,9 @@ namespace cask {
       public:
         std::shared_ptr<cask::spmv::Spmv> bestArchitecture;
         std::vector<std::string> matrices;
+        // the architectures not dominated by another in estimated GFlops,
+        // LUTs, BRAMs and memory bandwidth, in the order of the design space
+        std::vector<std::shared_ptr<cask::spmv::Spmv>> paretoFront;
 
         DseResult(std::string path, std::shared_ptr<cask::spmv::Spmv> arch) {
           matrices.push_back(path);
@@ -75,7 +130,32 @@ namespace cask {
         }
     };
 
+    /** The single architecture of highest geometric mean estimated GFlops
+     * over all matrices of a benchmark, sized for its largest matrix */
+    struct FamilyDesign {
+      // not analysed: it has estimates for each matrix, below
+      std::shared_ptr<cask::spmv::Spmv> architecture;
+      cask::model::HardwareModel hardwareModel{cask::model::LogicResourceUsage{}, 0};
+      double geomeanGflops = 0;
+      std::vector<std::string> matrices;
+      std::vector<double> gflops;
+    };
+
+    /** The best architecture of each device of a matrix split in shards (see
+     * spmv::ShardedSpmv), all devices having the same architecture */
+    struct ShardedDesign {
+      std::string matrix;
+      int numShards = 0;
+      // sized for the largest shard, not analysed
+      std::shared_ptr<cask::spmv::Spmv> architecture;
+      cask::model::HardwareModel hardwareModel{cask::model::LogicResourceUsage{}, 0};
+      double gflops = 0, clockCycles = 0;
+    };
+
     class SparkDse {
+      cask::model::Calibration measured;
+      FamilyDesign family;
+      std::vector<ShardedDesign> sharded;
       public:
         SparkDse() {}
         // returns the best architecture
@@ -83,6 +163,24 @@ namespace cask {
             const Benchmark& benchmark,
             const DseParameters& dseParams,
             const cask::model::DeviceModel& deviceModel);
+
+        /** Of the benchmark of the last call to run(); its architecture is
+         * null if no point of the design space fits all matrices */
+        const FamilyDesign& getFamilyDesign() const {
+          return family;
+        }
+
+        /** Of the matrices of the last call to run(), by matrix then number
+         * of shards, for the numShards above one which fit the device */
+        const std::vector<ShardedDesign>& getShardedDesigns() const {
+          return sharded;
+        }
+
+        /** Fitted to the runs of the best architectures of the last call to
+         * run(), to calibrate the estimates of later explorations */
+        const cask::model::Calibration& getMeasuredCalibration() const {
+          return measured;
+        }
     };
   }
 }
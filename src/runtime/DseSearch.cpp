@@ -0,0 +1,225 @@
+#include "DseSearch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace cask::dse;
+
+namespace {
+
+// the scores of the points evaluated so far; each point is evaluated once
+class Evaluations {
+  const Evaluator& evaluate;
+  std::unordered_map<int64_t, double> scores;
+
+ public:
+  explicit Evaluations(const Evaluator& _evaluate) : evaluate(_evaluate) {}
+
+  // the scores of the points, evaluating those not seen before in one batch
+  std::vector<double> operator()(const std::vector<int64_t>& points) {
+    std::vector<int64_t> batch;
+    for (int64_t p : points)
+      if (!scores.count(p) && std::find(batch.begin(), batch.end(), p) == batch.end())
+        batch.push_back(p);
+    if (!batch.empty()) {
+      std::vector<double> s = evaluate(batch);
+      for (size_t i = 0; i < batch.size(); i++)
+        scores[batch[i]] = s[i];
+    }
+    std::vector<double> result;
+    for (int64_t p : points)
+      result.push_back(scores[p]);
+    return result;
+  }
+
+  double operator()(int64_t point) {
+    return (*this)(std::vector<int64_t>{point})[0];
+  }
+
+  int64_t count() const {
+    return scores.size();
+  }
+};
+
+// the best seed, or the centre of the space if there is none
+int64_t startingPoint(const DesignSpace& space, Evaluations& evaluations,
+    const std::vector<int64_t>& seeds) {
+  if (seeds.empty()) {
+    std::vector<int> centre;
+    for (int d = 0; d < space.dimensions(); d++)
+      centre.push_back(space.size(d) / 2);
+    return space.index(centre);
+  }
+  std::vector<double> scores = evaluations(seeds);
+  return seeds[std::max_element(scores.begin(), scores.end()) - scores.begin()];
+}
+
+}
+
+DesignSpace::DesignSpace(std::vector<cask::utils::Parameter<int>> dimensions) : dims(dimensions) {
+  for (const auto& p : dims) {
+    if (p.step <= 0 || p.end < p.start)
+      throw std::invalid_argument("Invalid range of parameter " + p.name);
+    sizes.push_back((p.end - p.start) / p.step + 1);
+  }
+}
+
+int64_t DesignSpace::points() const {
+  int64_t n = 1;
+  for (int s : sizes)
+    n *= s;
+  return n;
+}
+
+int DesignSpace::value(int64_t point, const std::string& name) const {
+  std::vector<int> c = coordinates(point);
+  for (int d = 0; d < dimensions(); d++)
+    if (dims[d].name == name)
+      return value(d, c[d]);
+  throw std::invalid_argument("Param not found " + name);
+}
+
+int64_t DesignSpace::index(const std::vector<int>& coordinates) const {
+  int64_t point = 0;
+  for (int d = dimensions() - 1; d >= 0; d--) {
+    if (coordinates[d] < 0 || coordinates[d] >= sizes[d])
+      throw std::invalid_argument("Point outside of the range of parameter " + dims[d].name);
+    point = point * sizes[d] + coordinates[d];
+  }
+  return point;
+}
+
+std::vector<int> DesignSpace::coordinates(int64_t point) const {
+  std::vector<int> c(dimensions());
+  for (int d = 0; d < dimensions(); d++) {
+    c[d] = point % sizes[d];
+    point /= sizes[d];
+  }
+  return c;
+}
+
+int64_t DesignSpace::nearest(const std::map<std::string, int>& values) const {
+  std::vector<int> c(dimensions(), 0);
+  for (int d = 0; d < dimensions(); d++) {
+    auto v = values.find(dims[d].name);
+    if (v == values.end())
+      continue;
+    double i = std::round(double(v->second - dims[d].start) / dims[d].step);
+    c[d] = std::max(0, std::min(sizes[d] - 1, int(i)));
+  }
+  return index(c);
+}
+
+void ExhaustiveSearch::search(const DesignSpace& space, const Evaluator& evaluate,
+    const ScoreBound&, const std::vector<int64_t>&) {
+  std::vector<int64_t> all(space.points());
+  std::iota(all.begin(), all.end(), 0);
+  evaluate(all);
+}
+
+void BranchAndBoundSearch::search(const DesignSpace& space, const Evaluator& evaluate,
+    const ScoreBound& bound, const std::vector<int64_t>&) {
+  std::vector<std::pair<double, int64_t>> order;
+  for (int64_t p = 0; p < space.points(); p++) {
+    double b = bound(p);
+    if (b > 0)
+      order.emplace_back(-b, p);
+  }
+  // by decreasing bound, then in the order of the space
+  std::sort(order.begin(), order.end());
+
+  double best = 0;
+  for (size_t first = 0; first < order.size(); first += batchSize) {
+    // no point of this batch, or any later one, can do better
+    if (-order[first].first < best)
+      break;
+    std::vector<int64_t> batch;
+    for (size_t i = first; i < std::min(order.size(), first + batchSize); i++)
+      batch.push_back(order[i].second);
+    for (double s : evaluate(batch))
+      best = std::max(best, s);
+  }
+}
+
+void CoordinateDescentSearch::search(const DesignSpace& space, const Evaluator& evaluate,
+    const ScoreBound&, const std::vector<int64_t>& seeds) {
+  Evaluations evaluations(evaluate);
+  int64_t current = startingPoint(space, evaluations, seeds);
+  double score = evaluations(current);
+  bool improved = true;
+  while (improved && evaluations.count() < budget) {
+    improved = false;
+    for (int d = 0; d < space.dimensions() && evaluations.count() < budget; d++) {
+      std::vector<int> c = space.coordinates(current);
+      std::vector<int64_t> line;
+      for (int i = 0; i < space.size(d); i++) {
+        c[d] = i;
+        line.push_back(space.index(c));
+      }
+      std::vector<double> scores = evaluations(line);
+      for (size_t i = 0; i < line.size(); i++) {
+        if (scores[i] > score) {
+          score = scores[i];
+          current = line[i];
+          improved = true;
+        }
+      }
+    }
+  }
+}
+
+void AnnealingSearch::search(const DesignSpace& space, const Evaluator& evaluate,
+    const ScoreBound&, const std::vector<int64_t>& seeds) {
+  Evaluations evaluations(evaluate);
+  std::mt19937 rng(randomSeed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  int64_t current = startingPoint(space, evaluations, seeds);
+  double score = evaluations(current);
+  // invalid starting points are left for any valid neighbour
+  double initialTemperature = std::max(score, 1.0) * 0.1;
+  int steps = std::max(1, budget / std::max(1, batchSize));
+  for (int step = 0; step < steps && evaluations.count() < budget; step++) {
+    double temperature = initialTemperature * std::pow(1E-3, double(step) / steps);
+    std::vector<int64_t> neighbours;
+    for (int k = 0; k < batchSize; k++) {
+      std::vector<int> c = space.coordinates(current);
+      int d = std::uniform_int_distribution<int>(0, space.dimensions() - 1)(rng);
+      if (space.size(d) == 1)
+        continue;
+      int move = uniform(rng) < 0.5 ? -1 : 1;
+      if (c[d] + move < 0 || c[d] + move >= space.size(d))
+        move = -move;
+      c[d] += move;
+      neighbours.push_back(space.index(c));
+    }
+    if (neighbours.empty())
+      break;
+    std::vector<double> scores = evaluations(neighbours);
+    size_t best = std::max_element(scores.begin(), scores.end()) - scores.begin();
+    if (scores[best] <= 0)
+      continue;
+    double delta = scores[best] - score;
+    if (score <= 0 || delta >= 0 || uniform(rng) < std::exp(delta / temperature)) {
+      current = neighbours[best];
+      score = scores[best];
+    }
+  }
+}
+
+std::unique_ptr<SearchEngine> cask::dse::makeSearchEngine(const SearchParameters& params, int batchSize) {
+  batchSize = std::max(1, batchSize);
+  if (params.engine == "exhaustive")
+    return std::unique_ptr<SearchEngine>(new ExhaustiveSearch());
+  if (params.engine == "branch-and-bound")
+    return std::unique_ptr<SearchEngine>(new BranchAndBoundSearch(batchSize));
+  if (params.engine == "coordinate-descent")
+    return std::unique_ptr<SearchEngine>(new CoordinateDescentSearch(params.budget));
+  if (params.engine == "annealing")
+    return std::unique_ptr<SearchEngine>(new AnnealingSearch(params.budget, batchSize, params.randomSeed));
+  throw std::invalid_argument("Unknown search engine " + params.engine);
+}
@@ -0,0 +1,153 @@
+#ifndef DSESEARCH_HPP_P7W3NQ2Z
+#define DSESEARCH_HPP_P7W3NQ2Z
+
+#include "Utils.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cask {
+  namespace dse {
+
+    /** The grid of values of a set of design parameters. A point is
+     * identified by its index, in the order of ChainedParameterRange (the
+     * first parameter varies fastest), or by the index of its value in each
+     * dimension. Unlike ChainedParameterRange, the last point is included. */
+    class DesignSpace {
+      std::vector<cask::utils::Parameter<int>> dims;
+      std::vector<int> sizes;
+
+      public:
+        explicit DesignSpace(std::vector<cask::utils::Parameter<int>> dimensions);
+
+        int dimensions() const {
+          return dims.size();
+        }
+
+        /** The number of values of dimension d */
+        int size(int d) const {
+          return sizes[d];
+        }
+
+        int64_t points() const;
+
+        const std::string& name(int d) const {
+          return dims[d].name;
+        }
+
+        int value(int d, int i) const {
+          return dims[d].start + i * dims[d].step;
+        }
+
+        /** The value of the named parameter at a point */
+        int value(int64_t point, const std::string& name) const;
+
+        int64_t index(const std::vector<int>& coordinates) const;
+        std::vector<int> coordinates(int64_t point) const;
+
+        /** The point nearest the given values of (some of) the parameters,
+         * by name; other parameters take their first value */
+        int64_t nearest(const std::map<std::string, int>& values) const;
+    };
+
+    /** Evaluates a batch of points, which may be done in parallel, and
+     * returns the score of each (estimated GFlops); points which are not
+     * valid designs score 0. */
+    typedef std::function<std::vector<double>(const std::vector<int64_t>&)> Evaluator;
+
+    /** An upper bound of the score of a point, found without evaluating it;
+     * 0 if the point is known not to be valid */
+    typedef std::function<double(int64_t)> ScoreBound;
+
+    struct SearchParameters {
+      // exhaustive, branch-and-bound, coordinate-descent or annealing
+      std::string engine = "exhaustive";
+      // maximum number of points evaluated by coordinate descent and annealing
+      int budget = 256;
+      unsigned randomSeed = 1;
+      // starting points, e.g. the best architectures of a previous run, as
+      // values of the parameters by name
+      std::vector<std::map<std::string, int>> seeds;
+    };
+
+    /** Explores a design space, choosing which points to evaluate */
+    class SearchEngine {
+      public:
+        virtual ~SearchEngine() {}
+        virtual std::string name() const = 0;
+
+        /** Evaluates the points of the space the engine selects; the best
+         * design is that of highest score among the evaluated points. seeds
+         * are points to start from, if the engine uses any. */
+        virtual void search(
+            const DesignSpace& space,
+            const Evaluator& evaluate,
+            const ScoreBound& bound,
+            const std::vector<int64_t>& seeds) = 0;
+    };
+
+    /** Evaluates every point, in a single batch */
+    class ExhaustiveSearch : public SearchEngine {
+      public:
+        std::string name() const override {
+          return "exhaustive";
+        }
+        void search(const DesignSpace& space, const Evaluator& evaluate,
+            const ScoreBound& bound, const std::vector<int64_t>& seeds) override;
+    };
+
+    /** Evaluates points by decreasing bound, in batches, until no remaining
+     * point can beat the best score; finds the best design of the
+     * exhaustive search when the bound is valid */
+    class BranchAndBoundSearch : public SearchEngine {
+      int batchSize;
+      public:
+        explicit BranchAndBoundSearch(int _batchSize) : batchSize(_batchSize) {}
+        std::string name() const override {
+          return "branch-and-bound";
+        }
+        void search(const DesignSpace& space, const Evaluator& evaluate,
+            const ScoreBound& bound, const std::vector<int64_t>& seeds) override;
+    };
+
+    /** From the best seed (or the centre of the space), evaluates all values
+     * of one parameter at a time, moving to the best, until no parameter
+     * improves the score or the budget is spent */
+    class CoordinateDescentSearch : public SearchEngine {
+      int budget;
+      public:
+        explicit CoordinateDescentSearch(int _budget) : budget(_budget) {}
+        std::string name() const override {
+          return "coordinate-descent";
+        }
+        void search(const DesignSpace& space, const Evaluator& evaluate,
+            const ScoreBound& bound, const std::vector<int64_t>& seeds) override;
+    };
+
+    /** Simulated annealing from the best seed (or the centre of the space):
+     * batches of neighbours, one step away in one parameter, are evaluated
+     * and the best is accepted by the Metropolis criterion, under a
+     * geometrically cooled temperature; deterministic for a random seed */
+    class AnnealingSearch : public SearchEngine {
+      int budget, batchSize;
+      unsigned randomSeed;
+      public:
+        AnnealingSearch(int _budget, int _batchSize, unsigned _randomSeed) :
+          budget(_budget), batchSize(_batchSize), randomSeed(_randomSeed) {}
+        std::string name() const override {
+          return "annealing";
+        }
+        void search(const DesignSpace& space, const Evaluator& evaluate,
+            const ScoreBound& bound, const std::vector<int64_t>& seeds) override;
+    };
+
+    /** The engine of the parameters; batches are of batchSize points */
+    std::unique_ptr<SearchEngine> makeSearchEngine(const SearchParameters& params, int batchSize);
+  }
+}
+
+#endif /* end of include guard: DSESEARCH_HPP_P7W3NQ2Z */
@@ -0,0 +1,138 @@
+#include "FormatTuner.hpp"
+#include "CpuSpmv.hpp"
+#include "MatrixProfile.hpp"
+#include "Parallel.hpp"
+#include "Trace.hpp"
+
+#include <dfesnippets/Timing.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+using namespace cask::cpu;
+
+std::string cask::cpu::to_string(Format f) {
+  switch (f) {
+    case Format::Csr:
+      return "csr";
+    case Format::BlockedCsr:
+      return "blocked_csr";
+    case Format::Sell:
+      return "sell";
+  }
+  throw std::invalid_argument("Unknown CPU format");
+}
+
+MatrixFeatures cask::cpu::matrixFeatures(const CsrView& a) {
+  return matrixFeatures(spmv::MatrixProfile(a));
+}
+
+MatrixFeatures cask::cpu::matrixFeatures(const spmv::MatrixProfile& p) {
+  MatrixFeatures f{p.n, p.m, p.nnzs, 0, 0, 0, 0, 0, 0};
+  if (p.n == 0)
+    return f;
+  f.maxRowLength = p.maxRowLength;
+  f.bandwidth = p.bandwidth();
+  f.meanRowLength = p.meanRowLength();
+  f.rowLengthVariance = std::max(0.0, p.rowLengthSquares / p.n - f.meanRowLength * f.meanRowLength);
+  f.emptyRowFraction = double(p.emptyRows) / p.n;
+  int64_t nonEmpty = p.n - p.emptyRows;
+  if (nonEmpty > 0) {
+    double mean = double(p.nnzs) / nonEmpty;
+    double variance = std::max(0.0, p.rowLengthSquares / nonEmpty - mean * mean);
+    f.nonEmptyRowVariation = std::sqrt(variance) / mean;
+  }
+  return f;
+}
+
+TunedSpmv::TunedSpmv(const CsrView& a, const FormatChoice& c, int blockSize, int sellSigma) :
+  choice(c), csr(a) {
+  if (c.format == Format::BlockedCsr)
+    blocked.reset(new BlockedCsrMatrix(a, blockSize));
+  else if (c.format == Format::Sell)
+    sell.reset(new SellMatrix(a, sellChunkHeight(), sellSigma));
+}
+
+void TunedSpmv::multiply(const double* x, double* y) const {
+  parallel::ThreadLimit limit(choice.threads);
+  switch (choice.format) {
+    case Format::Csr:
+      cpu::spmv(csr, x, y);
+      break;
+    case Format::BlockedCsr:
+      blockedSpmv(*blocked, x, y);
+      break;
+    case Format::Sell:
+      sellSpmv(*sell, x, y);
+      break;
+  }
+}
+
+cask::Vector TunedSpmv::spmv(const Vector& x) const {
+  if (x.size() != csr.m)
+    throw std::invalid_argument("TunedSpmv vector length " + std::to_string(x.size()) +
+                                " != matrix columns " + std::to_string(csr.m));
+  Vector y(csr.n);
+  multiply(x.data.data(), y.data.data());
+  return y;
+}
+
+std::vector<FormatChoice> FormatTuner::candidates(const MatrixFeatures& f) const {
+  std::vector<Format> formats{Format::Csr};
+  if (f.nonEmptyRowVariation <= maxSellVariation)
+    formats.push_back(Format::Sell);
+  if (int64_t(f.m) * int64_t(sizeof(double)) > cacheBytes && f.bandwidth > blockSize)
+    formats.push_back(Format::BlockedCsr);
+
+  // the kernels are serial below minParallelNnzs; otherwise halve the
+  // threads, as memory bandwidth may saturate before all cores are used
+  std::vector<int> threads{parallel::numThreads()};
+  if (f.nnzs < minParallelNnzs)
+    threads = {1};
+  else
+    while (threads.back() > 1 && threads.size() < 3)
+      threads.push_back(threads.back() / 2);
+
+  std::vector<FormatChoice> result;
+  for (Format format : formats)
+    for (int t : threads)
+      result.push_back(FormatChoice{format, t, 0});
+  return result;
+}
+
+FormatChoice FormatTuner::choose(const CsrView& a) {
+  return choose(a, spmv::MatrixProfile(a));
+}
+
+FormatChoice FormatTuner::choose(const CsrView& a, const spmv::MatrixProfile& profile) {
+  uint64_t key = profile.structureHash;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    auto it = choices.find(key);
+    if (it != choices.end())
+      return it->second;
+  }
+
+  CASK_TRACE_SCOPE("tuner:choose");
+  std::vector<double> x(a.m, 1.0), y(a.n);
+  FormatChoice best{Format::Csr, 1, 0};
+  bool found = false;
+  for (FormatChoice c : candidates(matrixFeatures(profile))) {
+    TunedSpmv s(a, c, blockSize, sellSigma);
+    s.multiply(x.data(), y.data());
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < trialMultiplications; i++)
+      s.multiply(x.data(), y.data());
+    c.seconds = dfesnippets::timing::clock_diff(start) / std::max(1, trialMultiplications);
+    if (!found || c.seconds < best.seconds) {
+      best = c;
+      found = true;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m);
+  choices[key] = best;
+  return best;
+}
@@ -0,0 +1,130 @@
+#ifndef FORMATTUNER_HPP_T6M1QF8C
+#define FORMATTUNER_HPP_T6M1QF8C
+
+#include "SparseMatrix.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cask {
+  namespace spmv {
+    struct MatrixProfile;
+  }
+
+  namespace cpu {
+
+    /** The storage formats of the CPU kernels */
+    enum class Format { Csr, BlockedCsr, Sell };
+
+    std::string to_string(Format f);
+
+    /** Structural features of a matrix, derived from its spmv::MatrixProfile
+     * (see src/frontend/sparsegrind.py for the offline equivalents) */
+    struct MatrixFeatures {
+      int n, m;
+      int64_t nnzs;
+      double meanRowLength;
+      double rowLengthVariance;
+      int maxRowLength;
+      // the variation (standard deviation over mean) of the lengths of the
+      // non empty rows
+      double nonEmptyRowVariation;
+      double emptyRowFraction;
+      // max |i - j| over the nonzeros
+      int bandwidth;
+    };
+
+    MatrixFeatures matrixFeatures(const CsrView& a);
+
+    /** The features of a matrix of the given profile */
+    MatrixFeatures matrixFeatures(const spmv::MatrixProfile& p);
+
+    /** A format and number of threads for the SpMV of a matrix, and the
+     * time per multiplication of its trial (0 if it was not timed) */
+    struct FormatChoice {
+      Format format;
+      int threads;
+      double seconds;
+    };
+
+    /**
+     * y = A * x on the CPU, in the format and with the number of threads of
+     * a FormatChoice. The matrix is converted once, on construction; CSR
+     * multiplies the matrix in place, which must then outlive the executor.
+     */
+    class TunedSpmv {
+      FormatChoice choice;
+      CsrView csr;
+      std::unique_ptr<BlockedCsrMatrix> blocked;
+      std::unique_ptr<SellMatrix> sell;
+
+      public:
+        TunedSpmv(const CsrView& a, const FormatChoice& c, int blockSize, int sellSigma);
+
+        void multiply(const double* x, double* y) const;
+
+        Vector spmv(const Vector& x) const;
+
+        const FormatChoice& getChoice() const {
+          return choice;
+        }
+    };
+
+    /**
+     * Chooses the fastest CPU format and number of threads for the SpMV of a
+     * matrix. The features of the matrix rule out the formats that cannot
+     * pay off:
+     * - SELL-C-sigma, if the non empty rows vary too much in length, as the
+     *   padding of chunks would outweigh the SIMD lanes;
+     * - blocked CSR, if x fits in cache or the matrix is banded within
+     *   a block, as the blocks then only add passes over y;
+     * - more threads than one, below the size at which the kernels run
+     *   serially anyway.
+     * The remaining candidates are timed over a few multiplications. As the
+     * time depends on the structure only, choices are cached per structure
+     * (see spmv::structureHash()).
+     */
+    class FormatTuner {
+      std::mutex m;
+      std::unordered_map<uint64_t, FormatChoice> choices;
+
+      public:
+        // columns of a block of blocked CSR: x of a block fits in L2
+        int blockSize = 1 << 15;
+        // blocked CSR is only tried if x exceeds this many bytes
+        int64_t cacheBytes = int64_t(32) << 20;
+        int sellSigma = 256;
+        double maxSellVariation = 1.5;
+        // timed multiplications of each candidate, after one warmup
+        int trialMultiplications = 5;
+
+        /** The candidates left by the features of a matrix, in order of
+         * preference on ties */
+        std::vector<FormatChoice> candidates(const MatrixFeatures& f) const;
+
+        /** The fastest candidate, timed on a, or the cached choice for its
+         * structure */
+        FormatChoice choose(const CsrView& a);
+
+        /** As above, for a matrix whose profile is known, which saves the
+         * pass over it */
+        FormatChoice choose(const CsrView& a, const spmv::MatrixProfile& profile);
+
+        /** An executor in the chosen format; a must outlive it */
+        TunedSpmv tune(const CsrView& a) {
+          return TunedSpmv(a, choose(a), blockSize, sellSigma);
+        }
+
+        int cachedChoices() {
+          std::lock_guard<std::mutex> lock(m);
+          return choices.size();
+        }
+    };
+  }
+}
+
+#endif /* end of include guard: FORMATTUNER_HPP_T6M1QF8C */
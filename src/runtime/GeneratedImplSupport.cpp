@@ -0,0 +1,48 @@
+#include "GeneratedImplSupport.hpp"
+#include "BlockingCache.hpp"
+#include "MatrixProfile.hpp"
+#include "Spmv.hpp"
+
+using namespace cask::runtime;
+
+GeneratedSpmvImplementation* SpmvImplementationLoader::fastestFor(const CsrView& mat) {
+  return fastestFor(mat, spmv::MatrixProfile(mat));
+}
+
+GeneratedSpmvImplementation* SpmvImplementationLoader::fastestFor(
+    const CsrView& mat,
+    const spmv::MatrixProfile& profile) {
+  uint64_t key = profile.structureHash;
+  {
+    std::lock_guard<std::mutex> lock(m);
+    auto it = fastest.find(key);
+    if (it != fastest.end())
+      return it->second;
+  }
+
+  // implementations of the same cache size share the blocked structure
+  spmv::BlockingCache cache(mat, profile);
+  GeneratedSpmvImplementation* best = nullptr;
+  double bestGflops = 0;
+  // row passes also transfer the vector once per pass, which the cycle
+  // model ignores, so they are only used if no implementation holds the rows
+  for (bool passes : {false, true}) {
+    for (GeneratedSpmvImplementation* impl : impls) {
+      if (!passes && impl->max_rows < mat.n)
+        continue;
+      spmv::Spmv s(*impl);
+      s.analyse(cache);
+      double gflops = s.getEstimatedGFlops(s.getDeviceModel());
+      if (!best || gflops > bestGflops || (gflops == bestGflops && impl->max_rows < best->max_rows)) {
+        best = impl;
+        bestGflops = gflops;
+      }
+    }
+    if (best)
+      break;
+  }
+
+  std::lock_guard<std::mutex> lock(m);
+  fastest[key] = best;
+  return best;
+}
@@ -6,6 +6,11 @@
 #include <iostream>
 #include <climits>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "ValueFormat.hpp"
 
 /**
  * This module captures device implementation aspects:
@@ -24,6 +29,12 @@
  *   based on the propoerties of the input matrix or other user input.
  */
 namespace cask {
+  class CsrView;
+
+  namespace spmv {
+    struct MatrixProfile;
+  }
+
   namespace runtime {
 
     /* Stubs for SpMV device functions (run/read/write). Used to enable parts
@@ -56,9 +67,23 @@ namespace cask {
 
       public:
       const int id, max_rows, num_pipes, cache_size, input_width, dram_reduction_enabled, num_controllers;
+      // format of the matrix values in the indptr / values stream
+      const spmv::ValueFormat value_format;
+      // bits per column index in the indptr / values stream, see IndexCoding
+      const int index_bits;
+      // the design multiplies the lower triangle of a symmetric matrix,
+      // adding each entry to both its row and its column (see
+      // spmv::Partition::firstRow)
+      const bool symmetric;
       std::function<SpmvFunctionT> Spmv;
+      // transfers (write / read) on different memory controllers may be
+      // issued concurrently, from different threads
       std::function<SpmvDramWriteFunctionT> write;
       std::function<SpmvDramReadFunctionT> read;
+      /** Identifies the matrix whose streams are stored in device DRAM (-1 if
+       * none); shared by all copies of this implementation, since they drive
+       * the same device. */
+      std::shared_ptr<int64_t> residentMatrix;
       GeneratedSpmvImplementation(
           int _id,
           SpmvFunctionT _fptr,
@@ -69,7 +94,10 @@ namespace cask {
           int _cache_size,
           int _input_width,
           int _dram_reduction_enabled,
-          int _num_controllers
+          int _num_controllers,
+          spmv::ValueFormat _value_format = spmv::ValueFormat::Fp64,
+          int _index_bits = 32,
+          bool _symmetric = false
           ) :
         id(_id),
         Spmv(_fptr),
@@ -80,7 +108,11 @@ namespace cask {
         cache_size(_cache_size),
         input_width(_input_width),
         dram_reduction_enabled(_dram_reduction_enabled),
-        num_controllers(_num_controllers)
+        num_controllers(_num_controllers),
+        value_format(_value_format),
+        index_bits(_index_bits),
+        symmetric(_symmetric),
+        residentMatrix(std::make_shared<int64_t>(-1))
       {}
 
       bool operator==(const GeneratedSpmvImplementation& other) const {
@@ -90,7 +122,10 @@ namespace cask {
           cache_size == other.cache_size &&
           input_width == other.input_width &&
           dram_reduction_enabled == other.dram_reduction_enabled &&
-          num_controllers == other.num_controllers;
+          num_controllers == other.num_controllers &&
+          value_format == other.value_format &&
+          index_bits == other.index_bits &&
+          symmetric == other.symmetric;
       }
     };
 
@@ -99,10 +134,17 @@ namespace cask {
     class SpmvImplementationLoader {
 
       std::vector<GeneratedSpmvImplementation*> impls;
+      std::mutex m;
+      // the choices of fastestFor(), by structure of the matrix
+      std::unordered_map<uint64_t, GeneratedSpmvImplementation*> fastest;
 
       public:
+      // loads the generated implementations
       SpmvImplementationLoader();
 
+      explicit SpmvImplementationLoader(std::vector<GeneratedSpmvImplementation*> _impls) :
+        impls(_impls) {}
+
       /**
        * Load the generated spmv implementation which supports the given number
        * of rows. If more exist, picks the one with smallest maxRows.
@@ -117,6 +159,21 @@ namespace cask {
         return  bestArch;
       }
 
+      /**
+       * Of the implementations which support the rows of mat, the one of
+       * highest estimated GFlops on it, by the cycle model of
+       * Spmv::analyse(); of equally fast ones, that with smallest maxRows.
+       * If none supports the rows, the fastest in several row passes (see
+       * Spmv::numRowPasses()). The choice is remembered for matrices of the
+       * same structure (see spmv::structureHash()). Returns nullptr only
+       * without implementations.
+       */
+      GeneratedSpmvImplementation* fastestFor(const CsrView& mat);
+
+      /** As above, for a matrix whose profile is known, which saves hashing
+       * it */
+      GeneratedSpmvImplementation* fastestFor(const CsrView& mat, const spmv::MatrixProfile& profile);
+
       GeneratedSpmvImplementation* architectureWithId(int id) {
         return static_cast<GeneratedSpmvImplementation*>(this->impls.at(id));
       }
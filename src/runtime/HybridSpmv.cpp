@@ -0,0 +1,170 @@
+#include "HybridSpmv.hpp"
+#include "CpuSpmv.hpp"
+#include "Parallel.hpp"
+#include "Trace.hpp"
+
+#include <dfesnippets/Timing.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+using namespace cask::spmv;
+
+std::vector<int> cask::spmv::costliestRows(const std::vector<int64_t>& rowCycles, double cpuFraction) {
+  std::vector<int> order(rowCycles.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return rowCycles[a] > rowCycles[b];
+  });
+  int64_t total = std::accumulate(rowCycles.begin(), rowCycles.end(), int64_t(0));
+  double target = cpuFraction * total;
+  std::vector<int> rows;
+  int64_t taken = 0;
+  for (int r : order) {
+    if (taken >= target)
+      break;
+    rows.push_back(r);
+    taken += rowCycles[r];
+  }
+  std::sort(rows.begin(), rows.end());
+  return rows;
+}
+
+double cask::spmv::stallingFraction(const std::vector<int64_t>& rowCycles, int numPipes) {
+  int64_t total = std::accumulate(rowCycles.begin(), rowCycles.end(), int64_t(0));
+  if (total == 0)
+    return 0;
+  int64_t stalling = 0;
+  for (int64_t c : rowCycles)
+    if (c * numPipes > total)
+      stalling += c;
+  return double(stalling) / total;
+}
+
+double cask::spmv::balancedCpuFraction(double f, double deviceSeconds, double cpuSeconds) {
+  if (f <= 0 || f >= 1)
+    return f;
+  // the time each part would take for the whole matrix
+  double device = deviceSeconds / (1 - f), cpu = cpuSeconds / f;
+  if (device + cpu <= 0)
+    return f;
+  return device / (device + cpu);
+}
+
+HybridSpmv::HybridSpmv(const runtime::GeneratedSpmvImplementation& impl) :
+  device(new Spmv(impl)) {}
+
+HybridSpmv::HybridSpmv(std::unique_ptr<Spmv> _device) : device(std::move(_device)) {
+  if (!device)
+    throw std::invalid_argument("HybridSpmv requires a device");
+}
+
+void HybridSpmv::setCpuFraction(double f) {
+  cpuFraction = autoTune ? std::max(minFraction, std::min(maxFraction, f)) : std::max(0.0, std::min(1.0, f));
+  if (!rowCycles.empty())
+    split();
+}
+
+void HybridSpmv::setAutoTune(bool enabled, int interval, double _minFraction, double _maxFraction) {
+  if (interval < 1 || _minFraction < 0 || _maxFraction > 1 || _minFraction > _maxFraction)
+    throw std::invalid_argument("Invalid auto tuning parameters of HybridSpmv");
+  autoTune = enabled;
+  tuneInterval = interval;
+  minFraction = _minFraction;
+  maxFraction = _maxFraction;
+  tunedMultiplications = 0;
+  tunedDeviceSeconds = tunedCpuSeconds = 0;
+}
+
+void HybridSpmv::preprocess(const CsrView& mat) {
+  matrix = mat;
+  rowCycles = device->estimateRowCycles(mat);
+  if (cpuFraction < 0) {
+    double f = stallingFraction(rowCycles, device->impl.num_pipes);
+    cpuFraction = autoTune ? std::max(minFraction, std::min(maxFraction, f)) : f;
+  }
+  tunedMultiplications = 0;
+  tunedDeviceSeconds = tunedCpuSeconds = 0;
+  split();
+}
+
+void HybridSpmv::split() {
+  CASK_TRACE_SCOPE("hybrid:split");
+  cpuRows = costliestRows(rowCycles, cpuFraction);
+  std::vector<char> onCpu(matrix.n, 0);
+  for (int r : cpuRows)
+    onCpu[r] = 1;
+
+  deviceMatrix = CsrMatrix();
+  deviceMatrix.n = matrix.n;
+  deviceMatrix.m = matrix.m;
+  cpuMatrix = CsrMatrix();
+  cpuMatrix.n = cpuRows.size();
+  cpuMatrix.m = matrix.m;
+  deviceMatrix.row_ptr.push_back(0);
+  cpuMatrix.row_ptr.push_back(0);
+  for (int i = 0; i < matrix.n; i++) {
+    CsrMatrix& part = onCpu[i] ? cpuMatrix : deviceMatrix;
+    for (int k = matrix.row_ptr[i]; k < matrix.row_ptr[i + 1]; k++) {
+      part.col_ind.push_back(matrix.col_ind[k]);
+      part.values.push_back(matrix.values[k]);
+    }
+    part.row_ptr.push_back(part.values.size());
+    if (onCpu[i])
+      deviceMatrix.row_ptr.push_back(deviceMatrix.values.size());
+  }
+  deviceMatrix.nnzs = deviceMatrix.values.size();
+  cpuMatrix.nnzs = cpuMatrix.values.size();
+  cpuResult.assign(cpuRows.size(), 0);
+  device->preprocess(deviceMatrix);
+}
+
+cask::Vector HybridSpmv::spmv(const Vector& v) {
+  if (int(v.size()) != matrix.m)
+    throw std::invalid_argument("Vector size does not match the number of matrix columns");
+  Vector y(matrix.n);
+  multiply(v.data.data(), y.data.data());
+  return y;
+}
+
+void HybridSpmv::multiply(const double* x, double* y) {
+  CASK_TRACE_SCOPE("hybrid:multiply");
+  if (rowCycles.empty() && matrix.n > 0)
+    throw std::runtime_error("HybridSpmv::multiply called before preprocess");
+  cask::parallel::ThreadPool::global().run(2, [&](int part) {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (part == 0) {
+      device->multiply(x, y);
+      deviceSeconds = dfesnippets::timing::clock_diff(start);
+    } else {
+      if (!cpuRows.empty())
+        cpu::spmv(cpuMatrix, x, cpuResult.data());
+      cpuSeconds = dfesnippets::timing::clock_diff(start);
+    }
+  });
+  // the CPU rows are empty on the device
+  for (size_t i = 0; i < cpuRows.size(); i++)
+    y[cpuRows[i]] = cpuResult[i];
+
+  if (autoTune) {
+    tunedDeviceSeconds += deviceSeconds;
+    tunedCpuSeconds += cpuSeconds;
+    if (++tunedMultiplications >= tuneInterval)
+      tune();
+  }
+}
+
+void HybridSpmv::tune() {
+  double balanced = balancedCpuFraction(cpuFraction, tunedDeviceSeconds, tunedCpuSeconds);
+  tunedMultiplications = 0;
+  tunedDeviceSeconds = tunedCpuSeconds = 0;
+  // halfway, as the times are noisy and not quite proportional to the cycles
+  double f = std::max(minFraction, std::min(maxFraction, (cpuFraction + balanced) / 2));
+  if (std::abs(f - cpuFraction) > tolerance) {
+    cpuFraction = f;
+    split();
+  }
+}
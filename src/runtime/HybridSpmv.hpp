@@ -0,0 +1,126 @@
+#ifndef HYBRIDSPMV_HPP_K3R8VW5N
+#define HYBRIDSPMV_HPP_K3R8VW5N
+
+#include "Spmv.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace cask {
+  namespace spmv {
+
+    /** The rows of highest estimated cycles, until they hold at least
+     * cpuFraction of the cycles of all rows (none if it is 0), in increasing
+     * order; ties are broken by row */
+    std::vector<int> costliestRows(const std::vector<int64_t>& rowCycles, double cpuFraction);
+
+    /** The share of the estimated cycles in rows longer than the balanced
+     * partition of a pipe (total / numPipes): these stall one pipe, however
+     * the rows are partitioned */
+    double stallingFraction(const std::vector<int64_t>& rowCycles, int numPipes);
+
+    /** The CPU fraction at which both parts would take the same time, given
+     * the times measured with a CPU fraction of f, assuming the time of each
+     * part is proportional to its share of the estimated cycles */
+    double balancedCpuFraction(double f, double deviceSeconds, double cpuSeconds);
+
+    /**
+     * An SpMV run concurrently on a DFE and on the CPU: the rows of highest
+     * estimated cycles (see Spmv::estimateRowCycles()), which would stall
+     * the pipes of the device, are multiplied by the multithreaded CPU kernel
+     * while the device multiplies the others.
+     *
+     * With auto tuning, the times of both parts are measured by each
+     * multiplication, and every tuneInterval multiplications the CPU share
+     * is moved towards the one where both finish together (see
+     * balancedCpuFraction()); the device matrix is then rebuilt, so
+     * iterative solvers converge to a balanced split over their iterations.
+     *
+     * The preprocessed matrix must outlive the executor.
+     */
+    class HybridSpmv {
+      std::unique_ptr<Spmv> device;
+      CsrView matrix;
+      std::vector<int64_t> rowCycles;
+      // of the estimated cycles of the matrix, on the CPU; negative until
+      // the first preprocess(), which then starts from the stalling rows
+      double cpuFraction = -1;
+      double minFraction = 0.01, maxFraction = 0.9;
+      bool autoTune = true;
+      int tuneInterval = 10;
+      double tolerance = 0.02;
+
+      std::vector<int> cpuRows;
+      // the matrix without the CPU rows, which are left empty
+      CsrMatrix deviceMatrix;
+      // the CPU rows only
+      CsrMatrix cpuMatrix;
+      std::vector<double> cpuResult;
+
+      // of the last multiplication, and summed since the last tuning
+      double deviceSeconds = 0, cpuSeconds = 0;
+      double tunedDeviceSeconds = 0, tunedCpuSeconds = 0;
+      int tunedMultiplications = 0;
+
+      // splits the matrix at the current fraction and preprocesses the device
+      void split();
+      void tune();
+
+      public:
+        explicit HybridSpmv(const runtime::GeneratedSpmvImplementation& impl);
+
+        /** e.g. a model of an architecture */
+        explicit HybridSpmv(std::unique_ptr<Spmv> _device);
+
+        Spmv& getDevice() {
+          return *device;
+        }
+
+        /** Fixes the CPU share before preprocess(), or splits the
+         * preprocessed matrix again; clamped to the bounds of auto tuning,
+         * if it is enabled */
+        void setCpuFraction(double f);
+
+        double getCpuFraction() const {
+          return cpuFraction;
+        }
+
+        /** Tunes the CPU fraction every interval multiplications, within
+         * [minFraction, maxFraction] (enabled by default); minFraction should
+         * be above 0, or the time of the CPU can not be measured once no row
+         * is left to it */
+        void setAutoTune(bool enabled, int interval = 10,
+            double _minFraction = 0.01, double _maxFraction = 0.9);
+
+        /** Estimates the row cycles of mat on the device, moves the costliest
+         * rows to the CPU and preprocesses the others on the device */
+        void preprocess(const CsrView& mat);
+
+        Vector spmv(const Vector& v);
+
+        /** y = A * x, as Spmv::multiply(); the device and the CPU run
+         * concurrently, each on its own rows */
+        void multiply(const double* x, double* y);
+
+        /** The rows multiplied on the CPU, in increasing order */
+        const std::vector<int>& getCpuRows() const {
+          return cpuRows;
+        }
+
+        const CsrMatrix& getDeviceMatrix() const {
+          return deviceMatrix;
+        }
+
+        /** Measured by the last multiplication */
+        double getDeviceSeconds() const {
+          return deviceSeconds;
+        }
+
+        double getCpuSeconds() const {
+          return cpuSeconds;
+        }
+    };
+  }
+}
+
+#endif /* end of include guard: HYBRIDSPMV_HPP_K3R8VW5N */
@@ -0,0 +1,572 @@
+#include "IO.hpp"
+#include "Parallel.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cask::io;
+
+MappedFile::MappedFile(const std::string& path) : path(path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::invalid_argument("File not found " + path);
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw std::runtime_error("Could not stat " + path + ": " + std::strerror(errno));
+  }
+  fileSize = st.st_size;
+  if (fileSize != 0) {
+    void* p = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("Could not map " + path + ": " + std::strerror(errno));
+    }
+    // the file is scanned front to back, by several threads at a time
+    ::madvise(p, fileSize, MADV_SEQUENTIAL | MADV_WILLNEED);
+    addr = static_cast<const char*>(p);
+  }
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (addr)
+    ::munmap(const_cast<char*>(addr), fileSize);
+}
+
+namespace {
+
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// a cursor over [pos, end) of the mapped file; all parse functions consume
+// the token and the whitespace preceding it
+struct Scanner {
+  const char* pos;
+  const char* end;
+
+  bool skipSpace() {
+    while (pos != end && isSpace(*pos))
+      pos++;
+    return pos != end;
+  }
+
+  int64_t parseInt64() {
+    if (!skipSpace())
+      throw std::invalid_argument("Unexpected end of file");
+    bool neg = *pos == '-';
+    if (neg || *pos == '+')
+      pos++;
+    if (pos == end || *pos < '0' || *pos > '9')
+      throw std::invalid_argument("Expecting integer index in MatrixMarket file");
+    int64_t v = 0;
+    while (pos != end && *pos >= '0' && *pos <= '9') {
+      if (v > (std::numeric_limits<int64_t>::max() - 9) / 10)
+        throw std::invalid_argument("Integer out of range in MatrixMarket file");
+      v = v * 10 + (*pos++ - '0');
+    }
+    return neg ? -v : v;
+  }
+
+  int parseInt() {
+    int64_t v = parseInt64();
+    if (v > std::numeric_limits<int>::max() || v < std::numeric_limits<int>::min())
+      throw std::invalid_argument("Index " + std::to_string(v) + " out of range in MatrixMarket file");
+    return int(v);
+  }
+
+  double parseDouble() {
+    if (!skipSpace())
+      throw std::invalid_argument("Unexpected end of file");
+    const char* start = pos;
+
+    // Fast path (Clinger): a decimal with up to 19 significant digits whose
+    // mantissa fits exactly in a double and with a small power of ten can be
+    // converted with one correctly rounded multiplication or division, so the
+    // result is identical to strtod
+    static const double powers[] = {
+      1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    bool neg = *pos == '-';
+    if (neg || *pos == '+')
+      pos++;
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false;
+    while (pos != end && *pos >= '0' && *pos <= '9') {
+      if (mantissa != 0 || *pos != '0')
+        digits++;
+      mantissa = mantissa * 10 + (*pos++ - '0');
+      any = true;
+    }
+    if (pos != end && *pos == '.') {
+      pos++;
+      while (pos != end && *pos >= '0' && *pos <= '9') {
+        if (mantissa != 0 || *pos != '0')
+          digits++;
+        mantissa = mantissa * 10 + (*pos++ - '0');
+        exp10--;
+        any = true;
+      }
+    }
+    if (any && pos != end && (*pos == 'e' || *pos == 'E')) {
+      const char* expStart = pos++;
+      bool expNeg = pos != end && *pos == '-';
+      if (pos != end && (*pos == '-' || *pos == '+'))
+        pos++;
+      int e = 0;
+      bool expAny = false;
+      while (pos != end && *pos >= '0' && *pos <= '9') {
+        if (e < 100000)
+          e = e * 10 + (*pos - '0');
+        pos++;
+        expAny = true;
+      }
+      if (!expAny)
+        pos = expStart;
+      else
+        exp10 += expNeg ? -e : e;
+    }
+
+    if (any && (pos == end || isSpace(*pos)) && digits <= 19 &&
+        mantissa <= (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+      double v = static_cast<double>(mantissa);
+      v = exp10 < 0 ? v / powers[-exp10] : v * powers[exp10];
+      return neg ? -v : v;
+    }
+
+    // slow path; copy the token since the mapping is not null terminated
+    pos = start;
+    while (pos != end && !isSpace(*pos))
+      pos++;
+    std::string token(start, pos);
+    char* tokenEnd;
+    double v = std::strtod(token.c_str(), &tokenEnd);
+    if (tokenEnd != token.c_str() + token.size())
+      throw std::invalid_argument("Could not parse value " + token + " in MatrixMarket file");
+    return v;
+  }
+};
+
+// the (row, column) order of the entries of a chunk, as row * m + column
+struct ChunkOrder {
+  bool sorted;
+  // of the first and last entries, -1 if the chunk has none
+  int64_t first, last;
+};
+
+// Splits the body of the file into chunks which start at the beginning of a
+// line; returns nChunks + 1 boundaries
+std::vector<const char*> splitLines(const char* begin, const char* end, int nChunks) {
+  std::vector<const char*> bounds{begin};
+  int64_t size = end - begin;
+  for (int c = 1; c < nChunks; c++) {
+    const char* p = std::max(begin + size * c / nChunks, bounds.back());
+    while (p != end && *p != '\n')
+      p++;
+    bounds.push_back(p == end ? end : p + 1);
+  }
+  bounds.push_back(end);
+  return bounds;
+}
+
+}
+
+cask::CsrMatrix cask::io::readCsrMatrix(const std::string& path, bool expandSymmetric) {
+  MmInfo info = readHeader(path);
+  if (!info.isMatrix() || !info.isCoordinate())
+    throw std::invalid_argument("Error! Expecting MatrixMarket coordinate matrix in " + path);
+  bool symmetric = info.isSymmetric() && expandSymmetric;
+
+  MappedFile file{path};
+  const char* end = file.data() + file.size();
+
+  // skip the header and comments
+  const char* p = file.data();
+  while (p != end && *p == '%') {
+    while (p != end && *p != '\n')
+      p++;
+    if (p != end)
+      p++;
+  }
+  Scanner header{p, end};
+  int n = header.parseInt();
+  int m = header.parseInt();
+  int64_t l = header.parseInt64();
+  while (header.pos != end && *header.pos != '\n')
+    header.pos++;
+  if (n < 0 || m < 0 || l < 0)
+    throw std::invalid_argument("Negative size in the header of " + path);
+  // the mirrored entry (j, i) of (i, j) must be a valid entry too
+  if (symmetric && n != m)
+    throw std::invalid_argument("Symmetric matrix " + path + " is not square: " + std::to_string(n) +
+                                " x " + std::to_string(m));
+
+  int nThreads = parallel::numThreads();
+  // don't bother splitting small files
+  int nChunks = std::max<int64_t>(1, std::min<int64_t>(nThreads, (end - header.pos) / (1 << 20)));
+  std::vector<const char*> bounds = splitLines(header.pos, end, nChunks);
+
+  // Pass 1: parse entries, counting nonzeros per row; each chunk also checks
+  // whether its entries are in strictly increasing (row, column) order
+  std::unique_ptr<std::atomic<int>[]> counts(new std::atomic<int>[n + 1]);
+  for (int i = 0; i <= n; i++)
+    counts[i].store(0, std::memory_order_relaxed);
+  std::vector<int64_t> entriesPerChunk(nChunks, 0);
+  std::vector<ChunkOrder> order(nChunks);
+
+  cask::parallel::ThreadPool::global().run(nChunks, [&](int c) {
+    Scanner s{bounds[c], bounds[c + 1]};
+    int64_t entries = 0;
+    ChunkOrder& o = order[c];
+    o.sorted = true;
+    o.first = o.last = -1;
+    while (s.skipSpace()) {
+      int i = s.parseInt();
+      int j = s.parseInt();
+      s.parseDouble();
+      if (i < 1 || i > n || j < 1 || j > m)
+        throw std::invalid_argument("Entry (" + std::to_string(i) + ", " + std::to_string(j) +
+                                    ") out of range in " + path);
+      counts[i - 1].fetch_add(1, std::memory_order_relaxed);
+      if (symmetric && i != j)
+        counts[j - 1].fetch_add(1, std::memory_order_relaxed);
+      int64_t key = int64_t(i - 1) * m + (j - 1);
+      o.sorted = o.sorted && key > o.last;
+      if (o.first == -1)
+        o.first = key;
+      o.last = key;
+      entries++;
+    }
+    entriesPerChunk[c] = entries;
+  });
+
+  int64_t entries = 0;
+  for (auto e : entriesPerChunk)
+    entries += e;
+  if (entries != l)
+    throw std::invalid_argument("File " + path + " has " + std::to_string(entries) +
+                                " entries, expecting " + std::to_string(l));
+
+  // a sorted file without entries to mirror is already in CSR order, with no
+  // duplicates: each chunk copies its entries to a contiguous range
+  bool sorted = !symmetric;
+  int64_t last = -1;
+  for (const ChunkOrder& o : order) {
+    if (o.first == -1)
+      continue;
+    sorted = sorted && o.sorted && o.first > last;
+    last = o.last;
+  }
+
+  std::vector<int> row_ptr(n + 1);
+  int64_t nnzs = 0;
+  for (int i = 0; i < n; i++) {
+    row_ptr[i] = nnzs;
+    nnzs += counts[i].load(std::memory_order_relaxed);
+    // reuse the counters as scatter cursors
+    counts[i].store(row_ptr[i], std::memory_order_relaxed);
+  }
+  row_ptr[n] = nnzs;
+  if (nnzs > std::numeric_limits<int>::max())
+    throw std::invalid_argument("Matrix " + path + " has too many nonzeros for 32 bit indices");
+
+  std::vector<int> col_ind(nnzs);
+  std::vector<double> values(nnzs);
+  if (sorted) {
+    counts.reset();
+    std::vector<int64_t> chunkStart(nChunks, 0);
+    for (int c = 1; c < nChunks; c++)
+      chunkStart[c] = chunkStart[c - 1] + entriesPerChunk[c - 1];
+    cask::parallel::ThreadPool::global().run(nChunks, [&](int c) {
+      Scanner s{bounds[c], bounds[c + 1]};
+      for (int64_t pos = chunkStart[c]; s.skipSpace(); pos++) {
+        s.parseInt();
+        col_ind[pos] = s.parseInt() - 1;
+        values[pos] = s.parseDouble();
+      }
+    });
+    return CsrMatrix(n, m, nnzs, std::move(values), std::move(col_ind), std::move(row_ptr));
+  }
+
+  // Pass 2: parse again, scattering entries into their rows
+  cask::parallel::ThreadPool::global().run(nChunks, [&](int c) {
+    Scanner s{bounds[c], bounds[c + 1]};
+    while (s.skipSpace()) {
+      int i = s.parseInt() - 1;
+      int j = s.parseInt() - 1;
+      double v = s.parseDouble();
+      int pos = counts[i].fetch_add(1, std::memory_order_relaxed);
+      col_ind[pos] = j;
+      values[pos] = v;
+      if (symmetric && i != j) {
+        pos = counts[j].fetch_add(1, std::memory_order_relaxed);
+        col_ind[pos] = i;
+        values[pos] = v;
+      }
+    }
+  });
+  counts.reset();
+
+  // Entries within a row arrive in file order (or any order when parsing in
+  // parallel); sort them by column and collapse duplicates, which may occur
+  // when a symmetric file stores both triangles
+  std::vector<int> rowNnzs(n);
+  std::atomic<bool> duplicates{false};
+  parallel::parallelForChunks(0, n, [&](int, int64_t rs, int64_t re) {
+    std::vector<std::pair<int, double>> row;
+    for (int64_t i = rs; i < re; i++) {
+      int s = row_ptr[i], e = row_ptr[i + 1];
+      bool sorted = true;
+      for (int k = s + 1; k < e && sorted; k++)
+        sorted = col_ind[k - 1] < col_ind[k];
+      if (sorted) {
+        rowNnzs[i] = e - s;
+        continue;
+      }
+      row.clear();
+      for (int k = s; k < e; k++)
+        row.push_back(std::make_pair(col_ind[k], values[k]));
+      std::sort(row.begin(), row.end());
+      int w = s;
+      for (size_t k = 0; k < row.size(); k++) {
+        if (k > 0 && row[k].first == row[k - 1].first) {
+          if (row[k].second != row[k - 1].second)
+            throw std::invalid_argument(
+                "Conflicting duplicate entries for (" + std::to_string(i + 1) + ", " +
+                std::to_string(row[k].first + 1) + ") in " + path);
+          duplicates = true;
+          continue;
+        }
+        col_ind[w] = row[k].first;
+        values[w] = row[k].second;
+        w++;
+      }
+      rowNnzs[i] = w - s;
+    }
+  }, 1024);
+
+  if (duplicates) {
+    int w = 0;
+    for (int i = 0; i < n; i++) {
+      int s = row_ptr[i];
+      int len = rowNnzs[i];
+      std::copy(col_ind.begin() + s, col_ind.begin() + s + len, col_ind.begin() + w);
+      std::copy(values.begin() + s, values.begin() + s + len, values.begin() + w);
+      row_ptr[i] = w;
+      w += len;
+    }
+    row_ptr[n] = w;
+    col_ind.resize(w);
+    values.resize(w);
+    nnzs = w;
+  }
+
+  CsrMatrix mat;
+  mat.n = n;
+  mat.m = m;
+  mat.nnzs = nnzs;
+  mat.row_ptr = std::move(row_ptr);
+  mat.col_ind = std::move(col_ind);
+  mat.values = std::move(values);
+  return mat;
+}
+
+namespace {
+
+const uint64_t cacheAlignment = 64;
+
+uint64_t alignOffset(uint64_t offset) {
+  return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+}
+
+bool statFile(const std::string& path, int64_t& size, int64_t& mtimeNs) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0)
+    return false;
+  size = st.st_size;
+  mtimeNs = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+template<typename T>
+void writeArray(std::ofstream& f, uint64_t offset, const std::vector<T>& v) {
+  static const char zeros[cacheAlignment] = {};
+  f.write(zeros, offset - f.tellp());
+  f.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+// returns nullptr if there is no valid, up to date cache for sourcePath
+// true if the arrays of the header are aligned, lie in a file of the given
+// size, and are in the order written by writeCsrCache(), without overlap; the
+// offsets are bounded by the file size before they are summed, so the sums
+// cannot overflow
+bool validLayout(const CsrCacheHeader& h, uint64_t fileSize) {
+  const int64_t maxInt = std::numeric_limits<int>::max();
+  if (h.n < 0 || h.m < 0 || h.nnzs < 0 || h.n >= maxInt || h.m > maxInt || h.nnzs > maxInt)
+    return false;
+  if (h.rowPtrOffset % cacheAlignment || h.colIndOffset % cacheAlignment || h.valuesOffset % cacheAlignment)
+    return false;
+  if (h.rowPtrOffset < sizeof(CsrCacheHeader) || h.rowPtrOffset > fileSize ||
+      h.colIndOffset > fileSize || h.valuesOffset > fileSize)
+    return false;
+  uint64_t rowPtrEnd = h.rowPtrOffset + sizeof(int) * uint64_t(h.n + 1);
+  uint64_t colIndEnd = h.colIndOffset + sizeof(int) * uint64_t(h.nnzs);
+  uint64_t valuesEnd = h.valuesOffset + sizeof(double) * uint64_t(h.nnzs);
+  return rowPtrEnd <= h.colIndOffset && colIndEnd <= h.valuesOffset && valuesEnd <= fileSize;
+}
+
+std::unique_ptr<MappedCsrMatrix> tryMapCache(const std::string& cachePath,
+                                             const std::string& sourcePath) {
+  std::unique_ptr<MappedCsrMatrix> m;
+  try {
+    m.reset(new MappedCsrMatrix(cachePath));
+  } catch (std::invalid_argument&) {
+    return nullptr;
+  }
+  if (!m->isFreshFor(sourcePath))
+    return nullptr;
+  return m;
+}
+
+}
+
+bool cask::io::matrixCacheEnabled() {
+  const char* env = std::getenv("CASK_MATRIX_CACHE");
+  return !env || std::string(env) != "0";
+}
+
+void cask::io::writeCsrCache(const CsrMatrix& mat,
+                             bool symmetric,
+                             const std::string& cachePath,
+                             const std::string& sourcePath) {
+  CsrCacheHeader h;
+  std::memset(&h, 0, sizeof(h));
+  h.magic = CsrCacheHeader::MAGIC;
+  h.version = CsrCacheHeader::VERSION;
+  h.flags = symmetric ? CsrCacheHeader::FLAG_SYMMETRIC : 0;
+  h.n = mat.n;
+  h.m = mat.m;
+  h.nnzs = mat.nnzs;
+  h.rowPtrOffset = alignOffset(sizeof(CsrCacheHeader));
+  h.colIndOffset = alignOffset(h.rowPtrOffset + sizeof(int) * (mat.n + 1));
+  h.valuesOffset = alignOffset(h.colIndOffset + sizeof(int) * mat.nnzs);
+  if (!sourcePath.empty() && !statFile(sourcePath, h.sourceSize, h.sourceMtimeNs))
+    throw std::invalid_argument("File not found " + sourcePath);
+  if (mat.row_ptr.size() != size_t(mat.n + 1) ||
+      mat.col_ind.size() != size_t(mat.nnzs) || mat.values.size() != size_t(mat.nnzs))
+    throw std::invalid_argument("writeCsrCache: inconsistent CSR matrix");
+
+  // write to a temporary file first, so concurrent readers never see a
+  // partially written cache; its name is unique, so that concurrent writers
+  // of the same cache, in any thread or process, never share it
+  std::vector<char> name(cachePath.begin(), cachePath.end());
+  const char suffix[] = ".tmpXXXXXX";
+  name.insert(name.end(), suffix, suffix + sizeof(suffix));
+  int fd = ::mkstemp(name.data());
+  if (fd == -1)
+    throw std::runtime_error("Could not create a temporary file for " + cachePath + ": " + std::strerror(errno));
+  // readable as a file created by ofstream, rather than by the owner only
+  ::fchmod(fd, 0644);
+  ::close(fd);
+  std::string tmpPath(name.data());
+  {
+    std::ofstream f{tmpPath, std::ios::binary | std::ios::trunc};
+    if (!f)
+      throw std::runtime_error("Could not open " + tmpPath + " for writing");
+    f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    writeArray(f, h.rowPtrOffset, mat.row_ptr);
+    writeArray(f, h.colIndOffset, mat.col_ind);
+    writeArray(f, h.valuesOffset, mat.values);
+    if (!f) {
+      ::unlink(tmpPath.c_str());
+      throw std::runtime_error("Could not write " + tmpPath);
+    }
+  }
+  if (::rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+    ::unlink(tmpPath.c_str());
+    throw std::runtime_error("Could not create " + cachePath + ": " + std::strerror(errno));
+  }
+}
+
+MappedCsrMatrix::MappedCsrMatrix(const std::string& cachePath) : file(cachePath) {
+  if (file.size() < sizeof(CsrCacheHeader))
+    throw std::invalid_argument("Not a valid CSR cache " + cachePath);
+  std::memcpy(&header, file.data(), sizeof(header));
+  if (header.magic != CsrCacheHeader::MAGIC || header.version != CsrCacheHeader::VERSION)
+    throw std::invalid_argument("Not a valid CSR cache (or unsupported version) " + cachePath);
+  if (!validLayout(header, file.size()))
+    throw std::invalid_argument("Corrupted CSR cache " + cachePath);
+  const char* base = file.data();
+  const int* row_ptr = reinterpret_cast<const int*>(base + header.rowPtrOffset);
+  if (row_ptr[0] != 0 || row_ptr[header.n] != header.nnzs)
+    throw std::invalid_argument("Corrupted CSR cache " + cachePath);
+  for (int64_t i = 0; i < header.n; i++)
+    if (row_ptr[i] > row_ptr[i + 1])
+      throw std::invalid_argument("Corrupted CSR cache " + cachePath);
+  v = CsrView(header.n, header.m,
+              row_ptr,
+              reinterpret_cast<const int*>(base + header.colIndOffset),
+              reinterpret_cast<const double*>(base + header.valuesOffset));
+}
+
+bool MappedCsrMatrix::isFreshFor(const std::string& sourcePath) const {
+  int64_t size, mtimeNs;
+  return statFile(sourcePath, size, mtimeNs) &&
+      size == header.sourceSize && mtimeNs == header.sourceMtimeNs;
+}
+
+std::unique_ptr<MappedCsrMatrix> cask::io::mapMatrix(const std::string& mtxPath) {
+  std::string cachePath = csrCachePath(mtxPath);
+  std::unique_ptr<MappedCsrMatrix> cached = tryMapCache(cachePath, mtxPath);
+  if (cached)
+    return cached;
+  MmInfo info = readHeader(mtxPath);
+  writeCsrCache(readCsrMatrix(mtxPath, true), info.isSymmetric(), cachePath, mtxPath);
+  return std::unique_ptr<MappedCsrMatrix>(new MappedCsrMatrix(cachePath));
+}
+
+LoadedMatrix::LoadedMatrix(const std::string& path) {
+  MmInfo info = readHeader(path);
+  if (!info.isMatrix()) {
+    throw std::invalid_argument("Error! Expecting MatrixMarket matrix in " + path);
+  }
+  if (!matrixCacheEnabled()) {
+    owned = readCsrMatrix(path, true);
+    v = owned.view();
+    return;
+  }
+
+  std::string cachePath = csrCachePath(path);
+  mapped = tryMapCache(cachePath, path);
+  if (mapped) {
+    v = mapped->view();
+    return;
+  }
+  owned = readCsrMatrix(path, true);
+  v = owned.view();
+  try {
+    writeCsrCache(owned, info.isSymmetric(), cachePath, path);
+  } catch (std::runtime_error& e) {
+    // e.g. a read only benchmark directory; not an error, we just reparse next time
+    std::cerr << "Warning! Could not write matrix cache: " << e.what() << std::endl;
+  }
+}
+
+cask::CsrMatrix cask::io::readMatrix(std::string path) {
+  LoadedMatrix m(path);
+  if (m.isMapped())
+    return m.view().toCsr();
+  return std::move(m.owned);
+}
@@ -4,12 +4,13 @@
 #include <string>
 #include <iostream>
 #include "SparseMatrix.hpp"
-#include "SparseMatrix.hpp"
 #include <dfesnippets/Timing.hpp>
 #include <regex>
 #include <fstream>
 #include <cassert>
 #include <sstream>
+#include <cstdint>
+#include <memory>
 
 namespace cask {
 
@@ -147,21 +148,127 @@ inline DokMatrix readDokMatrix(std::string path, const MmInfo& info) {
   return mat;
 }
 
-// NB if the matrix is symmetric, returns a CsrMatrix with _explicitly_ stored symmetric values
-inline cask::CsrMatrix readMatrix(std::string path) {
-  MmInfo info = readHeader(path);
-  if (!info.isMatrix()) {
-    throw std::invalid_argument("Error! Expecting MatrixMarket matrix in " + path);
-  }
+/** A read only memory mapping of a file, unmapped on destruction */
+class MappedFile {
+  std::string path;
+  const char* addr = nullptr;
+  size_t fileSize = 0;
 
-  if (info.isSymmetric()) {
-    return cask::CsrMatrix(readDokMatrix(path, info).explicitSymmetric());
-  }
+ public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return addr; }
+  size_t size() const { return fileSize; }
+};
+
+/** Reads a MatrixMarket coordinate file straight into CSR format.
+ *
+ * The file is memory mapped and parsed in parallel chunks, in two passes: the
+ * first counts the nonzeros of each row to build row_ptr, the second scatters
+ * the entries into col_ind / values. No intermediate DOK or COO is built.
+ * Column indices are sorted within each row and duplicate entries are
+ * collapsed (an exception is thrown if duplicates have different values).
+ *
+ * If expandSymmetric is set and the file is symmetric, the transpose of each
+ * off diagonal entry is added during the scatter, and the matrix must be
+ * square; otherwise entries are stored as found in the file. Sizes and
+ * indices beyond the range of int are rejected with std::invalid_argument.
+ */
+cask::CsrMatrix readCsrMatrix(const std::string& path, bool expandSymmetric = true);
 
-  return cask::CsrMatrix(readDokMatrix(path, info));
-  // throw std::invalid_argument("Error! Generic matrix in MatrixMarket not supported");
+/** Support for the binary CSR cache format.
+ *
+ * A cache file holds a versioned header followed by the raw row_ptr, col_ind
+ * and values arrays, each starting at a 64 byte aligned offset, so that the
+ * file can be memory mapped and used in place (see MappedCsrMatrix). Caches
+ * are written next to the MatrixMarket file they were built from
+ * (csrCachePath()) and record its size and modification time; a cache which
+ * does not match its source is considered stale and rebuilt.
+ *
+ * The cached matrix is the one returned by readMatrix(), i.e. symmetric
+ * matrices are stored explicitly and the symmetric flag records that the
+ * source was symmetric.
+ */
+struct CsrCacheHeader {
+  static const uint64_t MAGIC = 0x5253435f4b534143ULL;  // "CASK_CSR"
+  static const uint32_t VERSION = 1;
+  static const uint32_t FLAG_SYMMETRIC = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t flags;
+  int64_t n, m, nnzs;
+  uint64_t rowPtrOffset, colIndOffset, valuesOffset;
+  // identifies the source file the cache was built from
+  int64_t sourceSize, sourceMtimeNs;
+};
+
+inline std::string csrCachePath(const std::string& mtxPath) {
+  return mtxPath + ".bcsr";
 }
 
+/** Writes mat in the binary CSR format to cachePath, atomically. If sourcePath
+ * is not empty its size and modification time are recorded in the header. */
+void writeCsrCache(const CsrMatrix& mat,
+                   bool symmetric,
+                   const std::string& cachePath,
+                   const std::string& sourcePath = "");
+
+/** A binary CSR file mapped into memory; view() points directly to the mapped
+ * arrays, no data is copied. The view is valid for the lifetime of this object. */
+class MappedCsrMatrix {
+  MappedFile file;
+  CsrCacheHeader header;
+  CsrView v;
+
+ public:
+  // throws std::invalid_argument if the file is not a valid cache
+  explicit MappedCsrMatrix(const std::string& cachePath);
+
+  const CsrView& view() const { return v; }
+  bool isSymmetric() const { return header.flags & CsrCacheHeader::FLAG_SYMMETRIC; }
+  // true if the cache was built from the current contents of sourcePath
+  bool isFreshFor(const std::string& sourcePath) const;
+};
+
+/** Maps the binary cache of the given MatrixMarket file, building it first if
+ * it is missing or stale. */
+std::unique_ptr<MappedCsrMatrix> mapMatrix(const std::string& mtxPath);
+
+/** Caching is enabled unless the CASK_MATRIX_CACHE environment variable is 0 */
+bool matrixCacheEnabled();
+
+/** The matrix of readMatrix(), for readers which only need a view of it: a
+ * cache hit maps the binary cache, so nothing is copied; a miss parses the
+ * file and writes the cache for later reads. view() is valid for the
+ * lifetime of this object. */
+class LoadedMatrix {
+  std::unique_ptr<MappedCsrMatrix> mapped;
+  CsrMatrix owned;
+  CsrView v;
+
+  friend cask::CsrMatrix readMatrix(std::string path);
+
+ public:
+  explicit LoadedMatrix(const std::string& mtxPath);
+
+  LoadedMatrix(const LoadedMatrix&) = delete;
+  LoadedMatrix& operator=(const LoadedMatrix&) = delete;
+
+  const CsrView& view() const { return v; }
+  // false if parsed, e.g. with caching disabled
+  bool isMapped() const { return mapped != nullptr; }
+};
+
+// NB if the matrix is symmetric, returns a CsrMatrix with _explicitly_ stored symmetric values;
+// uses (and on first read creates) the binary cache of the file, unless caching is disabled.
+// The matrix owns its arrays, so a cache hit copies them out of the mapping: use LoadedMatrix
+// (or mapMatrix()) where a view is enough
+cask::CsrMatrix readMatrix(std::string path);
+
 inline cask::SymCsrMatrix readSymMatrix(std::string path) {
   MmInfo info = readHeader(path);
   if (!info.isMatrix()) {
@@ -172,7 +279,7 @@ inline cask::SymCsrMatrix readSymMatrix(std::string path) {
     throw std::invalid_argument("Error! Matrix found in " + path +
         " is not symmetric. To read unsymmetric matrix use cask::io::readSymMatrix()");
   }
-  return cask::SymCsrMatrix(readDokMatrix(path, info));
+  return cask::SymCsrMatrix(readCsrMatrix(path, false));
 }
 
 template<typename value_type>
@@ -211,7 +318,7 @@ class MmReader {
         }
     }
 
-    bool parseHeader(bool pprint=false) {
+    void parseHeader(bool pprint=false) {
         std::string line;
         if (!getline(*f, line))
         throw std::invalid_argument("File " + path + " is empty");
@@ -284,47 +391,32 @@ class MmReader {
         return res;
     }
 
+    // Reads the file straight into CSR, see io::readCsrMatrix()
+    cask::CsrMatrix readCsrMatrix() {
+        return io::readCsrMatrix(path);
+    }
+
     // Read the given file as a MM format description of a sparse matrix.
     // Returns a COO representation of the matrix.
     // NOTE:
     // - the values will be adjusted to 0 based indexing
     // - for symmetric matrices, the symmetric entries are also included
     // - Triplets will be sorted in lexicographical order of their coordinates (row, column)
+    // - duplicate entries are collapsed
+    // The triplets are expanded from readCsrMatrix(), which is already in this
+    // order; prefer it when CSR will do.
     cask::sparse::SparkCooMatrix<value_type> mmreadMatrix(std::string path) {
         parseHeader();
 
         if (!matrix)
         throw std::invalid_argument("Matrix has only one column ==> Use readVector");
 
-        // skip comments
-        std::vector<CoordType> values;
-        std::string line;
-        for (int i = 0; i < nnzs; i++) {
-        if (!getline(*f, line))
-            throw std::invalid_argument("File has less than given nonzeros!");
-        auto tpl = mmparse(line);
-        values.push_back(tpl);
-        auto row = std::get<0>(tpl);
-        auto col = std::get<1>(tpl);
-        if (symmetric && row != col)
-            values.push_back(
-                            std::make_tuple(
-                                            std::get<1>(tpl),
-                                            std::get<0>(tpl),
-                                            std::get<2>(tpl)));
-        }
-
-        auto start = std::chrono::high_resolution_clock::now();
-        std::sort(values.begin(), values.end(),
-                [](CoordType x, CoordType y) {
-                    return
-                    std::get<0>(x) < std::get<0>(y) ||
-                                        (std::get<0>(x) == std::get<0>(y) && std::get<1>(x) < std::get<1>(y));
-                });
-        dfesnippets::timing::print_clock_diff("Sorting took: ", start);
-
+        cask::CsrMatrix a = io::readCsrMatrix(path);
         cask::sparse::SparkCooMatrix<value_type> m(nrows, ncols);
-        m.data = values;
+        m.data.reserve(a.nnzs);
+        for (int i = 0; i < a.n; i++)
+        for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++)
+            m.data.push_back(std::make_tuple(i, a.col_ind[k], value_type(a.values[k])));
         return m;
     }
 };
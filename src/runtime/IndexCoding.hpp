@@ -0,0 +1,116 @@
+#ifndef INDEXCODING_HPP_J5TE8MQX
+#define INDEXCODING_HPP_J5TE8MQX
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cask {
+  namespace spmv {
+
+/** Bits needed to store the column offsets [0, blockSize) of a block */
+inline int offsetBits(int blockSize) {
+  int bits = 1;
+  while ((int64_t(1) << bits) < blockSize)
+    bits++;
+  return bits;
+}
+
+/**
+ * Coding of the column offsets within a block in the indptr / values stream,
+ * as bits bits per entry:
+ * - bits == 32: the offset, as an int, which is the default;
+ * - bits >= offsetBits(blockSize): the offset, in a narrow field;
+ * - otherwise, the difference from the offset of the previous entry of the
+ *   same row in the block (from 0 for its first entry). A difference that
+ *   does not fit, or is negative, is replaced by the escape code (all bits
+ *   set) and the offset is appended to a separate escape stream, which the
+ *   decoder reads in order.
+ */
+struct IndexCoding {
+  int bits, blockSize;
+
+  IndexCoding(int _bits, int _blockSize) : bits(_bits), blockSize(_blockSize) {
+    if (bits < 2 || bits > 32)
+      throw std::invalid_argument("Index bits must be in [2, 32], got " + std::to_string(bits));
+  }
+
+  bool usesDeltas() const {
+    return bits < 32 && bits < offsetBits(blockSize);
+  }
+
+  uint32_t escapeCode() const {
+    return uint32_t((uint64_t(1) << bits) - 1);
+  }
+
+  /** The code of offset, given the offset of the previous entry of its row
+   * in the block (0 for the first entry); escaped is set if the offset must
+   * be added to the escape stream. */
+  uint32_t encode(int offset, int previous, bool& escaped) const {
+    escaped = false;
+    if (!usesDeltas())
+      return offset;
+    int64_t delta = int64_t(offset) - previous;
+    if (delta >= 0 && delta < escapeCode())
+      return delta;
+    escaped = true;
+    return escapeCode();
+  }
+};
+
+/** Counts the escapes of the entries of a sequence of rows, visited in order */
+class EscapeCounter {
+  IndexCoding coding;
+  std::vector<int> previous, previousRow;
+
+ public:
+  EscapeCounter(int indexBits, int blockSize, int nBlocks) :
+      coding(indexBits, blockSize), previous(nBlocks, 0), previousRow(nBlocks, -1) {}
+
+  bool enabled() const {
+    return coding.usesDeltas();
+  }
+
+  /** Returns 1 if the entry at the given offset of block b is escaped, 0
+   * otherwise; the entries of a row must be visited in order */
+  int count(int row, int b, int offset) {
+    bool escaped;
+    coding.encode(offset, previousRow[b] == row ? previous[b] : 0, escaped);
+    previous[b] = offset;
+    previousRow[b] = row;
+    return escaped;
+  }
+};
+
+/** Writes the nBits (<= 64) low bits of value to a little endian bit stream,
+ * starting at bit position pos; the stream must be large enough */
+inline void writeBits(std::vector<uint8_t>& stream, int64_t pos, uint64_t value, int nBits) {
+  for (int i = 0; i < nBits; ) {
+    int64_t byte = (pos + i) / 8;
+    int shift = (pos + i) % 8;
+    int n = std::min(8 - shift, nBits - i);
+    uint8_t mask = uint8_t(((1u << n) - 1) << shift);
+    stream[byte] = (stream[byte] & ~mask) | (uint8_t((value >> i) << shift) & mask);
+    i += n;
+  }
+}
+
+/** Reads the nBits (<= 64) bits written by writeBits() at position pos */
+inline uint64_t readBits(const std::vector<uint8_t>& stream, int64_t pos, int nBits) {
+  uint64_t value = 0;
+  for (int i = 0; i < nBits; ) {
+    int64_t byte = (pos + i) / 8;
+    int shift = (pos + i) % 8;
+    int n = std::min(8 - shift, nBits - i);
+    value |= uint64_t((stream[byte] >> shift) & ((1u << n) - 1)) << i;
+    i += n;
+  }
+  return value;
+}
+
+  }
+}
+
+#endif /* end of include guard: INDEXCODING_HPP_J5TE8MQX */
@@ -0,0 +1,191 @@
+#include "MatrixProfile.hpp"
+#include "Parallel.hpp"
+#include "Trace.hpp"
+
+#include <cstring>
+
+using namespace cask::spmv;
+
+namespace {
+
+// the rows of a chunk of the hashes
+const int hashRows = 1 << 14;
+// enough for rows of up to 2^32 entries
+const int histogramBins = 33;
+
+// FNV-1a, a byte at a time
+struct Fnv {
+  uint64_t h = 14695981039346656037ULL;
+
+  void add(uint64_t v) {
+    for (int b = 0; b < 8; b++) {
+      h ^= (v >> (8 * b)) & 0xff;
+      h *= 1099511628211ULL;
+    }
+  }
+};
+
+// of the rows of a chunk
+struct ChunkProfile {
+  uint64_t structure, content;
+  // the empty rows at the start and end of the chunk, and the runs and
+  // longest run strictly inside it
+  int leadingEmpty = 0, trailingEmpty = 0;
+  int64_t innerRuns = 0;
+  int longestInner = 0;
+};
+
+// of the chunks of a thread
+struct ThreadProfile {
+  std::vector<int64_t> histogram, blockNnzs, blockRows;
+  // the last row counted in each block
+  std::vector<int> lastRow;
+  int maxRowLength = 0, lowerBandwidth = 0, upperBandwidth = 0;
+  double rowLengthSquares = 0;
+  int64_t emptyRows = 0;
+};
+
+int histogramBin(int length) {
+  int bin = 0;
+  while (length > 0) {
+    bin++;
+    length >>= 1;
+  }
+  return bin;
+}
+
+}
+
+MatrixProfile::MatrixProfile(const CsrView& mat, int _blockSize) :
+  n(mat.n), m(mat.m), nnzs(mat.nnzs), blockSize(_blockSize) {
+  CASK_TRACE_SCOPE("profile:matrix", mat.n);
+  int nBlocks = blockSize > 0 ? (mat.m + blockSize - 1) / blockSize : 0;
+  int nChunks = (mat.n + hashRows - 1) / hashRows;
+  std::vector<ChunkProfile> chunks(nChunks);
+  std::vector<ThreadProfile> threads(cask::parallel::numThreads());
+  for (ThreadProfile& tp : threads) {
+    tp.histogram.assign(histogramBins, 0);
+    tp.blockNnzs.assign(nBlocks, 0);
+    tp.blockRows.assign(nBlocks, 0);
+    tp.lastRow.assign(nBlocks, -1);
+  }
+  const int* rowPtr = mat.row_ptr;
+  const int* colInd = mat.col_ind;
+  const double* values = mat.values;
+
+  int used = cask::parallel::parallelForChunks(0, nChunks, [&](int t, int64_t firstChunk, int64_t lastChunk) {
+    ThreadProfile& tp = threads[t];
+    for (int64_t c = firstChunk; c < lastChunk; c++) {
+      ChunkProfile& cp = chunks[c];
+      Fnv structure, content;
+      int begin = int(c * hashRows), end = std::min(mat.n, begin + hashRows);
+      bool leading = true;
+      int run = 0;
+      for (int i = begin; i < end; i++) {
+        int length = rowPtr[i + 1] - rowPtr[i];
+        structure.add(length);
+        content.add(length);
+        tp.histogram[histogramBin(length)]++;
+        tp.maxRowLength = std::max(tp.maxRowLength, length);
+        tp.rowLengthSquares += double(length) * length;
+        if (length == 0) {
+          tp.emptyRows++;
+          run++;
+          continue;
+        }
+        if (leading) {
+          cp.leadingEmpty = run;
+          leading = false;
+        } else if (run > 0) {
+          cp.innerRuns++;
+          cp.longestInner = std::max(cp.longestInner, run);
+        }
+        run = 0;
+        for (int k = rowPtr[i]; k < rowPtr[i + 1]; k++) {
+          int j = colInd[k];
+          structure.add(j);
+          uint64_t bits = 0;
+          if (values)
+            std::memcpy(&bits, &values[k], sizeof(bits));
+          content.add(j);
+          content.add(bits);
+          tp.lowerBandwidth = std::max(tp.lowerBandwidth, i - j);
+          tp.upperBandwidth = std::max(tp.upperBandwidth, j - i);
+          if (nBlocks > 0) {
+            int b = j / blockSize;
+            tp.blockNnzs[b]++;
+            if (tp.lastRow[b] != i) {
+              tp.lastRow[b] = i;
+              tp.blockRows[b]++;
+            }
+          }
+        }
+      }
+      if (leading)
+        cp.leadingEmpty = run;
+      else
+        cp.trailingEmpty = run;
+      cp.structure = structure.h;
+      cp.content = content.h;
+    }
+  });
+
+  rowLengthHistogram.assign(histogramBins, 0);
+  blockNnzs.assign(nBlocks, 0);
+  blockRows.assign(nBlocks, 0);
+  for (int t = 0; t < std::min<int>(used, threads.size()); t++) {
+    const ThreadProfile& tp = threads[t];
+    for (size_t b = 0; b < tp.histogram.size(); b++)
+      rowLengthHistogram[b] += tp.histogram[b];
+    // a row is in the chunks of a single thread
+    for (int b = 0; b < nBlocks; b++) {
+      blockNnzs[b] += tp.blockNnzs[b];
+      blockRows[b] += tp.blockRows[b];
+    }
+    maxRowLength = std::max(maxRowLength, tp.maxRowLength);
+    lowerBandwidth = std::max(lowerBandwidth, tp.lowerBandwidth);
+    upperBandwidth = std::max(upperBandwidth, tp.upperBandwidth);
+    rowLengthSquares += tp.rowLengthSquares;
+    emptyRows += tp.emptyRows;
+  }
+  // trim the histogram to the longest row
+  rowLengthHistogram.resize(histogramBin(maxRowLength) + 1);
+
+  // the runs of empty rows, across the chunks in order
+  Fnv structure, content;
+  structure.add(mat.n);
+  structure.add(mat.m);
+  content.add(mat.n);
+  content.add(mat.m);
+  int run = 0;
+  auto endRun = [&]() {
+    if (run > 0) {
+      emptyRowRuns++;
+      longestEmptyRun = std::max(longestEmptyRun, run);
+    }
+    run = 0;
+  };
+  for (int c = 0; c < nChunks; c++) {
+    const ChunkProfile& cp = chunks[c];
+    int rows = std::min(mat.n, (c + 1) * hashRows) - c * hashRows;
+    run += cp.leadingEmpty;
+    if (cp.leadingEmpty < rows) {
+      endRun();
+      emptyRowRuns += cp.innerRuns;
+      longestEmptyRun = std::max(longestEmptyRun, cp.longestInner);
+      run = cp.trailingEmpty;
+    }
+    structure.add(cp.structure);
+    content.add(cp.content);
+  }
+  endRun();
+  structureHash = structure.h;
+  contentHash = content.h;
+}
+
+int MatrixProfile::occupiedBlocks() const {
+  int occupied = 0;
+  for (int64_t e : blockNnzs)
+    occupied += e > 0;
+  return occupied;
+}
@@ -0,0 +1,71 @@
+#ifndef MATRIXPROFILE_HPP_H6D2PW8N
+#define MATRIXPROFILE_HPP_H6D2PW8N
+
+#include "SparseMatrix.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace cask {
+namespace spmv {
+
+/**
+ * A structural summary of a matrix, from a single parallel pass over its
+ * row_ptr and col_ind (and values, for the content hash). Build it once per
+ * matrix and reuse it for all the decisions that depend on the structure:
+ * the analysis cache of the DSE (see BlockingCache), the choice of an
+ * implementation (SpmvImplementationLoader::fastestFor()) and of a CPU
+ * format (cpu::FormatTuner::choose()).
+ *
+ * The hashes are computed over row chunks of a fixed size, so they do not
+ * depend on the number of threads.
+ */
+struct MatrixProfile {
+  int n = 0, m = 0;
+  int64_t nnzs = 0;
+
+  // rowLengthHistogram[0] counts the empty rows, [k] those of [2^(k - 1),
+  // 2^k) entries
+  std::vector<int64_t> rowLengthHistogram;
+  int maxRowLength = 0;
+  // the sum of the squares of the row lengths, for their variance
+  double rowLengthSquares = 0;
+
+  // max i - j and j - i over the entries (i, j), 0 if there is none
+  int lowerBandwidth = 0, upperBandwidth = 0;
+
+  int64_t emptyRows = 0;
+  // the number of runs of successive empty rows, and the longest
+  int64_t emptyRowRuns = 0;
+  int longestEmptyRun = 0;
+
+  // if blockSize > 0, for each block of columns [b * blockSize, (b + 1) *
+  // blockSize) as in BlockRowLengths, its entries and its non empty rows
+  int blockSize = 0;
+  std::vector<int64_t> blockNnzs, blockRows;
+
+  // of the dimensions and the sparsity pattern (see structureHash()), and
+  // of these and the values
+  uint64_t structureHash = 0, contentHash = 0;
+
+  MatrixProfile() {}
+
+  explicit MatrixProfile(const CsrView& mat, int blockSize = 0);
+
+  double meanRowLength() const {
+    return n == 0 ? 0 : double(nnzs) / n;
+  }
+
+  int bandwidth() const {
+    return std::max(lowerBandwidth, upperBandwidth);
+  }
+
+  /** The column blocks with at least one entry */
+  int occupiedBlocks() const;
+};
+
+}
+}
+
+#endif /* end of include guard: MATRIXPROFILE_HPP_H6D2PW8N */
@@ -57,7 +57,7 @@ inline std::vector<double> unittrsolve(const CsrMatrix& m,
 
 // Solve Lx = b where L is a unit lower triangular matrix (all diagonal entries of L are 1)
 // A more efficient implementation when repeated calls are made with the same values,
-// row_ptr, col_ind (e.g. in ILUPreconditioner::apply)
+// row_ptr, col_ind
 inline void unittrsolve(const double* values,
                         const int* row_ptr,
                         const int* col_ind,
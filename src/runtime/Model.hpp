@@ -1,8 +1,10 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <cstdint>
 #include <sstream>
 #include <iostream>
+#include <stdexcept>
 
 namespace cask {
   namespace model {
@@ -23,7 +25,7 @@ namespace cask {
           brams = ru.brams;
         }
 
-        std::string to_string() {
+        std::string to_string() const {
           std::stringstream s;
           s << luts << " " << ffs << " " << " " << dsps << " " << brams;
           return s.str();
@@ -81,12 +83,86 @@ namespace cask {
         }
     };
 
+    /** Resource costs of the parts of the SpMV design, the coefficients
+     * of a model linear in the number of pipes and inputs; the BRAMs of the
+     * vector caches and of the reduction buffers depend on the design
+     * parameters and on the device, so they are not part of these costs.
+     * Defaults are those of Max4 builds at 800 MHz memory frequency. */
+    struct KernelCostModel {
+      // per pipe: BRAM reduction (10069, 12965), padding (363, 543),
+      // 3 x unpadding (364, 474), state machine (1235, 643), memory
+      // (5325, 12184, 108 BRAMs) and FIFOs (500, 800, 81 BRAMs)
+      LogicResourceUsage perPipe{18584, 28557, 189, 0};
+      // per input of a pipe, besides its vector cache
+      LogicResourceUsage perInput{1458, 2031, 14, 4};
+      // memory controllers and infrastructure of the design
+      LogicResourceUsage fixed{15330, 17606, 56, 0};
+      // delta coded indices are decoded by a prefix sum over the inputs, per
+      // bit of an index, with a mux for escaped entries fed by an extra
+      // stream per pipe
+      LogicResourceUsage decoderPerInputBit{38, 45, 0, 0};
+      LogicResourceUsage escapeStreamPerPipe{864, 1274, 8, 0};
+      // symmetric designs: the multiply add of the reflected sum of each
+      // input, and per pipe the read of the x of its rows and the adder tree
+      // and output stream which flush the reflected sums of each block
+      LogicResourceUsage reflectionPerInput{1196, 1687, 0, 4};
+      LogicResourceUsage reflectionPerPipe{1422, 2046, 12, 0};
+    };
+
+    /** Corrections of the modelled performance, fitted to measured runs
+     * (see Spmv::getPerformanceReport()). The default calibration leaves
+     * estimates unchanged. */
+    class Calibration {
+      // sums of the least squares fit, through the origin, of the measured
+      // against the modelled kernel times
+      double modelledSquares = 0, products = 0;
+      int64_t hostBytes = 0;
+      double hostSeconds = 0;
+
+      public:
+        // measured / modelled kernel time
+        double cycleScale = 1.0;
+        // GB/s of transfers over the host link, 0 if not measured
+        double hostBandwidth = 0;
+        int runs = 0;
+
+        /** Adds a run of the kernel, ignored if it did not take any time
+         * (e.g. that of a mock implementation) */
+        void addRun(double modelledSeconds, double measuredSeconds) {
+          if (modelledSeconds <= 0 || measuredSeconds <= 0)
+            return;
+          modelledSquares += modelledSeconds * modelledSeconds;
+          products += modelledSeconds * measuredSeconds;
+          cycleScale = products / modelledSquares;
+          runs++;
+        }
+
+        void addTransfer(int64_t bytes, double seconds) {
+          if (bytes <= 0 || seconds <= 0)
+            return;
+          hostBytes += bytes;
+          hostSeconds += seconds;
+          hostBandwidth = hostBytes / hostSeconds / 1E9;
+        }
+    };
+
     /** Abstract representation of the device we are implementing for. */
     class DeviceModel {
       public:
+        virtual ~DeviceModel() {}
         virtual int entriesPerBram(int bitwidth) const = 0;
         virtual std::string getId() const = 0;
         virtual cask::model::HardwareModel maxParams() const = 0;
+
+        /** Clock frequency (Hz) of the design */
+        virtual double frequency() const {
+          return 200.0 * 1E6;
+        }
+
+        /** Resource costs of the design on this device */
+        virtual KernelCostModel kernelCosts() const {
+          throw std::invalid_argument("Unsupported device model " + getId());
+        }
     };
 
     /** Abstract representation of a Max4 board */
@@ -103,6 +179,9 @@ namespace cask {
         std::string getId() const override {
           return "Max4";
         }
+        KernelCostModel kernelCosts() const override {
+          return KernelCostModel();
+        }
         cask::model::HardwareModel maxParams() const override {
           return HardwareModel{LogicResourceUsage{524800, 1049600, 2567, 1963}, 65};
         }
@@ -130,6 +209,9 @@ namespace cask {
         std::string getId() const override {
           return "Max5";
         }
+        KernelCostModel kernelCosts() const override {
+          return KernelCostModel();
+        }
         cask::model::HardwareModel maxParams() const override {
           return HardwareModel{LogicResourceUsage{4 * 524800, 4 * 1049600, 11721, 11520}, 208};
         }
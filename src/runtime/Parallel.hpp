@@ -0,0 +1,251 @@
+#ifndef PARALLEL_HPP_K2Q7ZP1M
+#define PARALLEL_HPP_K2Q7ZP1M
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cask {
+
+/** Host side parallelism used by the runtime (I/O, preprocessing, CPU kernels,
+ * design space exploration).
+ *
+ * A single process wide pool of worker threads is started lazily on first use.
+ * Work is submitted as a job of independent tasks; the caller blocks until
+ * all tasks of the job complete and takes part in executing them.
+ *
+ * Jobs may be submitted from any thread, including from within a task (e.g.
+ * a parallel kernel invoked from a parallel DSE task). Idle threads steal
+ * tasks from the most recently submitted job which has tasks left, so nested
+ * work is spread over the whole pool; a thread waiting for its own job only
+ * helps with jobs submitted after it, which keeps waits short and cannot
+ * deadlock.
+ *
+ * The number of threads defaults to the hardware concurrency and can be
+ * overridden with the CASK_NUM_THREADS environment variable.
+ */
+namespace parallel {
+
+inline int defaultNumThreads() {
+  const char* env = std::getenv("CASK_NUM_THREADS");
+  if (env) {
+    int n = std::atoi(env);
+    if (n > 0)
+      return n;
+  }
+  int hw = std::thread::hardware_concurrency();
+  return hw > 0 ? hw : 1;
+}
+
+class ThreadPool {
+
+  using Task = std::function<void(int)>;
+
+  struct Job {
+    const Task* task;
+    int numTasks;
+    uint64_t id;
+    // guarded by m
+    int nextTask;
+    int pendingTasks;
+    std::exception_ptr error;
+  };
+
+  std::vector<std::thread> workers;
+
+  std::mutex m;
+  std::condition_variable changed;
+  // jobs with tasks not yet started, in submission order
+  std::vector<Job*> jobs;
+  uint64_t nextJobId = 0;
+  bool stopping = false;
+
+  // claims a task of the newest job submitted no earlier than job minId;
+  // must be called with m held
+  bool claim(uint64_t minId, Job*& job, int& index) {
+    for (size_t k = jobs.size(); k-- > 0; ) {
+      Job* j = jobs[k];
+      if (j->id < minId)
+        break;
+      job = j;
+      index = j->nextTask++;
+      if (j->nextTask == j->numTasks)
+        jobs.erase(jobs.begin() + k);
+      return true;
+    }
+    return false;
+  }
+
+  // runs a claimed task; must be called with lock held, releases it meanwhile
+  void execute(std::unique_lock<std::mutex>& lock, Job* j, int index) {
+    lock.unlock();
+    std::exception_ptr e;
+    try {
+      (*j->task)(index);
+    } catch (...) {
+      e = std::current_exception();
+    }
+    lock.lock();
+    if (e && !j->error)
+      j->error = e;
+    if (--j->pendingTasks == 0)
+      changed.notify_all();
+  }
+
+  void workerLoop() {
+    std::unique_lock<std::mutex> lock(m);
+    while (true) {
+      Job* j;
+      int index;
+      if (claim(0, j, index)) {
+        execute(lock, j, index);
+        continue;
+      }
+      if (stopping)
+        return;
+      changed.wait(lock);
+    }
+  }
+
+ public:
+
+  explicit ThreadPool(int nThreads) {
+    // the calling thread also executes tasks
+    for (int i = 0; i < nThreads - 1; i++)
+      workers.emplace_back([this] { workerLoop(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    changed.notify_all();
+    for (auto& w : workers)
+      w.join();
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int size() const {
+    return workers.size() + 1;
+  }
+
+  /** Runs f(i) for i in [0, n) and waits for completion. The first exception
+   * thrown by a task is rethrown on the calling thread. */
+  void run(int n, const Task& f) {
+    if (n <= 0)
+      return;
+
+    if (n == 1 || workers.empty()) {
+      for (int i = 0; i < n; i++)
+        f(i);
+      return;
+    }
+
+    Job job;
+    job.task = &f;
+    job.numTasks = n;
+    job.nextTask = 0;
+    job.pendingTasks = n;
+
+    std::unique_lock<std::mutex> lock(m);
+    job.id = nextJobId++;
+    jobs.push_back(&job);
+    changed.notify_all();
+
+    while (job.pendingTasks > 0) {
+      Job* j;
+      int index;
+      if (claim(job.id, j, index)) {
+        execute(lock, j, index);
+        continue;
+      }
+      changed.wait(lock);
+    }
+    // all tasks were claimed, so the job is no longer listed
+    std::exception_ptr e = job.error;
+    lock.unlock();
+    if (e)
+      std::rethrow_exception(e);
+  }
+
+  static ThreadPool& global() {
+    static ThreadPool pool{defaultNumThreads()};
+    return pool;
+  }
+};
+
+namespace detail {
+// the ThreadLimit of the calling thread, 0 if none
+inline int& threadLimit() {
+  static thread_local int limit = 0;
+  return limit;
+}
+}
+
+/** The number of tasks parallel work started from this thread is split
+ * into: the pool size, unless capped by a ThreadLimit */
+inline int numThreads() {
+  int n = ThreadPool::global().size();
+  int limit = detail::threadLimit();
+  return limit > 0 ? std::min(n, limit) : n;
+}
+
+/** Caps numThreads() on the calling thread while in scope, so that the
+ * kernels it starts use at most n threads (e.g. to time them with fewer) */
+class ThreadLimit {
+  int previous;
+
+ public:
+  explicit ThreadLimit(int n) : previous(detail::threadLimit()) {
+    detail::threadLimit() = n;
+  }
+
+  ~ThreadLimit() {
+    detail::threadLimit() = previous;
+  }
+
+  ThreadLimit(const ThreadLimit&) = delete;
+  ThreadLimit& operator=(const ThreadLimit&) = delete;
+};
+
+/** Splits [begin, end) into at most numThreads() contiguous chunks of at least
+ * minChunk elements and calls f(chunkId, chunkBegin, chunkEnd) on each of them
+ * in parallel. Returns the number of chunks used. */
+template<typename F>
+int parallelForChunks(int64_t begin, int64_t end, F f, int64_t minChunk = 1) {
+  int64_t size = end - begin;
+  if (size <= 0)
+    return 0;
+  int64_t maxChunks = std::max<int64_t>(1, size / std::max<int64_t>(minChunk, 1));
+  int nChunks = std::min<int64_t>(numThreads(), maxChunks);
+  int64_t chunk = size / nChunks, rem = size % nChunks;
+  ThreadPool::global().run(nChunks, [&](int c) {
+    int64_t s = begin + c * chunk + std::min<int64_t>(c, rem);
+    int64_t e = s + chunk + (c < rem ? 1 : 0);
+    f(c, s, e);
+  });
+  return nChunks;
+}
+
+/** Calls f(i) for every i in [begin, end) in parallel. */
+template<typename F>
+void parallelFor(int64_t begin, int64_t end, F f, int64_t minChunk = 1) {
+  parallelForChunks(begin, end, [&](int, int64_t s, int64_t e) {
+    for (int64_t i = s; i < e; i++)
+      f(i);
+  }, minChunk);
+}
+
+}
+}
+
+#endif /* end of include guard: PARALLEL_HPP_K2Q7ZP1M */
@@ -0,0 +1,248 @@
+#include "Reordering.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+using namespace cask::reordering;
+
+namespace {
+
+// the adjacency lists of the graph of A + A^T, without self loops
+struct Graph {
+  std::vector<int> ptr, adj;
+
+  explicit Graph(const cask::CsrView& a) {
+    int n = a.n;
+    ptr.assign(n + 1, 0);
+    for (int i = 0; i < n; i++)
+      for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+        int j = a.col_ind[k];
+        if (j != i) {
+          ptr[i + 1]++;
+          ptr[j + 1]++;
+        }
+      }
+    std::partial_sum(ptr.begin(), ptr.end(), ptr.begin());
+    adj.resize(ptr[n]);
+    std::vector<int> pos(ptr.begin(), ptr.end() - 1);
+    for (int i = 0; i < n; i++)
+      for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+        int j = a.col_ind[k];
+        if (j != i) {
+          adj[pos[i]++] = j;
+          adj[pos[j]++] = i;
+        }
+      }
+
+    // removes the duplicates of symmetric entries, in place
+    int64_t out = 0;
+    for (int i = 0; i < n; i++) {
+      int b = ptr[i], e = ptr[i + 1];
+      std::sort(adj.begin() + b, adj.begin() + e);
+      ptr[i] = out;
+      for (int k = b; k < e; k++)
+        if (k == b || adj[k] != adj[k - 1])
+          adj[out++] = adj[k];
+    }
+    ptr[n] = out;
+    adj.resize(out);
+  }
+
+  int degree(int i) const {
+    return ptr[i + 1] - ptr[i];
+  }
+};
+
+// breadth first search from root over unvisited vertices; appends the
+// vertices to order, neighbours by increasing degree, and returns the number
+// of levels; mark is set to stamp on visited vertices
+int bfs(const Graph& g, int root, std::vector<int>& mark, int stamp,
+        std::vector<int>& order, int& lastLevelStart) {
+  size_t first = order.size();
+  order.push_back(root);
+  mark[root] = stamp;
+  int levels = 0;
+  size_t levelStart = first;
+  std::vector<int> neighbours;
+  while (levelStart < order.size()) {
+    size_t levelEnd = order.size();
+    lastLevelStart = levelStart;
+    for (size_t q = levelStart; q < levelEnd; q++) {
+      int v = order[q];
+      neighbours.clear();
+      for (int k = g.ptr[v]; k < g.ptr[v + 1]; k++)
+        if (mark[g.adj[k]] != stamp) {
+          mark[g.adj[k]] = stamp;
+          neighbours.push_back(g.adj[k]);
+        }
+      std::stable_sort(neighbours.begin(), neighbours.end(),
+                       [&](int x, int y) { return g.degree(x) < g.degree(y); });
+      order.insert(order.end(), neighbours.begin(), neighbours.end());
+    }
+    levelStart = levelEnd;
+    levels++;
+  }
+  return levels;
+}
+
+// a pseudo peripheral vertex of the component of start (George and Liu):
+// moves to a vertex of minimum degree in the last level while this increases
+// the eccentricity
+int pseudoPeripheral(const Graph& g, int start, std::vector<int>& mark, int& stamp) {
+  std::vector<int> order;
+  int root = start, lastLevel = 0;
+  int levels = bfs(g, root, mark, ++stamp, order, lastLevel);
+  for (;;) {
+    int best = order[lastLevel];
+    for (size_t q = lastLevel; q < order.size(); q++)
+      if (g.degree(order[q]) < g.degree(best))
+        best = order[q];
+    order.clear();
+    int l = bfs(g, best, mark, ++stamp, order, lastLevel);
+    if (l <= levels)
+      return root;
+    root = best;
+    levels = l;
+  }
+}
+
+}
+
+std::string cask::reordering::to_string(Method m) {
+  switch (m) {
+    case Method::None: return "none";
+    case Method::Rcm: return "rcm";
+    case Method::CacheBlocks: return "cacheblocks";
+    case Method::RcmCacheBlocks: return "rcm+cacheblocks";
+  }
+  throw std::invalid_argument("Unknown reordering method");
+}
+
+Method cask::reordering::parseMethod(const std::string& name) {
+  for (Method m : {Method::None, Method::Rcm, Method::CacheBlocks, Method::RcmCacheBlocks})
+    if (to_string(m) == name)
+      return m;
+  throw std::invalid_argument("Unknown reordering method " + name);
+}
+
+Permutation Permutation::identity(int n, int m) {
+  Permutation p;
+  p.rows.resize(n);
+  p.cols.resize(m);
+  std::iota(p.rows.begin(), p.rows.end(), 0);
+  std::iota(p.cols.begin(), p.cols.end(), 0);
+  return p;
+}
+
+std::vector<int> cask::reordering::reverseCuthillMcKee(const CsrView& a) {
+  if (a.n != a.m)
+    throw std::invalid_argument("Reverse Cuthill-McKee requires a square matrix, got " +
+        std::to_string(a.n) + " x " + std::to_string(a.m));
+  Graph g(a);
+  int n = a.n;
+
+  // components are started from their vertex of minimum degree, as found by
+  // scanning the vertices by increasing degree
+  std::vector<int> byDegree(n);
+  std::iota(byDegree.begin(), byDegree.end(), 0);
+  std::stable_sort(byDegree.begin(), byDegree.end(),
+                   [&](int x, int y) { return g.degree(x) < g.degree(y); });
+
+  std::vector<int> order, visited(n, 0), mark(n, 0);
+  order.reserve(n);
+  int stamp = 0;
+  for (int v : byDegree) {
+    if (visited[v])
+      continue;
+    // marks are only compared for equality, so searches of other components
+    // do not interfere; the final search must not revisit ordered vertices
+    int root = pseudoPeripheral(g, v, mark, stamp);
+    size_t first = order.size();
+    int lastLevel;
+    ++stamp;
+    for (size_t q = 0; q < first; q++)
+      mark[order[q]] = stamp;
+    bfs(g, root, mark, stamp, order, lastLevel);
+    for (size_t q = first; q < order.size(); q++)
+      visited[order[q]] = 1;
+  }
+  std::reverse(order.begin(), order.end());
+  return order;
+}
+
+std::vector<int> cask::reordering::firstTouchColumnOrder(const CsrView& a) {
+  std::vector<int> order;
+  order.reserve(a.m);
+  std::vector<char> used(a.m, 0);
+  for (int i = 0; i < a.n; i++)
+    for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+      int j = a.col_ind[k];
+      if (!used[j]) {
+        used[j] = 1;
+        order.push_back(j);
+      }
+    }
+  for (int j = 0; j < a.m; j++)
+    if (!used[j])
+      order.push_back(j);
+  return order;
+}
+
+Permutation cask::reordering::reorder(const CsrView& a, Method m) {
+  Permutation p = Permutation::identity(a.n, a.m);
+  switch (m) {
+    case Method::None:
+      break;
+    case Method::Rcm:
+      p.rows = reverseCuthillMcKee(a);
+      p.cols = p.rows;
+      break;
+    case Method::CacheBlocks:
+      p.cols = firstTouchColumnOrder(a);
+      break;
+    case Method::RcmCacheBlocks: {
+      p.rows = reverseCuthillMcKee(a);
+      Permutation rowsOnly = Permutation::identity(a.n, a.m);
+      rowsOnly.rows = p.rows;
+      CsrMatrix b = permute(a, rowsOnly);
+      p.cols = firstTouchColumnOrder(b);
+      break;
+    }
+  }
+  return p;
+}
+
+cask::CsrMatrix cask::reordering::permute(const CsrView& a, const Permutation& p) {
+  if (int(p.rows.size()) != a.n || int(p.cols.size()) != a.m)
+    throw std::invalid_argument("Permutation does not match the matrix dimensions");
+  std::vector<int> newCol(a.m);
+  for (int j = 0; j < a.m; j++)
+    newCol[p.cols[j]] = j;
+
+  std::vector<int> rowPtr(a.n + 1, 0);
+  for (int i = 0; i < a.n; i++) {
+    int r = p.rows[i];
+    rowPtr[i + 1] = rowPtr[i] + a.row_ptr[r + 1] - a.row_ptr[r];
+  }
+  std::vector<int> colInd(rowPtr[a.n]);
+  std::vector<double> values(rowPtr[a.n]);
+  cask::parallel::parallelFor(0, a.n, [&](int64_t i) {
+    int r = p.rows[i];
+    std::vector<std::pair<int, double>> row;
+    for (int k = a.row_ptr[r]; k < a.row_ptr[r + 1]; k++)
+      row.emplace_back(newCol[a.col_ind[k]], a.values[k]);
+    std::sort(row.begin(), row.end(),
+              [](const std::pair<int, double>& x, const std::pair<int, double>& y) {
+                return x.first < y.first;
+              });
+    for (size_t k = 0; k < row.size(); k++) {
+      colInd[rowPtr[i] + k] = row[k].first;
+      values[rowPtr[i] + k] = row[k].second;
+    }
+  }, 1024);
+  int nnzs = rowPtr[a.n];
+  return CsrMatrix(a.n, a.m, nnzs, std::move(values), std::move(colInd), std::move(rowPtr));
+}
@@ -0,0 +1,65 @@
+#ifndef REORDERING_HPP_8GQW3ZCV
+#define REORDERING_HPP_8GQW3ZCV
+
+#include "SparseMatrix.hpp"
+
+#include <string>
+#include <vector>
+
+namespace cask {
+
+/**
+ * Row and column reorderings which reduce the number of column blocks each
+ * row of a matrix touches, applied before the matrix is partitioned (see
+ * Spmv::setReordering). With fewer blocks per row, fewer vector loads,
+ * empty row cycles and reduction cycles are needed; this is the native
+ * counterpart of src/frontend/reorder.py.
+ */
+namespace reordering {
+
+enum class Method {
+  None,
+  // reverse Cuthill-McKee, applied to rows and columns
+  Rcm,
+  // columns numbered in order of first use by the rows, which groups the
+  // columns read by neighbouring rows in the same cache windows
+  CacheBlocks,
+  // Rcm, then CacheBlocks on the columns
+  RcmCacheBlocks
+};
+
+std::string to_string(Method m);
+
+/** The inverse of to_string() */
+Method parseMethod(const std::string& name);
+
+/** Row i of the reordered matrix is row rows[i] of the original one and its
+ * column j is column cols[j]; so y = A x is computed as y[rows[i]] = (B x')[i]
+ * with x'[j] = x[cols[j]]. */
+struct Permutation {
+  std::vector<int> rows, cols;
+
+  static Permutation identity(int n, int m);
+};
+
+/** Reverse Cuthill-McKee ordering of the graph of A + A^T, for a square
+ * matrix: each connected component is numbered by a breadth first search
+ * from a pseudo peripheral vertex, visiting neighbours by increasing degree,
+ * and the numbering is reversed. Returns new-to-old indices. */
+std::vector<int> reverseCuthillMcKee(const CsrView& a);
+
+/** Columns in order of first use by the rows of a, then unused columns, as
+ * new-to-old indices */
+std::vector<int> firstTouchColumnOrder(const CsrView& a);
+
+/** The permutation of the given method; CacheBlocks is the only method that
+ * accepts rectangular matrices */
+Permutation reorder(const CsrView& a, Method m);
+
+/** The matrix B with B(i, j) = A(p.rows[i], p.cols[j]), with sorted rows */
+CsrMatrix permute(const CsrView& a, const Permutation& p);
+
+}
+}
+
+#endif /* end of include guard: REORDERING_HPP_8GQW3ZCV */
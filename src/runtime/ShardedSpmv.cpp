@@ -0,0 +1,95 @@
+#include "ShardedSpmv.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace cask::spmv;
+
+std::vector<int> cask::spmv::shardRowSplits(const CsrView& mat, int nShards) {
+  std::vector<int64_t> weights(mat.n);
+  for (int i = 0; i < mat.n; i++)
+    weights[i] = mat.row_ptr[i + 1] - mat.row_ptr[i] + 1;
+  int parts = std::min(nShards, mat.n);
+  if (parts == 0)
+    return std::vector<int>(nShards + 1, 0);
+  std::vector<int> splits = balancedRowSplits(weights, parts);
+  splits.resize(nShards + 1, mat.n);
+  return splits;
+}
+
+ShardedSpmv::ShardedSpmv(const std::vector<runtime::GeneratedSpmvImplementation>& impls) {
+  for (const auto& impl : impls)
+    shards.push_back(std::unique_ptr<Spmv>(new Spmv(impl)));
+  if (shards.empty())
+    throw std::invalid_argument("ShardedSpmv requires at least one implementation");
+}
+
+ShardedSpmv::ShardedSpmv(std::vector<std::unique_ptr<Spmv>> _shards) : shards(std::move(_shards)) {
+  if (shards.empty())
+    throw std::invalid_argument("ShardedSpmv requires at least one shard");
+}
+
+std::vector<cask::CsrView> ShardedSpmv::slices(const CsrView& mat) const {
+  std::vector<CsrView> result;
+  for (size_t s = 0; s < shards.size(); s++)
+    result.push_back(mat.sliceRows(rowSplits[s], rowSplits[s + 1] - rowSplits[s]));
+  return result;
+}
+
+void ShardedSpmv::preprocess(const CsrView& mat) {
+  rowSplits = shardRowSplits(mat, shards.size());
+  matrixRows = mat.n;
+  std::vector<CsrView> views = slices(mat);
+  cask::parallel::ThreadPool::global().run(shards.size(), [&](int s) {
+    if (views[s].n > 0)
+      shards[s]->preprocess(views[s]);
+  });
+}
+
+void ShardedSpmv::analyse(const CsrView& mat) {
+  rowSplits = shardRowSplits(mat, shards.size());
+  matrixRows = mat.n;
+  std::vector<CsrView> views = slices(mat);
+  cask::parallel::ThreadPool::global().run(shards.size(), [&](int s) {
+    if (views[s].n > 0)
+      shards[s]->analyse(views[s]);
+  });
+}
+
+cask::Vector ShardedSpmv::spmv(const Vector& v) {
+  Vector y(matrixRows);
+  multiply(v.data.data(), y.data.data());
+  return y;
+}
+
+void ShardedSpmv::multiply(const double* x, double* y) {
+  if (rowSplits.empty())
+    throw std::runtime_error("ShardedSpmv::multiply called before preprocess");
+  // each shard writes its own rows of y
+  cask::parallel::ThreadPool::global().run(shards.size(), [&](int s) {
+    if (rowSplits[s + 1] > rowSplits[s])
+      shards[s]->multiply(x, y + rowSplits[s]);
+  });
+}
+
+double ShardedSpmv::getEstimatedClockCycles() {
+  double cycles = 0;
+  for (size_t s = 0; s < shards.size(); s++)
+    if (rowSplits[s + 1] > rowSplits[s])
+      cycles = std::max(cycles, shards[s]->getEstimatedClockCycles());
+  return cycles;
+}
+
+double ShardedSpmv::getEstimatedGFlops(const model::DeviceModel& deviceModel) {
+  double flops = 0, seconds = 0;
+  for (size_t s = 0; s < shards.size(); s++) {
+    double shardFlops = shards[s]->getGFlopsCount();
+    if (rowSplits[s + 1] == rowSplits[s] || shardFlops == 0)
+      continue;
+    flops += shardFlops;
+    seconds = std::max(seconds, shardFlops / shards[s]->getEstimatedGFlops(deviceModel));
+  }
+  return seconds == 0 ? 0 : flops / seconds;
+}
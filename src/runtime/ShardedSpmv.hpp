@@ -0,0 +1,78 @@
+#ifndef SHARDEDSPMV_HPP_H4T9QZ2M
+#define SHARDEDSPMV_HPP_H4T9QZ2M
+
+#include "Spmv.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace cask {
+  namespace spmv {
+
+    /** Splits the rows of mat into nShards contiguous ranges of balanced
+     * work, counting the nonzeros of each row and one cycle per row (so
+     * empty rows are not free); returns the first row of each range, then
+     * the number of rows, as balancedRowSplits(). If there are fewer rows
+     * than shards, the last shards are empty. */
+    std::vector<int> shardRowSplits(const CsrView& mat, int nShards);
+
+    /**
+     * An SpMV of a matrix split by rows into shards, e.g. for matrices which
+     * exceed the rows or the DRAM of one DFE. Each shard is multiplied by its
+     * own Spmv, which drives its own device and balances the partitions of
+     * its pipes as usual; shards are run concurrently, from host threads,
+     * and each multiplies its rows by the whole vector.
+     */
+    class ShardedSpmv {
+      std::vector<std::unique_ptr<Spmv>> shards;
+      std::vector<int> rowSplits;
+      int matrixRows = 0;
+
+      // the shards of mat, by the current splits
+      std::vector<CsrView> slices(const CsrView& mat) const;
+
+      public:
+        /** One shard per implementation; each must drive another device */
+        explicit ShardedSpmv(const std::vector<runtime::GeneratedSpmvImplementation>& impls);
+
+        /** e.g. copies of an architecture, for design space exploration */
+        explicit ShardedSpmv(std::vector<std::unique_ptr<Spmv>> _shards);
+
+        int numShards() const {
+          return shards.size();
+        }
+
+        Spmv& shard(int i) {
+          return *shards.at(i);
+        }
+
+        /** The first row of each shard, then the number of rows */
+        const std::vector<int>& getRowSplits() const {
+          return rowSplits;
+        }
+
+        /** Splits the matrix (see shardRowSplits()) and preprocesses each
+         * shard, in parallel; a shard of more rows than its implementation
+         * supports is multiplied in row passes (see Spmv::numRowPasses()) */
+        void preprocess(const CsrView& mat);
+
+        /** As preprocess(), but only analyses the shards, for estimates */
+        void analyse(const CsrView& mat);
+
+        /** Multiplies the preprocessed matrix by v on all devices */
+        Vector spmv(const Vector& v);
+
+        /** y = A * x, as Spmv::multiply() */
+        void multiply(const double* x, double* y);
+
+        /** Of the slowest shard */
+        double getEstimatedClockCycles();
+
+        /** The flops of all shards over the estimated time of the slowest,
+         * on the given device (of each shard) */
+        double getEstimatedGFlops(const model::DeviceModel& deviceModel);
+    };
+  }
+}
+
+#endif /* end of include guard: SHARDEDSPMV_HPP_H4T9QZ2M */
@@ -0,0 +1,192 @@
+#include "SolverBenchmark.hpp"
+#include "SparseLinearSolvers.hpp"
+
+#include <dfesnippets/Timing.hpp>
+
+#include <Eigen/IterativeLinearSolvers>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+using namespace cask::benchmark;
+using namespace cask::sparse_linear_solvers;
+
+namespace {
+
+const int maxIterations = 2000;
+const double tolerance = 1E-5;
+
+template<typename Precon>
+SolverVariant cgVariant(const std::string& preconditioner) {
+  SolverVariant v;
+  v.solver = "cg";
+  v.preconditioner = preconditioner;
+  v.setup = [](const cask::SymCsrMatrix& a) -> SolveFunction {
+    std::shared_ptr<Precon> precon(new Precon(a.matrix));
+    std::shared_ptr<CgWorkspace> w(new CgWorkspace());
+    w->prepare(a.matrix);
+    const cask::CsrMatrix* m = &a.matrix;
+    return [precon, w, m](const double* rhs, double* x, int& iterations) {
+      return pcg<double, Precon>(*m, *precon, *w, rhs, x, iterations);
+    };
+  };
+  return v;
+}
+
+template<typename Precon>
+SolverVariant pipelinedVariant(const std::string& preconditioner) {
+  SolverVariant v;
+  v.solver = "pipelined_cg";
+  v.preconditioner = preconditioner;
+  v.setup = [](const cask::SymCsrMatrix& a) -> SolveFunction {
+    std::shared_ptr<Precon> precon(new Precon(a.matrix));
+    SymCsrOperator op(a.matrix);
+    return [precon, op](const double* rhs, double* x, int& iterations) mutable {
+      return pipelinedCg(op, *precon, op.size(), rhs, x, iterations, maxIterations, tolerance);
+    };
+  };
+  return v;
+}
+
+template<typename Precon>
+SolverVariant sStepVariant(const std::string& preconditioner, int s) {
+  SolverVariant v;
+  v.solver = "sstep" + std::to_string(s) + "_cg";
+  v.preconditioner = preconditioner;
+  v.setup = [s](const cask::SymCsrMatrix& a) -> SolveFunction {
+    std::shared_ptr<Precon> precon(new Precon(a.matrix));
+    SymCsrOperator op(a.matrix);
+    return [precon, op, s](const double* rhs, double* x, int& iterations) mutable {
+      return sStepCg(op, *precon, op.size(), rhs, x, iterations, s, maxIterations, tolerance);
+    };
+  };
+  return v;
+}
+
+// an Eigen solver of the explicitly symmetric matrix, which it refers to
+template<typename S>
+struct EigenSystem {
+  Eigen::SparseMatrix<double> a;
+  S solver;
+};
+
+template<typename S>
+SolverVariant eigenVariant(const std::string& solver) {
+  SolverVariant v;
+  v.solver = solver;
+  v.preconditioner = "diagonal";
+  v.setup = [](const cask::SymCsrMatrix& a) -> SolveFunction {
+    cask::CsrMatrix full = a.explicitSymmetric();
+    std::vector<Eigen::Triplet<double>> entries;
+    entries.reserve(full.nnzs);
+    for (int i = 0; i < full.n; i++)
+      for (int k = full.row_ptr[i]; k < full.row_ptr[i + 1]; k++)
+        entries.push_back(Eigen::Triplet<double>(i, full.col_ind[k], full.values[k]));
+    std::shared_ptr<EigenSystem<S>> e(new EigenSystem<S>());
+    e->a.resize(full.n, full.m);
+    e->a.setFromTriplets(entries.begin(), entries.end());
+    e->solver.setMaxIterations(maxIterations);
+    e->solver.compute(e->a);
+    return [e](const double* rhs, double* x, int& iterations) {
+      int n = e->a.rows();
+      Eigen::Map<const Eigen::VectorXd> b(rhs, n);
+      Eigen::Map<Eigen::VectorXd> xm(x, n);
+      // Eigen's tolerance is relative to ||b||
+      double bnorm = b.norm();
+      e->solver.setTolerance(bnorm > 0 ? tolerance / bnorm : tolerance);
+      Eigen::VectorXd guess = xm;
+      xm = e->solver.solveWithGuess(b, guess);
+      iterations = e->solver.iterations();
+      return e->solver.info() == Eigen::Success;
+    };
+  };
+  return v;
+}
+
+// e.g. the residual of a diverged solve, which JSON has no number for
+std::string jsonNumber(double v) {
+  if (!std::isfinite(v))
+    return "null";
+  std::stringstream s;
+  s << v;
+  return s.str();
+}
+
+std::vector<SolverVariant> defaultVariants() {
+  std::vector<SolverVariant> v;
+  v.push_back(cgVariant<IdentityPreconditioner>("none"));
+  v.push_back(cgVariant<ILUPreconditioner>("ilu0"));
+  v.push_back(pipelinedVariant<IdentityPreconditioner>("none"));
+  v.push_back(pipelinedVariant<ILUPreconditioner>("ilu0"));
+  v.push_back(sStepVariant<IdentityPreconditioner>("none", 4));
+  v.push_back(sStepVariant<ILUPreconditioner>("ilu0", 4));
+  v.push_back(eigenVariant<Eigen::ConjugateGradient<Eigen::SparseMatrix<double>, Eigen::Lower | Eigen::Upper>>("eigen_cg"));
+  v.push_back(eigenVariant<Eigen::BiCGSTAB<Eigen::SparseMatrix<double>>>("eigen_bicgstab"));
+  return v;
+}
+
+}
+
+std::vector<SolverVariant>& cask::benchmark::solverRegistry() {
+  static std::vector<SolverVariant> variants = defaultVariants();
+  return variants;
+}
+
+void cask::benchmark::registerSolver(const SolverVariant& v) {
+  for (const auto& r : solverRegistry())
+    if (r.name() == v.name())
+      throw std::invalid_argument("Solver " + v.name() + " is already registered");
+  solverRegistry().push_back(v);
+}
+
+SolverRun cask::benchmark::runSolver(const SolverVariant& v, const SymCsrMatrix& a,
+                                     const std::vector<double>& rhs, const std::string& matrix,
+                                     int repetitions) {
+  if (int(rhs.size()) != a.n)
+    throw std::invalid_argument("runSolver rhs length " + std::to_string(rhs.size()) +
+                                " != matrix rows " + std::to_string(a.n));
+  SolverRun r{matrix, v.solver, v.preconditioner, a.n, a.nnzs,
+              std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), 0, false, 0};
+  Vector x(a.n);
+  for (int k = 0; k < std::max(1, repetitions); k++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    SolveFunction solve = v.setup(a);
+    r.setupSeconds = std::min(r.setupSeconds, dfesnippets::timing::clock_diff(start));
+
+    std::fill(x.data.begin(), x.data.end(), 0.0);
+    int iterations = 0;
+    start = std::chrono::high_resolution_clock::now();
+    r.converged = solve(rhs.data(), x.data.data(), iterations);
+    r.solveSeconds = std::min(r.solveSeconds, dfesnippets::timing::clock_diff(start));
+    r.iterations = iterations;
+  }
+
+  Vector ax = a.dot(x);
+  double rr = 0, bb = 0;
+  for (int i = 0; i < a.n; i++) {
+    rr += (rhs[i] - ax[i]) * (rhs[i] - ax[i]);
+    bb += rhs[i] * rhs[i];
+  }
+  r.relativeResidual = std::sqrt(rr) / (bb > 0 ? std::sqrt(bb) : 1.0);
+  return r;
+}
+
+void cask::benchmark::writeJson(const std::vector<SolverRun>& runs, std::ostream& s) {
+  s << "[";
+  for (size_t i = 0; i < runs.size(); i++) {
+    const SolverRun& r = runs[i];
+    s << (i == 0 ? "\n" : ",\n")
+      << "{\"matrix\":\"" << r.matrix << "\",\"solver\":\"" << r.solver
+      << "\",\"preconditioner\":\"" << r.preconditioner << "\",\"n\":" << r.n
+      << ",\"nnzs\":" << r.nnzs << ",\"setupSeconds\":" << r.setupSeconds
+      << ",\"solveSeconds\":" << r.solveSeconds << ",\"iterations\":" << r.iterations
+      << ",\"secondsPerIteration\":" << r.secondsPerIteration()
+      << ",\"converged\":" << (r.converged ? "true" : "false")
+      << ",\"secondsToTolerance\":" << r.secondsToTolerance()
+      << ",\"relativeResidual\":" << jsonNumber(r.relativeResidual) << "}";
+  }
+  s << "]\n";
+}
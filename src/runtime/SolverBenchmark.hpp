@@ -0,0 +1,77 @@
+#ifndef SOLVERBENCHMARK_HPP_K3W8ZP1D
+#define SOLVERBENCHMARK_HPP_K3W8ZP1D
+
+#include "SparseMatrix.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace cask {
+  namespace benchmark {
+
+    /** Solves A x = b, from the initial guess in x; sets the number of
+     * iterations and returns whether the solver converged */
+    using SolveFunction = std::function<bool(const double* rhs, double* x, int& iterations)>;
+
+    /**
+     * A solver and preconditioner of the runtime. setup builds whatever the
+     * solver needs from the matrix (e.g. the preconditioner), which is a
+     * symmetric matrix with only its lower triangle stored, the convention
+     * of sparse_linear_solvers::pcg(); the returned function solves with it.
+     * All solvers stop at 2000 iterations, or once the residual norm drops
+     * below 1E-5 (in the norm of the preconditioner for the CG variants of
+     * the runtime, the 2 norm for the Eigen solvers).
+     */
+    struct SolverVariant {
+      std::string solver, preconditioner;
+      std::function<SolveFunction(const SymCsrMatrix& a)> setup;
+
+      std::string name() const {
+        return solver + "/" + preconditioner;
+      }
+    };
+
+    /** The registered variants, initially the CG variants of
+     * SparseLinearSolvers.hpp with each of their preconditioners and the
+     * Eigen solvers; registerSolver() adds more */
+    std::vector<SolverVariant>& solverRegistry();
+
+    void registerSolver(const SolverVariant& v);
+
+    /** The measurements of a variant on a system */
+    struct SolverRun {
+      std::string matrix, solver, preconditioner;
+      int n;
+      int64_t nnzs;
+      // of the fastest of the repetitions
+      double setupSeconds, solveSeconds;
+      int iterations;
+      bool converged;
+      // ||b - A x|| / ||b||, in fp64 on the CPU
+      double relativeResidual;
+
+      double secondsPerIteration() const {
+        return solveSeconds / std::max(1, iterations);
+      }
+
+      /** The time to set up and solve to the tolerance, or a negative value
+       * if the solver did not converge */
+      double secondsToTolerance() const {
+        return converged ? setupSeconds + solveSeconds : -1;
+      }
+    };
+
+    /** Sets up and solves A x = b from x = 0, repetitions times */
+    SolverRun runSolver(const SolverVariant& v, const SymCsrMatrix& a, const std::vector<double>& rhs,
+                        const std::string& matrix, int repetitions = 1);
+
+    /** The runs, as a JSON list of objects */
+    void writeJson(const std::vector<SolverRun>& runs, std::ostream& s);
+  }
+}
+
+#endif /* end of include guard: SOLVERBENCHMARK_HPP_K3W8ZP1D */
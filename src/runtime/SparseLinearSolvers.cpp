@@ -1,5 +1,7 @@
 #include "Utils.hpp"
 #include "SparseLinearSolvers.hpp"
+#include "Cg.hpp"
+#include "Converters.hpp"
 
 //extern "C" {
 //#include <SuiteSparse_config.h>
@@ -15,13 +17,14 @@
 #include <Eigen/Sparse>
 //#include <Eigen/UmfPackSupport>
 
-Eigen::VectorXd solveBICG(
-    const Eigen::SparseMatrix<double>& A,
-    const Eigen::VectorXd& b
-   )
+using cask::sparse_linear_solvers::EigenCsrRef;
+using cask::sparse_linear_solvers::EigenVectorRef;
+
+// the solvers refer to A, in its own (CSR) storage
+Eigen::VectorXd solveBICG(const EigenCsrRef& A, const EigenVectorRef& b)
 {
   using namespace Eigen;
-  BiCGSTAB<SparseMatrix<double>> solver(A);
+  BiCGSTAB<cask::converters::EigenCsrMatrix> solver(A);
   return solver.solve(b);
 }
 
@@ -50,18 +53,34 @@ Eigen::VectorXd solveLU(
   //return solver.solve(b);
 //}
 
-Eigen::VectorXd solveCG(
-    const Eigen::SparseMatrix<double>& A,
-    const Eigen::VectorXd& b)
+Eigen::VectorXd solveCG(const EigenCsrRef& A, const EigenVectorRef& b)
 {
-  Eigen::ConjugateGradient<Eigen::SparseMatrix<double>> cg;
+  Eigen::ConjugateGradient<cask::converters::EigenCsrMatrix> cg;
   cg.compute(A);
   return cg.solve(b);
 }
 
+cask::Vector cask::sparse_linear_solvers::Solver::solve(const CsrView& A, const Vector& b)
+{
+  Eigen::VectorXd x = solve(converters::asEigen(A), converters::asEigen(b));
+  return Vector(converters::eigenVectorToStdVector(x));
+}
+
 Eigen::VectorXd cask::sparse_linear_solvers::EigenSolver::solve(
-    const Eigen::SparseMatrix<double>& A,
-    const Eigen::VectorXd& b)
+    const EigenCsrRef& A,
+    const EigenVectorRef& b)
 {
   return solveBICG(A, b);
 }
+
+Eigen::VectorXd cask::sparse_linear_solvers::DfeCgSolver::solve(
+    const EigenCsrRef& A,
+    const EigenVectorRef& b)
+{
+  // partitioned in place; the host only copies A if the device values are in
+  // reduced precision
+  cask::solvers::Cg cg{cask::spmv::Spmv(impl)};
+  cg.preprocess(converters::asCsrView(A));
+  Vector x = cg.solve(std::vector<double>(b.data(), b.data() + b.size()));
+  return converters::asEigen(x);
+}
@@ -1,7 +1,12 @@
 #ifndef SPARSE_LINEAR_SOLVERS_HPP
 #define SPARSE_LINEAR_SOLVERS_HPP
 
+#include "CpuBlas1.hpp"
+#include "CpuTriangular.hpp"
+#include "GeneratedImplSupport.hpp"
+#include "Parallel.hpp"
 #include "SparseMatrix.hpp"
+#include "Trace.hpp"
 #include "Utils.hpp"
 
 #ifdef USEMKL
@@ -10,13 +15,17 @@
 #endif
 
 #include <Eigen/Sparse>
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <iterator>
 #include <map>
 #include <memory>
+#include <stdexcept>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -24,220 +33,1030 @@
 namespace cask {
   namespace sparse_linear_solvers {
 
+    /** A CSR matrix whose storage the solvers may share: binding it to an
+     * Eigen CSR matrix or to converters::asEigen() of a CsrView does not
+     * copy it, unlike matrices in other formats */
+    using EigenCsrRef = Eigen::Ref<const Eigen::SparseMatrix<double, Eigen::RowMajor, int32_t>>;
+    using EigenVectorRef = Eigen::Ref<const Eigen::VectorXd>;
+
     class Solver {
       public:
-        virtual void analyze(
-            const Eigen::SparseMatrix<double> &A) {
+        virtual void analyze(const EigenCsrRef& A) {
         }
 
-        virtual void preprocess(
-            const Eigen::SparseMatrix<double> &A) {
-  }
+        virtual void preprocess(const EigenCsrRef& A) {
+        }
+
+        virtual Eigen::VectorXd solve(const EigenCsrRef& A, const EigenVectorRef& b) = 0;
+
+        /** solve() on the storage of a CSR matrix and vector; only the
+         * solution is copied */
+        Vector solve(const CsrView& A, const Vector& b);
 
-        virtual Eigen::VectorXd solve(
-            const Eigen::SparseMatrix<double>& A,
-            const Eigen::VectorXd& b) = 0;
+        virtual ~Solver() {}
     };
 
     class EigenSolver: public Solver {
       public:
-        virtual Eigen::VectorXd solve(
-            const Eigen::SparseMatrix<double>& A,
-            const Eigen::VectorXd& b);
+        using Solver::solve;
+
+        virtual Eigen::VectorXd solve(const EigenCsrRef& A, const EigenVectorRef& b);
     };
 
+    /** CG with the SpMV on the given DFE implementation, see solvers::Cg;
+     * A must be symmetric, with all entries stored */
     class DfeCgSolver: public Solver {
+        runtime::GeneratedSpmvImplementation impl;
       public:
-        virtual Eigen::VectorXd solve(
-            const Eigen::SparseMatrix<double>& A,
-            const Eigen::VectorXd& b);
+        using Solver::solve;
+
+        explicit DfeCgSolver(const runtime::GeneratedSpmvImplementation& _impl) : impl(_impl) {}
+
+        virtual Eigen::VectorXd solve(const EigenCsrRef& A, const EigenVectorRef& b);
     };
 
     class DfeBiCgSolver: public Solver {
       public:
-        virtual Eigen::VectorXd solve(
-            const Eigen::SparseMatrix<double>& A,
-            const Eigen::VectorXd& b);
+        using Solver::solve;
+
+        virtual Eigen::VectorXd solve(const EigenCsrRef& A, const EigenVectorRef& b);
     };
 
 // Equivalent to un-precontitioned CG
 class IdentityPreconditioner {
  public:
-  IdentityPreconditioner(const CsrMatrix& a) {
+  IdentityPreconditioner(const CsrMatrix& a) : n(a.n) {
       // nothing to do, but maintain a consistent interface
   }
 
+  explicit IdentityPreconditioner(int _n) : n(_n) {}
+
   virtual std::vector<double> apply(const std::vector<double>& x) {
       return x;
   }
-};
 
-#ifdef USEMKL
+  // z = r, into a caller provided buffer
+  virtual void apply(const double* r, double* z) {
+      std::copy(r, r + n, z);
+  }
+
+ private:
+  int n;
+};
 
 class ILUPreconditioner {
  public:
-  DokMatrix pc;
-  CsrMatrix l, u; // lower and upper factors stored independently
-
-  // cached values, row and col ptrs; the latter two are 1 based indexed, as required by unitrrsolve
-  std::vector<double> Lvalues, Uvalues;
-  std::vector<int> Lrow_ptr, Lcol_ind, Urow_ptr, Ucol_ind;
-  std::vector<double> res;
+  // the ILU(0) factors, stored in place: L is the lower and U the upper
+  // triangle of pc, both including the diagonal
+  CsrMatrix pc;
 
   // pre - a is a symmetric matrix
-  ILUPreconditioner(const CsrMatrix &a) {
+  ILUPreconditioner(const CsrMatrix &a) : pc(factorise(a)), solver(pc.view()) {
+  }
+
+  // the solver refers to the storage of pc
+  ILUPreconditioner(const ILUPreconditioner&) = delete;
+  ILUPreconditioner& operator=(const ILUPreconditioner&) = delete;
+
+  virtual std::vector<double> apply(const std::vector<double>& x) {
+      std::vector<double> z(x.size());
+      apply(x.data(), z.data());
+      return z;
+  }
+
+  // z = M^-1 r, into a caller provided buffer of pc.n entries; r and z may
+  // be the same array
+  virtual void apply(const double* r, double* z) {
+      // solve z = M^-1 r <==> Mz = r <==> LUz = r
+      // solve: Ly = r
+      solver.solveLower(r, z);
+      // then solve Uz = y
+      solver.solveUpper(z, z);
+  }
+
+  void pretty_print() {
+      pc.pretty_print();
+  }
+
+ private:
+  cask::cpu::TriangularSolver solver;
+
+  static CsrMatrix factorise(const CsrMatrix& a) {
       if (!a.isSymmetric())
           throw std::invalid_argument("ILUPreconditioner only supports symmetric CSR matrices");
-      pc = a.toDok();
-      for (int i = 1; i < a.n; i++) {
-          if (pc.dok.count(i) == 0)
-              continue;
-
-          for (auto&p : pc.dok[i]) {
-            int k = p.first;
-            if (k >= i)
-                break;
-            if (!pc.isNnz(k, k))
-              continue;
-            pc.dok[i][k] = pc.dok[i][k] / pc.dok[k][k];
-            double beta = pc.dok[i][k];
-
-            for (auto&p : pc.dok[i]) {
-              int j = p.first;
-              if (j < k + 1)
+      CsrMatrix f = a;
+      cask::cpu::ilu0(f);
+      return f;
+  }
+};
+
+/** y = A * x for a symmetric matrix of which only the lower triangle is stored
+ * (the convention of pcg), using the multithreaded CPU kernel. */
+class SymCsrOperator {
+  CsrView lower;
+
+ public:
+  explicit SymCsrOperator(const CsrMatrix& a) : lower(a.view()) {}
+
+  int size() const {
+      return lower.n;
+  }
+
+  void operator()(const double* x, double* y) const {
+      cask::cpu::symSpmv(lower, x, y);
+  }
+};
+
+namespace detail {
+
+// below this many rows the vector kernels of the CG variants run serially
+const int64_t minParallelRows = 4096;
+
+// Computes k sums over the rows in [0, n) in a single pass: f(i, acc) adds the
+// terms of row i to acc[0 .. k). Rows are split in contiguous chunks whose
+// partial sums are reduced in order, so results are reproducible for a given
+// number of threads.
+template<typename F>
+void fusedSums(int n, int k, double* sums, F f) {
+    std::vector<double> partial(cask::parallel::numThreads() * k, 0.0);
+    int nChunks = cask::parallel::parallelForChunks(0, n, [&](int c, int64_t b, int64_t e) {
+        double* acc = &partial[c * k];
+        for (int64_t i = b; i < e; i++)
+            f(i, acc);
+    }, minParallelRows);
+    std::fill(sums, sums + k, 0.0);
+    for (int c = 0; c < nChunks; c++)
+        for (int j = 0; j < k; j++)
+            sums[j] += partial[c * k + j];
+}
+
+// calls f(i) for all rows in [0, n)
+template<typename F>
+void forEachRow(int n, F f) {
+    cask::parallel::parallelForChunks(0, n, [&](int, int64_t b, int64_t e) {
+        for (int64_t i = b; i < e; i++)
+            f(i);
+    }, minParallelRows);
+}
+
+}
+
+/** The diagonal of a; throws std::invalid_argument if it has a zero */
+inline std::vector<double> diagonalOf(const CsrMatrix& a) {
+    std::vector<double> d(a.n, 0.0);
+    for (int i = 0; i < a.n; i++)
+        for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++)
+            if (a.col_ind[k] == i)
+                d[i] = a.values[k];
+    for (int i = 0; i < a.n; i++)
+        if (d[i] == 0)
+            throw std::invalid_argument("zero on the diagonal in row " + std::to_string(i));
+    return d;
+}
+
+/** An upper bound to the eigenvalues of D^-1 A, from the Gershgorin circles,
+ * for the symmetric matrix of which a holds the lower triangle (as for pcg);
+ * its diagonal D must be positive */
+inline double jacobiScaledBound(const CsrMatrix& a) {
+    std::vector<double> d = diagonalOf(a), sums(a.n, 0.0);
+    for (int i = 0; i < a.n; i++)
+        for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+            int j = a.col_ind[k];
+            if (j > i)
                 continue;
+            sums[i] += std::fabs(a.values[k]);
+            if (j < i)
+                sums[j] += std::fabs(a.values[k]);
+        }
+    double bound = 0;
+    for (int i = 0; i < a.n; i++) {
+        if (!(d[i] > 0))
+            throw std::invalid_argument("jacobiScaledBound: negative diagonal in row " + std::to_string(i));
+        bound = std::max(bound, sums[i] / d[i]);
+    }
+    return bound;
+}
 
-              if (pc.isNnz(k, j)) {
-                pc.dok[i][j] = pc.dok[i][j] - pc.dok[k][j] * beta;
-              }
-            }
+/** M = diag(A). Each row is independent, so this parallelises fully; it
+ * only needs the diagonal of a, which must not be zero. */
+class JacobiPreconditioner {
+ public:
+  std::vector<double> invDiag;
+
+  JacobiPreconditioner(const CsrMatrix& a) : invDiag(diagonalOf(a)) {
+      for (double& v : invDiag)
+          v = 1 / v;
+  }
+
+  virtual std::vector<double> apply(const std::vector<double>& x) {
+      std::vector<double> z(x.size());
+      apply(x.data(), z.data());
+      return z;
+  }
+
+  // z = M^-1 r; r and z may be the same array
+  virtual void apply(const double* r, double* z) {
+      detail::forEachRow(int(invDiag.size()), [&](int64_t i) { z[i] = r[i] * invDiag[i]; });
+  }
+};
+
+/**
+ * M = the diagonal blocks of A, each factorised exactly (sparse LDL^T), for
+ * the symmetric matrix of which a holds the lower triangle (the entries
+ * above the diagonal are ignored, so all may be stored). The blocks are
+ * independent and solved concurrently.
+ *
+ * blockStarts holds the first row of each block, then the number of rows,
+ * e.g. Spmv::getRowSplits() of a, so that each block is the diagonal block
+ * of the partition of a pipe; empty blocks and rows past those of a are
+ * ignored. The default constructor (for pcg()) splits the rows evenly,
+ * in one block per thread.
+ */
+class BlockJacobiPreconditioner {
+  using Factor = Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>, Eigen::Lower>;
+  std::vector<int> starts;
+  std::vector<std::unique_ptr<Factor>> factors;
+
+  static std::vector<int> evenBlocks(int n, int numBlocks) {
+      std::vector<int> s;
+      for (int b = 0; b <= numBlocks; b++)
+          s.push_back(int(int64_t(n) * b / numBlocks));
+      return s;
+  }
+
+ public:
+  BlockJacobiPreconditioner(const CsrMatrix& a) :
+      BlockJacobiPreconditioner(a, evenBlocks(a.n, std::max(1, std::min(a.n, cask::parallel::numThreads())))) {}
+
+  BlockJacobiPreconditioner(const CsrMatrix& a, const std::vector<int>& blockStarts) {
+      if (blockStarts.empty() || blockStarts.front() != 0 || !std::is_sorted(blockStarts.begin(), blockStarts.end()))
+          throw std::invalid_argument("BlockJacobiPreconditioner: block starts must ascend from 0");
+      starts.push_back(0);
+      for (int s : blockStarts)
+          if (std::min(s, a.n) > starts.back())
+              starts.push_back(std::min(s, a.n));
+      if (starts.back() != a.n)
+          throw std::invalid_argument("BlockJacobiPreconditioner: the blocks hold " + std::to_string(starts.back()) +
+              " of " + std::to_string(a.n) + " rows");
+
+      factors.resize(starts.size() - 1);
+      cask::parallel::parallelForChunks(0, factors.size(), [&](int, int64_t first, int64_t last) {
+          for (int64_t b = first; b < last; b++) {
+              int begin = starts[b], size = starts[b + 1] - begin;
+              std::vector<Eigen::Triplet<double>> entries;
+              for (int i = begin; i < begin + size; i++)
+                  for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++)
+                      if (a.col_ind[k] >= begin && a.col_ind[k] <= i)
+                          entries.emplace_back(i - begin, a.col_ind[k] - begin, a.values[k]);
+              Eigen::SparseMatrix<double> block(size, size);
+              block.setFromTriplets(entries.begin(), entries.end());
+              factors[b].reset(new Factor(block));
+              if (factors[b]->info() != Eigen::Success)
+                  throw std::invalid_argument("BlockJacobiPreconditioner: block " + std::to_string(b) +
+                      " is singular");
+          }
+      });
+  }
+
+  int numBlocks() const {
+      return int(factors.size());
+  }
+
+  virtual std::vector<double> apply(const std::vector<double>& x) {
+      std::vector<double> z(x.size());
+      apply(x.data(), z.data());
+      return z;
+  }
+
+  // z = M^-1 r
+  virtual void apply(const double* r, double* z) {
+      cask::parallel::parallelForChunks(0, factors.size(), [&](int, int64_t first, int64_t last) {
+          for (int64_t b = first; b < last; b++) {
+              int begin = starts[b], size = starts[b + 1] - begin;
+              Eigen::Map<Eigen::VectorXd>(z + begin, size) =
+                  factors[b]->solve(Eigen::Map<const Eigen::VectorXd>(r + begin, size));
           }
+      });
+  }
+};
+
+/**
+ * Chebyshev polynomial preconditioner: z = p(A) r is degree steps of the
+ * Jacobi preconditioned Chebyshev iteration for A z = r from z = 0, which
+ * minimises the error over eigenvalues of D^-1 A in [lmax / eigRatio, lmax].
+ * For lmax at least the largest eigenvalue, M^-1 = p(A) is SPD.
+ *
+ * Applying it takes degree - 1 products by A and no triangular solve, so it
+ * runs at the speed of the SpMV: Op computes op(x, y), y = A x, e.g.
+ * SymCsrOperator or, with the matrix resident on a DFE,
+ * solvers::DfeSpmvOperator. Fewer CG iterations then trade their inner
+ * products for SpMVs.
+ */
+template<typename Op = SymCsrOperator>
+class ChebyshevPreconditioner {
+  Op op;
+  std::vector<double> invDiag;
+  double lmin, lmax;
+  int degree;
+  std::vector<double> res, d, ad;
+
+ public:
+  /** For the symmetric matrix of which a holds the lower triangle, with lmax
+   * the Gershgorin bound */
+  ChebyshevPreconditioner(const CsrMatrix& a, int _degree = 3, double eigRatio = 30) :
+      ChebyshevPreconditioner(Op{a}, diagonalOf(a), jacobiScaledBound(a), _degree, eigRatio) {}
+
+  /** With the products of op, the diagonal of its matrix and an upper bound
+   * to the eigenvalues of D^-1 A */
+  ChebyshevPreconditioner(Op _op, std::vector<double> diagonal, double _lmax, int _degree = 3,
+                          double eigRatio = 30) :
+      op(std::move(_op)), invDiag(std::move(diagonal)), lmin(_lmax / eigRatio), lmax(_lmax), degree(_degree),
+      res(invDiag.size()), d(invDiag.size()), ad(invDiag.size()) {
+      if (degree < 1 || !(eigRatio > 1) || !(lmax > 0))
+          throw std::invalid_argument("ChebyshevPreconditioner needs degree >= 1, eigRatio > 1 and lmax > 0");
+      for (double& v : invDiag)
+          v = 1 / v;
+  }
+
+  double maxEigenvalue() const {
+      return lmax;
+  }
+
+  virtual std::vector<double> apply(const std::vector<double>& x) {
+      std::vector<double> z(x.size());
+      apply(x.data(), z.data());
+      return z;
+  }
 
-          // simplified original version of the inner loops
-          // for (int k = 0; k < i; k++) {
-          //     // update pivot - a[i,k] = a[i, k] / a[k, k]
-          //     if (pc.isNnz(i, k) && pc.isNnz(k, k)) {
-          //         pc.get(i, k) = pc.get(i, k) / pc.get(k, k);
-          //         double beta = pc.get(i, k);
-          //         for (int j = k + 1; j < pc.n; j++) {
-          //             // update row - a[i, j] -= a[k, j] * a[i, k]
-          //             if (pc.isNnz(i, j) && pc.isNnz(k, j)) {
-          //                 pc.get(i, j) = pc.get(i, j) - pc.get(k, j) * beta;
-          //             }
-          //         }
-          //     }
-          // }
+  // z = M^-1 r (Saad, Algorithm 12.1)
+  virtual void apply(const double* r, double* z) {
+      int n = int(invDiag.size());
+      double theta = (lmax + lmin) / 2, delta = (lmax - lmin) / 2;
+      double sigma = theta / delta, rho = 1 / sigma;
+      detail::forEachRow(n, [&](int64_t i) {
+          res[i] = r[i];
+          d[i] = invDiag[i] * r[i] / theta;
+          z[i] = d[i];
+      });
+      for (int k = 1; k < degree; k++) {
+          op(d.data(), ad.data());
+          double rhoNew = 1 / (2 * sigma - rho), a = rhoNew * rho, b = 2 * rhoNew / delta;
+          detail::forEachRow(n, [&](int64_t i) {
+              res[i] -= ad[i];
+              d[i] = a * d[i] + b * invDiag[i] * res[i];
+              z[i] += d[i];
+          });
+          rho = rhoNew;
       }
+  }
+};
+
+/**
+ * Neumann series preconditioner: M^-1 = w sum_{j <= degree}
+ * (I - w D^-1 A)^j D^-1, with w = 1 / lmax for lmax at least the largest
+ * eigenvalue of D^-1 A, which makes it SPD. Like ChebyshevPreconditioner
+ * it only needs products by A, degree of them, but the polynomial is a
+ * worse approximation of A^-1 for the same degree.
+ */
+template<typename Op = SymCsrOperator>
+class NeumannPreconditioner {
+  Op op;
+  std::vector<double> invDiag;
+  double omega;
+  int degree;
+  std::vector<double> az;
+
+ public:
+  /** For the symmetric matrix of which a holds the lower triangle, with lmax
+   * the Gershgorin bound */
+  NeumannPreconditioner(const CsrMatrix& a, int _degree = 3) :
+      NeumannPreconditioner(Op{a}, diagonalOf(a), jacobiScaledBound(a), _degree) {}
 
-      l = CsrMatrix{pc.getLowerTriangular()};
-      Lvalues = l.values;
-      Lrow_ptr = l.getRowPtrWithOneBasedIndex();
-      Lcol_ind = l.getColIndWithOneBasedIndex();
-      u = CsrMatrix{pc.getUpperTriangular()};
-      Uvalues = u.values;
-      Urow_ptr = u.getRowPtrWithOneBasedIndex();
-      Ucol_ind = u.getColIndWithOneBasedIndex();
-      res = std::vector<double>(l.n);
+  /** As for ChebyshevPreconditioner */
+  NeumannPreconditioner(Op _op, std::vector<double> diagonal, double lmax, int _degree = 3) :
+      op(std::move(_op)), invDiag(std::move(diagonal)), omega(1 / lmax), degree(_degree), az(invDiag.size()) {
+      if (degree < 0 || !(lmax > 0))
+          throw std::invalid_argument("NeumannPreconditioner needs degree >= 0 and lmax > 0");
+      for (double& v : invDiag)
+          v = 1 / v;
   }
 
   virtual std::vector<double> apply(const std::vector<double>& x) {
-      // solve z = M^-1 r <==> Mz = r <==> LUz = r
-      // solve: Ly = r
-      cask::mkl::unittrsolve(Lvalues.data(), Lrow_ptr.data(), Lcol_ind.data(), x, res.data(), true);
-      // then solve Uz = y
-      auto y = res;
-      cask::mkl::unittrsolve(Uvalues.data(), Urow_ptr.data(), Ucol_ind.data(), y, res.data(), false);
-      return res;
+      std::vector<double> z(x.size());
+      apply(x.data(), z.data());
+      return z;
   }
 
-  void pretty_print() {
-      pc.pretty_print();
+  // z = M^-1 r by Horner's rule: z <- w D^-1 r + z - w D^-1 A z; r and z
+  // must not be the same array
+  virtual void apply(const double* r, double* z) {
+      int n = int(invDiag.size());
+      detail::forEachRow(n, [&](int64_t i) { z[i] = omega * invDiag[i] * r[i]; });
+      for (int k = 0; k < degree; k++) {
+          op(z, az.data());
+          detail::forEachRow(n, [&](int64_t i) { z[i] += omega * invDiag[i] * (r[i] - az[i]); });
+      }
   }
 };
 
 /**
- *  Standard preconditioned CG, (Saad et al)
- *  https://en.wikipedia.org/wiki/Conjugate_gradient_method
+ * Initial guesses for a sequence of solves with the same SPD matrix A and
+ * slowly changing right hand sides, e.g. the time steps of a simulation
+ * (Fischer, 1998). The solutions of previous solves are kept as an
+ * A-orthonormal basis; guess() returns the best approximation in the A-norm
+ * to the next solution from their span, at the cost of one inner product
+ * per basis vector. update() adds a solution to the basis with one product
+ * by A; once capacity vectors are kept, the basis restarts from the latest
+ * solution.
+ */
+class SolutionProjection {
+  int n, capacity, k = 0;
+  double dropTol;
+  // basis[j] and A * basis[j], for j < k
+  std::vector<std::vector<double>> basis, aBasis;
+  std::vector<double> coeffs;
+
+ public:
+  /** Keeps at most capacity solutions; the part of a solution A-orthogonal
+   * to the basis is not kept if its A-norm is below dropTol times that of
+   * the solution, as it is mostly the error of the solve */
+  explicit SolutionProjection(int _n, int _capacity = 8, double _dropTol = 1E-6) :
+      n(_n), capacity(_capacity), dropTol(_dropTol), coeffs(_capacity) {
+      if (capacity < 1)
+          throw std::invalid_argument("SolutionProjection needs capacity >= 1, got " + std::to_string(capacity));
+  }
+
+  int rows() const {
+      return n;
+  }
+
+  // the number of basis vectors
+  int size() const {
+      return k;
+  }
+
+  void clear() {
+      k = 0;
+  }
+
+  // x = sum_j (basis[j], rhs) basis[j], the projection of A^-1 rhs
+  void guess(const double* rhs, double* x) {
+      double* c = coeffs.data();
+      if (k > 0)
+          detail::fusedSums(n, k, c, [&](int64_t i, double* acc) {
+              for (int j = 0; j < k; j++)
+                  acc[j] += basis[j][i] * rhs[i];
+          });
+      detail::forEachRow(n, [&](int64_t i) {
+          double v = 0;
+          for (int j = 0; j < k; j++)
+              v += c[j] * basis[j][i];
+          x[i] = v;
+      });
+  }
+
+  // adds a solution x to the basis; op(in, out) computes out = A * in
+  template<typename Op>
+  void update(Op& op, const double* x) {
+      if (k == capacity)
+          clear();
+      if (int(basis.size()) == k) {
+          basis.emplace_back(n);
+          aBasis.emplace_back(n);
+      }
+      // the part of x A-orthogonal to the basis, whose A-norm squared is
+      // that of x less sum_j c_j^2
+      std::vector<double>& d = basis[k];
+      double* c = coeffs.data();
+      double inBasis = 0;
+      if (k > 0)
+          detail::fusedSums(n, k, c, [&](int64_t i, double* acc) {
+              for (int j = 0; j < k; j++)
+                  acc[j] += aBasis[j][i] * x[i];
+          });
+      for (int j = 0; j < k; j++)
+          inBasis += c[j] * c[j];
+      detail::forEachRow(n, [&](int64_t i) {
+          double v = x[i];
+          for (int j = 0; j < k; j++)
+              v -= c[j] * basis[j][i];
+          d[i] = v;
+      });
+      op(d.data(), aBasis[k].data());
+      double norm2;
+      detail::fusedSums(n, 1, &norm2, [&](int64_t i, double* acc) { acc[0] += d[i] * aBasis[k][i]; });
+      if (!(norm2 > dropTol * dropTol * (norm2 + inBasis)))
+          return;
+      double scale = 1 / std::sqrt(norm2);
+      detail::forEachRow(n, [&](int64_t i) {
+          d[i] *= scale;
+          aBasis[k][i] *= scale;
+      });
+      k++;
+  }
+};
+
+/**
+ * Configuration of pcg(). The iteration stops once the preconditioned
+ * residual norm sqrt((r, M^-1 r)) is at most tol, or relTol times its
+ * initial value (when relTol > 0).
  */
+struct CgOptions {
+  int maxiters = 2000;
+  double tol = 1E-5;
+  double relTol = 0;
+  // start from the solution in x, e.g. that of the previous time step;
+  // otherwise from zero, or the guess of projection if given
+  bool warmStart = true;
+  // called with each iteration and its residual norm; the solve stops,
+  // unconverged, when it returns false
+  std::function<bool(int, double)> monitor;
+  // recycles the solutions of previous solves with the same matrix, see
+  // SolutionProjection; supersedes the warm start
+  SolutionProjection* projection = nullptr;
+  bool verbose = false;
+};
+
+/**
+ * Pipelined preconditioned CG (Ghysels and Vanroose, 2014).
+ *
+ * Mathematically equivalent to pcg(), but both inner products of an iteration
+ * are computed in one fused reduction, which runs concurrently with the
+ * preconditioner application and matrix vector product of the same iteration;
+ * all vector updates are fused in a single pass. This hides the latency of the
+ * reductions behind the SpMV, e.g. when the SpMV runs on a DFE. The price is
+ * three more recurrences, which may slightly reduce the attainable accuracy.
+ *
+ * Op is a matrix vector product y = A * x invoked as op(x, y) (e.g.
+ * SymCsrOperator); precon provides apply(in, out). Convergence is declared
+ * when (r, M^-1 r) <= tol^2, as in pcg().
+ */
+template<typename Op, typename Precon>
+bool pipelinedCg(Op& op, Precon& precon, int n,
+                 const double* rhs, double* x, int& iterations,
+                 int maxiters = 2000, double tol = 1E-5, bool verbose = false) {
+    CASK_TRACE_SCOPE("pipelinedCg:solve");
+    std::vector<double> r(n), u(n), w(n), m(n), nv(n), z(n, 0.0), q(n, 0.0), s(n, 0.0), p(n, 0.0);
+
+    // r = b - A * x, u = M^-1 r, w = A u
+    op(x, r.data());
+    detail::forEachRow(n, [&](int64_t i) { r[i] = rhs[i] - r[i]; });
+    precon.apply(r.data(), u.data());
+    op(u.data(), w.data());
+
+    double alpha = 0, gammaOld = 0;
+    for (int i = 0; i < maxiters; i++) {
+        // gamma = (r, u) and delta = (w, u), overlapped with m = M^-1 w, n = A m
+        double dots[2];
+        cask::parallel::ThreadPool::global().run(2, [&](int task) {
+            if (task == 0) {
+                detail::fusedSums(n, 2, dots, [&](int64_t k, double* acc) {
+                    acc[0] += r[k] * u[k];
+                    acc[1] += w[k] * u[k];
+                });
+            } else {
+                precon.apply(w.data(), m.data());
+                op(m.data(), nv.data());
+            }
+        });
+        double gamma = dots[0], delta = dots[1];
+        CASK_TRACE_COUNTER("pipelinedCg:residual", std::sqrt(gamma));
+        if (verbose) {
+            std::cout << " rsold " << gamma << "iteration " << iterations << "\n";
+        }
+        if (i > 0 && gamma <= tol * tol)
+            return true;
+        if (i > 0)
+            iterations = i - 1;
+
+        double beta = 0;
+        if (i > 0) {
+            beta = gamma / gammaOld;
+            alpha = gamma / (delta - beta * gamma / alpha);
+        } else {
+            alpha = gamma / delta;
+        }
+
+        detail::forEachRow(n, [&](int64_t k) {
+            z[k] = nv[k] + beta * z[k];
+            q[k] = m[k] + beta * q[k];
+            s[k] = w[k] + beta * s[k];
+            p[k] = u[k] + beta * p[k];
+            x[k] += alpha * p[k];
+            r[k] -= alpha * s[k];
+            u[k] -= alpha * q[k];
+            w[k] -= alpha * z[k];
+        });
+        gammaOld = gamma;
+    }
+    return false;
+}
+
+/**
+ * s-step (communication avoiding) preconditioned CG, following Carson's
+ * CA-PCG with a monomial basis.
+ *
+ * Each outer iteration builds bases of the Krylov spaces of M^-1 A spanned by
+ * the search direction (s + 1 vectors) and by the preconditioned residual (s
+ * vectors), then computes all inner products between them as one fused
+ * reduction, a (2s + 1)^2 Gram matrix. The following s CG iterations are
+ * carried out on coordinates in these bases, without touching vectors of
+ * length n, and the iterates are recovered in one pass at the end.
+ *
+ * The monomial basis becomes ill conditioned quickly, so s should stay small
+ * (2 - 5); Op and Precon are as for pipelinedCg().
+ */
+template<typename Op, typename Precon>
+bool sStepCg(Op& op, Precon& precon, int n,
+             const double* rhs, double* x, int& iterations, int s = 4,
+             int maxiters = 2000, double tol = 1E-5, bool verbose = false) {
+    if (s < 1)
+        throw std::invalid_argument("sStepCg requires s >= 1, got " + std::to_string(s));
+
+    // columns 0 .. s of the bases span the search direction, s + 1 .. 2s the
+    // residual; yz[k] = M^-1 yr[k], and column 0 / s + 1 of yz holds p / z, of
+    // yr q = M p / r
+    CASK_TRACE_SCOPE("sStepCg:solve");
+    const int dim = 2 * s + 1;
+    const int zc = s + 1;
+    std::vector<std::vector<double>> yz(dim, std::vector<double>(n)), yr(dim, std::vector<double>(n));
+
+    // r = b - A * x, z = M^-1 r, p = z, q = r
+    op(x, yr[zc].data());
+    detail::forEachRow(n, [&](int64_t i) { yr[zc][i] = rhs[i] - yr[zc][i]; });
+    precon.apply(yr[zc].data(), yz[zc].data());
+    yz[0] = yz[zc];
+    yr[0] = yr[zc];
+
+    std::vector<double> g(dim * dim), cx(dim), cr(dim), cp(dim), bcp(dim);
+    std::vector<const double*> rCols(dim), zCols(dim);
+    for (int k = 0; k < dim; k++) {
+        rCols[k] = yr[k].data();
+        zCols[k] = yz[k].data();
+    }
+
+    // c1^T G c2, with G[a][b] = (yr[a], yz[b])
+    auto gram = [&](const std::vector<double>& c1, const std::vector<double>& c2) {
+        double sum = 0;
+        for (int a = 0; a < dim; a++)
+            for (int b = 0; b < dim; b++)
+                sum += c1[a] * g[a * dim + b] * c2[b];
+        return sum;
+    };
+
+    int it = 0;
+    while (it < maxiters) {
+        CASK_TRACE_SCOPE("sStepCg:outerIteration", it);
+        // monomial bases: yr[k + 1] = A yz[k], yz[k + 1] = M^-1 yr[k + 1]
+        for (int k = 0; k < s; k++) {
+            op(yz[k].data(), yr[k + 1].data());
+            precon.apply(yr[k + 1].data(), yz[k + 1].data());
+        }
+        for (int k = zc; k < dim - 1; k++) {
+            op(yz[k].data(), yr[k + 1].data());
+            precon.apply(yr[k + 1].data(), yz[k + 1].data());
+        }
+
+        detail::fusedSums(n, dim * dim, g.data(), [&](int64_t i, double* acc) {
+            for (int a = 0; a < dim; a++) {
+                double ra = rCols[a][i];
+                for (int b = 0; b < dim; b++)
+                    acc[a * dim + b] += ra * zCols[b][i];
+            }
+        });
+
+        std::fill(cx.begin(), cx.end(), 0.0);
+        std::fill(cr.begin(), cr.end(), 0.0);
+        std::fill(cp.begin(), cp.end(), 0.0);
+        cr[zc] = 1;
+        cp[0] = 1;
+        double rz = gram(cr, cr);
+        bool converged = false;
+        for (int j = 0; j < s && it < maxiters; j++, it++) {
+            if (verbose) {
+                std::cout << " rsold " << rz << "iteration " << iterations << "\n";
+            }
+            // B shifts coordinates to the columns multiplied by M^-1 A
+            std::fill(bcp.begin(), bcp.end(), 0.0);
+            for (int k = 0; k < s; k++)
+                bcp[k + 1] = cp[k];
+            for (int k = zc; k < dim - 1; k++)
+                bcp[k + 1] = cp[k];
+
+            double alpha = rz / gram(bcp, cp);
+            for (int k = 0; k < dim; k++) {
+                cx[k] += alpha * cp[k];
+                cr[k] -= alpha * bcp[k];
+            }
+            double rzNew = gram(cr, cr);
+            CASK_TRACE_COUNTER("sStepCg:residual", std::sqrt(std::fabs(rzNew)));
+            if (rzNew <= tol * tol) {
+                converged = true;
+                break;
+            }
+            double beta = rzNew / rz;
+            for (int k = 0; k < dim; k++)
+                cp[k] = cr[k] + beta * cp[k];
+            rz = rzNew;
+            iterations = it;
+        }
+
+        // recover x, and unless converged the new p, q, z, r
+        detail::forEachRow(n, [&](int64_t i) {
+            double dx = 0, p = 0, q = 0, z = 0, r = 0;
+            for (int k = 0; k < dim; k++) {
+                double vz = zCols[k][i], vr = rCols[k][i];
+                dx += cx[k] * vz;
+                p += cp[k] * vz;
+                q += cp[k] * vr;
+                z += cr[k] * vz;
+                r += cr[k] * vr;
+            }
+            x[i] += dx;
+            yz[0][i] = p;
+            yr[0][i] = q;
+            yz[zc][i] = z;
+            yr[zc][i] = r;
+        });
+        if (converged)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Mixed precision iterative refinement: repeats x += d, where the correction
+ * d solves A d = r approximately, e.g. with a reduced precision copy of A on
+ * a DFE, and the residual r = b - A x is computed in fp64 by op.
+ *
+ * inner(r, d, rnorm) is called with d = 0 and rnorm = ||r||; it only needs to
+ * reduce the residual by a modest factor. The refinement converges roughly if
+ * cond(A) times the relative error of the inner matrix is below one, and then
+ * to the accuracy of op. Converged when (r, r) <= tol^2; refinements is the
+ * number of corrections applied.
+ */
+template<typename Op, typename InnerSolve>
+bool iterativeRefinement(Op& op, InnerSolve& inner, int n,
+                         const double* rhs, double* x, int& refinements,
+                         int maxRefinements = 50, double tol = 1E-5, bool verbose = false) {
+    CASK_TRACE_SCOPE("refinement:solve");
+    std::vector<double> r(n), d(n);
+    refinements = 0;
+    for (int k = 0; ; k++) {
+        double rr;
+        op(x, r.data());
+        detail::fusedSums(n, 1, &rr, [&](int64_t i, double* acc) {
+            r[i] = rhs[i] - r[i];
+            acc[0] += r[i] * r[i];
+        });
+        CASK_TRACE_COUNTER("refinement:residual", std::sqrt(rr));
+        if (verbose) {
+            std::cout << " refinement " << k << " residual " << std::sqrt(rr) << "\n";
+        }
+        if (rr <= tol * tol)
+            return true;
+        if (k == maxRefinements)
+            return false;
+
+        std::fill(d.begin(), d.end(), 0.0);
+        {
+            CASK_TRACE_SCOPE("refinement:inner", k);
+            inner(r.data(), d.data(), std::sqrt(rr));
+        }
+        detail::forEachRow(n, [&](int64_t i) { x[i] += d[i]; });
+        refinements = k + 1;
+    }
+}
+
+/** pcg() with the pipelined CG iteration, see pipelinedCg(). */
 template<typename T=double, typename Precon=IdentityPreconditioner>
-bool pcg(const CsrMatrix& a, double *rhs, double *x, int &iterations, bool verbose = false, cask::utils::Timer* t = nullptr) {
-    // configuration (TODO Should be exposed through params)
-    char tr = 'l';
-    int maxiters = 2000;
-    double tol = 1E-5;
+bool pipelinedPcg(const CsrMatrix& a, double *rhs, double *x, int &iterations, bool verbose = false, cask::utils::Timer* t = nullptr) {
     if (t)
       t->tic("cg:setup");
     Precon precon{a};
+    SymCsrOperator op{a};
+    if (t)
+      t->toc("cg:setup");
 
-    int n = a.n;
-    auto values  = a.values;
-    auto row_ptr = a.getRowPtrWithOneBasedIndex();
-    auto col_ind = a.getColIndWithOneBasedIndex();
-    assert(row_ptr[0] == 1 && "Expecting one based indexing for use with mkl_?csrsymv");
+    if (t)
+      t->tic("cg:solve");
+    bool converged = pipelinedCg(op, precon, a.n, rhs, x, iterations, 2000, 1E-5, verbose);
+    if (t)
+      t->toc("cg:solve");
+    return converged;
+}
 
-    std::vector<double> r(n);             // residual
-    std::vector<double> b(rhs, rhs + n);  // rhs
-    std::vector<double> p(n);             //
-    std::vector<double> z(n);             //
+/** pcg() with the s-step CG iteration, see sStepCg(). */
+template<typename T=double, typename Precon=IdentityPreconditioner>
+bool sStepPcg(const CsrMatrix& a, double *rhs, double *x, int &iterations, int s = 4, bool verbose = false, cask::utils::Timer* t = nullptr) {
+    if (t)
+      t->tic("cg:setup");
+    Precon precon{a};
+    SymCsrOperator op{a};
     if (t)
       t->toc("cg:setup");
 
     if (t)
       t->tic("cg:solve");
+    bool converged = sStepCg(op, precon, a.n, rhs, x, iterations, s, 2000, 1E-5, verbose);
+    if (t)
+      t->toc("cg:solve");
+    return converged;
+}
+
+/**
+ * The iteration vectors of pcg() and, with MKL, the one based indices of its
+ * matrix.
+ *
+ * A workspace can be reused across solves: vectors are only reallocated when
+ * they grow and the indices are only rebuilt for a different matrix, so
+ * successive solves on the same matrix do not allocate. The matrix pattern
+ * must not be modified in place between solves sharing a workspace.
+ */
+class CgWorkspace {
+ public:
+  std::vector<double> r, p, z, Ap;
+#ifdef USEMKL
+  // one based, as required by mkl_dcsrsymv
+  std::vector<int> row_ptr, col_ind;
+#endif
+
+  void prepare(const CsrMatrix& a) {
+      fit(r, a.n);
+      fit(p, a.n);
+      fit(z, a.n);
+      fit(Ap, a.n);
+#ifdef USEMKL
+      if (a.row_ptr.data() == rowPtrSource && a.col_ind.data() == colIndSource &&
+          int(row_ptr.size()) == a.n + 1 && int(col_ind.size()) == a.nnzs)
+          return;
+      fit(row_ptr, a.n + 1);
+      fit(col_ind, a.nnzs);
+      for (int i = 0; i <= a.n; i++)
+          row_ptr[i] = a.row_ptr[i] + 1;
+      for (int k = 0; k < a.nnzs; k++)
+          col_ind[k] = a.col_ind[k] + 1;
+      rowPtrSource = a.row_ptr.data();
+      colIndSource = a.col_ind.data();
+#endif
+  }
+
+  /** The number of buffers prepare() had to allocate so far, which stays
+   * the same over solves reusing the workspace */
+  int64_t allocations() const {
+      return allocationCount;
+  }
+
+ private:
+  int64_t allocationCount = 0;
+#ifdef USEMKL
+  // the storage the indices were built from
+  const int* rowPtrSource = nullptr;
+  const int* colIndSource = nullptr;
+#endif
+
+  template <typename V>
+  void fit(std::vector<V>& v, int size) {
+      if (v.capacity() < size_t(size))
+          allocationCount++;
+      v.resize(size);
+  }
+};
+
+/**
+ *  Standard preconditioned CG, (Saad et al)
+ *  https://en.wikipedia.org/wiki/Conjugate_gradient_method
+ *
+ *  This version uses the given preconditioner (built for a) and workspace,
+ *  so that repeated solves perform no heap allocations (unless o.projection
+ *  gains a basis vector). The products are by mkl_dcsrsymv with MKL and by
+ *  cpu::symSpmv otherwise; the vector updates by the kernels of CpuBlas1.
+ */
+template<typename T=double, typename Precon=IdentityPreconditioner>
+bool pcg(const CsrMatrix& a, Precon& precon, CgWorkspace& w,
+         const double *rhs, double *x, int &iterations, const CgOptions& o) {
+    CASK_TRACE_SCOPE("pcg:solve");
+    int n = a.n;
+    w.prepare(a);
+    double* r = w.r.data();               // residual
+    double* p = w.p.data();
+    double* z = w.z.data();
+    double* Ap = w.Ap.data();
+#ifdef USEMKL
+    char tr = 'l';
+    const double* values = a.values.data();
+    const int* row_ptr = w.row_ptr.data();
+    const int* col_ind = w.col_ind.data();
+    assert(row_ptr[0] == 1 && "Expecting one based indexing for use with mkl_?csrsymv");
+    auto op = [&](const double* in, double* out) {
+        mkl_dcsrsymv(&tr, &n, values, row_ptr, col_ind, in, out);
+    };
+#else
+    CsrView lower = a.view();
+    auto op = [&](const double* in, double* out) {
+        cask::cpu::symSpmv(lower, in, out);
+    };
+#endif
+
+    if (o.projection) {
+        if (o.projection->rows() != n)
+            throw std::invalid_argument("pcg: the projection is for " + std::to_string(o.projection->rows()) +
+                " rows, the matrix has " + std::to_string(n));
+        o.projection->guess(rhs, x);
+    } else if (!o.warmStart) {
+        std::fill(x, x + n, 0.0);
+    }
 
     //  r = b - A * x
-    mkl_dcsrsymv(&tr, &n, values.data(), row_ptr.data(), col_ind.data(), &x[0], &r[0]);
-    cblas_daxpby(n, 1.0, &b[0], 1, -1.0, &r[0], 1);
+    op(x, r);
+    cask::cpu::residualFromProduct(n, rhs, r);
 
     // z = M^-1 * r
-    z = precon.apply(r);
+    precon.apply(r, z);
 
-    p = z;
+    std::copy(z, z + n, p);
 
     // rsold = r * z
-    double rsold = cblas_ddot(n, &r[0], 1, &z[0], 1);
+    double rsold = cask::cpu::dot(n, r, z);
+    double tol = std::max(o.tol, o.relTol * std::sqrt(rsold));
+    bool converged = rsold <= tol * tol;
+    if (converged)
+        iterations = 0;
 
-    for (int i = 0; i < maxiters; i++) {
-        if (verbose) {
+    for (int i = 0; i < o.maxiters && !converged; i++) {
+        if (o.verbose) {
             std::cout << " rsold " << rsold << "iteration " << iterations << "\n";
         }
-        std::vector<double> Ap(n);
         // Ap = A * p
-        mkl_dcsrsymv(&tr, &n, values.data(), row_ptr.data(), col_ind.data(), &p[0], &Ap[0]);
+        op(p, Ap);
         // alpha = rsold / (p * Ap)
-        double alpha = rsold / cblas_ddot(n, &p[0], 1, &Ap[0], 1);
+        double alpha = rsold / cask::cpu::dot(n, p, Ap);
         // x = x + alpha * p
-        cblas_daxpy(n, alpha, &p[0], 1, &x[0], 1);
+        cask::cpu::axpy(n, alpha, p, x);
         // r = r - alpha * Ap
-        cblas_daxpby(n, -alpha, &Ap[0], 1, 1.0, &r[0], 1);
+        cask::cpu::axpy(n, -alpha, Ap, r);
 
         // z = M^-1 * r
-        z = precon.apply(r);
+        precon.apply(r, z);
 
         // rsnew = r * z
-        double rsnew = cblas_ddot(n, &r[0], 1, &z[0], 1);
+        double rsnew = cask::cpu::dot(n, r, z);
+        CASK_TRACE_COUNTER("pcg:residual", std::sqrt(rsnew));
 
+        bool stop = o.monitor && !o.monitor(i, std::sqrt(rsnew));
         if (rsnew <= tol * tol) {
-            // std::cout << "Found solution" << std::endl;
-            // print_array("x", &x[0], n);
-          if (t)
-            t->toc("cg:solve");
-          return true;
+            converged = true;
+            break;
         }
+        if (stop)
+            break;
 
         // p = r + (rsnew/rsold) * p
-        cblas_daxpby(n, 1, &z[0], 1, rsnew / rsold, &p[0], 1);
+        cask::cpu::axpby(n, 1, z, rsnew / rsold, p);
         rsold = rsnew;
         iterations = i;
     }
 
-    mkl_free_buffers ();
+    if (converged && o.projection)
+        o.projection->update(op, x);
+#ifdef USEMKL
+    if (!converged)
+        mkl_free_buffers ();
+#endif
+    return converged;
+}
+
+/** pcg() with the default options, as many iterations as needed to reach a
+ * preconditioned residual norm of 1E-5 from the initial guess in x */
+template<typename T=double, typename Precon=IdentityPreconditioner>
+bool pcg(const CsrMatrix& a, Precon& precon, CgWorkspace& w,
+         const double *rhs, double *x, int &iterations, bool verbose = false) {
+    CgOptions o;
+    o.verbose = verbose;
+    return pcg<T, Precon>(a, precon, w, rhs, x, iterations, o);
+}
+
+/**
+ *  Standard preconditioned CG, (Saad et al)
+ *  https://en.wikipedia.org/wiki/Conjugate_gradient_method
+ */
+template<typename T=double, typename Precon=IdentityPreconditioner>
+bool pcg(const CsrMatrix& a, double *rhs, double *x, int &iterations, bool verbose = false, cask::utils::Timer* t = nullptr) {
+    if (t)
+      t->tic("cg:setup");
+    Precon precon{a};
+    CgWorkspace w;
+    w.prepare(a);
+    if (t)
+      t->toc("cg:setup");
 
+    if (t)
+      t->tic("cg:solve");
+    bool converged = pcg<T, Precon>(a, precon, w, rhs, x, iterations, verbose);
     if (t)
       t->toc("cg:solve");
-    return false;
+    return converged;
 }
-#endif
 
   }
 }
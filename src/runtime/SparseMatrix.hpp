@@ -9,12 +9,16 @@
 #include <stdexcept>
 #include <tuple>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 #include <vector>
 #include <iostream>
 
 #include <Eigen/Sparse>
 
+#include "CpuBlas1.hpp"
+#include "CpuSpmv.hpp"
+
 namespace cask {
   namespace sparse {
 
@@ -41,6 +45,8 @@ public:
   Vector(int n) : data(n, 0) {}
   Vector(std::initializer_list<double> l) : data(l) {}
   Vector(const std::vector<double>& v) : data(v.begin(), v.end()) {}
+  // takes over the storage of v
+  Vector(std::vector<double>&& v) : data(std::move(v)) {}
 
   Vector operator-(const Vector& other) const {
     int n = size();
@@ -55,6 +61,18 @@ public:
     return v;
   }
 
+  // a - b for a temporary a, e.g. (a - b) - c, reuses its storage
+  friend Vector operator-(Vector&& a, const Vector& b) {
+    if (a.size() != b.size()) {
+      throw std::invalid_argument("Attempt to subtract vectors of different lengths: " +
+                                  std::to_string(b.size()) + " != " + std::to_string(a.size()));
+    }
+    for (int i = 0; i < a.size(); i++) {
+      a[i] -= b[i];
+    }
+    return std::move(a);
+  }
+
   int size() const {
     return data.size();
   }
@@ -79,14 +97,30 @@ public:
   }
 
   double norm() const {
-    double residual;
-    for (double d : data)
-      residual += d * d;
-    return std::sqrt(residual);
+    return cpu::nrm2(size(), data.data());
   }
 
+  // ||this - exp||, without a temporary
   double distance(const Vector& exp) const {
-    return (*this - exp).norm();
+    checkSize(exp, "distance");
+    return cpu::distance(size(), data.data(), exp.data.data());
+  }
+
+  double dot(const Vector& other) const {
+    checkSize(other, "dot");
+    return cpu::dot(size(), data.data(), other.data.data());
+  }
+
+  // this += a x
+  void axpy(double a, const Vector& x) {
+    checkSize(x, "axpy");
+    cpu::axpy(size(), a, x.data.data(), data.data());
+  }
+
+  // this = a x + b this
+  void axpby(double a, const Vector& x, double b) {
+    checkSize(x, "axpby");
+    cpu::axpby(size(), a, x.data.data(), b, data.data());
   }
 
   void writeToFile(std::string path) {
@@ -96,6 +130,13 @@ public:
     for (auto v : data)
       f << v << std::endl;
   }
+
+private:
+  void checkSize(const Vector& other, const char* op) const {
+    if (other.size() != size())
+      throw std::invalid_argument(std::string("Vector::") + op + " of vectors of different lengths: " +
+                                  std::to_string(other.size()) + " != " + std::to_string(size()));
+  }
 };
 
 /**
@@ -265,6 +306,8 @@ class DokMatrix {
 
 };
 
+class CsrView;
+
 // TODO verify preconditions:
 // with 1 based indexing
 // lower triangular
@@ -312,11 +355,14 @@ class CsrMatrix {
     row_ptr.assign(_row_ptr, _row_ptr + n + 1);
   }
 
+  // Copies lvalue arguments, but takes over the storage of temporaries or of
+  // std::move()d buffers, so assembling a matrix needs no second copy
   CsrMatrix(int n, int m, int nnzs,
-            const std::vector<double> &values,
-            const std::vector<int> &col_ind,
-            const std::vector<int> &row_ptr) :
-      n(n), m(m), nnzs(nnzs), values(values), col_ind(col_ind), row_ptr(row_ptr) {}
+            std::vector<double> values,
+            std::vector<int> col_ind,
+            std::vector<int> row_ptr) :
+      n(n), m(m), nnzs(nnzs),
+      values(std::move(values)), col_ind(std::move(col_ind)), row_ptr(std::move(row_ptr)) {}
 
   // Prints all matrix values
   void pretty_print() const {
@@ -419,29 +465,14 @@ class CsrMatrix {
     return CsrMatrix(toDok().getUpperTriangular());
   }
 
-  Vector dot(const Vector& b) const {
-    return toDok().dot(b);
-  }
-
-  CsrMatrix sliceRows(int startRow, int nRows) const {
-    //startPos = row_ptr[startRow];
-    std::vector<int> newRowPtr, newColInd;
-    std::vector<double> newValues;
-    int nnzs = 0;
-    int offset = row_ptr[startRow];
-    for (int i = startRow; i < startRow + nRows; i++) {
-      int r = row_ptr[i];
-      newRowPtr.push_back(r - offset);
-      for (int j = r; j < row_ptr[i + 1]; j++) {
-        newValues.push_back(values[j]);
-        newColInd.push_back(col_ind[j]);
-        nnzs++;
-      }
-    }
-    newRowPtr.push_back(newValues.size());
-    return CsrMatrix(nRows, this->m, nnzs, newValues, newColInd, newRowPtr);
-  }
+  // y = A * b, computed without materialising the matrix in another format
+  Vector dot(const Vector& b) const;
+
+  // A non-owning view over the storage of this matrix
+  CsrView view() const;
 
+  // An owning copy of a range of rows; use view().sliceRows() to avoid the copy
+  CsrMatrix sliceRows(int startRow, int nRows) const;
 
   /** Slices columns from this matrix into blocks. Each block has as
       many rows as this matrix but at most blockSize columns.  All
@@ -455,34 +486,268 @@ class CsrMatrix {
       sliceColumns(3) returns:
       1 2 3 | 4
       5 6 7 | 8
+
+      See BlockedCsrMatrix for blocks which do not store their empty rows.
   */
-  std::vector<cask::CsrMatrix> sliceColumns(int blockSize) const {
-    // XXX constructing a CSR matrix this way is not safe because m and n are not updated
-    int nBlocks = m / blockSize + (m % blockSize == 0 ? 0 : 1);
-    std::vector<cask::CsrMatrix> partitions(nBlocks);
-    for (int i = 0; i < n; i++) {
-      for (int j = 0; j < nBlocks; j++) {
-        auto& p = partitions[j].row_ptr;
-        if (p.size() == 0)
-          p.push_back(0);
-        else
-          p.push_back(p.back());
+  std::vector<cask::CsrMatrix> sliceColumns(int blockSize) const;
+
+};
+
+/**
+ * A non-owning view of a matrix (or of a contiguous range of rows of a matrix)
+ * in CSR format. The storage may belong to a CsrMatrix or to a memory mapped
+ * file (see io::MappedCsrMatrix) and must outlive the view.
+ *
+ * row_ptr has n + 1 entries which are offsets into col_ind and values, so a row
+ * range of a parent matrix points to the parent's storage directly and only
+ * its row_ptr is shifted; as a consequence row_ptr[0] is not necessarily 0:
+ * use offset() to obtain the position of the first nonzero.
+ */
+class CsrView {
+ public:
+  int n, m;
+  int nnzs;
+  const int* row_ptr;
+  const int* col_ind;
+  const double* values;
+
+  CsrView() : n(0), m(0), nnzs(0), row_ptr(nullptr), col_ind(nullptr), values(nullptr) {}
+
+  CsrView(int _n, int _m, const int* _row_ptr, const int* _col_ind, const double* _values) :
+      n(_n), m(_m), nnzs(_row_ptr[_n] - _row_ptr[0]),
+      row_ptr(_row_ptr), col_ind(_col_ind), values(_values) {}
+
+  CsrView(const CsrMatrix& mat) :
+      n(mat.n), m(mat.m), nnzs(mat.row_ptr.empty() ? 0 : mat.row_ptr[mat.n]),
+      row_ptr(mat.row_ptr.data()), col_ind(mat.col_ind.data()), values(mat.values.data()) {}
+
+  int offset() const {
+    return row_ptr ? row_ptr[0] : 0;
+  }
+
+  CsrView sliceRows(int startRow, int nRows) const {
+    if (startRow < 0 || nRows < 0 || startRow + nRows > n)
+      throw std::invalid_argument("CsrView::sliceRows row range out of bounds");
+    return CsrView(nRows, m, row_ptr + startRow, col_ind, values);
+  }
+
+  // Makes an owning copy of the viewed rows, with row_ptr starting at 0
+  CsrMatrix toCsr() const {
+    CsrMatrix c;
+    c.n = n;
+    c.m = m;
+    c.nnzs = nnzs;
+    int base = offset();
+    c.values.assign(values + base, values + base + nnzs);
+    c.col_ind.assign(col_ind + base, col_ind + base + nnzs);
+    c.row_ptr.resize(n + 1);
+    for (int i = 0; i <= n; i++)
+      c.row_ptr[i] = row_ptr ? row_ptr[i] - base : 0;
+    return c;
+  }
+};
+
+inline CsrView CsrMatrix::view() const {
+  return CsrView(*this);
+}
+
+/**
+ * A matrix divided in blocks of blockSize columns, as a CSR of blocks: block b
+ * holds the entries of columns [b * blockSize, (b + 1) * blockSize) and is
+ * row compressed, i.e. only its non empty rows are stored. The matrix is
+ * built with one counting pass and one scatter over the nonzeros, so empty
+ * rows of a block take neither time nor storage.
+ *
+ * The non empty rows of block b are rows[block_ptr[b]] ... rows[block_ptr[b + 1] - 1],
+ * in increasing order; the entries of the k-th block row are
+ * row_ptr[k] ... row_ptr[k + 1] - 1 of col_ind, which holds column offsets
+ * in the block, and values. Entries keep their order within each row.
+ */
+class BlockedCsrMatrix {
+ public:
+  int n, m;
+  int nnzs;
+  int blockSize, nBlocks;
+  std::vector<int> block_ptr;
+  std::vector<int> rows;
+  std::vector<int> row_ptr;
+  std::vector<int> col_ind;
+  std::vector<double> values;
+
+  BlockedCsrMatrix() : n(0), m(0), nnzs(0), blockSize(1), nBlocks(0), block_ptr(1, 0), row_ptr(1, 0) {}
+
+  BlockedCsrMatrix(const CsrView& a, int _blockSize) :
+      n(a.n), m(a.m), nnzs(a.nnzs), blockSize(_blockSize) {
+    if (blockSize < 1)
+      throw std::invalid_argument("BlockedCsrMatrix block size must be positive, got " +
+                                  std::to_string(blockSize));
+    nBlocks = m / blockSize + (m % blockSize == 0 ? 0 : 1);
+
+    // counting pass: the non empty rows and the entries of each block
+    std::vector<int> lastRow(nBlocks, -1);
+    std::vector<int> entries(nBlocks + 1, 0);
+    block_ptr.assign(nBlocks + 1, 0);
+    for (int i = 0; i < n; i++)
+      for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+        int b = a.col_ind[k] / blockSize;
+        entries[b + 1]++;
+        if (lastRow[b] != i) {
+          lastRow[b] = i;
+          block_ptr[b + 1]++;
+        }
       }
-      //std::cout << "i = " << i << std::endl;
-      //std::cout << "colptr" << colptr[i] << std::endl;
-      for (int j = row_ptr[i]; j < row_ptr[i+1]; j++) {
-        auto& p = partitions[col_ind[j] / blockSize];
-        int idxInPartition = col_ind[j] - (col_ind[j] / blockSize ) * blockSize;
-        p.col_ind.push_back(idxInPartition);
-        p.values.push_back(values[j]);
-        p.row_ptr.back()++;
+    for (int b = 0; b < nBlocks; b++) {
+      block_ptr[b + 1] += block_ptr[b];
+      entries[b + 1] += entries[b];
+    }
+
+    // scatter pass, using the starts of each block as cursors
+    int nRows = block_ptr[nBlocks];
+    rows.resize(nRows);
+    row_ptr.resize(nRows + 1);
+    col_ind.resize(nnzs);
+    values.resize(nnzs);
+    row_ptr[nRows] = nnzs;
+    std::vector<int> rowCursor(block_ptr.begin(), block_ptr.end() - 1);
+    std::fill(lastRow.begin(), lastRow.end(), -1);
+    for (int i = 0; i < n; i++)
+      for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+        int col = a.col_ind[k];
+        int b = col / blockSize;
+        if (lastRow[b] != i) {
+          lastRow[b] = i;
+          rows[rowCursor[b]] = i;
+          row_ptr[rowCursor[b]++] = entries[b];
+        }
+        col_ind[entries[b]] = col - b * blockSize;
+        values[entries[b]++] = a.values[k];
       }
+  }
+
+  // The number of stored (non empty) rows, over all blocks
+  int blockRows() const {
+    return rows.size();
+  }
+
+  int blockNnzs(int b) const {
+    return row_ptr[block_ptr[b + 1]] - row_ptr[block_ptr[b]];
+  }
+
+  // Block b as a CSR matrix, with all n rows and the columns of the block
+  CsrMatrix block(int b) const {
+    if (b < 0 || b >= nBlocks)
+      throw std::invalid_argument("BlockedCsrMatrix::block " + std::to_string(b) + " out of range");
+    std::vector<int> blockRowPtr(n + 1, 0);
+    for (int k = block_ptr[b]; k < block_ptr[b + 1]; k++)
+      blockRowPtr[rows[k] + 1] = row_ptr[k + 1] - row_ptr[k];
+    for (int i = 0; i < n; i++)
+      blockRowPtr[i + 1] += blockRowPtr[i];
+    int base = row_ptr[block_ptr[b]];
+    int count = blockRowPtr[n];
+    return CsrMatrix(n, std::min(blockSize, m - b * blockSize), count,
+                     std::vector<double>(values.begin() + base, values.begin() + base + count),
+                     std::vector<int>(col_ind.begin() + base, col_ind.begin() + base + count),
+                     std::move(blockRowPtr));
+  }
+};
+
+/**
+ * A matrix in SELL-C-sigma format (Kreutzer et al., SIAM J. Sci. Comput.
+ * 2014): rows are sorted by decreasing length within windows of sigma rows,
+ * then grouped in chunks of C consecutive sorted rows; each chunk is stored
+ * column major and padded to the length of its longest row. With C the SIMD
+ * width (see cpu::sellChunkHeight()), a chunk is multiplied with one vector
+ * lane per row, and sorting keeps the padding small. sigma = 1 keeps the
+ * order of the rows, i.e. sliced ELLPACK.
+ *
+ * Entry j of the r-th row of chunk c, which is row rows[c * C + r] of the
+ * matrix, is at chunk_ptr[c] + j * C + r of col_ind and values, for j below
+ * chunk_len[c]; padding entries have value 0 and column 0.
+ */
+class SellMatrix {
+ public:
+  static const int maxChunkHeight = 64;
+
+  int n, m;
+  int nnzs;
+  int chunkHeight, sigma;
+  int nChunks;
+  std::vector<int64_t> chunk_ptr;
+  std::vector<int> chunk_len;
+  std::vector<int> rows;
+  std::vector<int> col_ind;
+  std::vector<double> values;
+
+  SellMatrix(const CsrView& a, int _chunkHeight, int _sigma) :
+      n(a.n), m(a.m), nnzs(a.nnzs), chunkHeight(_chunkHeight), sigma(_sigma) {
+    if (chunkHeight < 1 || chunkHeight > maxChunkHeight || sigma < 1)
+      throw std::invalid_argument("Invalid SELL-C-sigma parameters C = " + std::to_string(chunkHeight) +
+                                  ", sigma = " + std::to_string(sigma));
+    int C = chunkHeight;
+    nChunks = n / C + (n % C == 0 ? 0 : 1);
+    auto length = [&](int i) { return a.row_ptr[i + 1] - a.row_ptr[i]; };
+
+    rows.resize(n);
+    for (int i = 0; i < n; i++)
+      rows[i] = i;
+    if (sigma > 1)
+      for (int w = 0; w < n; w += sigma)
+        std::stable_sort(rows.begin() + w, rows.begin() + std::min(n, w + sigma),
+                         [&](int x, int y) { return length(x) > length(y); });
+
+    chunk_len.assign(nChunks, 0);
+    chunk_ptr.assign(nChunks + 1, 0);
+    for (int c = 0; c < nChunks; c++) {
+      for (int r = c * C; r < std::min(n, (c + 1) * C); r++)
+        chunk_len[c] = std::max(chunk_len[c], length(rows[r]));
+      chunk_ptr[c + 1] = chunk_ptr[c] + int64_t(chunk_len[c]) * C;
     }
-    return partitions;
+
+    col_ind.assign(chunk_ptr[nChunks], 0);
+    values.assign(chunk_ptr[nChunks], 0);
+    for (int c = 0; c < nChunks; c++)
+      for (int r = 0; r < C && c * C + r < n; r++) {
+        int i = rows[c * C + r];
+        for (int k = a.row_ptr[i], j = 0; k < a.row_ptr[i + 1]; k++, j++) {
+          col_ind[chunk_ptr[c] + int64_t(j) * C + r] = a.col_ind[k];
+          values[chunk_ptr[c] + int64_t(j) * C + r] = a.values[k];
+        }
+      }
   }
 
+  // Stored entries, including padding
+  int64_t storedEntries() const {
+    return chunk_ptr.back();
+  }
+
+  // The fraction of stored entries which are nonzeros
+  double fillRatio() const {
+    return storedEntries() == 0 ? 1 : double(nnzs) / storedEntries();
+  }
 };
 
+inline std::vector<CsrMatrix> CsrMatrix::sliceColumns(int blockSize) const {
+  BlockedCsrMatrix blocked(view(), blockSize);
+  std::vector<CsrMatrix> blocks;
+  blocks.reserve(blocked.nBlocks);
+  for (int b = 0; b < blocked.nBlocks; b++)
+    blocks.push_back(blocked.block(b));
+  return blocks;
+}
+
+inline CsrMatrix CsrMatrix::sliceRows(int startRow, int nRows) const {
+  return view().sliceRows(startRow, nRows).toCsr();
+}
+
+inline Vector CsrMatrix::dot(const Vector& b) const {
+  if (b.size() != m)
+    throw std::invalid_argument("CsrMatrix::dot vector length " + std::to_string(b.size()) +
+                                " != matrix columns " + std::to_string(m));
+  Vector result(n);
+  cpu::spmv(view(), b.data.data(), result.data.data());
+  return result;
+}
+
 /** A symmetric matrix for which only the lower triangle is stored explicitly, in CSR format */
 class SymCsrMatrix {
  public:
@@ -499,6 +764,16 @@ class SymCsrMatrix {
     nnzs = 2 * (l.nnzs - diagNnzs) + diagNnzs;
   }
 
+  // Construct a symmetric matrix from a lower triangular matrix in CSR format
+  explicit SymCsrMatrix(CsrMatrix l) : n(l.n), m(l.m), matrix(std::move(l)) {
+    int diagNnzs = 0;
+    for (int i = 0; i < matrix.n; i++)
+      for (int k = matrix.row_ptr[i]; k < matrix.row_ptr[i + 1]; k++)
+        if (matrix.col_ind[k] == i && matrix.values[k] != 0)
+          diagNnzs++;
+    nnzs = 2 * (matrix.nnzs - diagNnzs) + diagNnzs;
+  }
+
   void print() {
     // matrix.print();
   }
@@ -510,8 +785,49 @@ class SymCsrMatrix {
     matrix.toDok().explicitSymmetric().pretty_print();
   }
 
+  // Returns the matrix with both triangles stored explicitly, rows sorted by column
+  CsrMatrix explicitSymmetric() const {
+    int rows = matrix.n;
+    std::vector<int> row_ptr(rows + 1, 0);
+    for (int i = 0; i < rows; i++)
+      for (int k = matrix.row_ptr[i]; k < matrix.row_ptr[i + 1]; k++) {
+        int j = matrix.col_ind[k];
+        row_ptr[i + 1]++;
+        if (j != i)
+          row_ptr[j + 1]++;
+      }
+    for (int i = 0; i < rows; i++)
+      row_ptr[i + 1] += row_ptr[i];
+
+    // row i holds its stored entries, then the transpose of column i of the
+    // lower triangle, which is found in increasing row order
+    std::vector<int> pos(row_ptr.begin(), row_ptr.end() - 1);
+    std::vector<int> col_ind(row_ptr[rows]);
+    std::vector<double> values(row_ptr[rows]);
+    for (int i = 0; i < rows; i++)
+      for (int k = matrix.row_ptr[i]; k < matrix.row_ptr[i + 1]; k++) {
+        col_ind[pos[i]] = matrix.col_ind[k];
+        values[pos[i]++] = matrix.values[k];
+      }
+    for (int i = 0; i < rows; i++)
+      for (int k = matrix.row_ptr[i]; k < matrix.row_ptr[i + 1]; k++) {
+        int j = matrix.col_ind[k];
+        if (j == i)
+          continue;
+        col_ind[pos[j]] = i;
+        values[pos[j]++] = matrix.values[k];
+      }
+    int nnzs = row_ptr[rows];
+    return CsrMatrix(rows, m, nnzs, std::move(values), std::move(col_ind), std::move(row_ptr));
+  }
+
   Vector dot(const Vector& b) const {
-    return matrix.toDok().explicitSymmetric().dot(b);
+    if (b.size() != n)
+      throw std::invalid_argument("SymCsrMatrix::dot vector length " + std::to_string(b.size()) +
+                                  " != matrix rows " + std::to_string(n));
+    Vector result(n);
+    cpu::symSpmv(matrix.view(), b.data.data(), result.data.data());
+    return result;
   }
 
 };
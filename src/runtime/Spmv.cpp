@@ -5,101 +5,494 @@
 #include <dfesnippets/VectorUtils.hpp>
 #include <dfesnippets/Timing.hpp>
 #include <cassert>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <numeric>
 
 #include "GeneratedImplSupport.hpp"
 #include "Utils.hpp"
+#include "Parallel.hpp"
+#include "Trace.hpp"
 
 
 using namespace cask::spmv;
 using ssarch = cask::spmv::Spmv;
 namespace cutils = cask::utils;
 
-const int burst_size_bytes = 384;
+// source of Spmv::matrixId
+static std::atomic<int64_t> nextMatrixId{0};
 
-struct PartitionWriteResult {
-  int64_t outStartAddr, outSize, colptrStartAddress, colptrSize;
-  int64_t vStartAddress, indptrValuesStartAddress, indptrValuesSize;
+// a symmetric design loads the x of the n rows of a partition before its
+// blocks, and flushes the reflected sums of the last block after them (those
+// of the others are flushed while the next block loads its vector)
+static int reflectionCycles(bool symmetric, int n, int nBlocks, int blockSize) {
+  return symmetric ? n + (nBlocks > 0 ? blockSize : 0) : 0;
+}
+
+namespace {
+
+struct CountRowCycles {
+  const int32_t* rowEnds;
+  int n, cycles;
+
+  template<typename Width>
+  void operator()(Width w) {
+    cycles = countRowCycles(rowEnds, n, w);
+  }
 };
 
+}
+
 // how many cycles does it take to resolve the accesses
 int ssarch::countComputeCycles(int32_t* v, int size, int inputWidth)
 {
-  int cycles = 0;
-  int crtPos = 0;
-  for (int i = 0; i < size; i++) {
-    int toread = v[i] - (i > 0 ? v[i - 1] : 0);
-    do {
-      int canread = std::min(inputWidth - crtPos, toread);
-      crtPos += canread;
-      crtPos %= inputWidth;
-      cycles++;
-      toread -= canread;
-    } while (toread > 0);
+  CountRowCycles count{v, size, 0};
+  withInputWidth(inputWidth, count);
+  return count.cycles;
+}
+
+namespace {
+
+// allocates the indptr / values stream of a partition, zero initialised
+template<typename V>
+packed_entry<V>* allocateValueStream(Partition& p, int64_t entries) {
+  p.m_packed_indptr_values.assign(entries * sizeof(packed_entry<V>), 0);
+  return reinterpret_cast<packed_entry<V>*>(p.m_packed_indptr_values.data());
+}
+
+template<>
+indptr_value* allocateValueStream<Fp64Value>(Partition& p, int64_t entries) {
+  p.m_indptr_values.resize(entries);
+  return p.m_indptr_values.data();
+}
+
+// the entries of the indptr / values stream of a partition: packed_entry<V>
+// for 32 bit indices, otherwise bit fields of valueBits + indexBits bits
+template<typename V>
+class EntryStream {
+  typedef typename V::storage storage;
+  static const int valueBits = 8 * sizeof(storage);
+  Partition& p;
+  packed_entry<V>* entries = nullptr;
+
+  int64_t entryBits() const {
+    return valueBits + p.indexBits;
   }
-  return cycles;
+
+ public:
+  // allocates the stream, if the number of entries is given
+  EntryStream(Partition& _p, int64_t n = -1) : p(_p) {
+    if (p.indexBits == 32) {
+      entries = n < 0 ? reinterpret_cast<packed_entry<V>*>(p.m_packed_indptr_values.data()) :
+        allocateValueStream<V>(p, n);
+    } else if (n >= 0) {
+      p.m_packed_indptr_values.assign(cutils::ceilDivide(n * entryBits(), 8), 0);
+    }
+  }
+
+  int64_t size() const {
+    return p.indexBits == 32 ?
+      p.m_packed_indptr_values.size() / sizeof(packed_entry<V>) :
+      p.m_packed_indptr_values.size() * 8 / entryBits();
+  }
+
+  void set(int64_t i, storage value, uint32_t index) {
+    if (entries) {
+      entries[i] = packed_entry<V>(value, index);
+      return;
+    }
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(value));
+    writeBits(p.m_packed_indptr_values, i * entryBits(), bits, valueBits);
+    writeBits(p.m_packed_indptr_values, i * entryBits() + valueBits, index, p.indexBits);
+  }
+
+  void clearValue(int64_t i) {
+    if (entries) {
+      entries[i].value = V::encode(0, 0);
+      return;
+    }
+    writeBits(p.m_packed_indptr_values, i * entryBits(), 0, valueBits);
+  }
+};
+
+// the fill pass of do_blocking(): entries keep their order within each row of
+// a block; padding entries are zero
+struct FillBlocks {
+  const cask::CsrView& m;
+  int blockSize;
+  const std::vector<int64_t>& blockStart;
+  Partition& br;
+  // of row 0 of m in a symmetric matrix, whose diagonal is halved; -1 if
+  // the design is not symmetric
+  int firstRow;
+
+  template<typename V>
+  void operator()(V) {
+    int n = m.n;
+    int nBlocks = blockStart.size() - 1;
+    std::vector<int32_t>& scales = br.m_block_scales;
+    if (V::scaled) {
+      std::vector<double> maxAbs(nBlocks, 0);
+      for (int k = m.row_ptr[0]; k < m.row_ptr[n]; k++) {
+        double& b = maxAbs[m.col_ind[k] / blockSize];
+        b = std::max(b, std::abs(m.values[k]));
+      }
+      scales.resize(nBlocks);
+      for (int b = 0; b < nBlocks; b++)
+        scales[b] = Fixed16Value::scaleFor(maxAbs[b]);
+    }
+
+    EntryStream<V> stream(br, blockStart[nBlocks]);
+    IndexCoding coding(br.indexBits, blockSize);
+    // the escapes of each block, the offset of the previous entry of each
+    // block in its row and that row
+    std::vector<std::vector<int32_t>> escapes(nBlocks);
+    std::vector<int> previous(nBlocks, 0), previousRow(nBlocks, -1);
+    // holds the row end offsets of all blocks, before encoding
+    std::vector<int>& m_colptr = br.m_colptr;
+    m_colptr.resize(int64_t(n) * nBlocks);
+
+    std::vector<int64_t> cursor(blockStart.begin(), blockStart.end() - 1);
+    for (int i = 0; i < n; i++) {
+      for (int k = m.row_ptr[i]; k < m.row_ptr[i + 1]; k++) {
+        int col = m.col_ind[k];
+        int b = col / blockSize;
+        int scale = V::scaled ? scales[b] : 0;
+        int offset = col - b * blockSize;
+        bool escaped;
+        uint32_t code = coding.encode(offset, previousRow[b] == i ? previous[b] : 0, escaped);
+        if (escaped)
+          escapes[b].push_back(offset);
+        previous[b] = offset;
+        previousRow[b] = i;
+        double value = firstRow >= 0 && col == firstRow + i ? 0.5 * m.values[k] : m.values[k];
+        stream.set(cursor[b]++, V::encode(value, scale), code);
+      }
+      for (int b = 0; b < nBlocks; b++)
+        m_colptr[int64_t(b) * n + i] = cursor[b] - blockStart[b];
+    }
+
+    br.m_escapes.clear();
+    for (const auto& e : escapes)
+      br.m_escapes.insert(br.m_escapes.end(), e.begin(), e.end());
+    br.escapes = br.m_escapes.size();
+  }
+};
+
+// as FillBlocks, from a matrix whose blocks are already contiguous: each
+// block is copied to its part of the stream in order, and only the colptr of
+// the empty rows of a block is filled without reading the matrix
+struct FillBlockedCsr {
+  const cask::BlockedCsrMatrix& m;
+  const std::vector<int64_t>& blockStart;
+  Partition& br;
+
+  template<typename V>
+  void operator()(V) {
+    int n = m.n;
+    int nBlocks = m.nBlocks;
+    std::vector<int32_t>& scales = br.m_block_scales;
+    if (V::scaled) {
+      scales.resize(nBlocks);
+      for (int b = 0; b < nBlocks; b++) {
+        double maxAbs = 0;
+        for (int k = m.row_ptr[m.block_ptr[b]]; k < m.row_ptr[m.block_ptr[b + 1]]; k++)
+          maxAbs = std::max(maxAbs, std::abs(m.values[k]));
+        scales[b] = Fixed16Value::scaleFor(maxAbs);
+      }
+    }
+
+    EntryStream<V> stream(br, blockStart[nBlocks]);
+    IndexCoding coding(br.indexBits, m.blockSize);
+    std::vector<int>& m_colptr = br.m_colptr;
+    m_colptr.resize(int64_t(n) * nBlocks);
+    br.m_escapes.clear();
+    for (int b = 0; b < nBlocks; b++) {
+      int scale = V::scaled ? scales[b] : 0;
+      int64_t cursor = blockStart[b];
+      int32_t* rowEnds = m_colptr.data() + int64_t(b) * n;
+      int row = 0;
+      for (int r = m.block_ptr[b]; r < m.block_ptr[b + 1]; r++) {
+        for (; row < m.rows[r]; row++)
+          rowEnds[row] = cursor - blockStart[b];
+        int previous = 0;
+        for (int k = m.row_ptr[r]; k < m.row_ptr[r + 1]; k++) {
+          int offset = m.col_ind[k];
+          bool escaped;
+          uint32_t code = coding.encode(offset, previous, escaped);
+          if (escaped)
+            br.m_escapes.push_back(offset);
+          previous = offset;
+          stream.set(cursor++, V::encode(m.values[k], scale), code);
+        }
+      }
+      for (; row < n; row++)
+        rowEnds[row] = cursor - blockStart[b];
+    }
+    br.escapes = br.m_escapes.size();
+  }
+};
+
+// sets the values of the stream to zero, keeping the indices
+struct ClearValues {
+  Partition& p;
+
+  template<typename V>
+  void operator()(V) {
+    EntryStream<V> stream(p);
+    for (int64_t i = 0; i < stream.size(); i++)
+      stream.clearValue(i);
+  }
+};
+
+}
+
+void cask::spmv::Partition::clearValues() {
+  for (auto&& t : m_indptr_values)
+    t.value = 0;
+  if (!packedStream())
+    return;
+  ClearValues clear{*this};
+  withValueType(valueFormat, clear);
 }
+
 // transform a given matrix with n rows in blocks of size n X blockSize
 Partition ssarch::do_blocking(
-    const CsrMatrix& m,
+    const CsrView& m,
     int blockSize,
-    int inputWidth)
+    int inputWidth,
+    ValueFormat format,
+    int indexBits,
+    int firstRow)
 {
-  int rows = m.n;
+  int n = m.n;
   int cols = m.m;
-  int n = rows;
-  //std::cout << "Mat rows " << n << std::endl;
-  //std::cout << "Npartitions: " << nPartitions << std::endl;
+  int nBlocks = cols / blockSize + (cols % blockSize == 0 ? 0 : 1);
 
-  std::vector<CsrMatrix> partitions = m.sliceColumns(blockSize); // (nBlocks);
-  int nBlocks = partitions.size();
+  // counting pass: nonzeros of each block, which are padded to a multiple
+  // of the input width in the indptr / values stream
+  std::vector<int64_t> blockStart(nBlocks + 1, 0);
+  for (int k = m.row_ptr[0]; k < m.row_ptr[n]; k++)
+    blockStart[m.col_ind[k] / blockSize + 1]++;
+  for (int b = 0; b < nBlocks; b++)
+    blockStart[b + 1] = blockStart[b] + cutils::ceilDivide(blockStart[b + 1], inputWidth) * inputWidth;
 
-  //if (n > Spmv_maxRows)
-    //throw std::invalid_argument(
-        //"Matrix has too many rows - maximum supported: "
-        //+ std::to_string(Spmv_maxRows));
+  Partition br;
+  br.valueFormat = format;
+  br.indexBits = indexBits;
+  FillBlocks fill{m, blockSize, blockStart, br, firstRow};
+  withValueType(format, fill);
+  coalesceBlocks(br, n, nBlocks, blockSize, inputWidth, blockStart);
+  return br;
+}
 
-  std::vector<double> v(cols, 0);
-  std::vector<int> m_colptr;
-  std::vector<indptr_value> m_indptr_value;
+Partition ssarch::do_blocking(
+    const BlockedCsrMatrix& m,
+    int inputWidth,
+    ValueFormat format,
+    int indexBits)
+{
+  int nBlocks = m.nBlocks;
+  std::vector<int64_t> blockStart(nBlocks + 1, 0);
+  for (int b = 0; b < nBlocks; b++)
+    blockStart[b + 1] = blockStart[b] + cutils::ceilDivide(m.blockNnzs(b), inputWidth) * inputWidth;
+
+  Partition br;
+  br.valueFormat = format;
+  br.indexBits = indexBits;
+  FillBlockedCsr fill{m, blockStart, br};
+  withValueType(format, fill);
+  coalesceBlocks(br, m.n, nBlocks, m.blockSize, inputWidth, blockStart);
+  return br;
+}
 
+void ssarch::coalesceBlocks(
+    Partition& br,
+    int n,
+    int nBlocks,
+    int blockSize,
+    int inputWidth,
+    const std::vector<int64_t>& blockStart)
+{
+  std::vector<int>& m_colptr = br.m_colptr;
   // now we coalesce partitions
   int cycles = 0;
-  int partition = 0;
-  int reductionCycles = rows * partitions.size();
+  int reductionCycles = n * nBlocks;
   int emptyCycles = 0;
-  for (auto& p : partitions) {
-    auto pp = preprocessBlock(p, partition++, partitions.size());
-    auto& p_colptr = pp.row_ptr;
-    auto& p_indptr = pp.col_ind;
-    auto& p_values = pp.values;
+  int64_t colptrSize = 0;
+  for (int b = 0; b < nBlocks; b++) {
+    int32_t* rowEnds = n == 0 ? nullptr : &m_colptr[int64_t(b) * n];
+    int computeCycles = this->countComputeCycles(rowEnds, n, inputWidth);
+    int encodedSize = n == 0 ? 0 : this->encodeBlockRows(rowEnds, n, 0, b, nBlocks);
 
-    int diff = p.row_ptr.size() - p_colptr.size();
+    int diff = n - encodedSize;
     emptyCycles += diff;
     reductionCycles -= diff;
-    cycles += this->countComputeCycles(&p.row_ptr[0], n, inputWidth) - diff;
+    cycles += computeCycles - diff;
 
-    utils::align(p_indptr, sizeof(int) * inputWidth);
-    utils::align(p_values, sizeof(double) * inputWidth);
-    copy(p_colptr.begin(), p_colptr.end(), back_inserter(m_colptr));
-    for (size_t i = 0; i < p_values.size(); i++)
-      m_indptr_value.push_back(indptr_value( p_values[i], p_indptr[i]));
+    std::copy(rowEnds, rowEnds + encodedSize, m_colptr.begin() + colptrSize);
+    colptrSize += encodedSize;
   }
+  m_colptr.resize(colptrSize);
 
-  Partition br;
   br.m_colptr_unpaddedLength = m_colptr.size();
-  br.m_indptr_values_unpaddedLength = m_indptr_value.size();
-  std::vector<double> out(n, 0);
-  cutils::align(out, burst_size_bytes);
-  cutils::align(v, sizeof(double) * blockSize);
+  br.m_indptr_values_unpaddedLength = blockStart[nBlocks];
+  // the output is aligned to the burst size, the vector to the block size
+  int outSize = cutils::align(n * sizeof(double), burst_size_bytes) / sizeof(double);
+  int vSize = nBlocks * blockSize;
 
   br.nBlocks = nBlocks;
   br.n = n;
-  br.paddingCycles = out.size() - n; // number of cycles required to align to the burst size
-  br.totalCycles = cycles + v.size();
-  br.vector_load_cycles = v.size() / nBlocks; // per partition
-  br.m_indptr_values = m_indptr_value;
-  br.m_colptr = m_colptr;
-  br.outSize = out.size() * sizeof(double);
+  br.paddingCycles = outSize - n; // number of cycles required to align to the burst size
+  br.totalCycles = cycles + vSize + reflectionCycles(impl.symmetric, n, nBlocks, blockSize);
+  br.reflectedSize = impl.symmetric ? cutils::align(vSize * sizeof(double), burst_size_bytes) : 0;
+  br.vector_load_cycles = nBlocks == 0 ? 0 : vSize / nBlocks; // per partition
+  br.outSize = outSize * sizeof(double);
+  br.emptyCycles = emptyCycles;
+  br.reductionCycles = reductionCycles;
+}
+
+namespace {
+
+// the row by row scan of blockStatistics()
+struct ScanBlockRows {
+  const cask::CsrView& m;
+  std::vector<BlockStatistics>& blocks;
+  EscapeCounter& escapes;
+  std::vector<double>* maxAbs;
+
+  template<typename Width, typename BlockOf>
+  void operator()(Width w, BlockOf blockOf) {
+    std::vector<int> rowLength(blocks.size(), 0);
+    std::vector<int> touched;
+    for (int i = 0; i < m.n; i++) {
+      for (int k = m.row_ptr[i]; k < m.row_ptr[i + 1]; k++) {
+        int b = blockOf.block(m.col_ind[k]);
+        if (rowLength[b]++ == 0)
+          touched.push_back(b);
+        if (escapes.enabled())
+          blocks[b].escapes += escapes.count(i, b, blockOf.offset(m.col_ind[k]));
+        if (maxAbs)
+          (*maxAbs)[b] = std::max((*maxAbs)[b], std::abs(m.values[k]));
+      }
+      for (int b : touched) {
+        blocks[b].addRow(i, rowLength[b], w);
+        rowLength[b] = 0;
+      }
+      touched.clear();
+    }
+  }
+};
+
+// the rows [startRow, startRow + nRows) of analyse_blocking() from lengths
+struct AddBlockRowLengths {
+  const BlockRowLengths& lengths;
+  int startRow, nRows;
+  std::vector<BlockStatistics>& blocks;
+
+  template<typename Width>
+  void operator()(Width w) {
+    for (int b = 0; b < lengths.nBlocks; b++) {
+      auto range = lengths.rowRange(b, startRow, startRow + nRows);
+      for (int64_t k = range.first; k < range.second; k++) {
+        blocks[b].addRow(lengths.rows[k] - startRow, lengths.lengths[k], w);
+        if (!lengths.escapes.empty())
+          blocks[b].escapes += lengths.escapes[k];
+      }
+    }
+  }
+};
+
+}
+
+std::vector<BlockStatistics> ssarch::blockStatistics(
+    const CsrView& m,
+    int blockSize,
+    int inputWidth,
+    int indexBits,
+    std::vector<double>* maxAbs)
+{
+  int cols = m.m;
+  int nBlocks = cols / blockSize + (cols % blockSize == 0 ? 0 : 1);
+
+  // countComputeCycles() only depends on the lengths of the non empty rows
+  // (empty rows take one cycle each) and the encoding only on the number of
+  // empty row runs
+  std::vector<BlockStatistics> blocks(nBlocks);
+  EscapeCounter escapes(indexBits, blockSize, nBlocks);
+  if (maxAbs)
+    maxAbs->assign(nBlocks, 0);
+  ScanBlockRows scan{m, blocks, escapes, maxAbs};
+  withBlocking(inputWidth, blockSize, scan);
+  return blocks;
+}
+
+Partition ssarch::analyse_blocking(
+    const CsrView& m,
+    int blockSize,
+    int inputWidth,
+    int indexBits)
+{
+  std::vector<BlockStatistics> blocks = blockStatistics(m, blockSize, inputWidth, indexBits);
+  return partitionFromStatistics(blocks, m.n, blockSize, inputWidth);
+}
+
+Partition ssarch::analyse_blocking(
+    const BlockRowLengths& lengths,
+    int startRow,
+    int nRows,
+    int inputWidth)
+{
+  std::vector<BlockStatistics> blocks(lengths.nBlocks);
+  AddBlockRowLengths add{lengths, startRow, nRows, blocks};
+  withInputWidth(inputWidth, add);
+  return partitionFromStatistics(blocks, nRows, lengths.blockSize, inputWidth);
+}
+
+Partition ssarch::partitionFromStatistics(
+    std::vector<BlockStatistics>& blocks,
+    int n,
+    int blockSize,
+    int inputWidth)
+{
+  int nBlocks = blocks.size();
+  int cycles = 0;
+  int reductionCycles = n * nBlocks;
+  int emptyCycles = 0;
+  int64_t colptrSize = 0, indptrValuesSize = 0, escapes = 0;
+  for (int b = 0; b < nBlocks; b++) {
+    BlockStatistics& s = blocks[b];
+    escapes += s.escapes;
+    if (s.lastNonEmptyRow < n - 1)
+      s.emptyRuns++;
+    int computeCycles = s.cycles + (n - s.nonEmptyRows);
+    int encodedSize = n == 0 ? 0 : this->countEncodedBlockRows(s.nonEmptyRows, s.emptyRuns, n, b, nBlocks);
+
+    int diff = n - encodedSize;
+    emptyCycles += diff;
+    reductionCycles -= diff;
+    cycles += computeCycles - diff;
+    colptrSize += encodedSize;
+    indptrValuesSize += cutils::ceilDivide(s.nnzs, inputWidth) * inputWidth;
+  }
+
+  Partition br;
+  br.m_colptr_unpaddedLength = colptrSize;
+  br.m_indptr_values_unpaddedLength = indptrValuesSize;
+  br.escapes = escapes;
+  int outSize = cutils::align(n * sizeof(double), burst_size_bytes) / sizeof(double);
+  int vSize = nBlocks * blockSize;
+
+  br.nBlocks = nBlocks;
+  br.n = n;
+  br.paddingCycles = outSize - n;
+  br.totalCycles = cycles + vSize + reflectionCycles(impl.symmetric, n, nBlocks, blockSize);
+  br.reflectedSize = impl.symmetric ? cutils::align(vSize * sizeof(double), burst_size_bytes) : 0;
+  br.vector_load_cycles = nBlocks == 0 ? 0 : vSize / nBlocks;
+  br.outSize = outSize * sizeof(double);
   br.emptyCycles = emptyCycles;
   br.reductionCycles = reductionCycles;
 
@@ -115,7 +508,8 @@ std::vector<T> msinglearray(int size, int pos, T value) {
 
 /**
  * Ensures input data size is a multiple of burst size, by adding additional
- * zero padding if necessary.
+ * zero padding if necessary. Data which is already aligned is written
+ * without copying.
  *
  * @returns the number of bytes written, including padding if added
  */
@@ -124,103 +518,235 @@ int64_t writeAndPad(cask::runtime::GeneratedSpmvImplementation* impl,
     int controllerNum,
     int numControllers,
     int64_t startAddress,
-    std::vector<T> data,
-    std::string routingString)
+    const std::vector<T>& data,
+    const std::string& routingString)
 {
-  cutils::align(data, burst_size_bytes);
-  int64_t sizeBytes = cutils::size_bytes(data);
+  const std::vector<T>* out = &data;
+  std::vector<T> padded;
+  if (cutils::size_bytes(data) % burst_size_bytes != 0) {
+    padded = data;
+    cutils::align(padded, burst_size_bytes);
+    out = &padded;
+  }
+  int64_t sizeBytes = cutils::size_bytes(*out);
   auto sizes = msinglearray(numControllers, controllerNum, sizeBytes);
   auto addrs = msinglearray(numControllers, controllerNum, startAddress);
   impl->write(sizes[controllerNum],
               &sizes[0],
               &addrs[0],
-              (uint8_t*)data.data(),
+              (uint8_t*)out->data(),
               routingString.c_str());
   return sizeBytes;
 }
 
-
-// write the data for a partition, starting at the given offset
-PartitionWriteResult writeDataForPartition(
-    cask::runtime::GeneratedSpmvImplementation *impl,
-    int offset,
-    const Partition& br,
-    const std::vector<double>& v,
+/**
+ * As writeAndPad(), for n entries of data: the whole bursts are written
+ * directly, the last, partial, one from a zero padded copy.
+ */
+int64_t writeAndPad(cask::runtime::GeneratedSpmvImplementation* impl,
+    int controllerNum,
     int numControllers,
-    int controllerNum) {
-  // for each partition write this down
-  std::string routingString = "split -> tomem" + std::to_string(controllerNum);
-  PartitionWriteResult pwr;
-  pwr.indptrValuesStartAddress = cutils::align(offset, burst_size_bytes);
-  pwr.indptrValuesSize = writeAndPad(impl,
-      controllerNum,
-      numControllers,
-      pwr.indptrValuesStartAddress,
-      br.m_indptr_values,
-      routingString);
-
-  pwr.vStartAddress = pwr.indptrValuesStartAddress + pwr.indptrValuesSize;
-  // XXX, it may not be safe to pad the vector arbitrarily, if the hardware
-  // cannot support unpadding it at runtime
-  int64_t sizeV = pwr.colptrSize = writeAndPad(impl,
-      controllerNum,
-      numControllers,
-      pwr.vStartAddress,
-      v,
-      routingString);
-
-  pwr.colptrStartAddress = pwr.vStartAddress + sizeV;
-  pwr.colptrSize = writeAndPad(impl,
-      controllerNum,
-      numControllers,
-      pwr.colptrStartAddress,
-      br.m_colptr,
-      routingString);
-
-  pwr.outStartAddr = pwr.colptrStartAddress + pwr.colptrSize;
-  pwr.outSize = br.outSize;
-  return pwr;
+    int64_t startAddress,
+    const double* data,
+    int64_t n,
+    const std::string& routingString)
+{
+  const int64_t perBurst = burst_size_bytes / sizeof(double);
+  int64_t whole = n / perBurst * perBurst;
+  double tail[perBurst];
+  std::fill(tail, tail + perBurst, 0.0);
+  std::copy(data + whole, data + n, tail);
+  for (int piece = 0; piece < 2; piece++) {
+    int64_t sizeBytes = piece == 0 ? whole * sizeof(double) : (n > whole ? burst_size_bytes : 0);
+    if (sizeBytes == 0)
+      continue;
+    auto sizes = msinglearray(numControllers, controllerNum, sizeBytes);
+    auto addrs = msinglearray(numControllers, controllerNum,
+                              startAddress + (piece == 0 ? 0 : whole * int64_t(sizeof(double))));
+    impl->write(sizes[controllerNum],
+                &sizes[0],
+                &addrs[0],
+                (const uint8_t*)(piece == 0 ? data : tail),
+                routingString.c_str());
+  }
+  return (n + perBurst - 1) / perBurst * burst_size_bytes;
 }
 
-cask::Vector ssarch::spmv(const cask::Vector& x)
-{
-  using namespace std;
+// pads the vector as expected by the device
+std::vector<double> padVector(std::vector<double> v, int cacheSize) {
+  cutils::align(v, sizeof(double) * cacheSize);
+  cutils::align(v, burst_size_bytes);
+  return v;
+}
+
+std::string writeRoutingString(int controllerNum) {
+  return "split -> tomem" + std::to_string(controllerNum);
+}
+
+// a stream of a partition, to be written at address
+template<typename T>
+DramPiece piece(int64_t address, const std::vector<T>& stream) {
+  return DramPiece{address, reinterpret_cast<const uint8_t*>(stream.data()), cutils::size_bytes(stream)};
+}
+
+// symmetric designs read the x of the rows of each partition after x, so
+// the partitions of a controller cannot share its vector buffers
+DramLayoutOptions designLayout(DramLayoutOptions o, const cask::runtime::GeneratedSpmvImplementation& impl) {
+  o.shareVector = o.shareVector && !impl.symmetric;
+  return o;
+}
+
+/**
+ * Writes streams to the DRAM of a memory controller from pieces which
+ * together cover each byte of their padded length once. Bursts that lie
+ * within a piece are written directly; the bursts pieces share are kept,
+ * zero filled, until finish() writes them.
+ */
+class BurstAssembler {
+  cask::runtime::GeneratedSpmvImplementation* impl;
+  int controllerNum, numControllers;
+  std::string routingString;
+  // by address
+  std::map<int64_t, std::vector<uint8_t>> shared;
+
+ public:
+  BurstAssembler(cask::runtime::GeneratedSpmvImplementation* _impl, int _controllerNum, int _numControllers) :
+    impl(_impl), controllerNum(_controllerNum), numControllers(_numControllers),
+    routingString(writeRoutingString(_controllerNum)) {}
+
+  // size bytes from an aligned address, a multiple of the burst size
+  void write(int64_t address, const uint8_t* data, int64_t size) {
+    auto sizes = msinglearray(numControllers, controllerNum, size);
+    auto addrs = msinglearray(numControllers, controllerNum, address);
+    impl->write(sizes[controllerNum], &sizes[0], &addrs[0], data, routingString.c_str());
+  }
 
-  if (this->impl.dram_reduction_enabled) {
-    // because of DRAM read/write latency we can only hope to get correct
-    // answers for large matrices
-    // XXX figure out where to place this constant;
-    const int minRowsWithDramReduction = 35000;
-    if (mat.n < minRowsWithDramReduction ) {
-      stringstream ss;
-      ss << "Matrix is too small! Minimum supported rows with DRAM reduction: ";
-      ss << minRowsWithDramReduction;
-      ss << " actual rows: " << mat.n;
-      throw invalid_argument(ss.str());
+  // ORs the bytes into the shared bursts they fall in
+  void merge(int64_t address, const uint8_t* data, int64_t size) {
+    while (size > 0) {
+      int64_t start = address / burst_size_bytes * burst_size_bytes;
+      int64_t n = std::min(size, start + burst_size_bytes - address);
+      std::vector<uint8_t>& burst = shared[start];
+      burst.resize(burst_size_bytes);
+      for (int64_t i = 0; i < n; i++)
+        burst[address - start + i] |= data[i];
+      address += n;
+      data += n;
+      size -= n;
     }
-  } else if (impl.max_rows < mat.n) {
-      stringstream ss;
-      ss << "Matrix is too large! Maximum supported rows: ";
-      ss << impl.max_rows;
-      ss << " actual rows: " << mat.n;
-      throw invalid_argument(ss.str());
   }
 
-  int cacheSize = impl.cache_size;
+  void finish() {
+    for (const auto& b : shared)
+      write(b.first, b.second.data(), burst_size_bytes);
+    shared.clear();
+  }
+};
 
-  vector<double> v = x.data;
-  cutils::align(v, sizeof(double) * cacheSize);
-  cutils::align(v, burst_size_bytes);
+/**
+ * Fills the bits [startBit, endBit) of a stream in order, as a little endian
+ * bit stream (see writeBits()). Complete bursts within the segment are
+ * written by flush(); the others, which the segment shares with its
+ * neighbours or the padding of the stream, are merged. finish() pads the
+ * segment with zeros.
+ */
+class SegmentWriter {
+  BurstAssembler* out;
+  int64_t startBit, endBit;
+  // the staged bytes start at stagedAddress; bit is the end of the bits put
+  int64_t stagedAddress, bit;
+  std::vector<uint8_t> staged;
 
-  vector<int> nrows, totalCycles, reductionCycles, paddingCycles, colptrSizes, indptrValuesSizes, outputResultSizes;
-  vector<long> outputStartAddresses, colptrStartAddresses;
-  vector<long> vStartAddresses, indptrValuesStartAddresses;
+  // passes on the staged bytes before address
+  void emit(int64_t address) {
+    int64_t lastBurstEnd = endBit / 8 / burst_size_bytes * burst_size_bytes;
+    int64_t a = stagedAddress;
+    while (a < address) {
+      int64_t burstStart = a / burst_size_bytes * burst_size_bytes;
+      const uint8_t* data = staged.data() + (a - stagedAddress);
+      if (burstStart * 8 >= startBit && burstStart + burst_size_bytes <= lastBurstEnd) {
+        int64_t end = std::min(address / burst_size_bytes * burst_size_bytes, lastBurstEnd);
+        out->write(a, data, end - a);
+        a = end;
+      } else {
+        int64_t end = std::min(address, burstStart + burst_size_bytes);
+        out->merge(a, data, end - a);
+        a = end;
+      }
+    }
+    staged.erase(staged.begin(), staged.begin() + (address - stagedAddress));
+    stagedAddress = address;
+  }
 
-  int offset = 0;
-  int i = 0;
+ public:
+  SegmentWriter(BurstAssembler& _out, int64_t _startBit, int64_t _endBit) :
+    out(&_out), startBit(_startBit), endBit(_endBit), stagedAddress(_startBit / 8), bit(_startBit) {}
 
-  if (partitions.size() != impl.num_pipes) {
-    throw std::runtime_error("numPipes should equal numPartitions");
+  void put(uint64_t value, int nBits) {
+    int64_t size = (bit + nBits + 7) / 8 - stagedAddress;
+    if (int64_t(staged.size()) < size)
+      staged.resize(size, 0);
+    writeBits(staged, bit - 8 * stagedAddress, value, nBits);
+    bit += nBits;
+  }
+
+  void flush() {
+    int64_t address = bit / 8 / burst_size_bytes * burst_size_bytes;
+    if (address > stagedAddress)
+      emit(address);
+  }
+
+  void finish() {
+    if (bit > endBit)
+      throw std::runtime_error("Stream segment overflow");
+    int64_t end = (endBit + 7) / 8;
+    staged.resize(end - stagedAddress, 0);
+    bit = endBit;
+    emit(end);
+  }
+};
+
+// the bits of a value in its storage in the stream
+struct EncodeValue {
+  double v;
+  int scale;
+  uint64_t bits;
+
+  template<typename V>
+  void operator()(V) {
+    typename V::storage s = V::encode(v, scale);
+    bits = 0;
+    std::memcpy(&bits, &s, sizeof(s));
+  }
+};
+
+struct IsScaled {
+  bool scaled;
+
+  template<typename V>
+  void operator()(V) {
+    scaled = V::scaled;
+  }
+};
+
+void ssarch::checkDeviceLimits()
+{
+  using namespace std;
+
+  // matrices which do not fit the reduction are padded or split in passes
+  // when they are partitioned
+  if (this->impl.dram_reduction_enabled && matrixRows + paddingRows < minRowsWithDramReduction)
+    throw runtime_error("Spmv: " + std::to_string(matrixRows + paddingRows) + " rows, the DRAM reduction needs " +
+        std::to_string(minRowsWithDramReduction));
+  for (size_t pass = 0; pass + 1 < rowSplits.size(); pass += impl.num_pipes) {
+    int passRows = rowSplits[std::min(rowSplits.size() - 1, pass + impl.num_pipes)] - rowSplits[pass];
+    if (!this->impl.dram_reduction_enabled && passRows > impl.max_rows)
+      throw runtime_error("Spmv: a pass of " + std::to_string(passRows) + " rows, the design holds " +
+          std::to_string(impl.max_rows));
+  }
+
+  if (partitions.empty() || partitions.size() % impl.num_pipes != 0) {
+    throw std::runtime_error("numPartitions should be a multiple of numPipes");
   }
 
   if (impl.num_pipes % impl.num_controllers != 0) {
@@ -230,65 +756,561 @@ cask::Vector ssarch::spmv(const cask::Vector& x)
   if (impl.num_controllers > impl.num_pipes) {
      throw std::runtime_error("numPipes should be larger than numControllers");
   }
+}
 
-  for (auto& p : partitions) {
+DramLayout ssarch::planDeviceLayout() const
+{
+  if (!streamsBuilt)
+    throw std::runtime_error("Spmv::planDeviceLayout no matrix streams - run preprocess on the matrix");
+  int64_t vSizeBytes = cutils::size_bytes(padVector(std::vector<double>(matrixCols), impl.cache_size));
+  std::vector<PartitionStreamSizes> sizes;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    const Partition& p = partitions[i];
+    sizes.push_back(PartitionStreamSizes{controllerOf(i), p.indptrValuesBytes(),
+        cutils::size_bytes(p.m_colptr), cutils::size_bytes(p.m_block_scales), cutils::size_bytes(p.m_escapes),
+        vectorBufferBytes(p, vSizeBytes), p.outSize + p.reflectedSize});
+  }
+  return planDramLayout(sizes, impl.num_controllers, numVectorBuffers, designLayout(layoutOptions, impl));
+}
+
+void ssarch::loadMatrix()
+{
+  CASK_TRACE_SCOPE("spmv:loadMatrix");
+  if (!streamsBuilt) {
+    throw std::runtime_error("Spmv::loadMatrix no matrix streams - run preprocess or preprocessToDevice on the matrix");
+  }
+  checkDeviceLimits();
+
+  deviceLayout = planDeviceLayout();
+  transfers.assign(partitions.size(), PartitionTransfers());
+
+  // the streams of all partitions of a controller are written together,
+  // and the controllers concurrently
+  parallel::ThreadPool::global().run(impl.num_controllers, [&](int ctrlId) {
+    CASK_TRACE_SCOPE("spmv:writeMatrix", ctrlId);
+    std::vector<DramPiece> pieces;
+    for (int i : controllerPartitions(ctrlId)) {
+      const Partition& p = partitions[i];
+      const PartitionWriteResult& pr = deviceLayout.partitions[i];
+      if (p.packedStream())
+        pieces.push_back(piece(pr.indptrValuesStartAddress, p.m_packed_indptr_values));
+      else
+        pieces.push_back(piece(pr.indptrValuesStartAddress, p.m_indptr_values));
+      pieces.push_back(piece(pr.colptrStartAddress, p.m_colptr));
+      pieces.push_back(piece(pr.scalesStartAddress, p.m_block_scales));
+      pieces.push_back(piece(pr.escapesStartAddress, p.m_escapes));
+    }
+    BurstAssembler out(&this->impl, ctrlId, impl.num_controllers);
+    writeRegion(pieces, deviceLayout.base, deviceLayout.matrixEnd[ctrlId], maxWriteBytes,
+                [&](int64_t address, const uint8_t* data, int64_t size) { out.write(address, data, size); });
+  });
+  *impl.residentMatrix = matrixId;
+}
+
+ssarch::StreamCounts ssarch::countStreams(const CsrView& rows, int controllerNum, int64_t vSizeBytes)
+{
+  int blockSize = impl.cache_size, inputWidth = impl.input_width, indexBits = impl.index_bits;
+  int n = rows.n;
+  IsScaled isScaled{false};
+  withValueType(impl.value_format, isScaled);
+
+  // the same statistics as analyse_blocking()
+  std::vector<double> maxAbs;
+  std::vector<BlockStatistics> blocks = blockStatistics(rows, blockSize, inputWidth, indexBits,
+                                                        isScaled.scaled ? &maxAbs : nullptr);
+  int nBlocks = blocks.size();
+  Partition stats = partitionFromStatistics(blocks, n, blockSize, inputWidth);
+  StreamCounts c;
+  c.blockStart.assign(nBlocks + 1, 0);
+  c.colptrStart.assign(nBlocks + 1, 0);
+  c.escapesStart.assign(nBlocks + 1, 0);
+  for (int b = 0; b < nBlocks; b++) {
+    const BlockStatistics& s = blocks[b];
+    c.blockStart[b + 1] = c.blockStart[b] + cutils::ceilDivide(s.nnzs, inputWidth) * inputWidth;
+    int encodedSize = n == 0 ? 0 : countEncodedBlockRows(s.nonEmptyRows, s.emptyRuns, n, b, nBlocks);
+    c.colptrStart[b + 1] = c.colptrStart[b] + encodedSize;
+    c.escapesStart[b + 1] = c.escapesStart[b] + s.escapes;
+  }
+  for (double m : maxAbs)
+    c.scales.push_back(Fixed16Value::scaleFor(m));
+
+  int64_t entryBits = valueBits(impl.value_format) + indexBits;
+  c.sizes = PartitionStreamSizes{controllerNum, (c.blockStart[nBlocks] * entryBits + 7) / 8,
+      c.colptrStart[nBlocks] * int64_t(sizeof(int32_t)), int64_t(c.scales.size() * sizeof(int32_t)),
+      c.escapesStart[nBlocks] * int64_t(sizeof(int32_t)), vectorBufferBytes(stats, vSizeBytes),
+      stats.outSize + stats.reflectedSize};
+  return c;
+}
+
+void ssarch::streamPartition(
+    const CsrView& mat,
+    int start,
+    int n,
+    bool filler,
+    const StreamCounts& counts,
+    const PartitionWriteResult& pwr,
+    int controllerNum,
+    int64_t chunkNnzs)
+{
+  int blockSize = impl.cache_size, indexBits = impl.index_bits;
+  ValueFormat format = impl.value_format;
+  IsScaled isScaled{false};
+  withValueType(format, isScaled);
+  CsrView rows = mat.sliceRows(start, n);
+  const std::vector<int64_t>& blockStart = counts.blockStart;
+  const std::vector<int64_t>& colptrStart = counts.colptrStart;
+  const std::vector<int64_t>& escapesStart = counts.escapesStart;
+  const std::vector<int32_t>& scales = counts.scales;
+  int nBlocks = blockStart.size() - 1;
+  int vBits = valueBits(format);
+  int64_t entryBits = vBits + indexBits;
+
+  BurstAssembler out(&impl, controllerNum, impl.num_controllers);
+  std::vector<SegmentWriter> values, colptr, escapes;
+  for (int b = 0; b < nBlocks; b++) {
+    values.emplace_back(out, 8 * pwr.indptrValuesStartAddress + blockStart[b] * entryBits,
+                        8 * pwr.indptrValuesStartAddress + blockStart[b + 1] * entryBits);
+    colptr.emplace_back(out, 8 * pwr.colptrStartAddress + 32 * colptrStart[b],
+                        8 * pwr.colptrStartAddress + 32 * colptrStart[b + 1]);
+    escapes.emplace_back(out, 8 * pwr.escapesStartAddress + 32 * escapesStart[b],
+                         8 * pwr.escapesStartAddress + 32 * escapesStart[b + 1]);
+  }
+  if (!scales.empty()) {
+    SegmentWriter w(out, 8 * pwr.scalesStartAddress, 8 * pwr.scalesStartAddress + 32 * nBlocks);
+    for (int32_t scale : scales)
+      w.put(uint32_t(scale), 32);
+    w.finish();
+  }
+
+  // fill pass, as FillBlocks and coalesceBlocks(), a chunk of rows at a time.
+  // The row ends of each block are encoded up to its last non empty row in
+  // the chunk; the empty rows after it, whose ends are that of the last
+  // encoded row, are held until the next non empty row or the end
+  IndexCoding coding(indexBits, blockSize);
+  std::vector<int> previous(nBlocks, 0), previousRow(nBlocks, -1);
+  std::vector<int64_t> cursor(blockStart.begin(), blockStart.end() - 1);
+  std::vector<std::vector<int32_t>> ends(nBlocks);
+  std::vector<int> lastNonEmpty(nBlocks);
+  std::vector<int64_t> held(nBlocks, 0), encoded(nBlocks, 0);
+  std::vector<int32_t> encodedEnd(nBlocks, 0);
+  auto encode = [&](int b, bool last) {
+    int keep = last ? 0 : ends[b].size() - (lastNonEmpty[b] + 1);
+    if (!last && lastNonEmpty[b] == -1) {
+      held[b] += keep;
+      ends[b].clear();
+      return;
+    }
+    std::vector<int32_t> rowEnds(held[b], encodedEnd[b]);
+    rowEnds.insert(rowEnds.end(), ends[b].begin(), ends[b].end() - keep);
+    held[b] = keep;
+    ends[b].clear();
+    if (rowEnds.empty())
+      return;
+    int32_t end = rowEnds.back();
+    int size = encodeBlockRows(rowEnds.data(), rowEnds.size(), encodedEnd[b], b, nBlocks);
+    for (int i = 0; i < size; i++)
+      colptr[b].put(uint32_t(rowEnds[i]), 32);
+    encoded[b] += size;
+    encodedEnd[b] = end;
+  };
+
+  for (int chunkStart = 0; chunkStart < n; ) {
+    int chunkEnd = chunkStart + 1;
+    while (chunkEnd < n && rows.row_ptr[chunkEnd + 1] - rows.row_ptr[chunkStart] <= chunkNnzs &&
+           int64_t(chunkEnd + 1 - chunkStart) * nBlocks <= chunkNnzs)
+      chunkEnd++;
+    CASK_TRACE_SCOPE("spmv:streamChunk", chunkStart);
+
+    std::fill(lastNonEmpty.begin(), lastNonEmpty.end(), -1);
+    for (int i = chunkStart; i < chunkEnd; i++) {
+      for (int k = rows.row_ptr[i]; k < rows.row_ptr[i + 1]; k++) {
+        int col = rows.col_ind[k];
+        int b = col / blockSize;
+        int o = col - b * blockSize;
+        bool escaped;
+        uint32_t code = coding.encode(o, previousRow[b] == i ? previous[b] : 0, escaped);
+        if (escaped)
+          escapes[b].put(uint32_t(o), 32);
+        previous[b] = o;
+        previousRow[b] = i;
+        double value = filler ? 0 : rows.values[k];
+        if (impl.symmetric && col == start + i)
+          value *= 0.5;
+        EncodeValue v{value, isScaled.scaled ? scales[b] : 0, 0};
+        withValueType(format, v);
+        values[b].put(v.bits, vBits);
+        values[b].put(code, indexBits);
+        cursor[b]++;
+        lastNonEmpty[b] = i - chunkStart;
+      }
+      for (int b = 0; b < nBlocks; b++)
+        ends[b].push_back(cursor[b] - blockStart[b]);
+    }
+    for (int b = 0; b < nBlocks; b++) {
+      encode(b, false);
+      values[b].flush();
+      colptr[b].flush();
+      escapes[b].flush();
+    }
+    chunkStart = chunkEnd;
+  }
+
+  for (int b = 0; b < nBlocks; b++) {
+    encode(b, true);
+    if (encoded[b] != colptrStart[b + 1] - colptrStart[b])
+      throw std::runtime_error("Spmv::preprocessToDevice block " + std::to_string(b) +
+          " encodes to " + std::to_string(encoded[b]) + " row ends, expecting " +
+          std::to_string(colptrStart[b + 1] - colptrStart[b]));
+    values[b].finish();
+    colptr[b].finish();
+    escapes[b].finish();
+  }
+  out.finish();
+}
+
+void ssarch::writeVector(const std::vector<double>& v, int buffer)
+{
+  // controllers are independent, so their transfers are issued concurrently
+  parallel::ThreadPool::global().run(impl.num_controllers, [&](int ctrlId) {
+    std::string routing = writeRoutingString(ctrlId);
+    for (int i : controllerPartitions(ctrlId)) {
+      // the others read the copy of the first partition of the controller
+      if (!deviceLayout.writesVector[i])
+        continue;
+      CASK_TRACE_SCOPE("spmv:writeVector", i);
+      auto start = std::chrono::high_resolution_clock::now();
+      transfers[i].vectorBytes = writeAndPad(&this->impl, ctrlId, impl.num_controllers,
+          deviceLayout.partitions[i].vAddress(buffer), v, routing);
+      // a symmetric design reads the x of the rows of the partition after x
+      if (impl.symmetric)
+        transfers[i].vectorBytes += writeAndPad(&this->impl, ctrlId, impl.num_controllers,
+            deviceLayout.partitions[i].vAddress(buffer) + cutils::size_bytes(v),
+            v.data() + partitions[i].firstRow, partitions[i].n, routing);
+      transfers[i].vectorWriteSeconds = dfesnippets::timing::clock_diff(start);
+    }
+  });
+}
+
+void ssarch::runOnDevice(int buffer, int nIterations)
+{
+  using namespace std;
+  vector<int> nrows, totalCycles, reductionCycles, colptrSizes, indptrValuesSizes;
+  vector<long> outputStartAddresses, colptrStartAddresses;
+  vector<long> vStartAddresses, indptrValuesStartAddresses;
+
+  for (size_t i = 0; i < partitions.size(); i++) {
+    const Partition& p = partitions[i];
+    const PartitionWriteResult& pr = deviceLayout.partitions[i];
     nrows.push_back(p.n);
-    paddingCycles.push_back(p.paddingCycles);
     totalCycles.push_back(p.totalCycles);
     reductionCycles.push_back(p.reductionCycles);
-
-    int nc = impl.num_controllers;
-    int pipesPerController = impl.num_pipes / nc;
-    int ctrlId = i / pipesPerController;
-    // moving to a new controller, reset offset in memory
-    if (i % pipesPerController == 0) {
-      offset = 0;
-    }
-    PartitionWriteResult pr = writeDataForPartition(&this->impl, offset, p, v, nc, ctrlId);
-    outputStartAddresses.push_back(pr.outStartAddr);
-    outputResultSizes.push_back(pr.outSize);
+    outputStartAddresses.push_back(pr.outAddress(buffer));
     colptrStartAddresses.push_back(pr.colptrStartAddress);
-    colptrSizes.push_back(cutils::size_bytes(p.m_colptr));
-    vStartAddresses.push_back(pr.vStartAddress);
-    indptrValuesSizes.push_back(cutils::size_bytes(p.m_indptr_values));
+    colptrSizes.push_back(p.m_colptr_unpaddedLength * sizeof(int));
+    vStartAddresses.push_back(pr.vAddress(buffer));
+    indptrValuesSizes.push_back(p.indptrValuesBytes());
     indptrValuesStartAddresses.push_back(pr.indptrValuesStartAddress);
+  }
+
+  // each row pass is a run of the design over its own partitions
+  for (size_t first = 0; first < partitions.size(); first += impl.num_pipes) {
+    // npartitions and vector load cycles should be the same for all partitions
+    int nBlocks = this->partitions[first].nBlocks;
+    int vector_load_cycles = this->partitions[first].vector_load_cycles;
 
-    offset = pr.outStartAddr + p.outSize;
-    i++;
+    CASK_TRACE_SCOPE("spmv:run", nIterations);
+    impl.Spmv(
+        nIterations,
+        nBlocks,
+        vector_load_cycles,
+        &colptrStartAddresses[first],
+        &colptrSizes[first],
+        &indptrValuesStartAddresses[first],
+        &indptrValuesSizes[first],
+        &nrows[first],
+        &outputStartAddresses[first],
+        &reductionCycles[first],
+        &totalCycles[first],
+        &vStartAddresses[first]
+        );
   }
+}
+
+// read sizeBytes from the given address of a memory controller into out
+void readFromController(
+    cask::runtime::GeneratedSpmvImplementation* impl,
+    int ctrlId,
+    int64_t address,
+    int64_t sizeBytes,
+    double* out)
+{
+  auto sizes = msinglearray(impl->num_controllers, ctrlId, sizeBytes);
+  auto addrs = msinglearray(impl->num_controllers, ctrlId, address);
+  std::string routing = "frommem" + std::to_string(ctrlId) + " -> join";
+  impl->read(
+      sizes[ctrlId],
+      &sizes[0],
+      &addrs[0],
+      (uint8_t*)out,
+      routing.c_str()
+      );
+}
 
-  // npartitions and vector load cycles should be the same for all partitions
-  int nBlocks = this->partitions[0].nBlocks;
-  int vector_load_cycles = this->partitions[0].vector_load_cycles;
-  cout << "Running on DFE" << endl;
+cask::Vector ssarch::readResult(int buffer)
+{
+  int outRows = 0;
+  for (const auto& p : partitions)
+    outRows += p.n;
+  // room for the burst padding of the last partition
+  Vector total(outRows + burst_size_bytes / sizeof(double));
+  readResult(buffer, total.data.data(), total.size());
 
-  int nIterations = 2;
-  utils::logResult("Total cycles", totalCycles);
-  utils::logResult("Padding cycles", paddingCycles);
-  utils::logResult("Reduction cycles", reductionCycles);
+  // remove the elements which were only for padding; if n < num_pipes,
+  // extra work is added to prevent a design pipeline stall, and the DRAM
+  // reduction may add empty rows: here we must remove these unnecessary
+  // filler elements from the output
+  total.data.resize(matrixRows);
+  return total;
+}
+
+void ssarch::readResult(int buffer, double* total, int64_t capacity)
+{
+  using namespace std;
+
+  // the output of each partition is read in place, at its row offset
+  vector<int> rowOffset(partitions.size() + 1, 0);
+  for (size_t i = 0; i < partitions.size(); i++)
+    rowOffset[i + 1] = rowOffset[i] + partitions[i].n;
 
+  parallel::ThreadPool::global().run(impl.num_controllers, [&](int ctrlId) {
+    for (int i : controllerPartitions(ctrlId)) {
+      // padding may overwrite rows of the following partitions of this
+      // controller, which are read later, but not those of other controllers
+      size_t next = i + 1;
+      while (next < partitions.size() && controllerOf(next) == ctrlId)
+        next++;
+      int64_t limit = next == partitions.size() ? capacity : rowOffset[next];
+      CASK_TRACE_SCOPE("spmv:readResult", i);
+      auto start = chrono::high_resolution_clock::now();
+      const PartitionWriteResult& pr = deviceLayout.partitions[i];
+      double* out = total + rowOffset[i];
+      int64_t address = pr.outAddress(buffer);
+      int n = partitions[i].n;
+      // the reflected sums of symmetric designs follow the rows
+      int64_t rowBytes = partitions[i].outSize;
+      if (rowOffset[i] + rowBytes / int64_t(sizeof(double)) <= limit) {
+        readFromController(&this->impl, ctrlId, address, rowBytes, out);
+        transfers[i].resultBytes = rowBytes;
+      } else {
+        // read the last, padded, burst separately
+        int64_t alignedBytes = int64_t(n) * sizeof(double) / burst_size_bytes * burst_size_bytes;
+        if (alignedBytes > 0)
+          readFromController(&this->impl, ctrlId, address, alignedBytes, out);
+        double tail[burst_size_bytes / sizeof(double)];
+        readFromController(&this->impl, ctrlId, address + alignedBytes, burst_size_bytes, tail);
+        int tailRows = n - alignedBytes / sizeof(double);
+        copy(tail, tail + tailRows, out + alignedBytes / sizeof(double));
+        transfers[i].resultBytes = alignedBytes + burst_size_bytes;
+      }
+      transfers[i].resultReadSeconds = dfesnippets::timing::clock_diff(start);
+    }
+  });
+  if (impl.symmetric)
+    addReflectedSums(buffer, total, capacity);
+}
+
+void ssarch::addReflectedSums(int buffer, double* out, int64_t capacity)
+{
+  CASK_TRACE_SCOPE("spmv:addReflectedSums");
+  int64_t rows = std::min<int64_t>(matrixRows, capacity);
+  int64_t stride = cutils::align(rows * int64_t(sizeof(double)), burst_size_bytes) / sizeof(double);
+  reflectedBuffer.assign(2 * stride * impl.num_controllers, 0.0);
+
+  // each controller sums the reflected sums of its partitions, of which only
+  // the columns below the last row of the partition can be non zero
+  parallel::ThreadPool::global().run(impl.num_controllers, [&](int ctrlId) {
+    double* partial = reflectedBuffer.data() + 2 * stride * ctrlId;
+    double* sums = partial + stride;
+    for (int i : controllerPartitions(ctrlId)) {
+      // fillers hold no values
+      if (i > 0 && hasFillers())
+        continue;
+      auto start = std::chrono::high_resolution_clock::now();
+      const Partition& p = partitions[i];
+      int64_t cols = std::min<int64_t>(p.firstRow + p.n, rows);
+      int64_t bytes = cutils::align(cols * int64_t(sizeof(double)), burst_size_bytes);
+      if (bytes == 0)
+        continue;
+      readFromController(&this->impl, ctrlId, deviceLayout.partitions[i].outAddress(buffer) + p.outSize, bytes, partial);
+      for (int64_t j = 0; j < cols; j++)
+        sums[j] += partial[j];
+      transfers[i].resultBytes += bytes;
+      transfers[i].resultReadSeconds += dfesnippets::timing::clock_diff(start);
+    }
+  });
+
+  parallel::parallelFor(0, rows, [&](int64_t j) {
+    for (int c = 0; c < impl.num_controllers; c++)
+      out[j] += reflectedBuffer[2 * stride * c + stride + j];
+  });
+}
+
+void ssarch::checkVectorSize(const Vector& x) {
+  if (x.size() != matrixCols) {
+    throw std::invalid_argument("Spmv vector length " + std::to_string(x.size()) +
+        " != matrix columns " + std::to_string(matrixCols));
+  }
+}
+
+std::shared_ptr<const cask::model::DeviceModel> ssarch::defaultDeviceModel() {
+  static std::shared_ptr<const model::DeviceModel> m = std::make_shared<model::Max4Model>();
+  return m;
+}
+
+void ssarch::buildPerformanceReport(int nIterations, double runSeconds,
+    double estimatedGflops, double measuredGflops)
+{
+  PerformanceReport& r = performanceReport;
+  r = PerformanceReport();
+  r.design = get_name() + " " + std::to_string(impl.cache_size) + " " +
+      std::to_string(impl.input_width) + " " + std::to_string(impl.num_pipes) + " " +
+      std::to_string(impl.num_controllers);
+  r.iterations = nIterations;
+  r.runSeconds = runSeconds;
+  r.estimatedGflops = estimatedGflops;
+  r.measuredGflops = measuredGflops;
+
+  // the memory bandwidth of the device is shared by all pipes
+  double pipeBandwidth = deviceModel->maxParams().memoryBandwidth * 1E9 / impl.num_pipes;
+  double passKernelSeconds = 0, passDramSeconds = 0;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    const Partition& p = partitions[i];
+    const PartitionTransfers& t = transfers[i];
+    PartitionReport pr;
+    pr.pipe = i % impl.num_pipes;
+    pr.controller = controllerOf(i);
+    pr.rows = p.n;
+    pr.totalCycles = p.totalCycles;
+    pr.reductionCycles = p.reductionCycles;
+    pr.paddingCycles = p.paddingCycles;
+    pr.emptyCycles = p.emptyCycles;
+    pr.streamBytes = p.streamBytes();
+    pr.kernelSeconds = p.totalCycles / getFrequency();
+    pr.dramSeconds = pr.streamBytes / pipeBandwidth;
+    pr.vectorBytes = t.vectorBytes;
+    pr.resultBytes = t.resultBytes;
+    pr.vectorWriteSeconds = t.vectorWriteSeconds;
+    pr.resultReadSeconds = t.resultReadSeconds;
+    r.partitions.push_back(pr);
+    passKernelSeconds = std::max(passKernelSeconds, pr.kernelSeconds);
+    passDramSeconds = std::max(passDramSeconds, pr.dramSeconds);
+    // row passes run one after the other
+    if ((i + 1) % impl.num_pipes == 0) {
+      r.kernelSeconds += passKernelSeconds;
+      r.dramSeconds += passDramSeconds;
+      passKernelSeconds = passDramSeconds = 0;
+    }
+  }
+
+  double writeSeconds = 0, readSeconds = 0;
+  for (int c = 0; c < impl.num_controllers; c++) {
+    ControllerReport cr{c, 0, 0, 0, 0};
+    for (int i : controllerPartitions(c)) {
+      cr.bytesWritten += transfers[i].vectorBytes;
+      cr.bytesRead += transfers[i].resultBytes;
+      cr.writeSeconds += transfers[i].vectorWriteSeconds;
+      cr.readSeconds += transfers[i].resultReadSeconds;
+    }
+    r.controllers.push_back(cr);
+    writeSeconds = std::max(writeSeconds, cr.writeSeconds);
+    readSeconds = std::max(readSeconds, cr.readSeconds);
+  }
+  // vectors are written, then results read
+  r.hostSeconds = writeSeconds + readSeconds;
+}
+
+std::string PerformanceReport::bottleneck() const {
+  if (hostSeconds > kernelSeconds && hostSeconds > dramSeconds)
+    return "host";
+  return dramSeconds > kernelSeconds ? "dram" : "kernel";
+}
+
+void PerformanceReport::writeJson(std::ostream& s) const {
+  s << "{\"design\":\"" << design << "\",\"iterations\":" << iterations
+    << ",\"runSeconds\":" << runSeconds
+    << ",\"kernelSeconds\":" << kernelSeconds
+    << ",\"dramSeconds\":" << dramSeconds
+    << ",\"hostSeconds\":" << hostSeconds
+    << ",\"estimatedGflops\":" << estimatedGflops
+    << ",\"measuredGflops\":" << measuredGflops
+    << ",\"bottleneck\":\"" << bottleneck() << "\",\n\"partitions\":[";
+  for (size_t i = 0; i < partitions.size(); i++) {
+    const PartitionReport& p = partitions[i];
+    s << (i == 0 ? "\n" : ",\n")
+      << "{\"pipe\":" << p.pipe << ",\"controller\":" << p.controller << ",\"rows\":" << p.rows
+      << ",\"totalCycles\":" << p.totalCycles << ",\"reductionCycles\":" << p.reductionCycles
+      << ",\"paddingCycles\":" << p.paddingCycles << ",\"emptyCycles\":" << p.emptyCycles
+      << ",\"streamBytes\":" << p.streamBytes << ",\"kernelSeconds\":" << p.kernelSeconds
+      << ",\"dramSeconds\":" << p.dramSeconds << ",\"vectorBytes\":" << p.vectorBytes
+      << ",\"resultBytes\":" << p.resultBytes << ",\"vectorWriteSeconds\":" << p.vectorWriteSeconds
+      << ",\"resultReadSeconds\":" << p.resultReadSeconds << "}";
+  }
+  s << "],\n\"controllers\":[";
+  for (size_t i = 0; i < controllers.size(); i++) {
+    const ControllerReport& c = controllers[i];
+    s << (i == 0 ? "\n" : ",\n")
+      << "{\"controller\":" << c.controller << ",\"bytesWritten\":" << c.bytesWritten
+      << ",\"bytesRead\":" << c.bytesRead << ",\"writeSeconds\":" << c.writeSeconds
+      << ",\"readSeconds\":" << c.readSeconds << "}";
+  }
+  s << "]}\n";
+}
+
+cask::Vector ssarch::spmv(const cask::Vector& x)
+{
+  using namespace std;
+
+  CASK_TRACE_SCOPE("spmv:spmv");
+  checkVectorSize(x);
+  if (!isMatrixLoaded()) {
+    loadMatrix();
+  }
+
+  // only the vector is transferred, the matrix is already in DRAM
+  writeVector(deviceVector(x), 0);
+
+  int nIterations = 2;
   auto start = chrono::_V2::system_clock::now();
-  impl.Spmv(
-      nIterations,
-      nBlocks,
-      vector_load_cycles,
-      &colptrStartAddresses[0],
-      &colptrSizes[0],
-      &indptrValuesStartAddresses[0],
-      &indptrValuesSizes[0],
-      &nrows[0],
-      &outputStartAddresses[0],
-      &reductionCycles[0],
-      &totalCycles[0],
-      &vStartAddresses[0]
-      );
+  runOnDevice(0, nIterations);
   double took = dfesnippets::timing::clock_diff(start) / nIterations;
+  Vector result = originalOrder(readResult(0));
+
+  // the report is recorded once the result is in, and printed with a
+  // single flush if verbose
+  vector<int> totalCycles, reductionCycles, paddingCycles;
+  for (auto& p : partitions) {
+    paddingCycles.push_back(p.paddingCycles);
+    totalCycles.push_back(p.totalCycles);
+    reductionCycles.push_back(p.reductionCycles);
+  }
   double maxCycles = *std::max_element(totalCycles.begin(), totalCycles.end());
-  double bwidthEst = impl.num_pipes * impl.input_width * getFrequency() * 12 / 1E9;
-  double scalingFactor = max(bwidthEst / 65.0, 1.0);
+  double bwidthEst = impl.num_pipes * impl.input_width * getFrequency() * bytesPerEntry() / 1E9;
   double est = maxCycles / getFrequency();
-  double gflopsEst = (2.0 * (double)this->mat.nnzs / (est * scalingFactor)) / 1E9;
-  double gflopsActual = (2.0 * (double)this->mat.nnzs / took) / 1E9;
+  double gflopsEst = getEstimatedGFlops(*deviceModel);
+  double gflopsActual = (2.0 * (double)this->matrixNnzs / took) / 1E9;
+  CASK_TRACE_COUNTER("spmv:cycles", maxCycles);
+  CASK_TRACE_COUNTER("spmv:seconds", took);
+  CASK_TRACE_COUNTER("spmv:estSeconds", est);
+  CASK_TRACE_COUNTER("spmv:gflops", gflopsActual);
+  CASK_TRACE_COUNTER("spmv:gflopsEst", gflopsEst);
+  buildPerformanceReport(nIterations, took, gflopsEst, gflopsActual);
+  if (!verbose)
+    return result;
+
+  cout << "Running on DFE\n";
+  utils::logResult("Total cycles", totalCycles);
+  utils::logResult("Padding cycles", paddingCycles);
+  utils::logResult("Reduction cycles", reductionCycles);
 
   utils::logResult("Input width ", impl.input_width);
   utils::logResult("Pipes ", impl.num_pipes);
@@ -299,67 +1321,551 @@ cask::Vector ssarch::spmv(const cask::Vector& x)
   utils::logResult("Gflops (est)", gflopsEst);
   utils::logResult("Gflops (actual)", gflopsActual);
   utils::logResult("BWidth (est)", bwidthEst);
+  cout.flush();
 
-  vector<double> total;
-  for (size_t i = 0; i < outputStartAddresses.size(); i++) {
-    vector<double> tmp(outputResultSizes[i] / sizeof(double), 0);
-    int ctrlId = i / (impl.num_pipes / impl.num_controllers);
-    auto sizes = msinglearray(impl.num_controllers, ctrlId, utils::size_bytes(tmp));
-    auto addrs = msinglearray(impl.num_controllers, ctrlId, outputStartAddresses[i]);
-    string routing = "frommem" + std::to_string(ctrlId) + " -> join";
-    impl.read(
-        sizes[ctrlId],
-        &sizes[0],
-        &addrs[0],
-        (uint8_t*)&tmp[0],
-        routing.c_str()
-        );
-    copy(tmp.begin(), tmp.begin() + nrows[i], back_inserter(total));
+  return result;
+}
+
+std::vector<cask::Vector> ssarch::spmm(const std::vector<cask::Vector>& xs)
+{
+  using namespace std;
+
+  for (const auto& x : xs)
+    checkVectorSize(x);
+  int k = xs.size();
+  vector<Vector> results;
+  results.reserve(k);
+  if (k == 0)
+    return results;
+
+  CASK_TRACE_SCOPE("spmv:spmm", k);
+  if (!isMatrixLoaded()) {
+    loadMatrix();
   }
 
-  // remove the elements which were only for padding
-  if (mat.n < impl.num_pipes) {
-    // handles the case where n < num_pipes; in this case extra work is added
-    // to prevent a design pipeline stall; here we must remove these
-    // unnecessary fller elements from the output
-    total.resize(mat.n);
+  auto start = chrono::_V2::system_clock::now();
+  writeVector(deviceVector(xs[0]), 0);
+
+  // three stage pipeline: while vector i is multiplied, vector i + 1 is
+  // written and result i - 1 is read, each in its own buffer
+  vector<double> runTimes(k);
+  for (int i = 0; i < k; i++) {
+    parallel::ThreadPool::global().run(2, [&](int task) {
+      if (task == 0) {
+        auto runStart = chrono::_V2::system_clock::now();
+        runOnDevice(i % numVectorBuffers, 1);
+        runTimes[i] = dfesnippets::timing::clock_diff(runStart);
+        return;
+      }
+      if (i + 1 < k)
+        writeVector(deviceVector(xs[i + 1]), (i + 1) % numVectorBuffers);
+      if (i > 0)
+        results.push_back(originalOrder(readResult((i - 1) % numVectorBuffers)));
+    });
   }
-  return Vector{total};
+  results.push_back(originalOrder(readResult((k - 1) % numVectorBuffers)));
+  double took = dfesnippets::timing::clock_diff(start);
+
+  double flopsPerVector = 2.0 * (double)this->matrixNnzs;
+  double tookPerVector = std::accumulate(runTimes.begin(), runTimes.end(), 0.0) / k;
+  vector<double> gflopsPerVector;
+  for (double t : runTimes)
+    gflopsPerVector.push_back(flopsPerVector / t / 1E9);
+
+  CASK_TRACE_COUNTER("spmm:seconds", took);
+  CASK_TRACE_COUNTER("spmm:gflops", flopsPerVector * k / took / 1E9);
+  if (!verbose)
+    return results;
+
+  cout << "Running on DFE (batch)\n";
+  utils::logResult("Batch size", k);
+  utils::logResult("Took (ms)", took);
+  utils::logResult("Took per vector (ms)", tookPerVector);
+  utils::logResult("Gflops per vector", gflopsPerVector);
+  utils::logResult("Gflops (aggregate)", flopsPerVector * k / took / 1E9);
+  cout.flush();
+  return results;
+}
+
+void ssarch::multiply(const double* x, double* y)
+{
+  CASK_TRACE_SCOPE("spmv:multiply");
+  if (!isMatrixLoaded()) {
+    loadMatrix();
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  bool permuted = !permutation.rows.empty();
+  if (permuted) {
+    paddedVector.resize(matrixCols);
+    for (int j = 0; j < matrixCols; j++)
+      paddedVector[j] = x[permutation.cols[j]];
+  } else {
+    paddedVector.assign(x, x + matrixCols);
+  }
+  cutils::align(paddedVector, sizeof(double) * impl.cache_size);
+  cutils::align(paddedVector, burst_size_bytes);
+  writeVector(paddedVector, 0);
+  multiplyTimes.uploadSeconds = dfesnippets::timing::clock_diff(start);
+  start = std::chrono::high_resolution_clock::now();
+  runOnDevice(0, 1);
+  multiplyTimes.kernelSeconds = dfesnippets::timing::clock_diff(start);
+
+  start = std::chrono::high_resolution_clock::now();
+  readMultiplyResult(y, permuted);
+  multiplyTimes.readbackSeconds = dfesnippets::timing::clock_diff(start);
+}
+
+void ssarch::readMultiplyResult(double* y, bool permuted)
+{
+  int outRows = 0;
+  for (const auto& p : partitions)
+    outRows += p.n;
+  if (outRows == matrixRows && !permuted) {
+    readResult(0, y, matrixRows);
+    return;
+  }
+  // the filler rows added when n < num_pipes are dropped
+  resultBuffer.resize(outRows + burst_size_bytes / sizeof(double));
+  readResult(0, resultBuffer.data(), resultBuffer.size());
+  if (permuted) {
+    for (int i = 0; i < matrixRows; i++)
+      y[permutation.rows[i]] = resultBuffer[i];
+    return;
+  }
+  std::copy(resultBuffer.begin(), resultBuffer.begin() + matrixRows, y);
+}
+
+std::vector<double> ssarch::deviceVector(const cask::Vector& x) {
+  if (permutation.cols.empty())
+    return padVector(x.data, impl.cache_size);
+  std::vector<double> v(matrixCols);
+  for (int j = 0; j < matrixCols; j++)
+    v[j] = x.data[permutation.cols[j]];
+  return padVector(std::move(v), impl.cache_size);
+}
+
+cask::Vector ssarch::originalOrder(cask::Vector y) {
+  if (permutation.rows.empty())
+    return y;
+  cask::Vector original(y.size());
+  for (int i = 0; i < y.size(); i++)
+    original.data[permutation.rows[i]] = y.data[i];
+  return original;
+}
+
+cask::CsrView ssarch::reorder(const CsrView& mat, CsrMatrix& reordered) {
+  permutation = reordering::Permutation();
+  if (reorderingMethod == reordering::Method::None)
+    return mat;
+  // a permuted lower triangle is no longer lower triangular
+  if (impl.symmetric)
+    throw std::invalid_argument("Spmv symmetric designs do not support reordering");
+  CASK_TRACE_SCOPE("spmv:reorder");
+  permutation = reordering::reorder(mat, reorderingMethod);
+  reordered = reordering::permute(mat, permutation);
+  return reordered.view();
+}
+
+void ssarch::setMatrix(const CsrView& mat) {
+  this->matrixRows = mat.n - paddingRows;
+  this->matrixCols = mat.m;
+  this->matrixNnzs = mat.nnzs;
+  if (impl.symmetric) {
+    if (matrixRows != mat.m)
+      throw std::invalid_argument("Spmv symmetric designs need a square matrix, not " +
+          std::to_string(matrixRows) + " x " + std::to_string(mat.m));
+    int64_t diagonal = 0;
+    for (int i = 0; i < mat.n; i++)
+      for (int k = mat.row_ptr[i]; k < mat.row_ptr[i + 1]; k++) {
+        if (mat.col_ind[k] > i)
+          throw std::invalid_argument("Spmv symmetric designs take the lower triangle, entry (" +
+              std::to_string(i) + ", " + std::to_string(mat.col_ind[k]) + ") is above the diagonal");
+        diagonal += mat.col_ind[k] == i;
+      }
+    // the entries above the diagonal are multiplied too
+    this->matrixNnzs = 2 * mat.nnzs - diagonal;
+  }
+  // the streams on the device, if any, are now out of date
+  this->matrixId = nextMatrixId++;
+  this->deviceLayout = DramLayout();
+}
+
+std::vector<int> cask::spmv::balancedRowSplits(const std::vector<int64_t>& rowWeights, int nParts) {
+  int n = rowWeights.size();
+  if (nParts <= 0 || nParts > n)
+    throw std::invalid_argument("Cannot split " + std::to_string(n) + " rows in " +
+        std::to_string(nParts) + " partitions");
+  std::vector<int64_t> prefix(n + 1, 0);
+  for (int i = 0; i < n; i++)
+    prefix[i + 1] = prefix[i] + rowWeights[i];
+
+  // greedily fills ranges up to the given weight, leaving at least a row for
+  // each remaining range; this always fits if the weight is feasible
+  auto split = [&](int64_t maxWeight, std::vector<int>* splits) {
+    int start = 0;
+    for (int p = 0; p < nParts - 1; p++) {
+      int maxEnd = n - (nParts - 1 - p);
+      // the last row end whose range weight is at most maxWeight
+      int end = std::upper_bound(prefix.begin() + start + 1, prefix.begin() + maxEnd + 1,
+                                 prefix[start] + maxWeight) - prefix.begin() - 1;
+      end = std::max(end, start + 1);
+      if (splits)
+        splits->push_back(start);
+      start = end;
+    }
+    if (splits) {
+      splits->push_back(start);
+      splits->push_back(n);
+    }
+    return prefix[n] - prefix[start] <= maxWeight;
+  };
+
+  // binary search of the smallest feasible largest range weight
+  int64_t lo = *std::max_element(rowWeights.begin(), rowWeights.end());
+  lo = std::max(lo, (prefix[n] + nParts - 1) / nParts);
+  int64_t hi = prefix[n];
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    if (split(mid, nullptr))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  std::vector<int> splits;
+  split(lo, &splits);
+  return splits;
+}
+
+namespace {
+
+// adds to cycles[i] the cycles of row i in each block it is not empty in,
+// less those of an empty row of the block
+struct EstimateRowCycles {
+  const cask::CsrView& m;
+  const std::vector<int>& empty;
+  std::vector<int64_t>& cycles;
+
+  template<typename Width, typename BlockOf>
+  void operator()(Width w, BlockOf blockOf) {
+    std::vector<int> rowLength(empty.size(), 0);
+    std::vector<int> touched;
+    for (int i = 0; i < m.n; i++) {
+      for (int k = m.row_ptr[i]; k < m.row_ptr[i + 1]; k++) {
+        int b = blockOf.block(m.col_ind[k]);
+        if (rowLength[b]++ == 0)
+          touched.push_back(b);
+      }
+      for (int b : touched) {
+        cycles[i] += rowCycles(rowLength[b], w) - empty[b];
+        rowLength[b] = 0;
+      }
+      touched.clear();
+    }
+  }
+};
+
+// as above, from the lengths of the non empty rows of each block
+struct EstimateBlockRowCycles {
+  const BlockRowLengths& lengths;
+  const std::vector<int>& empty;
+  std::vector<int64_t>& cycles;
+
+  template<typename Width>
+  void operator()(Width w) {
+    for (int b = 0; b < lengths.nBlocks; b++)
+      for (int64_t k = lengths.blockStart[b]; k < lengths.blockStart[b + 1]; k++)
+        cycles[lengths.rows[k]] += rowCycles(lengths.lengths[k], w) - empty[b];
+  }
+};
+
+}
+
+std::vector<int64_t> ssarch::estimateRowCycles(const CsrView& m) {
+  CASK_TRACE_SCOPE("spmv:rowCycles");
+  int nBlocks = cutils::ceilDivide(m.m, impl.cache_size);
+  int64_t emptyCycles = 0;
+  for (int b = 0; b < nBlocks; b++)
+    emptyCycles += emptyRowCycles(b, nBlocks);
+
+  std::vector<int64_t> cycles(m.n, emptyCycles);
+  std::vector<int> empty(nBlocks);
+  for (int b = 0; b < nBlocks; b++)
+    empty[b] = emptyRowCycles(b, nBlocks);
+  EstimateRowCycles estimate{m, empty, cycles};
+  withBlocking(impl.input_width, impl.cache_size, estimate);
+  return cycles;
+}
+
+std::vector<int64_t> ssarch::estimateRowCycles(const BlockRowLengths& lengths) {
+  CASK_TRACE_SCOPE("spmv:rowCycles");
+  int64_t emptyCycles = 0;
+  for (int b = 0; b < lengths.nBlocks; b++)
+    emptyCycles += emptyRowCycles(b, lengths.nBlocks);
+
+  std::vector<int64_t> cycles(lengths.n, emptyCycles);
+  std::vector<int> empty(lengths.nBlocks);
+  for (int b = 0; b < lengths.nBlocks; b++)
+    empty[b] = emptyRowCycles(b, lengths.nBlocks);
+  EstimateBlockRowCycles estimate{lengths, empty, cycles};
+  withInputWidth(impl.input_width, estimate);
+  return cycles;
+}
+
+std::vector<Partition> ssarch::buildPartitions(
+    const std::vector<int>& splits,
+    const std::function<Partition(int, int)>& blocking) {
+  std::vector<Partition> result(impl.num_pipes);
+  cask::parallel::parallelFor(0, impl.num_pipes, [&](int64_t i) {
+    CASK_TRACE_SCOPE("spmv:partition", i);
+    result[i] = blocking(splits[i], splits[i + 1] - splits[i]);
+    result[i].firstRow = splits[i];
+  });
+  return result;
+}
+
+cask::CsrView ssarch::padForDramReduction(const CsrView& mat) {
+  paddingRows = 0;
+  paddedRowPtr.clear();
+  if (!impl.dram_reduction_enabled || mat.n >= minRowsWithDramReduction)
+    return mat;
+  // the empty rows share the nonzeros of the matrix
+  paddingRows = minRowsWithDramReduction - mat.n;
+  paddedRowPtr.assign(mat.row_ptr, mat.row_ptr + mat.n + 1);
+  paddedRowPtr.resize(minRowsWithDramReduction + 1, mat.row_ptr[mat.n]);
+  return CsrView(minRowsWithDramReduction, mat.m, paddedRowPtr.data(), mat.col_ind, mat.values);
+}
+
+int ssarch::rowPassesFor(int n) const {
+  if (impl.dram_reduction_enabled || n <= impl.max_rows)
+    return 1;
+  if (impl.max_rows < impl.num_pipes)
+    throw std::invalid_argument("Spmv: max rows " + std::to_string(impl.max_rows) +
+        " leave less than a row for each of " + std::to_string(impl.num_pipes) + " pipes");
+  return cutils::ceilDivide(n, impl.max_rows);
 }
-void ssarch::preprocess(
-    const CsrMatrix& mat) {
-  this->mat = mat;
 
+std::vector<int> ssarch::controllerPartitions(int ctrlId) const {
+  int pipesPerController = impl.num_pipes / impl.num_controllers;
+  std::vector<int> result;
+  for (size_t pass = 0; pass < partitions.size(); pass += impl.num_pipes)
+    for (int i = ctrlId * pipesPerController; i < (ctrlId + 1) * pipesPerController; i++)
+      result.push_back(pass + i);
+  return result;
+}
+
+void ssarch::partitionRows(
+    const CsrView& mat,
+    std::function<std::vector<int64_t>()> rowCycles,
+    std::function<Partition(int, int)> analysis,
+    std::function<Partition(int, int)> blocking) {
+  setMatrix(mat);
   partitions.clear();
-  int rowsPerPartition = mat.n / impl.num_pipes;
-  int start = 0;
+  rowSplits.clear();
+  int passes = rowPassesFor(mat.n);
+  if (passes == 1) {
+    partitionPass(mat.n, rowCycles, analysis, blocking);
+    rowSplits.push_back(mat.n);
+    return;
+  }
+
+  // passes of about the same rows; each is partitioned as a matrix of its own
+  std::vector<int64_t> cycles;
+  if (rowPartitioning == RowPartitioning::Balanced)
+    cycles = rowCycles();
+  for (int pass = 0; pass < passes; pass++) {
+    int start = int(int64_t(mat.n) * pass / passes);
+    int n = int(int64_t(mat.n) * (pass + 1) / passes) - start;
+    auto shifted = [start](const std::function<Partition(int, int)>& f) -> std::function<Partition(int, int)> {
+      if (!f)
+        return nullptr;
+      return [start, f](int s, int nRows) { return f(start + s, nRows); };
+    };
+    size_t first = rowSplits.size();
+    partitionPass(
+        n,
+        [&] { return std::vector<int64_t>(cycles.begin() + start, cycles.begin() + start + n); },
+        shifted(analysis),
+        shifted(blocking));
+    for (size_t i = first; i < rowSplits.size(); i++) {
+      rowSplits[i] += start;
+      partitions[i].firstRow = rowSplits[i];
+    }
+  }
+  rowSplits.push_back(mat.n);
+}
+
+void ssarch::partitionPass(
+    int n,
+    std::function<std::vector<int64_t>()> rowCycles,
+    std::function<Partition(int, int)> analysis,
+    std::function<Partition(int, int)> blocking) {
+  int rowsPerPartition = n / impl.num_pipes;
+  std::vector<int> splits;
+  std::vector<Partition> pass;
 
   if (rowsPerPartition == 0) {
     // handles the relatively uninteresting case where there are fewer rows
     // than pipes; this  arises in several tiny tests, but is unlikely in
     // practice, where there should be more rows than pipes; NB that we need to
     // assign some workload to the pipes, leaving them empty stalls the design;
-    Partition p = do_blocking(mat.sliceRows(start, mat.n), impl.cache_size, impl.input_width);
-    this->partitions.assign(impl.num_pipes, p);
-    for (auto&& p : this->partitions) {
-      for (auto&& t : p.m_indptr_values) {
-        t.value = 0;
+    Partition p = blocking ? blocking(0, n) : analysis(0, n);
+    pass.assign(impl.num_pipes, p);
+    for (auto&& p : pass) {
+      p.clearValues();
+    }
+    pass[0] = p;
+    splits.assign(impl.num_pipes + 1, n);
+    splits[0] = 0;
+  } else {
+    // put all rows left in the last partition
+    splits.resize(impl.num_pipes + 1);
+    for (int i = 0; i < impl.num_pipes; i++)
+      splits[i] = i * rowsPerPartition;
+    splits[impl.num_pipes] = n;
+
+    std::vector<int> balanced;
+    if (rowPartitioning == RowPartitioning::Balanced)
+      balanced = balancedRowSplits(rowCycles(), impl.num_pipes);
+    if (!balanced.empty() && balanced != splits) {
+      // the row estimates ignore the alignment of rows to the input width
+      // and the encoding of empty rows, so the model picks the faster split
+      auto maxCycles = [](const std::vector<Partition>& ps) {
+        int cycles = 0;
+        for (const auto& p : ps)
+          cycles = std::max(cycles, p.totalCycles);
+        return cycles;
+      };
+      std::vector<Partition> even = buildPartitions(splits, analysis);
+      std::vector<Partition> candidate = buildPartitions(balanced, analysis);
+      if (maxCycles(candidate) < maxCycles(even)) {
+        splits = balanced;
+        pass = std::move(candidate);
+      } else {
+        pass = std::move(even);
       }
+      if (blocking)
+        pass = buildPartitions(splits, blocking);
+    } else {
+      pass = buildPartitions(splits, blocking ? blocking : analysis);
     }
-    this->partitions[0] = p;
-    return;
   }
+  partitions.insert(partitions.end(), pass.begin(), pass.end());
+  rowSplits.insert(rowSplits.end(), splits.begin(), splits.end() - 1);
+}
+
+void ssarch::preprocess(
+    const CsrView& original) {
+  CASK_TRACE_SCOPE("spmv:preprocess");
+  CsrMatrix reordered;
+  CsrView mat = padForDramReduction(reorder(original, reordered));
+  partitionRows(
+      mat,
+      [&] { return estimateRowCycles(mat); },
+      [&](int start, int nRows) {
+        return analyse_blocking(mat.sliceRows(start, nRows), impl.cache_size, impl.input_width, impl.index_bits);
+      },
+      [&](int start, int nRows) {
+        return do_blocking(mat.sliceRows(start, nRows), impl.cache_size, impl.input_width,
+                           impl.value_format, impl.index_bits, impl.symmetric ? start : -1);
+      });
+  streamsBuilt = true;
+}
+
+void ssarch::preprocessToDevice(
+    const CsrView& mat,
+    int64_t chunkNnzs) {
+  CASK_TRACE_SCOPE("spmv:preprocessToDevice");
+  if (reorderingMethod != reordering::Method::None)
+    throw std::invalid_argument("Spmv::preprocessToDevice does not support reordering");
+  if (chunkNnzs < 1)
+    throw std::invalid_argument("Spmv::preprocessToDevice chunks must hold at least a nonzero");
+  permutation = reordering::Permutation();
+  CsrView padded = padForDramReduction(mat);
+  partitionRows(
+      padded,
+      [&] { return estimateRowCycles(padded); },
+      [&](int start, int nRows) {
+        return analyse_blocking(padded.sliceRows(start, nRows), impl.cache_size, impl.input_width, impl.index_bits);
+      },
+      nullptr);
+  streamsBuilt = false;
+  checkDeviceLimits();
 
-  for (int i = 0; i < impl.num_pipes - 1; i++) {
-    this->partitions.push_back(
-        do_blocking(
-          mat.sliceRows(start, rowsPerPartition),
-          impl.cache_size, impl.input_width));
-    start += rowsPerPartition;
+  // as loadMatrix(), laid out from a counting pass over all partitions;
+  // with fewer rows than pipes, the other pipes hold all rows with zero values
+  int64_t vSizeBytes = cutils::size_bytes(padVector(std::vector<double>(matrixCols), impl.cache_size));
+  auto rowsOf = [&](size_t i) {
+    bool filler = i > 0 && hasFillers();
+    return std::make_pair(filler ? 0 : rowSplits[i], filler ? padded.n : rowSplits[i + 1] - rowSplits[i]);
+  };
+  std::vector<StreamCounts> counts;
+  std::vector<PartitionStreamSizes> sizes;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    std::pair<int, int> r = rowsOf(i);
+    counts.push_back(countStreams(padded.sliceRows(r.first, r.second), controllerOf(i), vSizeBytes));
+    sizes.push_back(counts.back().sizes);
+  }
+  deviceLayout = planDramLayout(sizes, impl.num_controllers, numVectorBuffers, designLayout(layoutOptions, impl));
+  transfers.assign(partitions.size(), PartitionTransfers());
+  for (size_t i = 0; i < partitions.size(); i++) {
+    partitions[i].valueFormat = impl.value_format;
+    partitions[i].indexBits = impl.index_bits;
+    std::pair<int, int> r = rowsOf(i);
+    CASK_TRACE_SCOPE("spmv:streamPartition", i);
+    streamPartition(padded, r.first, r.second, i > 0 && hasFillers(), counts[i], deviceLayout.partitions[i],
+                    controllerOf(i), chunkNnzs);
   }
+  *impl.residentMatrix = matrixId;
+}
+
+void ssarch::analyse(
+    const CsrView& original) {
+  CASK_TRACE_SCOPE("spmv:analyse");
+  CsrMatrix reordered;
+  CsrView mat = padForDramReduction(reorder(original, reordered));
+  partitionRows(
+      mat,
+      [&] { return estimateRowCycles(mat); },
+      [&](int start, int nRows) {
+        return analyse_blocking(mat.sliceRows(start, nRows), impl.cache_size, impl.input_width, impl.index_bits);
+      },
+      nullptr);
+  streamsBuilt = false;
+}
 
-  // put all rows left in the last partition
-  this->partitions.push_back(
-      do_blocking(mat.sliceRows(start, mat.n - start),
-        impl.cache_size, impl.input_width));
+void ssarch::analyse(
+    BlockingCache& cache) {
+  // the cache holds the blocked structure of the original, unpadded, matrix
+  if (reorderingMethod != reordering::Method::None ||
+      padForDramReduction(cache.matrix()).n != cache.matrix().n) {
+    analyse(cache.matrix());
+    return;
+  }
+  permutation = reordering::Permutation();
+  // the partitions do not depend on the memory controllers (nor max rows)
+  std::stringstream key;
+  key << get_name() << " " << impl.cache_size << " " << impl.input_width << " " << impl.num_pipes
+      << " " << impl.index_bits << " " << int(rowPartitioning) << " " << impl.symmetric
+      << " " << rowPassesFor(cache.matrix().n);
+  bool computed = false;
+  std::vector<Partition> cached = cache.partitions(key.str(), [&] {
+    std::shared_ptr<const BlockRowLengths> lengths = cache.rowLengths(impl.cache_size, impl.index_bits);
+    partitionRows(
+        cache.matrix(),
+        [&] { return estimateRowCycles(*lengths); },
+        [&](int start, int nRows) { return analyse_blocking(*lengths, start, nRows, impl.input_width); },
+        nullptr);
+    computed = true;
+    return partitions;
+  });
+  if (!computed) {
+    setMatrix(cache.matrix());
+    partitions = cached;
+    // the partitions are contiguous, and fillers have as many rows as the matrix
+    rowSplits.assign(1, 0);
+    for (const auto& p : partitions)
+      rowSplits.push_back(std::min(rowSplits.back() + p.n, matrixRows));
+  }
+  streamsBuilt = false;
 }
@@ -5,20 +5,18 @@
 #include "Model.hpp"
 #include "GeneratedImplSupport.hpp"
 #include "Utils.hpp"
+#include "BlockingCache.hpp"
+#include "DramLayout.hpp"
+#include "CycleCounting.hpp"
+#include "ValueFormat.hpp"
+#include "IndexCoding.hpp"
+#include "Reordering.hpp"
+
+#include <memory>
 
 namespace cask {
   namespace spmv {
 
-  // pack values and colptr to reduce number of streams
-#pragma pack(1)
-struct indptr_value {
-  double value;
-  int indptr;
-  indptr_value(double _value, int _indptr) : value(_value), indptr(_indptr) {}
-  indptr_value() : value(0), indptr(0) {}
-} __attribute__((packed));
-#pragma pack()
-
 /* A partition is a horizontal stripe of an input matrix. Each
  partition can be further divided into vertical stripes, which
  we call blocks. */
@@ -28,7 +26,47 @@ struct Partition {
   int m_colptr_unpaddedLength;
   int m_indptr_values_unpaddedLength;
   std::vector<int> m_colptr;
+  ValueFormat valueFormat = ValueFormat::Fp64;
+  int indexBits = 32;
+  // the indptr / values stream: for Fp64 values and 32 bit indices
+  // m_indptr_values holds the entries; otherwise m_packed_indptr_values holds
+  // the packed_entry<V> of the format or, for narrower indices, the entries
+  // packed as valueBits + indexBits bits each
   std::vector<indptr_value> m_indptr_values;
+  std::vector<uint8_t> m_packed_indptr_values;
+  // Fixed16 only, the scale of the values of each block
+  std::vector<int32_t> m_block_scales;
+  // the offsets of escaped entries, in stream order (see IndexCoding)
+  std::vector<int32_t> m_escapes;
+  int64_t escapes = 0;
+  // the partition holds rows [firstRow, firstRow + n) of the matrix (fillers
+  // hold all rows, from 0)
+  int firstRow = 0;
+  // symmetric designs only: the vector buffers of the partition hold x, then
+  // the x of its rows (outSize bytes); its output buffers hold the sums of its
+  // rows (outSize bytes), then the reflected sums of all blocks, of its
+  // entries added to the rows of their columns (reflectedSize bytes)
+  int reflectedSize = 0;
+
+  bool packedStream() const {
+    return valueFormat != ValueFormat::Fp64 || indexBits != 32;
+  }
+
+  // of the unpadded streams, which need not be held on the host (see
+  // Spmv::preprocessToDevice())
+  int64_t indptrValuesBytes() const {
+    return (int64_t(m_indptr_values_unpaddedLength) * (valueBits(valueFormat) + indexBits) + 7) / 8;
+  }
+
+  // the streams read from device DRAM by each multiplication
+  int64_t streamBytes() const {
+    int64_t scales = valueFormat == ValueFormat::Fixed16 ? nBlocks : 0;
+    return indptrValuesBytes() + int64_t(m_colptr_unpaddedLength) * sizeof(int) +
+        (scales + escapes) * int64_t(sizeof(int32_t));
+  }
+
+  /** Sets all values of the indptr / values stream to zero */
+  void clearValues();
 
   std::string to_string() {
     std::stringstream s;
@@ -43,18 +81,184 @@ struct Partition {
   }
 };
 
+/* Modelled and measured performance of a partition, in the last call to
+ Spmv::spmv(). Kernel and DRAM times are modelled, for one multiplication;
+ host transfers are measured. */
+struct PartitionReport {
+  int pipe, controller, rows;
+  int totalCycles, reductionCycles, paddingCycles, emptyCycles;
+  // matrix streams read from DRAM by each multiplication
+  int64_t streamBytes;
+  // totalCycles at the design frequency
+  double kernelSeconds;
+  // streamBytes at the share of the device memory bandwidth of a pipe
+  double dramSeconds;
+  // transferred over the host link: the vector written, the result read
+  int64_t vectorBytes, resultBytes;
+  double vectorWriteSeconds, resultReadSeconds;
+};
+
+/* Measured wall clock times of the phases of the last Spmv::multiply() */
+struct MultiplyTimes {
+  // permuting, padding and writing x to the device
+  double uploadSeconds;
+  // running the design, once
+  double kernelSeconds;
+  // reading y back, in the original row order
+  double readbackSeconds;
+};
+
+/* Measured host transfers of a memory controller, over its partitions */
+struct ControllerReport {
+  int controller;
+  int64_t bytesWritten, bytesRead;
+  double writeSeconds, readSeconds;
+};
+
+/* The performance of a multiplication, by partition and controller, to tell
+ whether a design is limited by its kernel, DRAM or the host link */
+struct PerformanceReport {
+  std::string design;
+  std::vector<PartitionReport> partitions;
+  std::vector<ControllerReport> controllers;
+  int iterations = 0;
+  // measured, per iteration
+  double runSeconds = 0;
+  // modelled, of the slowest partition
+  double kernelSeconds = 0, dramSeconds = 0;
+  // measured, of the slowest controllers (which transfer concurrently)
+  double hostSeconds = 0;
+  double estimatedGflops = 0, measuredGflops = 0;
+
+  /** "kernel", "dram" or "host", whichever takes longest */
+  std::string bottleneck() const;
+
+  void writeJson(std::ostream& s) const;
+};
+
+    /** How the rows of a matrix are split across the pipes */
+    enum class RowPartitioning {
+      // rowsPerPipe = n / numPipes rows each, the remainder on the last pipe
+      Even,
+      // contiguous row ranges of about the same estimated cycles
+      Balanced
+    };
+
+    /** Splits rows with the given (non negative) weights into nParts <= rows
+     * contiguous ranges of at least one row, minimising the largest total
+     * weight of a range; returns the first row of each range, then the
+     * number of rows. */
+    std::vector<int> balancedRowSplits(const std::vector<int64_t>& rowWeights, int nParts);
+
+    /** Designs with the DRAM reduction only give correct results if each
+     * partial sum is written back before it is read again, which holds for
+     * at least this many rows; smaller matrices are padded with empty rows
+     * (see Spmv::preprocess()) */
+    const int minRowsWithDramReduction = 35000;
+
     /**
      * Interface for all SpMV implementations. Provides both runtime and design time functions.
      */
     class Spmv {
-      CsrMatrix mat;
+      // dimensions of the preprocessed matrix; of a symmetric design, the
+      // nonzeros are those of both triangles
+      int matrixRows = 0;
+      int matrixCols = 0;
+      int matrixNnzs = 0;
+      // identifies the partitions built by the last call to preprocess
+      int64_t matrixId = -1;
       std::vector<Partition> partitions;
+      // false if the partitions hold only statistics (see analyse)
+      bool streamsBuilt = false;
+      DramLayout deviceLayout;
+      DramLayoutOptions layoutOptions;
+      RowPartitioning rowPartitioning = RowPartitioning::Balanced;
+      // the first row of each partition, then the number of rows
+      std::vector<int> rowSplits;
+      // empty rows added after those of the matrix for the DRAM reduction,
+      // and the row_ptr of the padded matrix
+      int paddingRows = 0;
+      std::vector<int> paddedRowPtr;
+      // applied to the matrix before it is partitioned
+      reordering::Method reorderingMethod = reordering::Method::None;
+      // of the preprocessed matrix, empty if it is not reordered
+      reordering::Permutation permutation;
+      // reused by multiply(); reflectedBuffer holds, for each controller,
+      // the reflected sums of a partition and their total
+      std::vector<double> paddedVector, resultBuffer, reflectedBuffer;
+      // estimates of spmv() are those of this device
+      std::shared_ptr<const model::DeviceModel> deviceModel;
+      model::Calibration calibration;
+      // if set, spmv() and spmm() also print their estimates and timings
+      bool verbose = false;
+      // measured by the last transfers of each partition
+      struct PartitionTransfers {
+        int64_t vectorBytes = 0, resultBytes = 0;
+        double vectorWriteSeconds = 0, resultReadSeconds = 0;
+      };
+      std::vector<PartitionTransfers> transfers;
+      PerformanceReport performanceReport;
+      MultiplyTimes multiplyTimes{0, 0, 0};
+
+      static std::shared_ptr<const model::DeviceModel> defaultDeviceModel();
+      void checkDeviceLimits();
+      // mat, padded with empty rows to minRowsWithDramReduction if the
+      // design has the DRAM reduction; sets paddingRows
+      CsrView padForDramReduction(const CsrView& mat);
+      // the passes of the BRAM reduction for n rows, of at most max_rows
+      int rowPassesFor(int n) const;
+      // the partitions of controller ctrlId, in all passes
+      std::vector<int> controllerPartitions(int ctrlId) const;
+      int controllerOf(int partition) const {
+        return partition % impl.num_pipes / (impl.num_pipes / impl.num_controllers);
+      }
+      // the pipes other than the first hold copies of all rows, with no values
+      bool hasFillers() const {
+        return matrixRows + paddingRows < impl.num_pipes;
+      }
+      void checkVectorSize(const Vector& x);
+      // x in the column order of the preprocessed matrix, padded for the device
+      std::vector<double> deviceVector(const Vector& x);
+      // restores the row order of a result of the preprocessed matrix
+      Vector originalOrder(Vector y);
+      // sets the permutation of mat and returns mat, or its reordering which
+      // is stored in reordered
+      CsrView reorder(const CsrView& mat, CsrMatrix& reordered);
+      void writeVector(const std::vector<double>& v, int buffer);
+      // the bytes of a vector buffer of partition p, for vectors of
+      // vSizeBytes padded bytes
+      int64_t vectorBufferBytes(const Partition& p, int64_t vSizeBytes) const {
+        return vSizeBytes + (impl.symmetric ? p.outSize : 0);
+      }
+      // symmetric designs: adds the reflected sums of all partitions to the
+      // rows of out, which has room for capacity >= rows entries
+      void addReflectedSums(int buffer, double* out, int64_t capacity);
+      void runOnDevice(int buffer, int nIterations);
+      // the report of a multiplication which took runSeconds per iteration
+      void buildPerformanceReport(int nIterations, double runSeconds,
+          double estimatedGflops, double measuredGflops);
+      Vector readResult(int buffer);
+      // reads the rows of all partitions to out, which has room for
+      // capacity >= rows entries
+      void readResult(int buffer, double* out, int64_t capacity);
+      // reads the result of multiply() to y, in the original row order
+      void readMultiplyResult(double* y, bool permuted);
 
      public:
+      /** Number of vector and output buffers in DRAM for each partition
+       * (or controller, if its partitions share the vector), so that spmm() can transfer the next vector and the previous result
+       * while the current one is being multiplied. */
+      static const int numVectorBuffers = 3;
+      /** loadMatrix() writes the matrix streams of a controller in writes of
+       * at most this, each staged on the host */
+      static const int64_t maxWriteBytes = int64_t(1) << 26;
+
       runtime::GeneratedSpmvImplementation impl;
       /** Constructor interface for mock Spmv Implementation to be used during design space exploration */
-      Spmv(int _cacheSize, int  _inputWidth, int _numPipes, int _maxRows, int _numControllers)
-          : impl(-1,
+      Spmv(int _cacheSize, int  _inputWidth, int _numPipes, int _maxRows, int _numControllers,
+          ValueFormat _valueFormat = ValueFormat::Fp64, int _indexBits = 32, bool _symmetric = false)
+          : deviceModel(defaultDeviceModel()),
+          impl(-1,
               cask::runtime::spmvRunMock,
               cask::runtime::spmvWriteMock,
               cask::runtime::spmvReadMock,
@@ -63,33 +267,104 @@ struct Partition {
               _cacheSize,
               _inputWidth,
               false, // dram_reduction_enabled
-              _numControllers) {}
+              _numControllers,
+              _valueFormat,
+              _indexBits,
+              _symmetric) {}
       /**
        * For execution we build the architecture and give it a pointer to the
        * device implementation.
        */
-      Spmv(runtime::GeneratedSpmvImplementation _impl): impl(_impl) { }
+      Spmv(runtime::GeneratedSpmvImplementation _impl):
+          deviceModel(defaultDeviceModel()), impl(_impl) { }
 
      public:
 
+      /** Builds the partition for the given rows of a matrix, divided in
+       * blocks of blockSize columns. The streams are sized with a counting
+       * pass and filled in place, without slicing the matrix; values are
+       * packed in the given format and column offsets in indexBits bits.
+       * For a symmetric design, mat holds rows [firstRow, firstRow + n) of
+       * the lower triangle, whose diagonal values are halved, as the design
+       * adds every entry to both its row and its column. */
+      Partition do_blocking(
+          const CsrView& mat,
+          int blockSize,
+          int inputWidth,
+          ValueFormat format = ValueFormat::Fp64,
+          int indexBits = 32,
+          int firstRow = -1);
+
+      /** As above, from a matrix already divided in blocks (of its block
+       * size), whose blocks are copied to the stream in order */
       Partition do_blocking(
-          const CsrMatrix& mat,
+          const BlockedCsrMatrix& mat,
+          int inputWidth,
+          ValueFormat format = ValueFormat::Fp64,
+          int indexBits = 32);
+
+      /** Computes the statistics of the partition do_blocking() would build
+       * (cycle counts, padding, stream lengths) from a scan of the matrix, in
+       * O(nnz) time, without building its streams. */
+      Partition analyse_blocking(
+          const CsrView& mat,
           int blockSize,
+          int inputWidth,
+          int indexBits = 32);
+
+      /** As above, for rows [startRow, startRow + nRows), from the cached
+       * blocked structure of the matrix (whose escapes, if any, are those of
+       * the index coding to model); this does not read the matrix. */
+      Partition analyse_blocking(
+          const BlockRowLengths& lengths,
+          int startRow,
+          int nRows,
           int inputWidth);
 
+      const std::vector<Partition>& getPartitions() const {
+        return partitions;
+      }
+
+      /** Estimated on the given device, as calibrated; the kernel is
+       * limited by the memory bandwidth of the device, if it needs more. */
       double getEstimatedGFlops(const model::DeviceModel& deviceModel) {
         auto hardwareModel = getEstimatedHardwareModel(deviceModel);
-        double gflops = getGFlopsCount() * getFrequency() / getEstimatedClockCycles();
+        double scale = calibration.cycleScale;
+        double frequency = deviceModel.frequency();
+        double gflops = getGFlopsCount() * frequency / (getEstimatedClockCycles() * scale);
         double deviceMaxBandwidth = deviceModel.maxParams().memoryBandwidth;
-        if (hardwareModel.memoryBandwidth < deviceMaxBandwidth) {
+        double bandwidth = (hardwareModel.memoryBandwidth + getEscapeBandwidth(frequency)) / scale;
+        if (bandwidth < deviceMaxBandwidth) {
           return gflops;
         }
         // design is memory bound
-        return gflops * deviceMaxBandwidth/ hardwareModel.memoryBandwidth;
+        return gflops * deviceMaxBandwidth / bandwidth;
+      }
+
+      /** Bytes of an entry of the indptr / values stream */
+      double bytesPerEntry() const {
+        return (valueBits(impl.value_format) + impl.index_bits) / 8.0;
+      }
+
+      /** Bandwidth (GB/s) taken by the escape streams of delta coded indices,
+       * which depends on the matrix, unlike that of the hardware model */
+      double getEscapeBandwidth() {
+        return getEscapeBandwidth(getFrequency());
+      }
+
+      /** As above, at the given clock frequency (Hz) */
+      double getEscapeBandwidth(double frequency) {
+        int64_t escapes = 0;
+        for (const auto& p : partitions)
+          escapes += p.escapes;
+        if (escapes == 0)
+          return 0;
+        return escapes * sizeof(int32_t) * frequency / getEstimatedClockCycles() / 1E9;
       }
 
+      /** Of the device model of the design (see setDeviceModel()) */
       double getFrequency() {
-        return 200.0 * 1E6;
+        return deviceModel->frequency();
       }
 
       virtual std::string get_name() {
@@ -100,16 +375,30 @@ struct Partition {
         return impl == other.impl;
       }
 
+      /** Of the slowest pipe, summed over the row passes */
       virtual double getEstimatedClockCycles() {
-        auto res = max_element(partitions.begin(), partitions.end(),
-            [](const Partition& a, const Partition& b) {
-              return a.totalCycles < b.totalCycles;
-            });
-        return res->totalCycles;
+        double cycles = 0;
+        for (size_t pass = 0; pass < partitions.size(); pass += impl.num_pipes) {
+          auto end = partitions.begin() + std::min(partitions.size(), pass + impl.num_pipes);
+          auto res = max_element(partitions.begin() + pass, end,
+              [](const Partition& a, const Partition& b) {
+                return a.totalCycles < b.totalCycles;
+              });
+          cycles += res->totalCycles;
+        }
+        return cycles;
+      }
+
+      /** The runs of the design for each multiplication: matrices with more
+       * rows than the BRAM reduction holds (impl.max_rows) are multiplied
+       * in passes over ranges of at most max_rows rows, on the same design,
+       * each with its own partitions of all pipes */
+      int numRowPasses() const {
+        return std::max<int>(1, partitions.size() / impl.num_pipes);
       }
 
       virtual double getGFlopsCount() {
-        return 2 * this->mat.nnzs / 1E9;
+        return 2 * this->matrixNnzs / 1E9;
       }
 
       virtual bool isValid() {
@@ -119,10 +408,10 @@ struct Partition {
 
       model::HardwareModel getEstimatedHardwareModel(
           const model::DeviceModel& deviceModel) {
-        if (this->mat.n == 0) {
+        if (this->matrixRows == 0) {
           throw "Matrix not defined - run preprocess on the matrix";
         }
-        return getEstimatedHardwareModel(deviceModel, this->mat.n);
+        return getEstimatedHardwareModel(deviceModel, this->matrixRows);
       }
 
       /* Returns the expected values for implementing this design on the given deviceModel. */
@@ -133,41 +422,35 @@ struct Partition {
         //int brams = (double)cacheSize * (double)inputWidth / 512.0 * 2.0;
         using namespace model;
 
-        // It's hard to do this polymorphically; this hack should be fine for
-        // small device numbers
-        if (deviceModel.getId() != "Max4" && deviceModel.getId() != "Max5") {
-          throw std::invalid_argument("Unsupported device model " + deviceModel.getId());
-        }
+        const KernelCostModel costs = deviceModel.kernelCosts();
 
-        // TODO this should be architecture parameter
+        // the vector cache holds fp64 values, whatever the matrix value format
         const int vectorDataWidthInBits = 64;
         const int entriesPerBram = deviceModel.entriesPerBram(vectorDataWidthInBits);
         const int maxRows = utils::ceilDivide(matrixDimension, impl.num_pipes);
 
-        LogicResourceUsage bramReductionKernel{10069, 12965, utils::ceilDivide(maxRows, entriesPerBram), 0};
-        LogicResourceUsage paddingKernel{363, 543, 0, 0};
-        LogicResourceUsage unpaddingKernel{364, 474, 0, 0};
-        LogicResourceUsage spmvKernelPerInput{1458, 2031, impl.cache_size / entriesPerBram + 14, 4};
-        LogicResourceUsage sm{1235, 643, 0, 0};
-
-        LogicResourceUsage spmvPerPipe =
-            bramReductionKernel +
-                paddingKernel +
-                unpaddingKernel * 3 +
-                spmvKernelPerInput * impl.input_width +
-                sm;
+        LogicResourceUsage reductionBuffer{0, 0, utils::ceilDivide(maxRows, entriesPerBram), 0};
+        LogicResourceUsage vectorCache{0, 0, impl.cache_size / entriesPerBram, 0};
+        LogicResourceUsage perPipe =
+            costs.perPipe + reductionBuffer + (costs.perInput + vectorCache) * impl.input_width;
 
-        // NB these assume an 800Mhz memory bandwidth build
-        LogicResourceUsage memoryPerPipe{5325, 12184, 108, 0};
-        LogicResourceUsage memory{15330, 17606, 56, 0};
+        if (IndexCoding(impl.index_bits, impl.cache_size).usesDeltas()) {
+          perPipe = perPipe + costs.decoderPerInputBit * (impl.index_bits * impl.input_width) +
+              costs.escapeStreamPerPipe;
+        }
 
-        // There are also a number of FIFOs per pipe, their depth and
-        // number is generally independent from design parameters
-        LogicResourceUsage fifosPerPipe{500, 800, 81, 0};
+        if (impl.symmetric) {
+          // the x of the rows of a partition and, per input, a double
+          // buffered accumulator of the reflected sums of a block
+          LogicResourceUsage rowVector{0, 0, utils::ceilDivide(maxRows, entriesPerBram), 0};
+          LogicResourceUsage accumulator{0, 0, 2 * impl.cache_size / entriesPerBram, 0};
+          perPipe = perPipe + rowVector + costs.reflectionPerPipe +
+              (costs.reflectionPerInput + accumulator) * impl.input_width;
+        }
 
-        LogicResourceUsage designUsage = (spmvPerPipe + memoryPerPipe + fifosPerPipe) * impl.num_pipes + memory;
+        LogicResourceUsage designUsage = perPipe * impl.num_pipes + costs.fixed;
 
-        double memoryBandwidth =(double)impl.input_width * impl.num_pipes * getFrequency() * 12.0 / 1E9;
+        double memoryBandwidth =(double)impl.input_width * impl.num_pipes * deviceModel.frequency() * bytesPerEntry() / 1E9;
         HardwareModel ip{designUsage, memoryBandwidth};
         //ip.clockFrequency = getFrequency() / 1E6; // MHz
         return ip;
@@ -185,20 +468,295 @@ struct Partition {
         return s.str();
       }
 
+      /** The device of the estimates reported by spmv(), a Max4 by default */
+      void setDeviceModel(std::shared_ptr<const model::DeviceModel> m) {
+        deviceModel = m;
+      }
+
+      const model::DeviceModel& getDeviceModel() const {
+        return *deviceModel;
+      }
+
+      /** Corrects the estimates of getEstimatedGFlops(), e.g. by a
+       * calibration fitted to previous runs */
+      void setCalibration(const model::Calibration& c) {
+        calibration = c;
+      }
+
+      const model::Calibration& getCalibration() const {
+        return calibration;
+      }
+
+      /** If set, spmv() and spmm() print their cycles, timings and estimates
+       * to stdout, e.g. for the client runs parsed by the frontend; they are
+       * always recorded as trace counters (see Trace.hpp) */
+      void setVerbose(bool v) {
+        verbose = v;
+      }
+
+      /** The report of the last call to spmv() */
+      const PerformanceReport& getPerformanceReport() const {
+        return performanceReport;
+      }
+
+      /** The phases of the last call to multiply() */
+      const MultiplyTimes& getMultiplyTimes() const {
+        return multiplyTimes;
+      }
+
+      /** Dimensions of the preprocessed matrix; the nonzeros are those
+       * multiplied, of both triangles on a symmetric design */
+      int getMatrixRows() const {
+        return matrixRows;
+      }
+
+      int getMatrixCols() const {
+        return matrixCols;
+      }
+
+      int getMatrixNnzs() const {
+        return matrixNnzs;
+      }
+
+      /** Writes the matrix streams of all partitions to device DRAM, so that
+       * subsequent calls to spmv() only transfer the vector and the result.
+       * The matrix remains resident until preprocess() is called again or
+       * another matrix is loaded on the same device. */
+      void loadMatrix();
+
+      bool isMatrixLoaded() const {
+        return matrixId != -1 && *impl.residentMatrix == matrixId;
+      }
+
+      /** DRAM layout of each partition, valid after loadMatrix() */
+      const std::vector<PartitionWriteResult>& getDeviceLayout() const {
+        return deviceLayout.partitions;
+      }
+
+      /** Sets the placement of the streams from the next load of a matrix;
+       * symmetric designs never share the vector buffers. A matrix streamed
+       * by preprocessToDevice() must be streamed again. */
+      void setDramLayoutOptions(const DramLayoutOptions& o) {
+        layoutOptions = o;
+        if (isMatrixLoaded())
+          *impl.residentMatrix = -1;
+      }
+
+      /** The layout loadMatrix() writes the preprocessed streams in, e.g.
+       * to size the DRAM regions of the matrix before it is loaded */
+      DramLayout planDeviceLayout() const;
+
+      /** The regions of each controller and the vector buffers written, as
+       * getDeviceLayout() */
+      const DramLayout& getDramLayout() const {
+        return deviceLayout;
+      }
+
+      /** Multiplies the preprocessed matrix by v on the device, loading the
+       * matrix first if it is not resident. */
       Vector spmv(const Vector& v);
 
-      void preprocess(const CsrMatrix& mat);
+      /** Multiplies the preprocessed matrix by each of the given vectors.
+       * The matrix is loaded and the design launched once per vector, with
+       * the write of vector i + 1 and the read of result i - 1 overlapping
+       * the computation of vector i. */
+      std::vector<Vector> spmm(const std::vector<Vector>& xs);
+
+      /** y = A * x on the device, for iterative solvers: x has as many
+       * entries as the matrix has columns and y as many as it has rows. Unlike
+       * spmv(), the design is run once, nothing is logged and, after the
+       * first call, no memory is allocated; only x and y are transferred. */
+      void multiply(const double* x, double* y);
+
+      /** Partitions the matrix, building the partitions of all pipes in
+       * parallel. Matrices that do not fit the reduction of the design are
+       * still supported: more rows than a BRAM reduction holds are
+       * multiplied in several row passes (see numRowPasses()), and fewer
+       * than minRowsWithDramReduction rows are padded with empty rows, at
+       * the cost of their cycles. A symmetric design (see impl.symmetric) takes the lower
+       * triangle of a symmetric matrix, as stored by SymCsrMatrix, and
+       * throws std::invalid_argument for entries above the diagonal. */
+      void preprocess(const CsrView& mat);
+
+      /** As above; the matrix is expanded to both triangles unless the
+       * design is symmetric */
+      void preprocess(const SymCsrMatrix& a) {
+        if (impl.symmetric)
+          preprocess(a.matrix.view());
+        else
+          preprocess(a.explicitSymmetric().view());
+      }
+
+      /** Like preprocess() followed by loadMatrix(), for matrices whose
+       * streams do not fit in host memory, such as the view of a
+       * MappedCsrMatrix. A counting pass over the rows of each partition
+       * lays out its streams. The rows are then encoded in chunks of at most
+       * chunkNnzs nonzeros (and as many row ends per block), and the streams
+       * are written to device DRAM in bursts as they fill; they are never
+       * built on the host. Host memory is O(chunkNnzs + rows), instead of
+       * O(nnz). The DRAM contents and the partitions are those of
+       * preprocess(), but no streams are kept: if another matrix is loaded
+       * on the device, this one must be streamed again. Reordering is not
+       * supported, as it copies the matrix. */
+      void preprocessToDevice(const CsrView& mat, int64_t chunkNnzs = int64_t(1) << 22);
+
+      /** Like preprocess(), but only computes the partition statistics needed
+       * for estimates (e.g. getEstimatedClockCycles()), which are the same
+       * as those of preprocess(); used during design space exploration. The
+       * matrix must be preprocessed before it can be multiplied. */
+      void analyse(const CsrView& mat);
+
+      /** Analyses the matrix of the cache, reusing the blocked structure and
+       * the partitions of previously analysed architectures where possible */
+      void analyse(BlockingCache& cache);
+
+      /** Reorders the rows and columns of matrices passed to preprocess()
+       * and analyse() before they are partitioned; spmv(), spmm() and
+       * multiply() permute x and restore the order of y, so results are
+       * those of the original matrix. */
+      void setReordering(reordering::Method m) {
+        reorderingMethod = m;
+      }
+
+      reordering::Method getReordering() const {
+        return reorderingMethod;
+      }
+
+      /** The permutation of the last preprocessed or analysed matrix; empty
+       * if it was not reordered */
+      const reordering::Permutation& getPermutation() const {
+        return permutation;
+      }
+
+      /** Balanced by default; both preprocess() and analyse() split the rows
+       * in the same way, so estimates are those of the device. */
+      void setRowPartitioning(RowPartitioning r) {
+        rowPartitioning = r;
+      }
+
+      /** The first row of the partition of each pipe in the last preprocessed
+       * or analysed matrix, then its number of rows (if the matrix has fewer
+       * rows than pipes, the first partition holds all rows and the others
+       * are empty fillers). With several row passes, the partitions of each
+       * pass follow those of the previous one. */
+      const std::vector<int>& getRowSplits() const {
+        return rowSplits;
+      }
+
+      /** Estimated compute cycles of each row of the matrix, summed over its
+       * blocks, as used to balance partitions; this ignores the alignment of
+       * rows to the input width within a block. */
+      std::vector<int64_t> estimateRowCycles(const CsrView& mat);
+
+      /** As above, from the blocked structure of the matrix */
+      std::vector<int64_t> estimateRowCycles(const BlockRowLengths& lengths);
 
      protected:
+      // countRowCycles() of the width; NB analyse_blocking() computes the
+      // same count incrementally
       virtual int countComputeCycles(int32_t* v, int size, int inputWidth);
 
-      virtual CsrMatrix preprocessBlock(
-          const CsrMatrix& in,
+      /** Encodes in place the row end offsets of a block (n entries), before
+       * they are added to the colptr stream; previousEnd is the end of the
+       * row before rowEnds[0] (0 for the first row of the block). Returns the
+       * encoded length, which must not exceed n. preprocessToDevice() encodes
+       * blocks in pieces, each ending with a non empty row but the last; the
+       * encoded pieces must add up to the encoding of the whole block. */
+      virtual int encodeBlockRows(
+          int32_t* rowEnds,
+          int n,
+          int32_t previousEnd,
           int blockNumber,
           int nBlocks) {
-        return in;
+        return n;
       }
 
+      /** The length encodeBlockRows() returns for a block of n rows with the
+       * given number of non empty rows and runs of empty rows; used by
+       * analyse_blocking(), so the two must be overridden together. */
+      virtual int countEncodedBlockRows(
+          int nonEmptyRows,
+          int emptyRuns,
+          int n,
+          int blockNumber,
+          int nBlocks) {
+        return n;
+      }
+
+      // records the dimensions of a new matrix
+      void setMatrix(const CsrView& mat);
+
+      /** Counts the cycles of the filled streams of a partition of n rows
+       * and encodes its colptr stream, as the last step of do_blocking() */
+      void coalesceBlocks(Partition& br, int n, int nBlocks, int blockSize, int inputWidth,
+          const std::vector<int64_t>& blockStart);
+
+      /** Cycles taken by an empty row of block blockNumber; must match
+       * countEncodedBlockRows() */
+      virtual int emptyRowCycles(int blockNumber, int nBlocks) {
+        return 1;
+      }
+
+      // calls blocking(startRow, nRows) to build the partition of each pipe,
+      // or analysis(startRow, nRows) if blocking is null; rowCycles() and
+      // analysis() are used to balance partitions; matrices of more rows
+      // than the BRAM reduction holds are split in passes first
+      void partitionRows(
+          const CsrView& mat,
+          std::function<std::vector<int64_t>()> rowCycles,
+          std::function<Partition(int, int)> analysis,
+          std::function<Partition(int, int)> blocking);
+
+      // as partitionRows(), for one pass over n rows, from row 0; appends
+      // the partitions and the first row of each, without the last
+      void partitionPass(
+          int n,
+          std::function<std::vector<int64_t>()> rowCycles,
+          std::function<Partition(int, int)> analysis,
+          std::function<Partition(int, int)> blocking);
+
+      // the partitions of the row ranges of splits, built in parallel
+      std::vector<Partition> buildPartitions(
+          const std::vector<int>& splits,
+          const std::function<Partition(int, int)>& blocking);
+
+      // the statistics of each block of the rows of m; if given, maxAbs is
+      // set to the largest magnitude of the values of each block
+      std::vector<BlockStatistics> blockStatistics(
+          const CsrView& m,
+          int blockSize,
+          int inputWidth,
+          int indexBits,
+          std::vector<double>* maxAbs = nullptr);
+
+      // the length of each block in each stream of a partition, from the
+      // counting pass of streamPartition()
+      struct StreamCounts {
+        std::vector<int64_t> blockStart, colptrStart, escapesStart;
+        std::vector<int32_t> scales;
+        PartitionStreamSizes sizes;
+      };
+      StreamCounts countStreams(const CsrView& rows, int controllerNum, int64_t vSizeBytes);
+
+      // writes rows [start, start + nRows) of mat as a partition at the
+      // addresses of pwr, as preprocessToDevice(); fillers have zero values
+      void streamPartition(
+          const CsrView& mat,
+          int start,
+          int nRows,
+          bool filler,
+          const StreamCounts& counts,
+          const PartitionWriteResult& pwr,
+          int controllerNum,
+          int64_t chunkNnzs);
+
+      // rows are numbered from 0 within the partition
+      Partition partitionFromStatistics(
+          std::vector<BlockStatistics>& blocks,
+          int n,
+          int blockSize,
+          int inputWidth);
+
     };
 
     inline std::ostream& operator<<(std::ostream& s, Spmv& a) {
@@ -210,48 +768,65 @@ struct Partition {
     // Model for an architecture which can skip sequences of empty rows
     class SkipEmptyRowsSpmv : public Spmv {
       protected:
-        std::vector<int32_t> encodeEmptyRows(std::vector<int32_t> pin, bool encode) {
-          std::vector<int32_t> encoded;
-          if (!encode) {
-            return pin;
-          }
-
+        // replaces each run of empty rows with its length, flagged by the
+        // top bit; the encoding is done in place, since it never grows
+        int encodeEmptyRows(int32_t* pin, int n, int32_t previousEnd = 0) {
+          int encoded = 0;
           int emptyRunLength = 0;
-          for (size_t i = 0; i < pin.size(); i++) {
-            uint32_t rowLength = pin[i] - (i == 0 ? 0 : pin[i - 1]);
+          int32_t prev = previousEnd;
+          for (int i = 0; i < n; i++) {
+            int32_t rowEnd = pin[i];
+            uint32_t rowLength = rowEnd - prev;
+            prev = rowEnd;
             if (rowLength == 0) {
               emptyRunLength++;
             } else {
               if (emptyRunLength != 0) {
-                encoded.push_back(emptyRunLength | (1 << 31));
+                pin[encoded++] = emptyRunLength | (1 << 31);
               }
               emptyRunLength = 0;
-              encoded.push_back(pin[i]);
+              pin[encoded++] = rowEnd;
             }
           }
 
           if (emptyRunLength != 0) {
-            encoded.push_back(emptyRunLength | (1 << 31));
+            pin[encoded++] = emptyRunLength | (1 << 31);
           }
 
           return encoded;
         }
 
-        virtual cask::CsrMatrix preprocessBlock(
-            const cask::CsrMatrix& in,
+        virtual int encodeBlockRows(
+            int32_t* rowEnds,
+            int n,
+            int32_t previousEnd,
             int blockNumber,
             int nBlocks) override {
           bool encode = blockNumber != 0 && blockNumber != nBlocks - 1;
-          cask::CsrMatrix m;
-          m.row_ptr = encodeEmptyRows(in.row_ptr, encode);
-          m.values = in.values;
-          m.col_ind = in.col_ind;
-          return m;
+          return encode ? encodeEmptyRows(rowEnds, n, previousEnd) : n;
+        }
+
+        virtual int countEncodedBlockRows(
+            int nonEmptyRows,
+            int emptyRuns,
+            int n,
+            int blockNumber,
+            int nBlocks) override {
+          bool encode = blockNumber != 0 && blockNumber != nBlocks - 1;
+          return encode ? nonEmptyRows + emptyRuns : n;
+        }
+
+        // runs of empty rows are encoded in a single cycle
+        virtual int emptyRowCycles(int blockNumber, int nBlocks) override {
+          bool encode = blockNumber != 0 && blockNumber != nBlocks - 1;
+          return encode ? 0 : 1;
         }
 
       public:
-      SkipEmptyRowsSpmv(int _cacheSize, int  _inputWidth, int _numPipes, int _maxRows, int _numControllers) :
-        Spmv(_cacheSize, _inputWidth, _numPipes, _maxRows, _numControllers) {}
+      SkipEmptyRowsSpmv(int _cacheSize, int  _inputWidth, int _numPipes, int _maxRows, int _numControllers,
+          ValueFormat _valueFormat = ValueFormat::Fp64, int _indexBits = 32, bool _symmetric = false) :
+        Spmv(_cacheSize, _inputWidth, _numPipes, _maxRows, _numControllers, _valueFormat, _indexBits,
+             _symmetric) {}
 
       virtual std::string get_name() override {
         return std::string("SkipEmpty");
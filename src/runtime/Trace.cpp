@@ -0,0 +1,191 @@
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+using namespace cask::trace;
+
+std::atomic<bool> cask::trace::detail::enabled{false};
+
+namespace {
+
+// the events of a thread; only that thread writes to it
+struct ThreadBuffer {
+  int thread;
+  std::vector<Event> events;
+  std::atomic<int64_t> recorded{0};
+
+  explicit ThreadBuffer(int _thread) : thread(_thread), events(eventsPerThread) {}
+};
+
+struct Registry {
+  std::mutex m;
+  std::map<std::string, CounterId> ids;
+  std::vector<std::string> names;
+  // kept after their thread exits, so that its events can be exported
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  int64_t epoch = detail::now();
+};
+
+Registry& registry() {
+  static Registry* r = new Registry();
+  return *r;
+}
+
+ThreadBuffer& threadBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (!buffer) {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.m);
+    r.buffers.push_back(std::make_shared<ThreadBuffer>(r.buffers.size()));
+    buffer = r.buffers.back().get();
+  }
+  return *buffer;
+}
+
+std::string escape(const std::string& s) {
+  std::string e;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      e += '\\';
+    e += c;
+  }
+  return e;
+}
+
+// writes the trace given by CASK_TRACE on exit
+struct EnvironmentTrace {
+  EnvironmentTrace() {
+    const char* path = std::getenv("CASK_TRACE");
+    if (!path || !*path)
+      return;
+    enable();
+    std::atexit([] {
+      try {
+        writeChromeTrace(std::getenv("CASK_TRACE"));
+      } catch (std::exception& e) {
+        std::cerr << "Warning! Could not write trace: " << e.what() << std::endl;
+      }
+    });
+  }
+} environmentTrace;
+
+}
+
+CounterId cask::trace::intern(const std::string& name) {
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.m);
+  auto it = r.ids.find(name);
+  if (it != r.ids.end())
+    return it->second;
+  CounterId id = r.names.size();
+  r.names.push_back(name);
+  r.ids[name] = id;
+  return id;
+}
+
+std::string cask::trace::name(CounterId id) {
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.m);
+  if (id >= r.names.size())
+    throw std::invalid_argument("Unknown trace id " + std::to_string(id));
+  return r.names[id];
+}
+
+void cask::trace::enable(bool on) {
+  detail::enabled.store(on, std::memory_order_relaxed);
+}
+
+void cask::trace::detail::record(CounterId id, char type, int64_t start, int64_t duration, double value) {
+  ThreadBuffer& b = threadBuffer();
+  int64_t n = b.recorded.load(std::memory_order_relaxed);
+  b.events[n % eventsPerThread] = Event{id, type, b.thread, start, duration, value};
+  b.recorded.store(n + 1, std::memory_order_release);
+}
+
+std::vector<Event> cask::trace::events() {
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.m);
+  std::vector<Event> all;
+  for (const auto& b : r.buffers) {
+    int64_t n = b->recorded.load(std::memory_order_acquire);
+    for (int64_t i = std::max<int64_t>(0, n - eventsPerThread); i < n; i++)
+      all.push_back(b->events[i % eventsPerThread]);
+  }
+  return all;
+}
+
+void cask::trace::clear() {
+  Registry& r = registry();
+  std::lock_guard<std::mutex> lock(r.m);
+  for (const auto& b : r.buffers)
+    b->recorded.store(0, std::memory_order_release);
+}
+
+std::vector<PhaseSummary> cask::trace::summary() {
+  std::vector<Event> all = events();
+  std::vector<PhaseSummary> phases;
+  {
+    Registry& r = registry();
+    std::lock_guard<std::mutex> lock(r.m);
+    for (const auto& n : r.names)
+      phases.push_back(PhaseSummary{n, 0, 0});
+  }
+  for (const Event& e : all) {
+    if (e.type != 'X')
+      continue;
+    phases[e.id].count++;
+    phases[e.id].seconds += e.duration / 1E9;
+  }
+  phases.erase(std::remove_if(phases.begin(), phases.end(),
+                              [](const PhaseSummary& p) { return p.count == 0; }),
+               phases.end());
+  return phases;
+}
+
+void cask::trace::writeChromeTrace(std::ostream& s) {
+  std::vector<Event> all = events();
+  int64_t epoch = registry().epoch;
+  s << "{\"traceEvents\":[";
+  s << std::fixed << std::setprecision(3);
+  for (size_t i = 0; i < all.size(); i++) {
+    const Event& e = all[i];
+    s << (i == 0 ? "\n" : ",\n");
+    s << "{\"name\":\"" << escape(name(e.id)) << "\",\"ph\":\"" << e.type << "\""
+      << ",\"pid\":0,\"tid\":" << e.thread << ",\"ts\":" << (e.start - epoch) / 1E3;
+    if (e.type == 'X') {
+      s << ",\"dur\":" << e.duration / 1E3;
+      if (!std::isnan(e.value))
+        s << ",\"args\":{\"value\":" << std::defaultfloat << e.value << std::fixed << "}";
+    } else {
+      s << ",\"args\":{\"value\":" << std::defaultfloat << e.value << std::fixed << "}";
+    }
+    s << "}";
+  }
+  s << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+void cask::trace::writeChromeTrace(const std::string& path) {
+  std::ofstream f(path);
+  if (!f)
+    throw std::runtime_error("Could not open trace file " + path);
+  writeChromeTrace(f);
+}
+
+void cask::trace::writeSummary(std::ostream& s) {
+  s << "[";
+  std::vector<PhaseSummary> phases = summary();
+  for (size_t i = 0; i < phases.size(); i++) {
+    s << (i == 0 ? "\n" : ",\n");
+    s << "{\"name\":\"" << escape(phases[i].name) << "\",\"count\":" << phases[i].count
+      << ",\"seconds\":" << phases[i].seconds << "}";
+  }
+  s << "\n]\n";
+}
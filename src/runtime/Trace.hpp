@@ -0,0 +1,136 @@
+#ifndef TRACE_HPP_H4XK9QWE
+#define TRACE_HPP_H4XK9QWE
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace cask {
+
+/** Low overhead tracing of the runtime phases (preprocessing, transfers and
+ * runs of each partition, solver iterations).
+ *
+ * Events are named by ids interned once per call site, and recorded in a ring
+ * buffer owned by the recording thread, so recording takes no lock and does
+ * no I/O; when tracing is disabled, which is the default, it costs a relaxed
+ * load. Traces are exported after the fact, in the Chrome trace event format
+ * (chrome://tracing, Perfetto) or as per phase summaries.
+ *
+ * Setting the CASK_TRACE environment variable to a path enables tracing
+ * and writes the Chrome trace there on exit.
+ */
+namespace trace {
+
+typedef uint32_t CounterId;
+
+/** The id of the given event name, the same for all calls with that name;
+ * takes a lock, so call sites should keep the id (see CASK_TRACE_SCOPE) */
+CounterId intern(const std::string& name);
+
+/** The name of an interned id */
+std::string name(CounterId id);
+
+namespace detail {
+extern std::atomic<bool> enabled;
+
+inline int64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void record(CounterId id, char type, int64_t start, int64_t duration, double value);
+}
+
+inline bool enabled() {
+  return detail::enabled.load(std::memory_order_relaxed);
+}
+
+void enable(bool on = true);
+
+/** Events kept per thread; older events are overwritten */
+const int64_t eventsPerThread = 1 << 16;
+
+/** A recorded event: a completed scope (type 'X') or a counter value ('C');
+ * times are in nanoseconds of the steady clock and value is the argument of
+ * a scope (e.g. a partition index), NaN if it has none. */
+struct Event {
+  CounterId id;
+  char type;
+  int thread;
+  int64_t start, duration;
+  double value;
+};
+
+/** Records the time between construction and destruction of the scope,
+ * with an optional argument */
+class Scope {
+  CounterId id;
+  int64_t start;
+  double value;
+
+ public:
+  explicit Scope(CounterId _id, double _value = NAN) :
+      id(_id), start(enabled() ? detail::now() : -1), value(_value) {}
+
+  ~Scope() {
+    if (start >= 0)
+      detail::record(id, 'X', start, detail::now() - start, value);
+  }
+
+  Scope(const Scope&) = delete;
+  Scope& operator=(const Scope&) = delete;
+};
+
+/** Records a value of a counter, e.g. the residual of a solver iteration */
+inline void counter(CounterId id, double value) {
+  if (enabled())
+    detail::record(id, 'C', detail::now(), 0, value);
+}
+
+/** The events of all threads, by thread then in recording order; this must
+ * not be called while other threads record events */
+std::vector<Event> events();
+
+/** Discards all recorded events */
+void clear();
+
+/** Total time and number of the scopes of a name, in order of first interning */
+struct PhaseSummary {
+  std::string name;
+  int64_t count;
+  double seconds;
+};
+
+std::vector<PhaseSummary> summary();
+
+/** Writes the events in the Chrome trace event JSON format */
+void writeChromeTrace(std::ostream& s);
+void writeChromeTrace(const std::string& path);
+
+/** Writes summary() as a JSON array of {name, count, seconds} */
+void writeSummary(std::ostream& s);
+
+}
+}
+
+#define CASK_TRACE_CONCAT_(a, b) a##b
+#define CASK_TRACE_CONCAT(a, b) CASK_TRACE_CONCAT_(a, b)
+
+/** Traces the enclosing scope as the given (literal) name, with an optional
+ * numeric argument */
+#define CASK_TRACE_SCOPE(name, ...) \
+  static const cask::trace::CounterId CASK_TRACE_CONCAT(caskTraceId_, __LINE__) = cask::trace::intern(name); \
+  cask::trace::Scope CASK_TRACE_CONCAT(caskTraceScope_, __LINE__)(CASK_TRACE_CONCAT(caskTraceId_, __LINE__), ##__VA_ARGS__)
+
+/** Records a value of the given (literal) counter name */
+#define CASK_TRACE_COUNTER(name, value) \
+  do { \
+    static const cask::trace::CounterId caskTraceCounterId = cask::trace::intern(name); \
+    cask::trace::counter(caskTraceCounterId, value); \
+  } while (0)
+
+#endif /* end of include guard: TRACE_HPP_H4XK9QWE */
@@ -58,13 +58,14 @@ void print(T v, std::string message="") {
   std::cout << std::endl;
 }
 
+// pads v with T{} to a multiple of widthInBytes, or by at most
+// widthInBytes / sizeof(T) entries if T does not divide the width
 template<typename T>
 void align(std::vector<T>& v, int widthInBytes) {
-  int limit = widthInBytes / sizeof(T);
-  while ((v.size() * sizeof(T)) % widthInBytes != 0 && limit != 0) {
-    v.push_back(T{});
-    limit--;
-  }
+  size_t limit = widthInBytes / sizeof(T), pad = 0;
+  while (pad < limit && ((v.size() + pad) * sizeof(T)) % widthInBytes != 0)
+    pad++;
+  v.resize(v.size() + pad);
 }
 
 inline int align(int bytes, int to) {
@@ -96,19 +97,21 @@ inline void logResultR(std::string s) {
   std::cout << s << "=";
 }
 
+// NB does not flush std::cout, so results can be logged from timed code;
+// see also Trace.hpp for timings
 template<typename U>
 void logResult(std::string s, std::vector<U> vals) {
   logResultR(s);
   for (const auto& v : vals)
     std::cout << v << ",";
-  std::cout << std::endl;
+  std::cout << '\n';
 }
 
 template<typename Arg, typename... Args>
 void logResult(std::string s, Arg a, Args... as) {
   logResultR(s, as...);
   std::cout << a << ",";
-  std::cout << std::endl;
+  std::cout << '\n';
 }
 
 // A ranged design parameter; it is defined with a fixed value OR a range
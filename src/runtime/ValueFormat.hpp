@@ -0,0 +1,159 @@
+#ifndef VALUEFORMAT_HPP_R7KQ2WDN
+#define VALUEFORMAT_HPP_R7KQ2WDN
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace cask {
+  namespace spmv {
+
+/**
+ * Storage formats of the matrix values in the indptr / values stream. The SpMV
+ * is bandwidth bound, so storing values in fewer bits directly increases the
+ * number of nonzeros per second: an entry takes 12 bytes (value and 32 bit
+ * column index) for Fp64, 8 for Fp32 and 6 for Bf16 and Fixed16. The device
+ * widens values to fp64 before the multiplication; vectors and results remain
+ * fp64.
+ */
+enum class ValueFormat {
+  Fp64,
+  Fp32,
+  // bfloat16: the top 16 bits of an IEEE single precision float
+  Bf16,
+  // 16 bit signed integers, with a power of two scale per block of a partition
+  Fixed16
+};
+
+/* Value types of each format, used as template parameters: storage is the
+ * type stored in the stream, encode() / decode() convert to / from double and
+ * scaled formats take the scale of the block holding the value. */
+struct Fp64Value {
+  typedef double storage;
+  static const bool scaled = false;
+  static storage encode(double v, int) { return v; }
+  static double decode(storage s, int) { return s; }
+};
+
+struct Fp32Value {
+  typedef float storage;
+  static const bool scaled = false;
+  static storage encode(double v, int) { return static_cast<float>(v); }
+  static double decode(storage s, int) { return s; }
+};
+
+struct Bf16Value {
+  typedef uint16_t storage;
+  static const bool scaled = false;
+
+  // rounds the single precision value to nearest, ties to even
+  static storage encode(double v, int) {
+    float f = static_cast<float>(v);
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    if (std::isnan(f))
+      return (bits >> 16) | 0x40;
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return bits >> 16;
+  }
+
+  static double decode(storage s, int) {
+    uint32_t bits = uint32_t(s) << 16;
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+};
+
+struct Fixed16Value {
+  typedef int16_t storage;
+  static const bool scaled = true;
+  static const int maxMagnitude = 32767;
+
+  /** The scale of a block whose largest magnitude is maxAbs: values are
+   * stored as round(v * 2^-scale), so that maxAbs uses all 15 bits */
+  static int scaleFor(double maxAbs) {
+    if (maxAbs == 0 || !std::isfinite(maxAbs))
+      return 0;
+    int e;
+    std::frexp(maxAbs, &e);
+    return e - 15;
+  }
+
+  static storage encode(double v, int scale) {
+    double s = std::round(std::ldexp(v, -scale));
+    return static_cast<storage>(std::max<double>(-maxMagnitude, std::min<double>(maxMagnitude, s)));
+  }
+
+  static double decode(storage s, int scale) {
+    return std::ldexp(double(s), scale);
+  }
+};
+
+/** An entry of the indptr / values stream: the value and its column index
+ * within the block */
+#pragma pack(1)
+template<typename V>
+struct packed_entry {
+  typename V::storage value;
+  int indptr;
+  packed_entry(typename V::storage _value, int _indptr) : value(_value), indptr(_indptr) {}
+  packed_entry() : value(0), indptr(0) {}
+} __attribute__((packed));
+#pragma pack()
+
+// pack values and colptr to reduce number of streams
+typedef packed_entry<Fp64Value> indptr_value;
+
+/** Calls f(V()) with the value type V of the format */
+template<typename F>
+void withValueType(ValueFormat format, F& f) {
+  switch (format) {
+    case ValueFormat::Fp64: f(Fp64Value()); return;
+    case ValueFormat::Fp32: f(Fp32Value()); return;
+    case ValueFormat::Bf16: f(Bf16Value()); return;
+    case ValueFormat::Fixed16: f(Fixed16Value()); return;
+  }
+  throw std::invalid_argument("Unknown value format");
+}
+
+inline int valueBits(ValueFormat format) {
+  switch (format) {
+    case ValueFormat::Fp64: return 64;
+    case ValueFormat::Fp32: return 32;
+    case ValueFormat::Bf16: return 16;
+    case ValueFormat::Fixed16: return 16;
+  }
+  throw std::invalid_argument("Unknown value format");
+}
+
+/** Bytes taken by a nonzero in the indptr / values stream */
+inline int bytesPerNnz(ValueFormat format) {
+  return valueBits(format) / 8 + sizeof(int32_t);
+}
+
+inline std::string to_string(ValueFormat format) {
+  switch (format) {
+    case ValueFormat::Fp64: return "fp64";
+    case ValueFormat::Fp32: return "fp32";
+    case ValueFormat::Bf16: return "bf16";
+    case ValueFormat::Fixed16: return "fixed16";
+  }
+  throw std::invalid_argument("Unknown value format");
+}
+
+/** The inverse of to_string(), e.g. for the value_format build parameter */
+inline ValueFormat parseValueFormat(const std::string& name) {
+  for (ValueFormat f : {ValueFormat::Fp64, ValueFormat::Fp32, ValueFormat::Bf16, ValueFormat::Fixed16})
+    if (to_string(f) == name)
+      return f;
+  throw std::invalid_argument("Unknown value format " + name);
+}
+
+  }
+}
+
+#endif /* end of include guard: VALUEFORMAT_HPP_R7KQ2WDN */
@@ -36,6 +36,7 @@ class SpmvKernel extends Kernel {
       int cacheSize,
       int indexWidth,
       int mantissaWidth,
+      int valueBits,
       boolean dbg) {
     super(parameters);
 
@@ -53,7 +54,7 @@ class SpmvKernel extends Kernel {
 
     SpmvCacheKernel cache = new SpmvCacheKernel(this,
         vRomLoadEnable, cacheReadEnable, readMask,
-        inputWidth, cacheSize, indexWidth, mantissaWidth);
+        inputWidth, cacheSize, indexWidth, mantissaWidth, valueBits);
     DFEVector<DFEVar> matrixValues = cache.getMatrixValues();
     DFEVector<DFEVar> vectorValues = cache.getVectorValues();
     //DFEVector<DFEVar> vectorIndices = cache.getVectorIndices();
@@ -120,7 +121,8 @@ class SpmvCacheKernel extends KernelLib {
       int inputWidth,
       int cacheSize,
       int indexWidth,
-      int mantissaWidth) {
+      int mantissaWidth,
+      int valueBits) {
     super(owner);
 
     this.addressT = dfeUInt(MathUtils.bitsToAddress(cacheSize));
@@ -137,7 +139,7 @@ class SpmvCacheKernel extends KernelLib {
     DFEVar vectorValue = owner.io.input("vromLoad", dfeFloat(11, mantissaWidth), vRomLoadEnable);
     vtype = new DFEVectorType<DFEVar> (dfeFloat(11, mantissaWidth), inputWidth);
     ivtype = new DFEVectorType<DFEVar> (dfeUInt(indexWidth), inputWidth);
-    DFEVectorType<DFEVar> inputType = new DFEVectorType<DFEVar> (dfeUInt(96), inputWidth);
+    DFEVectorType<DFEVar> inputType = new DFEVectorType<DFEVar> (dfeUInt(valueBits + 32), inputWidth);
 
      //--- Cache allocation and control
     vroms = new ArrayList<Memory<DFEVar>>();
@@ -157,8 +159,8 @@ class SpmvCacheKernel extends KernelLib {
     DFEVector<DFEVar> valuesVector = vtype.newInstance(this);
     indptrVector = ivtype.newInstance(this);
     for (int i = 0; i < inputWidth; i++) {
-      indptrVector[i] <== indptrValues[i].slice(64, 32).cast(dfeUInt(32));
-      valuesVector[i] <== indptrValues[i].slice(0, 64).cast(dfeFloat(11, 53));
+      indptrVector[i] <== indptrValues[i].slice(valueBits, 32).cast(dfeUInt(32));
+      valuesVector[i] <== widenValue(indptrValues[i].slice(0, valueBits), valueBits);
     }
 
     DFEVector<DFEVar> colptr = selectValues(indptrVector, readMask);
@@ -166,6 +168,16 @@ class SpmvCacheKernel extends KernelLib {
     vectorValues = resolveVectorReads(colptr);
   }
 
+  // matrix values are stored as fp64, fp32 or bf16 and computed in fp64
+  DFEVar widenValue(DFEVar bits, int valueBits)
+  {
+    if (valueBits == 64)
+      return bits.cast(dfeFloat(11, 53));
+    if (valueBits == 32)
+      return bits.cast(dfeFloat(8, 24)).cast(dfeFloat(11, 53));
+    return bits.cast(dfeFloat(8, 8)).cast(dfeFloat(11, 53));
+  }
+
   DFEVector<DFEVar> getMatrixValues()
   {
     return matrixValues;
@@ -16,9 +16,11 @@ public class SpmvManager extends CustomManager{
     public final int numPipes;
     public final int numControllers;
     private final int pipesPerController;
+    private final int valueBits;
     private final int burstSizeBytes = 384;
 
-    // parameters of CSR format used: float64 values, int32 index.
+    // parameters of CSR format used: float64 vector, int32 index; the matrix
+    // values are stored in valueBits (see SpmvEngineParams.value_format)
     private static final int mantissaWidth = 53;
     private static final int indexWidth = 32;
 
@@ -38,6 +40,7 @@ public class SpmvManager extends CustomManager{
         numPipes = ep.getNumPipes();
         numControllers = ep.getNumControllers();
         pipesPerController = numPipes / numControllers;
+        valueBits = valueBits(ep.getValueFormat());
 
         if (ep.getMaxRows() % numPipes != 0) {
           maxRows = ep.getMaxRows() / numPipes + 1;
@@ -61,6 +64,7 @@ public class SpmvManager extends CustomManager{
         addMaxFileConstant("numPipes", numPipes);
         addMaxFileConstant("numControllers", numControllers);
         addMaxFileConstant("dramReductionEnabled", dramReductionEnabled ? 1 : 0);
+        addMaxFileConstant("valueBits", valueBits);
 
         ManagerUtils.setDRAMFreq(this, ep, 400);
         config.setAllowNonMultipleTransitions(true);
@@ -98,6 +102,17 @@ public class SpmvManager extends CustomManager{
         }
     }
 
+    static int valueBits(String valueFormat) {
+        if (valueFormat.equals("fp64"))
+            return 64;
+        if (valueFormat.equals("fp32"))
+            return 32;
+        if (valueFormat.equals("bf16"))
+            return 16;
+        // fixed16 would also need the block scales, which the kernel does not read
+        throw new RuntimeException("Unsupported value format " + valueFormat);
+    }
+
     void addComputePipe(int id, int inputWidth, LMemInterface iface) {
         StateMachineBlock readControlBlock = addStateMachine(
             getReadControl(id),
@@ -111,10 +126,11 @@ public class SpmvManager extends CustomManager{
               cacheSize,
               indexWidth,
               mantissaWidth,
+              valueBits,
               DBG_SPMV_KERNEL
               ));
 
-        k.getInput("indptr_values") <== addUnpaddingKernel("indptr_values" + id, inputWidth * 96, id * 10 + 2, iface);
+        k.getInput("indptr_values") <== addUnpaddingKernel("indptr_values" + id, inputWidth * (valueBits + indexWidth), id * 10 + 2, iface);
         k.getInput("vromLoad") <== addUnpaddingKernel("vromLoad" + id, 64, id * 10 + 3, iface);
         k.getInput("control") <== readControlBlock.getOutput("control");
 
@@ -0,0 +1,101 @@
+#include <Cask.hpp>
+#include <CpuSpmv.hpp>
+#include <DeviceModels.hpp>
+#include <DfeSimulator.hpp>
+#include <IO.hpp>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+
+namespace {
+
+// a simulated device of 4 pipes on 2 controllers
+struct SimulatedDevice {
+  spmv::Spmv design{64, 4, 4, 20000, 2};
+  std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(design.impl);
+};
+
+}
+
+TEST(CaskContext, PreprocessesMatricesOfTheCaller) {
+  SimulatedDevice d;
+  CaskContext cc({&d.design.impl});
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+
+  // arrays the caller owns, e.g. those of a SciPy matrix, released once
+  // preprocessed
+  std::unique_ptr<std::vector<int>> rowPtr(new std::vector<int>(a.row_ptr)), colInd(new std::vector<int>(a.col_ind));
+  std::unique_ptr<std::vector<double>> values(new std::vector<double>(a.values));
+  CsrView view(a.n, a.m, rowPtr->data(), colInd->data(), values->data());
+  double cycles = cc.estimateClockCycles(view);
+  std::shared_ptr<spmv::Spmv> s = cc.preprocess(view);
+  rowPtr.reset();
+  colInd.reset();
+  values.reset();
+
+  EXPECT_EQ(s->getMatrixRows(), a.n);
+  EXPECT_DOUBLE_EQ(s->getEstimatedClockCycles(), cycles);
+  std::vector<double> x(a.m), y(a.n), exp(a.n);
+  for (int j = 0; j < a.m; j++)
+    x[j] = 1 + j % 5;
+  s->multiply(x.data(), y.data());
+  cpu::spmv(a, x.data(), exp.data());
+  for (int i = 0; i < a.n; i++)
+    ASSERT_NEAR(y[i], exp[i], 1E-9 * std::max(1.0, std::abs(exp[i]))) << i;
+
+  CaskContext none(std::vector<runtime::GeneratedSpmvImplementation*>{});
+  EXPECT_THROW(none.preprocess(a), std::runtime_error);
+}
+
+TEST(CaskContext, ExploresMatricesInMemory) {
+  // the exploration needs no generated implementation
+  CaskContext cc(std::vector<runtime::GeneratedSpmvImplementation*>{});
+  std::string path = "test/matrices/bfwb62.mtx";
+  dse::Benchmark benchmark;
+  benchmark.add_matrix_path(path);
+  benchmark.add_matrix("bfwb62", std::make_shared<const CsrMatrix>(io::readMatrix(path)));
+  EXPECT_THROW(benchmark.add_matrix("none", nullptr), std::invalid_argument);
+
+  dse::DseParameters params;
+  params.numPipes = utils::Parameter<int>{"numPipes", 1, 2, 1};
+  params.inputWidth = utils::Parameter<int>{"inputWidth", 8, 8, 1};
+  params.cacheSize = utils::Parameter<int>{"cacheSize", 1024, 2048, 1024};
+  params.numControllers = utils::Parameter<int>{"numControllers", 1, 1, 1};
+  std::shared_ptr<model::DeviceModel> device = model::makeDeviceModel("Max4");
+  std::vector<dse::DseResult> results = cc.explore(benchmark, params, *device);
+
+  // the same best architecture whether read from the path or not
+  ASSERT_EQ(results.size(), 2u);
+  EXPECT_EQ(results[1].matrices, std::vector<std::string>{"bfwb62"});
+  EXPECT_EQ(results[0].bestArchitecture->impl, results[1].bestArchitecture->impl);
+  EXPECT_DOUBLE_EQ(results[0].bestArchitecture->getEstimatedClockCycles(),
+                   results[1].bestArchitecture->getEstimatedClockCycles());
+  EXPECT_EQ(cc.getDse().getFamilyDesign().matrices.size(), 2u);
+}
+
+TEST(CaskContext, ExploresIndexCoding) {
+  CaskContext cc(std::vector<runtime::GeneratedSpmvImplementation*>{});
+  dse::Benchmark benchmark;
+  benchmark.add_matrix_path("test/matrices/bfwb62.mtx");
+
+  dse::DseParameters params;
+  params.numPipes = utils::Parameter<int>{"numPipes", 1, 1, 1};
+  params.inputWidth = utils::Parameter<int>{"inputWidth", 8, 8, 1};
+  params.cacheSize = utils::Parameter<int>{"cacheSize", 1024, 1024, 1024};
+  params.numControllers = utils::Parameter<int>{"numControllers", 1, 1, 1};
+  params.indexBits = utils::Parameter<int>{"indexBits", 8, 32, 24};
+  std::shared_ptr<model::DeviceModel> device = model::makeDeviceModel("Max4");
+  std::vector<dse::DseResult> results = cc.explore(benchmark, params, *device);
+
+  // delta coded offsets take less bandwidth and more logic, so neither
+  // design dominates the other
+  ASSERT_EQ(results.size(), 1u);
+  std::vector<int> widths;
+  for (const auto& a : results[0].paretoFront)
+    widths.push_back(a->impl.index_bits);
+  EXPECT_EQ(widths, (std::vector<int>{8, 32}));
+}
@@ -0,0 +1,65 @@
+#include <Converters.hpp>
+#include <IO.hpp>
+#include <SparseLinearSolvers.hpp>
+#include <SparseMatrix.hpp>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::converters;
+
+TEST(Converters, EigenMapsShareCsrStorage) {
+  CsrMatrix a{DokMatrix{3, {
+      1, 0, 2,
+      0, 0, 3,
+      4, 5, 0}}};
+  EigenCsrMap m = asEigen(a);
+  EXPECT_EQ(m.rows(), 3);
+  EXPECT_EQ(m.nonZeros(), a.nnzs);
+  EXPECT_EQ(m.valuePtr(), a.values.data());
+  EXPECT_EQ(m.outerIndexPtr(), a.row_ptr.data());
+  EXPECT_DOUBLE_EQ(m.coeff(2, 1), 5);
+
+  Vector x{1, 2, 3};
+  Eigen::VectorXd y = asEigen(a) * asEigen(x);
+  EXPECT_EQ(eigenVectorToStdVector(y), a.dot(x).data);
+  asEigen(x)[0] = 7;
+  EXPECT_EQ(x[0], 7);
+
+  // rows of a view keep the base of the storage
+  EigenCsrMap rows = asEigen(a.view().sliceRows(1, 2));
+  EXPECT_EQ(rows.rows(), 2);
+  EXPECT_DOUBLE_EQ(rows.coeff(1, 0), 4);
+  EXPECT_EQ(rows.nonZeros(), 3);
+
+  // the solvers take the map as it is
+  sparse_linear_solvers::EigenCsrRef ref(m);
+  EXPECT_EQ(ref.valuePtr(), a.values.data());
+
+  // and back, without copies
+  EigenCsrMatrix e = m;
+  CsrView v = asCsrView(e);
+  EXPECT_EQ(v.values, e.valuePtr());
+  EXPECT_EQ(v.toCsr(), a);
+  e.insert(1, 0) = 1;
+  EXPECT_THROW(asCsrView(e), std::invalid_argument);
+}
+
+TEST(Converters, SolversRunOnCsrStorage) {
+  SymCsrMatrix s = io::readSymMatrix("test/systems/tinysym.mtx");
+  CsrMatrix a = s.explicitSymmetric();
+  Vector b = io::readVector("test/systems/tinysym_b.mtx");
+
+  sparse_linear_solvers::EigenSolver solver;
+  Vector x = solver.solve(a, b);
+  Vector ax = a.dot(x);
+  for (int i = 0; i < a.n; i++)
+    EXPECT_NEAR(ax[i], b[i], 1E-8);
+
+  // an Eigen matrix in another format is copied, to the same result
+  Eigen::SparseMatrix<double> cols = asEigen(a);
+  Eigen::VectorXd y = solver.solve(cols, stdvectorToEigen(b.data));
+  for (int i = 0; i < a.n; i++)
+    EXPECT_NEAR(y[i], x[i], 1E-10);
+}
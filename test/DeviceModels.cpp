@@ -0,0 +1,131 @@
+#include <DeviceModels.hpp>
+#include <Spmv.hpp>
+#include <SparseMatrix.hpp>
+#include <sstream>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::model;
+
+namespace {
+
+LogicResourceUsage estimate(const DeviceModel& device, int cacheSize, int inputWidth,
+    int numPipes, int maxRows, int indexBits = 32) {
+  spmv::Spmv s(cacheSize, inputWidth, numPipes, maxRows, 1, spmv::ValueFormat::Fp64, indexBits);
+  return s.getEstimatedHardwareModel(device, maxRows).ru;
+}
+
+void expectSameUsage(const LogicResourceUsage& a, const LogicResourceUsage& b) {
+  EXPECT_EQ(a.luts, b.luts);
+  EXPECT_EQ(a.ffs, b.ffs);
+  EXPECT_EQ(a.brams, b.brams);
+  EXPECT_EQ(a.dsps, b.dsps);
+}
+
+const char* descriptor = R"({
+  "id": "Custom",
+  "frequency_mhz": 250,
+  "entries_per_bram": 512,
+  "memory_bandwidth": 100,
+  "resources": {"luts": 1000000, "ffs": 2000000, "brams": 4000, "dsps": 3000},
+  "kernel_costs": {"per_input": {"luts": 2000, "ffs": 3000, "brams": 10, "dsps": 2}}
+})";
+
+}
+
+TEST(DeviceModels, DefaultCostsMatchMax4Builds) {
+  // the usage of a 4 pipe design with 8 inputs, a 1024 entry cache and
+  // 100000 rows, as modelled from per kernel costs
+  Max4Model max4;
+  LogicResourceUsage u = estimate(max4, 1024, 8, 4, 100000);
+  int reductionBrams = utils::ceilDivide(25000, 256);
+  EXPECT_EQ(u.luts, 4 * (10069 + 363 + 3 * 364 + 1458 * 8 + 1235 + 5325 + 500) + 15330);
+  EXPECT_EQ(u.ffs, 4 * (12965 + 543 + 3 * 474 + 2031 * 8 + 643 + 12184 + 800) + 17606);
+  EXPECT_EQ(u.brams, 4 * (reductionBrams + (1024 / 256 + 14) * 8 + 108 + 81) + 56);
+  EXPECT_EQ(u.dsps, 4 * 4 * 8);
+
+  // delta coded indices add a decoder per input and an escape stream
+  LogicResourceUsage d = estimate(max4, 1024, 8, 4, 100000, 8);
+  EXPECT_EQ(d.luts - u.luts, 4 * (38 * 8 * 8 + 364 + 500));
+  EXPECT_EQ(d.brams - u.brams, 4 * 8);
+
+  EXPECT_THROW(estimate(Max3Model(), 1024, 8, 4, 100000), std::invalid_argument);
+}
+
+TEST(DeviceModels, DescriptorRoundTrip) {
+  for (const char* name : {"Max4", "Max4MoreMemory", "Max5"}) {
+    std::shared_ptr<DeviceModel> device = makeDeviceModel(name);
+    std::stringstream s;
+    writeDeviceModel(*device, s);
+    std::shared_ptr<JsonDeviceModel> loaded = readDeviceModel(s);
+    EXPECT_EQ(loaded->getId(), device->getId());
+    EXPECT_EQ(loaded->frequency(), device->frequency());
+    EXPECT_EQ(loaded->maxParams().memoryBandwidth, device->maxParams().memoryBandwidth);
+    expectSameUsage(loaded->maxParams().ru, device->maxParams().ru);
+    expectSameUsage(estimate(*loaded, 2048, 4, 6, 50000), estimate(*device, 2048, 4, 6, 50000));
+  }
+  EXPECT_THROW(makeDeviceModel("no such device.json"), std::invalid_argument);
+}
+
+TEST(DeviceModels, DescriptorDefaultsAndFrequency) {
+  std::stringstream s(descriptor);
+  std::shared_ptr<JsonDeviceModel> custom = readDeviceModel(s);
+  EXPECT_EQ(custom->getId(), "Custom");
+  EXPECT_EQ(custom->entriesPerBram(64), 512);
+  KernelCostModel defaults;
+  KernelCostModel costs = custom->kernelCosts();
+  expectSameUsage(costs.perPipe, defaults.perPipe);
+  expectSameUsage(costs.perInput, LogicResourceUsage{2000, 3000, 10, 2});
+
+  // estimates are at the frequency of the device
+  DokMatrix d(200, 200);
+  for (int i = 0; i < 200; i++)
+    d.set(i, i, 1);
+  CsrMatrix a(d);
+  spmv::Spmv sp(1024, 1, 1, a.n, 1);
+  sp.analyse(a);
+  EXPECT_DOUBLE_EQ(sp.getEstimatedGFlops(*custom) / sp.getEstimatedGFlops(Max4Model()), 1.25);
+
+  std::stringstream invalid(R"({"id": "X", "memory_bandwidth": 0, "resources": {}})");
+  EXPECT_THROW(readDeviceModel(invalid), std::invalid_argument);
+}
+
+TEST(DeviceModels, FitRecoversKernelCosts) {
+  std::stringstream s(descriptor);
+  std::shared_ptr<JsonDeviceModel> truth = readDeviceModel(s);
+  truth->costs.perPipe = LogicResourceUsage{20000, 30000, 150, 3};
+  truth->costs.fixed = LogicResourceUsage{12000, 15000, 40, 0};
+
+  // builds of the true device, one of which uses delta coded indices
+  std::vector<BuildMeasurement> builds;
+  int designs[][4] = {{1024, 4, 2, 32}, {2048, 8, 4, 32}, {1024, 2, 6, 32}, {4096, 16, 2, 16}};
+  for (auto& d : designs)
+    builds.push_back(BuildMeasurement{d[0], d[1], d[2], 100000, d[3],
+                                      estimate(*truth, d[0], d[1], d[2], 100000, d[3])});
+
+  // starting from the default costs
+  JsonDeviceModel initial = *truth;
+  initial.costs.perPipe = KernelCostModel().perPipe;
+  initial.costs.perInput = KernelCostModel().perInput;
+  initial.costs.fixed = KernelCostModel().fixed;
+  KernelCostModel fitted = fitKernelCosts(initial, builds);
+  expectSameUsage(fitted.perPipe, truth->costs.perPipe);
+  expectSameUsage(fitted.perInput, truth->costs.perInput);
+  expectSameUsage(fitted.fixed, truth->costs.fixed);
+
+  std::stringstream json(R"([
+    {"cache_size": 1024, "input_width": 4, "num_pipes": 2, "max_rows": 1000,
+     "luts": 1, "ffs": 2, "brams": 3, "dsps": 4}])");
+  std::vector<BuildMeasurement> read = readBuildMeasurements(json);
+  ASSERT_EQ(read.size(), 1u);
+  EXPECT_EQ(read[0].indexBits, 32);
+  expectSameUsage(read[0].usage, LogicResourceUsage{1, 2, 3, 4});
+
+  builds.resize(2);
+  EXPECT_THROW(fitKernelCosts(initial, builds), std::invalid_argument);
+  // the same number of inputs per pipe in all builds
+  builds = {BuildMeasurement{1024, 4, 2, 1000, 32, {}}, BuildMeasurement{1024, 4, 4, 1000, 32, {}},
+            BuildMeasurement{1024, 4, 6, 1000, 32, {}}};
+  EXPECT_THROW(fitKernelCosts(initial, builds), std::invalid_argument);
+}
@@ -0,0 +1,141 @@
+#include <DeviceScheduler.hpp>
+#include <CpuSpmv.hpp>
+#include <DfeSimulator.hpp>
+#include <IO.hpp>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::spmv;
+
+namespace {
+
+// a simulated device of 4 pipes on 2 controllers
+struct SimulatedDevice {
+  Spmv design{64, 4, 4, 20000, 2};
+  std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(design.impl);
+};
+
+Vector testVector(int m, int seed) {
+  Vector x(m);
+  for (int j = 0; j < m; j++)
+    x[j] = 1 + (j + seed) % 7;
+  return x;
+}
+
+void expectProduct(const CsrMatrix& a, const Vector& x, const Vector& got, const std::string& what) {
+  Vector exp(a.n);
+  cpu::spmv(a, x.data.data(), exp.data.data());
+  ASSERT_EQ(got.size(), exp.size()) << what;
+  for (int i = 0; i < a.n; i++)
+    ASSERT_NEAR(got[i], exp[i], 1E-9 * std::max(1.0, std::abs(exp[i]))) << what << " row " << i;
+}
+
+}
+
+TEST(DeviceScheduler, ServesConcurrentClients) {
+  SimulatedDevice d;
+  std::vector<CsrMatrix> matrices{io::readMatrix("test/matrices/bfwb62.mtx"),
+                                  io::readMatrix("test/matrices/OPF_3754.mtx")};
+  DeviceScheduler scheduler(d.design.impl, int64_t(1) << 30);
+  std::vector<std::shared_ptr<const SpmvPlan>> plans;
+  for (const auto& a : matrices)
+    plans.push_back(scheduler.plan(a));
+  EXPECT_NE(plans[0]->id(), plans[1]->id());
+  EXPECT_EQ(plans[1]->rows(), matrices[1].n);
+
+  // each client alternates between the matrices
+  int clients = 4, requests = 6;
+  std::vector<std::thread> threads;
+  for (int c = 0; c < clients; c++)
+    threads.emplace_back([&, c] {
+      for (int r = 0; r < requests; r++) {
+        int k = (c + r) % 2;
+        Vector x = testVector(matrices[k].m, c * requests + r);
+        Vector y = scheduler.submit(plans[k], x).get();
+        expectProduct(matrices[k], x, y, "client " + std::to_string(c) + " request " + std::to_string(r));
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+
+  // both matrices stay resident, in their own regions
+  SchedulerStats stats = scheduler.getStats();
+  EXPECT_EQ(stats.requests, clients * requests);
+  EXPECT_LE(stats.batches, stats.requests);
+  EXPECT_EQ(stats.loads, 2);
+  EXPECT_EQ(stats.evictions, 0);
+}
+
+TEST(DeviceScheduler, BatchesTheRequestsOfAPlan) {
+  SimulatedDevice d;
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  DeviceScheduler scheduler(d.design.impl, int64_t(1) << 30, 4);
+  std::shared_ptr<const SpmvPlan> plan = scheduler.plan(a);
+
+  std::vector<Vector> xs;
+  for (int i = 0; i < 10; i++)
+    xs.push_back(testVector(a.m, i));
+  int64_t runs = d.sim->numRuns();
+  std::vector<std::future<Vector>> ys = scheduler.submit(plan, xs);
+  ASSERT_EQ(ys.size(), xs.size());
+  for (size_t i = 0; i < xs.size(); i++)
+    expectProduct(a, xs[i], ys[i].get(), "vector " + std::to_string(i));
+  // one run of the design for each vector, in batches of at most 4
+  EXPECT_EQ(d.sim->numRuns() - runs, 10);
+  EXPECT_EQ(scheduler.getStats().batches, 3);
+}
+
+TEST(DeviceScheduler, EvictsTheLeastRecentlyUsedPlan) {
+  SimulatedDevice d;
+  std::vector<CsrMatrix> matrices{io::readMatrix("test/matrices/bfwb62.mtx"),
+                                  io::readMatrix("test/matrices/test_tols90.mtx"),
+                                  io::readMatrix("test/matrices/OPF_3754.mtx")};
+  // room for the largest plan only
+  int64_t largest = 0;
+  {
+    DeviceScheduler sizing(d.design.impl, int64_t(1) << 30);
+    for (const auto& a : matrices) {
+      std::shared_ptr<const SpmvPlan> p = sizing.plan(a);
+      for (int64_t bytes : p->deviceBytes())
+        largest = std::max(largest, alignAddress(bytes));
+    }
+  }
+  DeviceScheduler scheduler(d.design.impl, largest);
+  std::vector<std::shared_ptr<const SpmvPlan>> plans;
+  for (const auto& a : matrices)
+    plans.push_back(scheduler.plan(a));
+
+  for (int round = 0; round < 2; round++)
+    for (size_t k = 0; k < matrices.size(); k++) {
+      Vector x = testVector(matrices[k].m, round);
+      expectProduct(matrices[k], x, scheduler.submit(plans[k], x).get(),
+                    "matrix " + std::to_string(k) + " round " + std::to_string(round));
+    }
+  SchedulerStats stats = scheduler.getStats();
+  EXPECT_GT(stats.evictions, 0);
+  EXPECT_GT(stats.loads, 3);
+  // the plans resident at the end
+  EXPECT_GE(stats.loads - stats.evictions, 1);
+  EXPECT_LE(stats.loads - stats.evictions, 2);
+}
+
+TEST(DeviceScheduler, RejectsInvalidRequests) {
+  SimulatedDevice d;
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  DeviceScheduler scheduler(d.design.impl, int64_t(1) << 30), other(d.design.impl, int64_t(1) << 30);
+  std::shared_ptr<const SpmvPlan> plan = scheduler.plan(a);
+  EXPECT_THROW(scheduler.submit(plan, Vector(a.m + 1)), std::invalid_argument);
+  EXPECT_THROW(other.submit(plan, Vector(a.m)), std::invalid_argument);
+  EXPECT_THROW(scheduler.submit(nullptr, Vector(a.m)), std::invalid_argument);
+
+  DeviceScheduler tiny(d.design.impl, 1024);
+  EXPECT_THROW(tiny.plan(a), std::invalid_argument);
+  EXPECT_THROW(DeviceScheduler(d.design.impl, 0), std::invalid_argument);
+}
@@ -0,0 +1,319 @@
+#include <DfeSimulator.hpp>
+#include <Cg.hpp>
+#include <CpuSpmv.hpp>
+#include <IO.hpp>
+#include <Spmv.hpp>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::spmv;
+
+namespace {
+
+const std::vector<std::string> matrices{
+  "test/matrices/bfwb62.mtx",
+  "test/matrices/test_tols90.mtx",
+  "test/matrices/test_large_empty.mtx",
+  "test/matrices/OPF_3754.mtx",
+};
+
+// cache size, input width, pipes, controllers
+const std::vector<std::vector<int>> architectures{
+  {64, 4, 4, 2},
+  {1024, 8, 2, 1},
+  {16, 3, 3, 1},
+};
+
+Vector testVector(const CsrMatrix& a) {
+  Vector x(a.m);
+  for (int j = 0; j < a.m; j++)
+    x[j] = 1 + j % 7;
+  return x;
+}
+
+// y = A * x on the CPU
+Vector expected(const CsrMatrix& a, const Vector& x) {
+  Vector y(a.n);
+  cpu::spmv(a, x.data.data(), y.data.data());
+  return y;
+}
+
+// the order of the additions of the device differs from that of the CPU
+void expectNear(const Vector& got, const Vector& exp, const std::string& what) {
+  ASSERT_EQ(got.size(), exp.size()) << what;
+  for (int i = 0; i < exp.size(); i++)
+    ASSERT_NEAR(got[i], exp[i], 1E-9 * std::max(1.0, std::abs(exp[i]))) << what << " row " << i;
+}
+
+// checks the multiplication and the cycle counts of s, whose device is simulated
+void checkSimulatedRun(Spmv& s, const runtime::DfeSimulator& sim, const CsrMatrix& a,
+                       const std::string& what) {
+  Vector x = testVector(a);
+  Vector exp = expected(a, x);
+  s.preprocess(a);
+  expectNear(s.spmv(x), exp, what);
+
+  const std::vector<Partition>& partitions = s.getPartitions();
+  ASSERT_EQ(sim.lastRun().size(), partitions.size());
+  for (size_t p = 0; p < partitions.size(); p++) {
+    const runtime::PipeSimulation& pipe = sim.lastRun()[p];
+    EXPECT_EQ(pipe.kernelCycles, partitions[p].totalCycles) << what;
+    EXPECT_EQ(pipe.reductionInputs, partitions[p].reductionCycles) << what;
+    // the read control waits a cycle for each row length
+    EXPECT_GT(pipe.controlCycles, pipe.kernelCycles) << what;
+  }
+}
+
+// underestimates the cycles of rows which span several inputs
+class OptimisticSpmv : public Spmv {
+  public:
+    OptimisticSpmv(int cacheSize, int inputWidth, int numPipes, int maxRows, int numControllers) :
+      Spmv(cacheSize, inputWidth, numPipes, maxRows, numControllers) {}
+
+  protected:
+    int countComputeCycles(int32_t* v, int size, int inputWidth) override {
+      int cycles = 0;
+      for (int i = 0; i < size; i++)
+        cycles += std::max(1, (v[i] - (i > 0 ? v[i - 1] : 0)) / inputWidth);
+      return cycles;
+    }
+};
+
+}
+
+TEST(DfeSimulator, MultipliesAsTheHostModel) {
+  for (const auto& path : matrices) {
+    CsrMatrix a = io::readMatrix(path);
+    for (const auto& c : architectures) {
+      std::string what = path + " with " + std::to_string(c[2]) + " pipes";
+      Spmv s(c[0], c[1], c[2], a.n, c[3]);
+      std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+      checkSimulatedRun(s, *sim, a, what);
+
+      // runs of empty rows are encoded in the colptr stream
+      SkipEmptyRowsSpmv skip(c[0], c[1], c[2], a.n, c[3]);
+      sim = runtime::simulate(skip.impl);
+      checkSimulatedRun(skip, *sim, a, what + ", skipping empty rows");
+    }
+  }
+}
+
+TEST(DfeSimulator, BatchesAndValueFormats) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  Vector x = testVector(a);
+  Vector exp = expected(a, x);
+
+  Spmv s(16, 4, 2, a.n, 2);
+  std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+  s.preprocess(a);
+  std::vector<Vector> xs{x, x, x};
+  for (int i = 0; i < a.m; i++)
+    xs[1][i] = 2 * x[i];
+  std::vector<Vector> ys = s.spmm(xs);
+  ASSERT_EQ(ys.size(), 3u);
+  expectNear(ys[0], exp, "first vector");
+  expectNear(ys[2], exp, "last vector");
+  for (int i = 0; i < a.n; i++)
+    EXPECT_NEAR(ys[1][i], 2 * exp[i], 1E-9 * std::max(1.0, std::abs(exp[i])));
+  EXPECT_EQ(sim->numRuns(), 3);
+
+  // single precision values, as the host rounds them
+  Spmv fp32(16, 4, 2, a.n, 1, ValueFormat::Fp32);
+  runtime::simulate(fp32.impl);
+  fp32.preprocess(a);
+  Vector got = fp32.spmv(x);
+  for (int i = 0; i < a.n; i++)
+    EXPECT_NEAR(got[i], exp[i], 1E-5 * std::max(1.0, std::abs(exp[i])));
+
+  Spmv fixed(16, 4, 2, a.n, 1, ValueFormat::Fixed16);
+  EXPECT_THROW(runtime::simulate(fixed.impl), std::invalid_argument);
+  Spmv narrow(16, 4, 2, a.n, 1, ValueFormat::Fp64, 16);
+  EXPECT_THROW(runtime::simulate(narrow.impl), std::invalid_argument);
+}
+
+TEST(DfeSimulator, MultipliesStreamedMatrix) {
+  std::string path = "test/matrices/OPF_3754.mtx";
+  std::string cachePath = "OPF_3754_streamed.bcsr";
+  CsrMatrix a = io::readMatrix(path);
+  io::writeCsrCache(a, false, cachePath);
+  Vector x = testVector(a);
+  Vector exp = expected(a, x);
+  {
+    // the streams are encoded from the mapped file, a thousand nonzeros at a time
+    io::MappedCsrMatrix mapped{cachePath};
+    SkipEmptyRowsSpmv s(64, 4, 4, a.n, 2);
+    std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+    s.preprocessToDevice(mapped.view(), 1000);
+    expectNear(s.spmv(x), exp, path);
+    const std::vector<Partition>& partitions = s.getPartitions();
+    ASSERT_EQ(sim->lastRun().size(), partitions.size());
+    for (size_t p = 0; p < partitions.size(); p++) {
+      EXPECT_EQ(sim->lastRun()[p].kernelCycles, partitions[p].totalCycles);
+      EXPECT_EQ(sim->lastRun()[p].reductionInputs, partitions[p].reductionCycles);
+    }
+  }
+  std::remove(cachePath.c_str());
+}
+
+TEST(DfeSimulator, DetectsWrongCycleCounts) {
+  CsrMatrix a = io::readMatrix("test/matrices/OPF_3754.mtx");
+  Vector x = testVector(a);
+  OptimisticSpmv s(64, 4, 2, a.n, 1);
+  std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+  s.preprocess(a);
+  EXPECT_THROW(s.spmv(x), std::runtime_error);
+  ASSERT_EQ(sim->lastRun().size(), 2u);
+  EXPECT_GT(sim->lastRun()[0].kernelCycles, sim->lastRun()[0].expectedKernelCycles);
+}
+
+TEST(DfeSimulator, MultipliesSymmetricMatrix) {
+  for (std::string path : {"test/matrices/bfwb62.mtx", "test/matrices/OPF_3754.mtx"}) {
+    SymCsrMatrix a = io::readSymMatrix(path);
+    Vector x = testVector(a.matrix);
+    Vector exp(a.n);
+    cpu::symSpmv(a.matrix.view(), x.data.data(), exp.data.data());
+    for (const auto& c : architectures) {
+      std::string what = path + " with " + std::to_string(c[2]) + " pipes";
+      Spmv s(c[0], c[1], c[2], a.n, c[3], ValueFormat::Fp64, 32, true);
+      std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+      s.preprocess(a);
+      expectNear(s.spmv(x), exp, what);
+      for (size_t p = 0; p < s.getPartitions().size(); p++)
+        EXPECT_EQ(sim->lastRun()[p].kernelCycles, s.getPartitions()[p].totalCycles) << what;
+
+      SkipEmptyRowsSpmv skip(c[0], c[1], c[2], a.n, c[3], ValueFormat::Fp64, 32, true);
+      runtime::simulate(skip.impl);
+      skip.preprocess(a);
+      expectNear(skip.spmv(x), exp, what + ", skipping empty rows");
+    }
+  }
+
+  // fewer rows than pipes, in single precision
+  SymCsrMatrix small = io::readSymMatrix("test/matrices/bfwb62.mtx");
+  Spmv fp32(16, 4, 64, small.n, 2, ValueFormat::Fp32, 32, true);
+  runtime::simulate(fp32.impl);
+  fp32.preprocess(small);
+  Vector x = testVector(small.matrix);
+  Vector exp(small.n);
+  cpu::symSpmv(small.matrix.view(), x.data.data(), exp.data.data());
+  Vector got = fp32.spmv(x);
+  for (int i = 0; i < small.n; i++)
+    EXPECT_NEAR(got[i], exp[i], 1E-5 * std::max(1.0, std::abs(exp[i])));
+}
+
+TEST(DfeSimulator, CgOnSymmetricDesign) {
+  SymCsrMatrix a = io::readSymMatrix("test/matrices/bfwb62.mtx");
+  Vector exp = testVector(a.matrix), b(a.n);
+  cpu::symSpmv(a.matrix.view(), exp.data.data(), b.data.data());
+  Spmv s(16, 4, 2, a.n, 1, ValueFormat::Fp64, 32, true);
+  runtime::simulate(s.impl);
+  solvers::Cg cg(s);
+  cg.tolerance = 1e-12;
+  cg.preprocess(a);
+  Vector x = cg.solve(b);
+  EXPECT_TRUE(cg.converged);
+  for (int i = 0; i < a.n; i++)
+    EXPECT_NEAR(x[i], exp[i], 1e-6 * std::max(1.0, std::abs(exp[i]))) << i;
+}
+
+TEST(DfeSimulator, MultipliesInRowPasses) {
+  CsrMatrix a = io::readMatrix("test/matrices/OPF_3754.mtx");
+  Vector x = testVector(a);
+  Vector exp = expected(a, x);
+  for (const auto& c : architectures) {
+    std::string what = std::to_string(c[2]) + " pipes";
+    // passes of at most 4000 rows
+    SkipEmptyRowsSpmv s(c[0], c[1], c[2], 4000, c[3]);
+    std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+    s.preprocess(a);
+    ASSERT_EQ(s.numRowPasses(), 4) << what;
+    expectNear(s.spmv(x), exp, what);
+    // of the last pass
+    for (int p = 0; p < c[2]; p++)
+      EXPECT_EQ(sim->lastRun()[p].kernelCycles, s.getPartitions()[3 * c[2] + p].totalCycles) << what;
+
+    // a run of the design for each pass
+    int64_t runs = sim->numRuns();
+    Vector y(a.n);
+    s.multiply(x.data.data(), y.data.data());
+    expectNear(y, exp, what + ", multiply");
+    EXPECT_EQ(sim->numRuns() - runs, 4) << what;
+    expectNear(s.spmm({x, x})[1], exp, what + ", spmm");
+
+    SkipEmptyRowsSpmv streamed(c[0], c[1], c[2], 4000, c[3]);
+    runtime::simulate(streamed.impl);
+    streamed.preprocessToDevice(a, 1000);
+    expectNear(streamed.spmv(x), exp, what + ", streamed");
+  }
+
+  SymCsrMatrix sym = io::readSymMatrix("test/matrices/OPF_3754.mtx");
+  Vector symExp(sym.n);
+  cpu::symSpmv(sym.matrix.view(), x.data.data(), symExp.data.data());
+  Spmv s(64, 4, 4, 4000, 2, ValueFormat::Fp64, 32, true);
+  runtime::simulate(s.impl);
+  s.preprocess(sym);
+  expectNear(s.spmv(x), symExp, "symmetric");
+}
+
+TEST(DfeSimulator, MultipliesWithEachDramLayout) {
+  CsrMatrix a = io::readMatrix("test/matrices/OPF_3754.mtx");
+  Vector x = testVector(a);
+  Vector exp = expected(a, x);
+  DramLayoutOptions staggered, unshared;
+  staggered.banks = 8;
+  unshared.shareVector = false;
+  for (const DramLayoutOptions& o : {staggered, unshared}) {
+    std::string what = "with " + std::to_string(o.banks) + " banks" + (o.shareVector ? "" : ", unshared vector");
+    Spmv s(64, 4, 4, a.n, 2);
+    runtime::simulate(s.impl);
+    s.setDramLayoutOptions(o);
+    s.preprocess(a);
+    expectNear(s.spmv(x), exp, what);
+    std::vector<Vector> ys = s.spmm({x, x});
+    expectNear(ys[1], exp, what);
+
+    SkipEmptyRowsSpmv streamed(64, 4, 4, a.n, 2);
+    runtime::simulate(streamed.impl);
+    streamed.setDramLayoutOptions(o);
+    streamed.preprocessToDevice(a, 1000);
+    expectNear(streamed.spmv(x), exp, what + ", streamed");
+  }
+}
+
+TEST(DfeSimulator, PolynomialPreconditionerOnTheDevice) {
+  // the 5 point Laplacian on a 20 x 20 grid, which is SPD
+  int k = 20;
+  DokMatrix lower(k * k, k * k);
+  for (int i = 0; i < k * k; i++) {
+    lower.set(i, i, 4 + i % 3);
+    if (i % k > 0)
+      lower.set(i, i - 1, -1);
+    if (i >= k)
+      lower.set(i, i - k, -1);
+  }
+  SymCsrMatrix a(lower);
+  Spmv s(16, 4, 2, a.n, 1, ValueFormat::Fp64, 32, true);
+  std::shared_ptr<runtime::DfeSimulator> sim = runtime::simulate(s.impl);
+  s.preprocess(a);
+
+  using namespace sparse_linear_solvers;
+  double lmax = jacobiScaledBound(a.matrix);
+  ChebyshevPreconditioner<> host(a.matrix, 4);
+  ChebyshevPreconditioner<solvers::DfeSpmvOperator> device(solvers::DfeSpmvOperator(s), diagonalOf(a.matrix), lmax, 4);
+  BlockJacobiPreconditioner blocks(a.matrix, s.getRowSplits());
+  EXPECT_EQ(blocks.numBlocks(), 2);
+
+  Vector r = testVector(a.matrix), exp(a.n), got(a.n);
+  int64_t runs = sim->numRuns();
+  host.apply(r.data.data(), exp.data.data());
+  device.apply(r.data.data(), got.data.data());
+  // the products by A of the polynomial, with the matrix resident
+  EXPECT_EQ(sim->numRuns() - runs, 3);
+  expectNear(got, exp, "chebyshev on the device");
+}
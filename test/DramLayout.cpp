@@ -0,0 +1,141 @@
+#include <DramLayout.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask::spmv;
+
+namespace {
+
+// four partitions on two controllers
+std::vector<PartitionStreamSizes> streams() {
+  return {
+    PartitionStreamSizes{0, 1000, 500, 0, 0, 3840, 400},
+    PartitionStreamSizes{0, 10, 20, 4, 8, 3840, 800},
+    PartitionStreamSizes{1, 0, 384, 0, 0, 3840, 400},
+    PartitionStreamSizes{1, 5000, 100, 0, 12, 3840, 400},
+  };
+}
+
+// the streams of a partition, by address
+std::vector<std::pair<int64_t, int64_t>> extents(const PartitionWriteResult& r, int buffers) {
+  return {
+    {r.indptrValuesStartAddress, r.indptrValuesSize}, {r.colptrStartAddress, r.colptrSize},
+    {r.scalesStartAddress, r.scalesSize}, {r.escapesStartAddress, r.escapesSize},
+    {r.outStartAddr, r.outSize * buffers},
+  };
+}
+
+}
+
+TEST(DramLayout, StreamsAreAlignedAndDisjoint) {
+  DramLayout l = planDramLayout(streams(), 2, 3);
+  ASSERT_EQ(l.partitions.size(), 4u);
+  for (int c = 0; c < 2; c++) {
+    std::vector<std::pair<int64_t, int64_t>> used{{l.partitions[2 * c].vStartAddress, 3 * 3840}};
+    for (int i = 2 * c; i < 2 * c + 2; i++)
+      for (const auto& e : extents(l.partitions[i], 3))
+        used.push_back(e);
+    std::sort(used.begin(), used.end());
+    for (size_t k = 0; k < used.size(); k++) {
+      EXPECT_EQ(used[k].first % burst_size_bytes, 0) << "controller " << c;
+      if (k > 0) {
+        EXPECT_GE(used[k].first, used[k - 1].first + used[k - 1].second) << "controller " << c;
+      }
+    }
+    EXPECT_EQ(l.matrixEnd[c] % burst_size_bytes, 0);
+    EXPECT_EQ(l.end[c], used.back().first + used.back().second);
+  }
+  EXPECT_EQ(l.partitions[1].indptrValuesSize, burst_size_bytes);
+  EXPECT_EQ(l.partitions[1].scalesSize, burst_size_bytes);
+  EXPECT_EQ(l.partitions[3].indptrValuesSize, 5376);
+}
+
+TEST(DramLayout, PartitionsOfAControllerShareTheVector) {
+  DramLayout l = planDramLayout(streams(), 2, 3);
+  EXPECT_EQ(l.writesVector, std::vector<bool>({true, false, true, false}));
+  for (int i = 0; i < 4; i++) {
+    const PartitionWriteResult& r = l.partitions[i];
+    int c = i / 2;
+    EXPECT_EQ(r.vStartAddress, l.matrixEnd[c]);
+    EXPECT_EQ(r.vSize, 3840);
+    EXPECT_LE(r.escapesStartAddress + r.escapesSize, l.matrixEnd[c]);
+    EXPECT_GE(r.outStartAddr, r.vStartAddress + 3 * r.vSize);
+  }
+
+  DramLayoutOptions o;
+  o.shareVector = false;
+  DramLayout own = planDramLayout(streams(), 2, 3, o);
+  EXPECT_EQ(own.writesVector, std::vector<bool>(4, true));
+  EXPECT_EQ(own.partitions[1].vStartAddress, own.partitions[0].vStartAddress + 3 * 3840);
+  EXPECT_EQ(own.end[0], l.end[0] + 3 * 3840);
+}
+
+TEST(DramLayout, StreamsStartInSuccessiveBanks) {
+  DramLayoutOptions o;
+  o.banks = 4;
+  o.bankBytes = 8192;
+  DramLayout l = planDramLayout(streams(), 2, 1, o);
+  // the non empty matrix streams of controller 1, in order
+  std::vector<int64_t> starts{l.partitions[2].colptrStartAddress, l.partitions[3].indptrValuesStartAddress,
+                              l.partitions[3].colptrStartAddress, l.partitions[3].escapesStartAddress};
+  for (size_t k = 0; k < starts.size(); k++) {
+    EXPECT_EQ(starts[k] / o.bankBytes % o.banks, int64_t(k % o.banks)) << "stream " << k;
+    EXPECT_EQ(starts[k] % burst_size_bytes, 0);
+  }
+  EXPECT_EQ(l.partitions[2].indptrValuesSize, 0);
+
+  o.bankBytes = 100;
+  EXPECT_THROW(planDramLayout(streams(), 2, 1, o), std::invalid_argument);
+  EXPECT_THROW(planDramLayout(streams(), 1, 1), std::invalid_argument);
+}
+
+TEST(DramLayout, RegionsAreWrittenInChunks) {
+  std::vector<uint8_t> a(1000, 1), b(10, 2);
+  std::vector<uint8_t> dram(2000, 7);
+  std::vector<int64_t> sizes;
+  auto write = [&](int64_t address, const uint8_t* data, int64_t size) {
+    std::copy(data, data + size, dram.begin() + address);
+    sizes.push_back(size);
+  };
+  int64_t end = 1536;
+  EXPECT_EQ(writeRegion({DramPiece{1152, b.data(), 10}, DramPiece{0, a.data(), 1000}}, 0, end, 1 << 20, write), 1);
+  EXPECT_EQ(sizes, std::vector<int64_t>{end});
+  for (int64_t i = 0; i < end; i++)
+    ASSERT_EQ(dram[i], i < 1000 ? 1 : (i >= 1152 && i < 1162 ? 2 : 0)) << i;
+  EXPECT_EQ(dram[end], 7);
+
+  // chunks of whole bursts, pieces span them
+  sizes.clear();
+  std::fill(dram.begin(), dram.end(), 7);
+  EXPECT_EQ(writeRegion({DramPiece{0, a.data(), 1000}, DramPiece{1152, b.data(), 10}}, 0, end, 800, write), 2);
+  EXPECT_EQ(sizes, std::vector<int64_t>({768, 768}));
+  for (int64_t i = 0; i < end; i++)
+    ASSERT_EQ(dram[i], i < 1000 ? 1 : (i >= 1152 && i < 1162 ? 2 : 0)) << i;
+
+  EXPECT_THROW(writeRegion({DramPiece{0, a.data(), 1000}, DramPiece{990, b.data(), 10}}, 0, end, 800, write),
+               std::runtime_error);
+  EXPECT_THROW(writeRegion({DramPiece{1530, b.data(), 10}}, 0, end, 800, write), std::runtime_error);
+  EXPECT_EQ(writeRegion({}, 0, 0, 800, write), 0);
+}
+
+TEST(DramLayout, RegionsStartAtTheBase) {
+  DramLayout l = planDramLayout(streams(), 2, 3);
+  DramLayoutOptions o;
+  o.baseAddress = 1000;
+  DramLayout shifted = planDramLayout(streams(), 2, 3, o);
+  int64_t base = 3 * burst_size_bytes;
+  EXPECT_EQ(l.base, 0);
+  EXPECT_EQ(shifted.base, base);
+  for (size_t i = 0; i < l.partitions.size(); i++) {
+    EXPECT_EQ(shifted.partitions[i].indptrValuesStartAddress, l.partitions[i].indptrValuesStartAddress + base);
+    EXPECT_EQ(shifted.partitions[i].vStartAddress, l.partitions[i].vStartAddress + base);
+    EXPECT_EQ(shifted.partitions[i].outStartAddr, l.partitions[i].outStartAddr + base);
+  }
+  for (int c = 0; c < 2; c++) {
+    EXPECT_EQ(shifted.matrixEnd[c], l.matrixEnd[c] + base);
+    EXPECT_EQ(shifted.end[c], l.end[c] + base);
+  }
+}
@@ -0,0 +1,134 @@
+#include <DseSearch.hpp>
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+using namespace cask::dse;
+using cask::utils::Parameter;
+
+namespace {
+
+DesignSpace space() {
+  return DesignSpace{{
+      Parameter<int>{"numPipes", 1, 8, 1},
+      Parameter<int>{"inputWidth", 1, 4, 1},
+      Parameter<int>{"cacheSize", 1024, 8192, 1024}}};
+}
+
+// a separable concave score, of maximum 100 at numPipes = 6, inputWidth = 3
+// and cacheSize = 4096; points with more than 24 inputs are not valid
+double score(const DesignSpace& s, int64_t point) {
+  int p = s.value(point, "numPipes"), w = s.value(point, "inputWidth");
+  int c = s.value(point, "cacheSize") / 1024;
+  if (p * w > 24)
+    return 0;
+  return 100 - (p - 6) * (p - 6) - 2 * (w - 3) * (w - 3) - (c - 4) * (c - 4);
+}
+
+// records the evaluated points
+struct Recorder {
+  const DesignSpace& s;
+  std::vector<int64_t> evaluated;
+  std::vector<double> scores;
+
+  Evaluator evaluator() {
+    return [this](const std::vector<int64_t>& batch) {
+      std::vector<double> result;
+      for (int64_t p : batch) {
+        evaluated.push_back(p);
+        result.push_back(score(s, p));
+        scores.push_back(result.back());
+      }
+      return result;
+    };
+  }
+
+  double best() const {
+    return scores.empty() ? 0 : *std::max_element(scores.begin(), scores.end());
+  }
+};
+
+ScoreBound bound(const DesignSpace& s) {
+  // ignores the cache size
+  return [&s](int64_t point) {
+    int p = s.value(point, "numPipes"), w = s.value(point, "inputWidth");
+    if (p * w > 24)
+      return 0.0;
+    return 100.0 - (p - 6) * (p - 6) - 2 * (w - 3) * (w - 3);
+  };
+}
+
+}
+
+TEST(DseSearch, DesignSpaceIndexing) {
+  DesignSpace s = space();
+  EXPECT_EQ(s.points(), 8 * 4 * 8);
+  EXPECT_EQ(s.size(2), 8);
+  for (int64_t p = 0; p < s.points(); p++)
+    EXPECT_EQ(s.index(s.coordinates(p)), p);
+  // the first parameter varies fastest
+  EXPECT_EQ(s.value(1, "numPipes"), 2);
+  EXPECT_EQ(s.value(8, "inputWidth"), 2);
+  EXPECT_EQ(s.value(s.points() - 1, "cacheSize"), 8192);
+  EXPECT_THROW(s.value(0, "maxRows"), std::invalid_argument);
+  EXPECT_THROW(s.index({8, 0, 0}), std::invalid_argument);
+
+  // to the nearest value of the grid, clamped to its range
+  int64_t p = s.nearest({{"numPipes", 20}, {"cacheSize", 3000}});
+  EXPECT_EQ(s.value(p, "numPipes"), 8);
+  EXPECT_EQ(s.value(p, "inputWidth"), 1);
+  EXPECT_EQ(s.value(p, "cacheSize"), 3072);
+
+  EXPECT_THROW(DesignSpace({Parameter<int>{"numPipes", 4, 1, 1}}), std::invalid_argument);
+}
+
+TEST(DseSearch, ExhaustiveAndBranchAndBound) {
+  DesignSpace s = space();
+  Recorder exhaustive{s};
+  ExhaustiveSearch().search(s, exhaustive.evaluator(), bound(s), {});
+  EXPECT_EQ(exhaustive.evaluated.size(), size_t(s.points()));
+  EXPECT_EQ(std::set<int64_t>(exhaustive.evaluated.begin(), exhaustive.evaluated.end()).size(),
+            size_t(s.points()));
+  EXPECT_EQ(exhaustive.best(), 100);
+
+  Recorder pruned{s};
+  BranchAndBoundSearch(4).search(s, pruned.evaluator(), bound(s), {});
+  EXPECT_EQ(pruned.best(), 100);
+  EXPECT_LT(pruned.evaluated.size(), exhaustive.evaluated.size());
+  // points known not to be valid are never evaluated
+  for (int64_t p : pruned.evaluated)
+    EXPECT_GT(score(s, p), 0);
+}
+
+TEST(DseSearch, LocalSearchesRespectTheBudget) {
+  DesignSpace s = space();
+  std::vector<int64_t> seeds{s.nearest({{"numPipes", 1}, {"inputWidth", 1}, {"cacheSize", 8192}})};
+
+  Recorder descent{s};
+  CoordinateDescentSearch(64).search(s, descent.evaluator(), bound(s), seeds);
+  EXPECT_EQ(descent.best(), 100);
+  EXPECT_LE(descent.evaluated.size(), 64u + 8u);
+
+  Recorder annealing{s}, again{s};
+  AnnealingSearch(100, 4, 7).search(s, annealing.evaluator(), bound(s), seeds);
+  AnnealingSearch(100, 4, 7).search(s, again.evaluator(), bound(s), seeds);
+  EXPECT_EQ(annealing.best(), 100);
+  EXPECT_LE(annealing.evaluated.size(), 100u + 4u);
+  EXPECT_EQ(annealing.evaluated, again.evaluated);
+  // each point is evaluated once
+  EXPECT_EQ(std::set<int64_t>(annealing.evaluated.begin(), annealing.evaluated.end()).size(),
+            annealing.evaluated.size());
+}
+
+TEST(DseSearch, MakeSearchEngine) {
+  SearchParameters params;
+  EXPECT_EQ(makeSearchEngine(params, 4)->name(), "exhaustive");
+  for (std::string engine : {"branch-and-bound", "coordinate-descent", "annealing"}) {
+    params.engine = engine;
+    EXPECT_EQ(makeSearchEngine(params, 4)->name(), engine);
+  }
+  params.engine = "genetic";
+  EXPECT_THROW(makeSearchEngine(params, 4), std::invalid_argument);
+}
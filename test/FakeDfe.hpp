@@ -0,0 +1,98 @@
+#ifndef SPAM_FAKEDFE_HPP
+#define SPAM_FAKEDFE_HPP
+
+#include <GeneratedImplSupport.hpp>
+#include <SparseMatrix.hpp>
+#include <Utils.hpp>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+namespace cask {
+namespace test {
+
+// a device with one DRAM per memory controller, on which the design
+// multiplies its matrix (e.g. the rows of a shard) by the vector in DRAM
+struct FakeDfe {
+  std::mutex m;
+  std::vector<std::vector<uint8_t>> dram;
+  int numPipes, numControllers;
+  // multiplied by the design, set by the test
+  const CsrMatrix* matrix = nullptr;
+  int runs = 0;
+
+  FakeDfe(int _numPipes, int _numControllers) :
+    dram(_numControllers), numPipes(_numPipes), numControllers(_numControllers) {}
+
+  int controller(const int64_t* sizes) {
+    for (int c = 0; c < numControllers; c++)
+      if (sizes[c] != 0)
+        return c;
+    return 0;
+  }
+
+  uint8_t* at(int ctrl, int64_t address, int64_t size) {
+    auto& d = dram[ctrl];
+    if (d.size() < size_t(address + size))
+      d.resize(address + size);
+    return &d[address];
+  }
+
+  runtime::GeneratedSpmvImplementation impl(int maxRows) {
+    runtime::GeneratedSpmvImplementation i(
+        0, runtime::spmvRunMock, runtime::spmvWriteMock, runtime::spmvReadMock,
+        maxRows, numPipes, 16, 2, false, numControllers);
+    i.write = [this](const int64_t size, const int64_t* sizes, const int64_t* addrs,
+                     const uint8_t* data, const char*) {
+      std::lock_guard<std::mutex> lock(m);
+      int c = controller(sizes);
+      std::memcpy(at(c, addrs[c], size), data, size);
+    };
+    i.read = [this](const int64_t size, const int64_t* sizes, const int64_t* addrs,
+                    uint8_t* data, const char*) {
+      std::lock_guard<std::mutex> lock(m);
+      int c = controller(sizes);
+      std::memcpy(data, at(c, addrs[c], size), size);
+    };
+    i.Spmv = [this](int64_t, int64_t, int64_t,
+                    const int64_t*, const int32_t*, const int64_t*,
+                    const int32_t*, const int32_t* nrows, const int64_t* outAddrs,
+                    const int32_t*, const int32_t*, const int64_t* vAddrs) {
+      std::lock_guard<std::mutex> lock(m);
+      runs++;
+      int firstRow = 0;
+      for (int p = 0; p < numPipes; p++) {
+        int c = p / (numPipes / numControllers);
+        std::vector<double> x(matrix->m);
+        std::memcpy(x.data(), at(c, vAddrs[p], matrix->m * sizeof(double)), matrix->m * sizeof(double));
+        int paddedRows = utils::ceilDivide(nrows[p], 48) * 48;
+        double* out = reinterpret_cast<double*>(at(c, outAddrs[p], paddedRows * sizeof(double)));
+        for (int r = 0; r < nrows[p]; r++) {
+          int row = firstRow + r;
+          out[r] = 0;
+          for (int k = matrix->row_ptr[row]; k < matrix->row_ptr[row + 1]; k++)
+            out[r] += matrix->values[k] * x[matrix->col_ind[k]];
+        }
+        firstRow += nrows[p];
+      }
+    };
+    return i;
+  }
+};
+
+// a banded matrix whose first tenth of rows, of half width denseWidth, are
+// much denser than the others, of half width 1
+inline CsrMatrix skewedMatrix(int n, int denseWidth) {
+  DokMatrix d(n, n);
+  for (int i = 0; i < n; i++) {
+    int width = i < n / 10 ? denseWidth : 1;
+    for (int j = std::max(0, i - width); j <= std::min(n - 1, i + width); j++)
+      d.set(i, j, 1 + (i + 2 * j) % 5);
+  }
+  return CsrMatrix(d);
+}
+
+}
+}
+#endif //SPAM_FAKEDFE_HPP
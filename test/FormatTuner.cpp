@@ -0,0 +1,91 @@
+#include <FormatTuner.hpp>
+#include <CpuSpmv.hpp>
+#include <IO.hpp>
+#include <Parallel.hpp>
+#include <SparseMatrix.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::cpu;
+
+namespace {
+
+bool hasFormat(const std::vector<FormatChoice>& choices, Format f) {
+  return std::any_of(choices.begin(), choices.end(), [f](const FormatChoice& c) { return c.format == f; });
+}
+
+}
+
+TEST(FormatTuner, MatrixFeatures) {
+  CsrMatrix a{DokMatrix{5, {
+      1, 0, 0, 0, 0,
+      2, 3, 4, 0, 0,
+      0, 0, 0, 0, 0,
+      5, 6, 0, 0, 0,
+      0, 0, 0, 0, 7}}};
+  MatrixFeatures f = matrixFeatures(a);
+  EXPECT_EQ(f.nnzs, 7);
+  EXPECT_DOUBLE_EQ(f.meanRowLength, 1.4);
+  // lengths 1, 3, 0, 2, 1
+  EXPECT_NEAR(f.rowLengthVariance, 15.0 / 5 - 1.4 * 1.4, 1E-12);
+  EXPECT_EQ(f.maxRowLength, 3);
+  EXPECT_DOUBLE_EQ(f.emptyRowFraction, 0.2);
+  EXPECT_NEAR(f.nonEmptyRowVariation, std::sqrt(15.0 / 4 - 1.75 * 1.75) / 1.75, 1E-12);
+  // entry (3, 0)
+  EXPECT_EQ(f.bandwidth, 3);
+  EXPECT_EQ(matrixFeatures(CsrView()).nnzs, 0);
+}
+
+TEST(FormatTuner, FeaturesRuleOutFormats) {
+  FormatTuner tuner;
+  MatrixFeatures small{1000, 1000, 5000, 5, 1, 6, 0.2, 0, 3};
+  std::vector<FormatChoice> c = tuner.candidates(small);
+  EXPECT_EQ(c.front().format, Format::Csr);
+  EXPECT_TRUE(hasFormat(c, Format::Sell));
+  EXPECT_FALSE(hasFormat(c, Format::BlockedCsr));
+  // the kernels run serially
+  for (const auto& choice : c)
+    EXPECT_EQ(choice.threads, 1);
+
+  // irregular rows, a wide vector and no band
+  MatrixFeatures wide{1 << 23, 1 << 23, int64_t(1) << 26, 8, 400, 2000, 2.5, 0.1, 1 << 22};
+  c = tuner.candidates(wide);
+  EXPECT_FALSE(hasFormat(c, Format::Sell));
+  EXPECT_TRUE(hasFormat(c, Format::BlockedCsr));
+  EXPECT_EQ(c.front().threads, parallel::numThreads());
+}
+
+TEST(FormatTuner, ChoosesOncePerStructure) {
+  CsrMatrix a = io::readMatrix("test/test-benchmark/psmigr_2.mtx");
+  Vector x(a.m);
+  for (int j = 0; j < a.m; j++)
+    x[j] = 1 + j % 5;
+  Vector exp = a.dot(x);
+
+  FormatTuner tuner;
+  tuner.trialMultiplications = 2;
+  FormatChoice c = tuner.choose(a);
+  EXPECT_GT(c.seconds, 0);
+  EXPECT_EQ(tuner.cachedChoices(), 1);
+
+  // the values do not change the choice
+  CsrMatrix b = a;
+  for (double& v : b.values)
+    v = -v;
+  TunedSpmv s = tuner.tune(b);
+  EXPECT_EQ(tuner.cachedChoices(), 1);
+  EXPECT_EQ(s.getChoice().format, c.format);
+  EXPECT_EQ(s.getChoice().threads, c.threads);
+
+  // every format multiplies as the CSR kernel
+  for (Format f : {Format::Csr, Format::BlockedCsr, Format::Sell}) {
+    TunedSpmv t(a, FormatChoice{f, 2, 0}, 64, 32);
+    Vector y = t.spmv(x);
+    for (int i = 0; i < a.n; i++)
+      ASSERT_NEAR(y[i], exp[i], 1E-10 * std::max(1.0, std::abs(exp[i]))) << to_string(f) << " row " << i;
+  }
+  EXPECT_THROW(s.spmv(Vector(a.m + 1)), std::invalid_argument);
+}
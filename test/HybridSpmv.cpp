@@ -0,0 +1,118 @@
+#include <HybridSpmv.hpp>
+#include <CpuSpmv.hpp>
+#include <FakeDfe.hpp>
+#include <SparseMatrix.hpp>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::spmv;
+using cask::test::FakeDfe;
+using cask::test::skewedMatrix;
+
+namespace {
+
+Vector product(const CsrMatrix& a, Vector& x) {
+  Vector y(a.n);
+  for (int j = 0; j < a.m; j++)
+    x[j] = 1 + j % 7;
+  cpu::spmv(a, x.data.data(), y.data.data());
+  return y;
+}
+
+}
+
+TEST(HybridSpmv, SplitsByEstimatedCycles) {
+  std::vector<int64_t> cycles{1, 10, 1, 8, 1, 1};
+  EXPECT_TRUE(costliestRows(cycles, 0).empty());
+  EXPECT_EQ(costliestRows(cycles, 0.3), (std::vector<int>{1}));
+  EXPECT_EQ(costliestRows(cycles, 0.5), (std::vector<int>{1, 3}));
+  EXPECT_EQ(costliestRows(cycles, 1).size(), cycles.size());
+
+  // 10 and 8 cycles exceed 22 / 4 cycles per pipe
+  EXPECT_DOUBLE_EQ(stallingFraction(cycles, 4), 18.0 / 22);
+  EXPECT_DOUBLE_EQ(stallingFraction(cycles, 1), 0);
+
+  // both parts took as long: balanced
+  EXPECT_DOUBLE_EQ(balancedCpuFraction(0.25, 1, 1), 0.25);
+  // as fast for the whole matrix: half each
+  EXPECT_DOUBLE_EQ(balancedCpuFraction(0.25, 3, 1), 0.5);
+  // a slower CPU is left fewer rows
+  EXPECT_LT(balancedCpuFraction(0.25, 1, 2), 0.25);
+}
+
+TEST(HybridSpmv, MultipliesOnDeviceAndCpu) {
+  CsrMatrix a = skewedMatrix(600, 40);
+  Vector x(a.m);
+  Vector exp = product(a, x);
+
+  FakeDfe dfe(2, 1);
+  HybridSpmv h(dfe.impl(1000));
+  h.setAutoTune(false);
+  h.setCpuFraction(0.3);
+  h.preprocess(a);
+  dfe.matrix = &h.getDeviceMatrix();
+
+  // the costliest rows go to the CPU, and are empty on the device
+  const std::vector<int>& cpuRows = h.getCpuRows();
+  ASSERT_FALSE(cpuRows.empty());
+  std::vector<int64_t> cycles = h.getDevice().estimateRowCycles(a);
+  int64_t cheapestCpuRow = cycles[cpuRows[0]], costliestDeviceRow = 0;
+  int cpuNnzs = 0;
+  for (int r = 0, next = 0; r < a.n; r++) {
+    if (next < int(cpuRows.size()) && cpuRows[next] == r) {
+      next++;
+      cheapestCpuRow = std::min(cheapestCpuRow, cycles[r]);
+      EXPECT_EQ(h.getDeviceMatrix().row_ptr[r], h.getDeviceMatrix().row_ptr[r + 1]);
+      cpuNnzs += a.row_ptr[r + 1] - a.row_ptr[r];
+    } else {
+      costliestDeviceRow = std::max(costliestDeviceRow, cycles[r]);
+    }
+  }
+  EXPECT_GE(cheapestCpuRow, costliestDeviceRow);
+  EXPECT_EQ(h.getDeviceMatrix().nnzs + cpuNnzs, a.nnzs);
+
+  EXPECT_EQ(h.spmv(x).data, exp.data);
+  Vector y(a.n);
+  h.multiply(x.data.data(), y.data.data());
+  EXPECT_EQ(y.data, exp.data);
+  EXPECT_EQ(dfe.runs, 2);
+
+  // all rows on the device
+  h.setCpuFraction(0);
+  EXPECT_TRUE(h.getCpuRows().empty());
+  EXPECT_EQ(h.spmv(x).data, exp.data);
+  EXPECT_THROW(h.spmv(Vector(a.m + 1)), std::invalid_argument);
+}
+
+TEST(HybridSpmv, TuningMovesWorkFromASlowDevice) {
+  CsrMatrix a = skewedMatrix(600, 40);
+  Vector x(a.m);
+  Vector exp = product(a, x);
+
+  FakeDfe dfe(2, 1);
+  runtime::GeneratedSpmvImplementation impl = dfe.impl(1000);
+  auto run = impl.Spmv;
+  impl.Spmv = [run](int64_t a, int64_t b, int64_t c, const int64_t* d, const int32_t* e,
+                    const int64_t* f, const int32_t* g, const int32_t* h, const int64_t* i,
+                    const int32_t* j, const int32_t* k, const int64_t* l) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    run(a, b, c, d, e, f, g, h, i, j, k, l);
+  };
+  HybridSpmv h(impl);
+  h.setAutoTune(true, 2, 0.05, 0.8);
+  h.preprocess(a);
+  dfe.matrix = &h.getDeviceMatrix();
+  EXPECT_DOUBLE_EQ(h.getCpuFraction(), 0.05);
+
+  for (int i = 0; i < 20; i++)
+    EXPECT_EQ(h.spmv(x).data, exp.data);
+  EXPECT_GT(h.getCpuFraction(), 0.5);
+  EXPECT_LE(h.getCpuFraction(), 0.8);
+  EXPECT_GT(h.getDeviceSeconds(), h.getCpuSeconds());
+  EXPECT_THROW(h.setAutoTune(true, 0), std::invalid_argument);
+}
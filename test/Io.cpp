@@ -1,6 +1,11 @@
 #include <IO.hpp>
 #include <SparseMatrix.hpp>
 #include <gtest/gtest.h>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <thread>
 
 class TestMmIo : public ::testing::Test { };
 
@@ -61,3 +66,196 @@ TEST_F(TestMmIo, ReadSymCsr) {
       1, 0, 0, 2};
   ASSERT_EQ(a.matrix.toDok().explicitSymmetric(), exp2);
 }
+
+TEST_F(TestMmIo, ReadCsrMatchesDokReader) {
+  std::vector<std::string> paths{
+      "test/systems/tinysym.mtx",
+      "test/matrices/test_some_empty_rows.mtx",
+      "test/test-benchmark/dw8192.mtx"};
+  for (auto path : paths) {
+    cask::io::MmInfo info = cask::io::readHeader(path);
+    cask::DokMatrix dok = cask::io::readDokMatrix(path, info);
+    cask::CsrMatrix exp{info.isSymmetric() ? dok.explicitSymmetric() : dok};
+    cask::CsrMatrix got = cask::io::readMatrix(path);
+    EXPECT_EQ(got.n, exp.n) << path;
+    EXPECT_EQ(got.m, exp.m) << path;
+    EXPECT_EQ(got.row_ptr, exp.row_ptr) << path;
+    EXPECT_EQ(got.col_ind, exp.col_ind) << path;
+    EXPECT_EQ(got.values, exp.values) << path;
+  }
+}
+
+TEST_F(TestMmIo, ReadCsrWithoutSymmetricExpansion) {
+  cask::CsrMatrix a = cask::io::readCsrMatrix("test/systems/tinysym.mtx", false);
+  std::vector<int> rows{0, 1, 2, 3, 5};
+  std::vector<int> cols{0, 1, 2, 0, 3};
+  EXPECT_EQ(a.nnzs, 5);
+  EXPECT_EQ(a.row_ptr, rows);
+  EXPECT_EQ(a.col_ind, cols);
+}
+
+TEST_F(TestMmIo, CsrCacheRoundTrip) {
+  std::string path = "test/matrices/test_some_empty_rows.mtx";
+  std::string cachePath = "test_some_empty_rows.bcsr";
+  cask::CsrMatrix exp = cask::io::readCsrMatrix(path);
+  cask::io::writeCsrCache(exp, false, cachePath, path);
+
+  cask::io::MappedCsrMatrix mapped{cachePath};
+  EXPECT_FALSE(mapped.isSymmetric());
+  EXPECT_TRUE(mapped.isFreshFor(path));
+  EXPECT_FALSE(mapped.isFreshFor("test/matrices/test_dense_4.mtx"));
+  const cask::CsrView& v = mapped.view();
+  EXPECT_EQ(v.n, exp.n);
+  EXPECT_EQ(v.m, exp.m);
+  EXPECT_EQ(v.nnzs, exp.nnzs);
+  // arrays are used in place, aligned for vector loads
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(v.values) % 64, 0u);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(v.col_ind) % 64, 0u);
+  EXPECT_EQ(v.toCsr(), exp);
+  std::remove(cachePath.c_str());
+}
+
+TEST_F(TestMmIo, CsrCacheOfConcurrentWriters) {
+  std::string path = "test/matrices/bfwb62.mtx";
+  std::string cachePath = "test_concurrent.bcsr";
+  cask::CsrMatrix exp = cask::io::readCsrMatrix(path);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 8; t++)
+    writers.emplace_back([&] {
+      for (int k = 0; k < 20; k++)
+        cask::io::writeCsrCache(exp, false, cachePath, path);
+    });
+  for (auto& w : writers)
+    w.join();
+  EXPECT_EQ(cask::io::MappedCsrMatrix{cachePath}.view().toCsr(), exp);
+  std::remove(cachePath.c_str());
+}
+
+TEST_F(TestMmIo, CsrCacheRejectsInvalidFile) {
+  EXPECT_THROW(cask::io::MappedCsrMatrix{"test/systems/tiny.mtx"}, std::invalid_argument);
+}
+
+namespace {
+
+void copyFile(const std::string& from, const std::string& to) {
+  std::ifstream in{from, std::ios::binary};
+  std::ofstream out{to, std::ios::binary | std::ios::trunc};
+  out << in.rdbuf();
+}
+
+}
+
+TEST_F(TestMmIo, CsrCacheRejectsInconsistentLayouts) {
+  std::string path = "test_inconsistent.mtx", cachePath = cask::io::csrCachePath(path);
+  copyFile("test/matrices/test_some_empty_rows.mtx", path);
+  cask::CsrMatrix exp = cask::io::readCsrMatrix(path);
+  cask::io::writeCsrCache(exp, false, cachePath, path);
+  std::string valid;
+  {
+    std::ifstream f{cachePath, std::ios::binary};
+    valid.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+  }
+  cask::io::CsrCacheHeader h;
+  std::memcpy(&h, valid.data(), sizeof(h));
+
+  std::vector<std::function<void(cask::io::CsrCacheHeader&, std::string&)>> corruptions{
+      // colInd overlaps rowPtr
+      [](cask::io::CsrCacheHeader& c, std::string&) { c.colIndOffset = c.rowPtrOffset; },
+      // regions out of order
+      [](cask::io::CsrCacheHeader& c, std::string&) { std::swap(c.colIndOffset, c.valuesOffset); },
+      // rowPtr past the end of the file
+      [](cask::io::CsrCacheHeader& c, std::string& file) { c.rowPtrOffset = file.size() + 64; },
+      [](cask::io::CsrCacheHeader& c, std::string&) { c.n = int64_t(1) << 40; },
+      // truncated
+      [](cask::io::CsrCacheHeader&, std::string& file) { file.resize(file.size() - 8); },
+      // row_ptr[n] != nnzs
+      [](cask::io::CsrCacheHeader& c, std::string&) { c.nnzs--; },
+  };
+  for (size_t k = 0; k < corruptions.size(); k++) {
+    cask::io::CsrCacheHeader c = h;
+    std::string file = valid;
+    corruptions[k](c, file);
+    std::memcpy(&file[0], &c, sizeof(c));
+    {
+      std::ofstream f{cachePath, std::ios::binary | std::ios::trunc};
+      f.write(file.data(), file.size());
+    }
+    EXPECT_THROW(cask::io::MappedCsrMatrix{cachePath}, std::invalid_argument) << k;
+    // the file is parsed instead, and the cache rebuilt
+    EXPECT_EQ(cask::io::readMatrix(path), exp) << k;
+    EXPECT_NO_THROW(cask::io::MappedCsrMatrix{cachePath}) << k;
+  }
+  std::remove(path.c_str());
+  std::remove(cachePath.c_str());
+}
+
+TEST_F(TestMmIo, LoadedMatrixMapsTheCache) {
+  std::string path = "test_loaded.mtx", cachePath = cask::io::csrCachePath(path);
+  copyFile("test/matrices/test_some_empty_rows.mtx", path);
+  std::remove(cachePath.c_str());
+  cask::CsrMatrix exp = cask::io::readCsrMatrix(path);
+  {
+    // parsed, and the cache written
+    cask::io::LoadedMatrix first(path);
+    EXPECT_FALSE(first.isMapped());
+    EXPECT_EQ(first.view().toCsr(), exp);
+  }
+  cask::io::LoadedMatrix second(path);
+  EXPECT_TRUE(second.isMapped());
+  EXPECT_EQ(second.view().toCsr(), exp);
+  EXPECT_EQ(cask::io::readMatrix(path), exp);
+  std::remove(path.c_str());
+  std::remove(cachePath.c_str());
+}
+
+TEST_F(TestMmIo, ReadCsrOfSortedAndUnsortedFiles) {
+  std::string header = "%%MatrixMarket matrix coordinate real general\n4 5 6\n";
+  std::vector<std::string> entries{"1 2 1.5", "1 5 2", "2 1 3", "3 3 4", "4 2 5", "4 4 6"};
+  std::string sortedPath = "test_sorted.mtx", unsortedPath = "test_unsorted.mtx";
+  std::ofstream sorted{sortedPath}, unsorted{unsortedPath};
+  sorted << header;
+  unsorted << header;
+  for (size_t k = 0; k < entries.size(); k++) {
+    sorted << entries[k] << "\n";
+    unsorted << entries[entries.size() - 1 - k] << "\n";
+  }
+  sorted.close();
+  unsorted.close();
+
+  cask::CsrMatrix exp(4, 5, 6, {1.5, 2, 3, 4, 5, 6}, {1, 4, 0, 2, 1, 3}, {0, 2, 3, 4, 6});
+  EXPECT_EQ(cask::io::readCsrMatrix(sortedPath), exp);
+  EXPECT_EQ(cask::io::readCsrMatrix(unsortedPath), exp);
+  std::remove(sortedPath.c_str());
+  std::remove(unsortedPath.c_str());
+}
+
+TEST_F(TestMmIo, ReadCsrRejectsInvalidHeadersAndIndices) {
+  std::vector<std::string> files{
+      // the mirrored entries would be out of range
+      "%%MatrixMarket matrix coordinate real symmetric\n2 6 1\n1 6 1\n",
+      "%%MatrixMarket matrix coordinate real general\n4294967298 3 1\n1 1 1\n",
+      "%%MatrixMarket matrix coordinate real general\n3 3 1\n4294967297 1 1\n",
+      "%%MatrixMarket matrix coordinate real general\n3 3 1\n1 99999999999999999999999 1\n",
+      "%%MatrixMarket matrix coordinate real general\n3 3 4294967297\n1 1 1\n"};
+  std::string path = "test_invalid.mtx";
+  for (size_t k = 0; k < files.size(); k++) {
+    std::ofstream{path} << files[k];
+    EXPECT_THROW(cask::io::readCsrMatrix(path), std::invalid_argument) << k;
+  }
+  std::remove(path.c_str());
+}
+
+TEST_F(TestMmIo, MmReaderMatchesCsr) {
+  std::string path = "test/systems/tinysym.mtx";
+  cask::io::MmReader<double> reader(path);
+  cask::sparse::SparkCooMatrix<double> coo = reader.mmreadMatrix(path);
+  cask::CsrMatrix csr = cask::io::readCsrMatrix(path);
+  ASSERT_EQ(coo.data.size(), size_t(csr.nnzs));
+  size_t k = 0;
+  for (int i = 0; i < csr.n; i++)
+    for (int p = csr.row_ptr[i]; p < csr.row_ptr[i + 1]; p++, k++) {
+      EXPECT_EQ(std::get<0>(coo.data[k]), i);
+      EXPECT_EQ(std::get<1>(coo.data[k]), csr.col_ind[p]);
+      EXPECT_EQ(std::get<2>(coo.data[k]), csr.values[p]);
+    }
+}
@@ -5,6 +5,8 @@
 #include <SparseMatrix.hpp>
 #include <Utils.hpp>
 #include <gtest/gtest.h>
+#include <cmath>
+#include <string>
 
 class TestLinearSolvers : public ::testing::Test { };
 
@@ -76,6 +78,26 @@ TEST_F(TestLinearSolvers, CGSymWithILUPC) {
    }
 }
 
+TEST_F(TestLinearSolvers, CGWithReusedWorkspace) {
+   Vector rhs = io::readVector("test/systems/tinysym_b.mtx");
+   SymCsrMatrix a = io::readSymMatrix("test/systems/tinysym.mtx");
+   int iterations = 0;
+   Vector exp(a.n);
+   pcg<double, ILUPreconditioner>(a.matrix, &rhs[0], &exp[0], iterations);
+
+   ILUPreconditioner precon{a.matrix};
+   CgWorkspace w;
+   Vector first(a.n), second(a.n);
+   pcg<double, ILUPreconditioner>(a.matrix, precon, w, &rhs[0], &first[0], iterations);
+   int64_t allocations = w.allocations();
+   EXPECT_GT(allocations, 0);
+   pcg<double, ILUPreconditioner>(a.matrix, precon, w, &rhs[0], &second[0], iterations);
+   EXPECT_EQ(w.allocations(), allocations);
+
+   ASSERT_EQ(first, exp);
+   ASSERT_EQ(second, exp);
+}
+
 TEST_F(TestLinearSolvers, ILUCompute2) {
    CsrMatrix a{
        2, 1, 1, 1,
@@ -95,7 +117,7 @@ TEST_F(TestLinearSolvers, ILUCompute2) {
 
    ASSERT_EQ(ilupc.pc.n, exp.n);
    ASSERT_EQ(ilupc.pc.nnzs, exp.nnzs);
-   ASSERT_EQ(ilupc.pc, exp);
+   ASSERT_EQ(ilupc.pc.toDok(), exp);
 }
 
 TEST_F(TestLinearSolvers, ILUCompute) {
@@ -144,3 +166,324 @@ TEST_F(TestLinearSolvers, ILUComputeAndApply) {
       ASSERT_DOUBLE_EQ(res[i], expPcApply[i]);
    }
 }
+
+// the original ILU(0) formulation, on a DokMatrix
+DokMatrix referenceIlu0(const CsrMatrix& a) {
+   DokMatrix pc = a.toDok();
+   for (int i = 1; i < a.n; i++) {
+      for (auto& p : pc.dok[i]) {
+         int k = p.first;
+         if (k >= i)
+            break;
+         if (!pc.isNnz(k, k))
+            continue;
+         p.second = p.second / pc.dok[k][k];
+         double beta = p.second;
+         for (auto& q : pc.dok[i])
+            if (q.first > k && pc.isNnz(k, q.first))
+               q.second = q.second - pc.dok[k][q.first] * beta;
+      }
+   }
+   return pc;
+}
+
+// row i is coupled to row i / 2, so levels grow geometrically and the
+// larger ones are processed in parallel
+CsrMatrix binaryTreeMatrix(int n) {
+   DokMatrix d(n, n);
+   for (int i = 0; i < n; i++) {
+      d.set(i, i, 4 + i % 3);
+      if (i > 0) {
+         d.set(i, i / 2, -1.0 / (1 + i % 5));
+         d.set(i / 2, i, -1.0 / (1 + i % 5));
+      }
+   }
+   return CsrMatrix{d};
+}
+
+TEST_F(TestLinearSolvers, ILUMatchesDokFactorisation) {
+   int n = 20000;
+   CsrMatrix a = binaryTreeMatrix(n);
+   std::vector<CsrMatrix> systems{a, a.getLowerTriangular(),
+                                  io::readMatrix("test/matrices/bfwb62.mtx")};
+   for (auto& m : systems) {
+      ILUPreconditioner ilupc{m};
+      ASSERT_EQ(ilupc.pc.toDok(), referenceIlu0(m));
+   }
+
+   cpu::LevelSchedule s = cpu::LevelSchedule::lower(a.view());
+   ASSERT_EQ(s.numLevels(), 16);
+   ASSERT_EQ(s.levelPtr[2] - s.levelPtr[1], 1);
+   ASSERT_EQ(s.levelPtr[16] - s.levelPtr[15], n - (1 << 14));
+}
+
+TEST_F(TestLinearSolvers, ILUApplyMatchesSubstitution) {
+   CsrMatrix a = binaryTreeMatrix(20000);
+   ILUPreconditioner ilupc{a};
+   DokMatrix f = ilupc.pc.toDok();
+
+   std::vector<double> r(a.n);
+   for (int i = 0; i < a.n; i++)
+      r[i] = 1 + i % 7;
+
+   // forward and backward substitution, in the same order of operations
+   std::vector<double> exp(r);
+   for (int i = 0; i < a.n; i++) {
+      for (auto& p : f.dok[i])
+         if (p.first < i)
+            exp[i] -= p.second * exp[p.first];
+      exp[i] /= f.dok[i][i];
+   }
+   for (int i = a.n - 1; i >= 0; i--) {
+      for (auto& p : f.dok[i])
+         if (p.first > i)
+            exp[i] -= p.second * exp[p.first];
+      exp[i] /= f.dok[i][i];
+   }
+
+   ASSERT_EQ(ilupc.apply(r), exp);
+   ilupc.apply(r.data(), r.data());
+   ASSERT_EQ(r, exp);
+
+   cpu::LevelSchedule s = cpu::LevelSchedule::upper(a.view());
+   ASSERT_EQ(s.numLevels(), 16);
+   ASSERT_EQ(s.rows.back(), 0);
+}
+
+// the lower triangle of the 5 point Laplacian on a k x k grid
+CsrMatrix laplacian2d(int k) {
+   DokMatrix d(k * k, k * k);
+   for (int i = 0; i < k * k; i++) {
+      d.set(i, i, 4);
+      if (i % k > 0)
+         d.set(i, i - 1, -1);
+      if (i >= k)
+         d.set(i, i - k, -1);
+   }
+   return CsrMatrix{d};
+}
+
+template<typename Precon>
+void checkCgVariants(const CsrMatrix& a) {
+   std::vector<double> exp(a.n), rhs(a.n);
+   for (int i = 0; i < a.n; i++)
+      exp[i] = 1 + i % 3;
+   cpu::symSpmv(a.view(), exp.data(), rhs.data());
+
+   auto check = [&](const std::string& name, int iterations, const std::vector<double>& x) {
+      double err = 0;
+      for (int i = 0; i < a.n; i++)
+         err = std::max(err, std::abs(x[i] - exp[i]));
+      std::cout << name << " iterations = " << iterations << " error = " << err << std::endl;
+      EXPECT_LT(err, 1e-3) << name;
+   };
+
+   int itPcg = 0;
+   std::vector<double> x(a.n, 0.0);
+   ASSERT_TRUE((pcg<double, Precon>(a, rhs.data(), x.data(), itPcg)));
+   check("pcg", itPcg, x);
+
+   int it = 0;
+   std::fill(x.begin(), x.end(), 0.0);
+   ASSERT_TRUE((pipelinedPcg<double, Precon>(a, rhs.data(), x.data(), it)));
+   check("pipelined", it, x);
+   EXPECT_LE(std::abs(it - itPcg), 1);
+
+   for (int s = 1; s <= 4; s++) {
+      it = 0;
+      std::fill(x.begin(), x.end(), 0.0);
+      ASSERT_TRUE((sStepPcg<double, Precon>(a, rhs.data(), x.data(), it, s)));
+      check("s-step " + std::to_string(s), it, x);
+      EXPECT_LE(std::abs(it - itPcg), 2);
+   }
+}
+
+TEST_F(TestLinearSolvers, PipelinedAndSStepCG) {
+   std::vector<CsrMatrix> systems{io::readSymMatrix("test/systems/tinysym.mtx").matrix, laplacian2d(70)};
+   for (auto& a : systems) {
+      checkCgVariants<IdentityPreconditioner>(a);
+      checkCgVariants<JacobiPreconditioner>(a);
+      checkCgVariants<BlockJacobiPreconditioner>(a);
+      checkCgVariants<ChebyshevPreconditioner<>>(a);
+   }
+}
+
+TEST_F(TestLinearSolvers, CGStoppingCriteriaAndMonitor) {
+   CsrMatrix a = laplacian2d(30);
+   std::vector<double> rhs(a.n, 1.0), x(a.n, 0.0);
+   IdentityPreconditioner precon{a};
+   CgWorkspace w;
+
+   CgOptions o;
+   o.tol = 0;
+   o.relTol = 1E-3;
+   std::vector<double> residuals;
+   o.monitor = [&](int, double r) {
+      residuals.push_back(r);
+      return true;
+   };
+   int iterations = 0;
+   ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), iterations, o)));
+   ASSERT_EQ(int(residuals.size()), iterations + 2);
+   // relative to the initial residual, sqrt(n) for x = 0
+   EXPECT_LE(residuals.back(), 1E-3 * std::sqrt(a.n));
+   EXPECT_GT(residuals[residuals.size() - 2], 1E-3 * std::sqrt(a.n));
+
+   // the monitor stops the solve
+   o.relTol = 0;
+   o.tol = 1E-10;
+   o.warmStart = false;
+   int calls = 0;
+   o.monitor = [&](int, double) { return ++calls < 3; };
+   EXPECT_FALSE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), iterations, o)));
+   EXPECT_EQ(calls, 3);
+}
+
+TEST_F(TestLinearSolvers, CGWarmStart) {
+   CsrMatrix a = laplacian2d(30);
+   std::vector<double> rhs(a.n, 1.0), x(a.n, 0.0);
+   IdentityPreconditioner precon{a};
+   CgWorkspace w;
+   CgOptions o;
+   int cold = 0, warm = -1;
+   ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), cold, o)));
+   EXPECT_GT(cold, 10);
+
+   // from the solution of a nearby system
+   rhs[0] += 1E-3;
+   ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), warm, o)));
+   EXPECT_LT(warm, cold / 2);
+
+   // a converged guess takes no iteration
+   ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), warm, o)));
+   EXPECT_EQ(warm, 0);
+
+   // the guess is ignored without warm start
+   std::vector<double> exp = x;
+   o.warmStart = false;
+   std::fill(x.begin(), x.end(), 1E6);
+   int it = 0;
+   ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), it, o)));
+   EXPECT_GT(it, 10);
+   for (int i = 0; i < a.n; i++)
+      ASSERT_NEAR(x[i], exp[i], 1E-4);
+}
+
+TEST_F(TestLinearSolvers, CGProjectsOnPreviousSolutions) {
+   CsrMatrix a = laplacian2d(30);
+   std::vector<double> b0(a.n), b1(a.n), rhs(a.n);
+   for (int i = 0; i < a.n; i++) {
+      b0[i] = 1;
+      b1[i] = i % 7;
+   }
+   IdentityPreconditioner precon{a};
+   CgWorkspace w;
+   SolutionProjection projection(a.n, 4);
+   CgOptions plain, projected;
+   projected.projection = &projection;
+
+   // time steps whose right hand sides span two vectors
+   std::vector<int> its;
+   for (int t = 0; t < 6; t++) {
+      for (int i = 0; i < a.n; i++)
+         rhs[i] = b0[i] + 0.1 * t * b1[i];
+      std::vector<double> exp(a.n, 0.0), x(a.n, 0.0);
+      int itPlain = 0, it = 0;
+      ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), exp.data(), itPlain, plain)));
+      ASSERT_TRUE((pcg<double, IdentityPreconditioner>(a, precon, w, rhs.data(), x.data(), it, projected)));
+      for (int i = 0; i < a.n; i++)
+         ASSERT_NEAR(x[i], exp[i], 1E-4) << "step " << t;
+      its.push_back(it);
+   }
+   EXPECT_GT(its[0], 10);
+   // later steps are in the span of the first two solutions, up to the
+   // error of their solves, which is not kept
+   for (int t = 2; t < 6; t++)
+      EXPECT_LT(its[t], its[0] / 4) << "step " << t;
+   EXPECT_EQ(projection.size(), 2);
+}
+
+// the lower triangle of an SPD matrix whose diagonal varies across rows
+CsrMatrix scaledLaplacian2d(int k) {
+   CsrMatrix a = laplacian2d(k);
+   std::vector<double> s(a.n);
+   for (int i = 0; i < a.n; i++)
+      s[i] = 1 + 9 * (i % 5 == 0);
+   // S A S
+   for (int i = 0; i < a.n; i++)
+      for (int p = a.row_ptr[i]; p < a.row_ptr[i + 1]; p++)
+         a.values[p] *= s[i] * s[a.col_ind[p]];
+   return a;
+}
+
+template<typename Precon>
+int pcgIterations(const CsrMatrix& a, Precon& precon, const std::string& name) {
+   std::vector<double> exp(a.n), rhs(a.n), x(a.n, 0.0);
+   for (int i = 0; i < a.n; i++)
+      exp[i] = 1 + i % 3;
+   cpu::symSpmv(a.view(), exp.data(), rhs.data());
+   CgWorkspace w;
+   CgOptions o;
+   o.tol = 1E-8;
+   int iterations = 0;
+   EXPECT_TRUE((pcg<double, Precon>(a, precon, w, rhs.data(), x.data(), iterations, o))) << name;
+   for (int i = 0; i < a.n; i++)
+      EXPECT_NEAR(x[i], exp[i], 1E-5) << name << " row " << i;
+   std::cout << name << " iterations = " << iterations << std::endl;
+   return iterations;
+}
+
+TEST_F(TestLinearSolvers, ParallelPreconditioners) {
+   CsrMatrix a = scaledLaplacian2d(40);
+   IdentityPreconditioner identity{a};
+   JacobiPreconditioner jacobi{a};
+   BlockJacobiPreconditioner blocks{a, {0, 400, 800, 1200, 1600}};
+   ChebyshevPreconditioner<> chebyshev{a, 4};
+   NeumannPreconditioner<> neumann{a, 3};
+   EXPECT_EQ(blocks.numBlocks(), 4);
+   // the Gershgorin bound of the Laplacian
+   EXPECT_DOUBLE_EQ(ChebyshevPreconditioner<>{laplacian2d(10)}.maxEigenvalue(), 2);
+
+   int none = pcgIterations(a, identity, "identity");
+   int itJacobi = pcgIterations(a, jacobi, "jacobi");
+   EXPECT_LT(itJacobi, none);
+   EXPECT_LT(pcgIterations(a, blocks, "block jacobi"), itJacobi);
+   EXPECT_LT(pcgIterations(a, chebyshev, "chebyshev"), itJacobi / 2);
+   EXPECT_LT(pcgIterations(a, neumann, "neumann"), itJacobi);
+
+   // one block is an exact solve
+   BlockJacobiPreconditioner one{a, {0, a.n}};
+   EXPECT_LE(pcgIterations(a, one, "one block"), 1);
+
+   // the splits of Spmv partitions may repeat, and count padding rows
+   BlockJacobiPreconditioner splits{a, {0, 0, 1000, a.n + 100}};
+   EXPECT_EQ(splits.numBlocks(), 2);
+   EXPECT_THROW((BlockJacobiPreconditioner{a, {0, 1000}}), std::invalid_argument);
+   EXPECT_THROW((BlockJacobiPreconditioner{a, {10, a.n}}), std::invalid_argument);
+   EXPECT_THROW((ChebyshevPreconditioner<>{a, 0}), std::invalid_argument);
+}
+
+TEST_F(TestLinearSolvers, PolynomialPreconditionersAreSymmetric) {
+   CsrMatrix a = scaledLaplacian2d(10);
+   ChebyshevPreconditioner<> chebyshev{a, 5};
+   NeumannPreconditioner<> neumann{a, 4};
+   std::vector<double> u(a.n), v(a.n), mu(a.n), mv(a.n);
+   for (int i = 0; i < a.n; i++) {
+      u[i] = std::sin(i);
+      v[i] = std::cos(3 * i);
+   }
+   auto dot = [](const std::vector<double>& x, const std::vector<double>& y) {
+      double s = 0;
+      for (size_t i = 0; i < x.size(); i++)
+         s += x[i] * y[i];
+      return s;
+   };
+   chebyshev.apply(u.data(), mu.data());
+   chebyshev.apply(v.data(), mv.data());
+   EXPECT_NEAR(dot(mu, v), dot(u, mv), 1E-10 * std::abs(dot(mu, v)));
+   EXPECT_GT(dot(mu, u), 0);
+   neumann.apply(u.data(), mu.data());
+   neumann.apply(v.data(), mv.data());
+   EXPECT_NEAR(dot(mu, v), dot(u, mv), 1E-10 * std::abs(dot(mu, v)));
+   EXPECT_GT(dot(mu, u), 0);
+}
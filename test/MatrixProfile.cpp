@@ -0,0 +1,167 @@
+#include <MatrixProfile.hpp>
+#include <BlockingCache.hpp>
+#include <IO.hpp>
+#include <Parallel.hpp>
+#include <SparseMatrix.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::spmv;
+
+namespace {
+
+// the profile by definition, row by row
+MatrixProfile expectedProfile(const CsrView& a, int blockSize) {
+  MatrixProfile p;
+  p.n = a.n;
+  p.m = a.m;
+  p.nnzs = a.nnzs;
+  p.blockSize = blockSize;
+  int nBlocks = blockSize > 0 ? (a.m + blockSize - 1) / blockSize : 0;
+  p.blockNnzs.assign(nBlocks, 0);
+  p.blockRows.assign(nBlocks, 0);
+  int run = 0;
+  for (int i = 0; i < a.n; i++) {
+    int length = a.row_ptr[i + 1] - a.row_ptr[i];
+    int bin = 0;
+    while (length >> bin)
+      bin++;
+    if (int(p.rowLengthHistogram.size()) <= bin)
+      p.rowLengthHistogram.resize(bin + 1, 0);
+    p.rowLengthHistogram[bin]++;
+    p.maxRowLength = std::max(p.maxRowLength, length);
+    p.rowLengthSquares += double(length) * length;
+    if (length == 0) {
+      p.emptyRows++;
+      run++;
+      continue;
+    }
+    if (run > 0) {
+      p.emptyRowRuns++;
+      p.longestEmptyRun = std::max(p.longestEmptyRun, run);
+    }
+    run = 0;
+    std::vector<bool> inBlock(nBlocks, false);
+    for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++) {
+      int j = a.col_ind[k];
+      p.lowerBandwidth = std::max(p.lowerBandwidth, i - j);
+      p.upperBandwidth = std::max(p.upperBandwidth, j - i);
+      if (nBlocks > 0) {
+        p.blockNnzs[j / blockSize]++;
+        inBlock[j / blockSize] = true;
+      }
+    }
+    for (int b = 0; b < nBlocks; b++)
+      p.blockRows[b] += inBlock[b];
+  }
+  if (run > 0) {
+    p.emptyRowRuns++;
+    p.longestEmptyRun = std::max(p.longestEmptyRun, run);
+  }
+  return p;
+}
+
+void expectProfile(const MatrixProfile& got, const MatrixProfile& exp, const std::string& what) {
+  EXPECT_EQ(got.n, exp.n) << what;
+  EXPECT_EQ(got.m, exp.m) << what;
+  EXPECT_EQ(got.nnzs, exp.nnzs) << what;
+  EXPECT_EQ(got.rowLengthHistogram, exp.rowLengthHistogram) << what;
+  EXPECT_EQ(got.maxRowLength, exp.maxRowLength) << what;
+  EXPECT_DOUBLE_EQ(got.rowLengthSquares, exp.rowLengthSquares) << what;
+  EXPECT_EQ(got.lowerBandwidth, exp.lowerBandwidth) << what;
+  EXPECT_EQ(got.upperBandwidth, exp.upperBandwidth) << what;
+  EXPECT_EQ(got.emptyRows, exp.emptyRows) << what;
+  EXPECT_EQ(got.emptyRowRuns, exp.emptyRowRuns) << what;
+  EXPECT_EQ(got.longestEmptyRun, exp.longestEmptyRun) << what;
+  EXPECT_EQ(got.blockNnzs, exp.blockNnzs) << what;
+  EXPECT_EQ(got.blockRows, exp.blockRows) << what;
+}
+
+// rows spanning several chunks of the hashes, with runs of empty rows
+// across their boundaries and a chunk of empty rows only
+CsrMatrix largeMatrix() {
+  CsrMatrix a;
+  a.n = 80000;
+  a.m = 70000;
+  a.row_ptr.push_back(0);
+  for (int i = 0; i < a.n; i++) {
+    bool empty = i % 11 == 3 || (i >= 16370 && i < 16400) || (i >= 32000 && i < 50000) || i >= 79990;
+    if (!empty) {
+      std::vector<int> cols{i % a.m, (i * 7) % a.m, std::max(0, i - 5000) % a.m};
+      std::sort(cols.begin(), cols.end());
+      cols.erase(std::unique(cols.begin(), cols.end()), cols.end());
+      for (int j : cols) {
+        a.col_ind.push_back(j);
+        a.values.push_back(1 + j % 3);
+      }
+    }
+    a.row_ptr.push_back(a.col_ind.size());
+  }
+  a.nnzs = a.col_ind.size();
+  return a;
+}
+
+}
+
+TEST(MatrixProfile, MatchesTheRowByRowDefinition) {
+  std::vector<CsrMatrix> matrices{io::readMatrix("test/matrices/bfwb62.mtx"),
+                                  io::readMatrix("test/matrices/test_large_empty.mtx"),
+                                  io::readMatrix("test/matrices/OPF_3754.mtx"),
+                                  largeMatrix()};
+  for (size_t k = 0; k < matrices.size(); k++)
+    for (int blockSize : {0, 64, 1024}) {
+      std::string what = "matrix " + std::to_string(k) + " block size " + std::to_string(blockSize);
+      expectProfile(MatrixProfile(matrices[k], blockSize), expectedProfile(matrices[k], blockSize), what);
+    }
+
+  CsrMatrix a = largeMatrix();
+  MatrixProfile p(a, 1024);
+  EXPECT_EQ(p.longestEmptyRun, 18000);
+  EXPECT_EQ(p.occupiedBlocks(), int(p.blockNnzs.size()));
+  EXPECT_DOUBLE_EQ(p.meanRowLength(), double(a.nnzs) / a.n);
+}
+
+TEST(MatrixProfile, HashesDoNotDependOnTheThreads) {
+  CsrMatrix a = largeMatrix();
+  MatrixProfile all(a);
+  for (int threads : {1, 2, 3}) {
+    cask::parallel::ThreadLimit limit(threads);
+    MatrixProfile p(a);
+    EXPECT_EQ(p.structureHash, all.structureHash) << threads << " threads";
+    EXPECT_EQ(p.contentHash, all.contentHash) << threads << " threads";
+    expectProfile(p, all, std::to_string(threads) + " threads");
+  }
+  EXPECT_EQ(structureHash(a), all.structureHash);
+}
+
+TEST(MatrixProfile, HashesTellMatricesApart) {
+  CsrMatrix a = io::readMatrix("test/matrices/OPF_3754.mtx");
+  MatrixProfile p(a);
+
+  // the values change the content only
+  CsrMatrix scaled = a;
+  scaled.values[10] *= 2;
+  MatrixProfile q(scaled);
+  EXPECT_EQ(q.structureHash, p.structureHash);
+  EXPECT_NE(q.contentHash, p.contentHash);
+
+  // the order of the entries of a row, or the rows taken
+  CsrMatrix moved = a.sliceRows(0, 100);
+  CsrMatrix base = moved;
+  std::swap(moved.col_ind[moved.row_ptr[1]], moved.col_ind[moved.row_ptr[1] + 1]);
+  EXPECT_NE(MatrixProfile(moved).structureHash, MatrixProfile(base).structureHash);
+  EXPECT_NE(MatrixProfile(a.sliceRows(0, 100)).structureHash, MatrixProfile(a.sliceRows(1, 100)).structureHash);
+
+  // a view of rows hashes as their copy
+  CsrView rows = CsrView(a).sliceRows(1000, 5000);
+  CsrMatrix copy = rows.toCsr();
+  EXPECT_EQ(MatrixProfile(rows).structureHash, MatrixProfile(copy).structureHash);
+  EXPECT_EQ(MatrixProfile(rows).contentHash, MatrixProfile(copy).contentHash);
+
+  // the analysis cache of a matrix is named by its profile
+  EXPECT_EQ(analysisCachePath("dir", a), analysisCachePath("dir", p.structureHash));
+  EXPECT_EQ(BlockingCache(a, p).matrixHash(), BlockingCache(a).matrixHash());
+}
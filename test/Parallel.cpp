@@ -0,0 +1,70 @@
+#include <Parallel.hpp>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask::parallel;
+
+TEST(Parallel, RunsEveryTaskOnce) {
+  std::vector<std::atomic<int>> counts(1000);
+  ThreadPool::global().run(counts.size(), [&](int i) { counts[i]++; });
+  for (auto& c : counts)
+    ASSERT_EQ(c, 1);
+}
+
+TEST(Parallel, NestedJobsComplete) {
+  const int outer = 16, inner = 64;
+  std::vector<std::atomic<int>> counts(outer * inner);
+  ThreadPool::global().run(outer, [&](int i) {
+    ThreadPool::global().run(inner, [&](int j) {
+      // a third level, which idle threads may steal as well
+      parallelFor(0, 4, [&](int64_t) {});
+      counts[i * inner + j]++;
+    });
+  });
+  for (auto& c : counts)
+    ASSERT_EQ(c, 1);
+}
+
+TEST(Parallel, ConcurrentSubmitters) {
+  std::atomic<int64_t> sum{0};
+  std::vector<std::thread> submitters;
+  for (int t = 0; t < 4; t++)
+    submitters.emplace_back([&] {
+      for (int r = 0; r < 50; r++)
+        parallelFor(0, 100, [&](int64_t i) { sum += i; });
+    });
+  for (auto& t : submitters)
+    t.join();
+  EXPECT_EQ(sum, 4 * 50 * 4950);
+}
+
+TEST(Parallel, RethrowsTaskExceptions) {
+  EXPECT_THROW(
+      ThreadPool::global().run(32, [](int i) {
+        if (i == 7)
+          throw std::runtime_error("task failed");
+      }),
+      std::runtime_error);
+  // the pool is still usable
+  std::atomic<int> n{0};
+  ThreadPool::global().run(8, [&](int) { n++; });
+  EXPECT_EQ(n, 8);
+}
+
+TEST(Parallel, ThreadLimitCapsChunks) {
+  int all = numThreads();
+  {
+    ThreadLimit one(1);
+    EXPECT_EQ(numThreads(), 1);
+    EXPECT_EQ(parallelForChunks(0, 1000, [](int, int64_t, int64_t) {}), 1);
+    {
+      ThreadLimit more(all + 1);
+      EXPECT_EQ(numThreads(), all);
+    }
+    EXPECT_EQ(numThreads(), 1);
+  }
+  EXPECT_EQ(numThreads(), all);
+}
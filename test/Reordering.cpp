@@ -0,0 +1,130 @@
+#include <Reordering.hpp>
+#include <CpuSpmv.hpp>
+#include <SparseMatrix.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::reordering;
+
+namespace {
+
+// a symmetric matrix of the given bandwidth, with its rows and columns
+// shuffled by the same random permutation
+CsrMatrix shuffledBanded(int n, int bandwidth, unsigned seed) {
+  std::vector<int> shuffle(n);
+  for (int i = 0; i < n; i++)
+    shuffle[i] = i;
+  std::mt19937 rng(seed);
+  std::shuffle(shuffle.begin(), shuffle.end(), rng);
+  DokMatrix a(n, n);
+  for (int i = 0; i < n; i++)
+    for (int j = std::max(0, i - bandwidth); j <= std::min(n - 1, i + bandwidth); j++)
+      a.set(shuffle[i], shuffle[j], 1 + (i + 2 * j) % 5);
+  return CsrMatrix(a);
+}
+
+int bandwidth(const CsrMatrix& a) {
+  int b = 0;
+  for (int i = 0; i < a.n; i++)
+    for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++)
+      b = std::max(b, std::abs(a.col_ind[k] - i));
+  return b;
+}
+
+// the number of (row, column block) pairs with at least one entry
+int blocksTouched(const CsrMatrix& a, int blockSize) {
+  int blocks = 0;
+  for (int i = 0; i < a.n; i++) {
+    std::set<int> b;
+    for (int k = a.row_ptr[i]; k < a.row_ptr[i + 1]; k++)
+      b.insert(a.col_ind[k] / blockSize);
+    blocks += b.size();
+  }
+  return blocks;
+}
+
+bool isPermutation(std::vector<int> p, int n) {
+  std::sort(p.begin(), p.end());
+  for (int i = 0; i < n; i++)
+    if (p[i] != i)
+      return false;
+  return int(p.size()) == n;
+}
+
+}
+
+TEST(Reordering, RcmRecoversBandwidth) {
+  CsrMatrix a = shuffledBanded(300, 3, 7);
+  ASSERT_GT(bandwidth(a), 100);
+  Permutation p = reorder(a, Method::Rcm);
+  ASSERT_TRUE(isPermutation(p.rows, a.n));
+  EXPECT_EQ(p.rows, p.cols);
+  EXPECT_LE(bandwidth(permute(a, p)), 6);
+}
+
+TEST(Reordering, RcmHandlesComponentsAndIsolatedVertices) {
+  // two blocks, plus rows without off diagonal entries (or without entries)
+  DokMatrix d(7, 7);
+  d.set(0, 4, 1);
+  d.set(4, 0, 1);
+  d.set(4, 6, 1);
+  d.set(1, 1, 2);
+  d.set(2, 5, 3);
+  CsrMatrix a(d);
+  std::vector<int> rcm = reverseCuthillMcKee(a);
+  EXPECT_TRUE(isPermutation(rcm, a.n));
+  EXPECT_THROW(reverseCuthillMcKee(CsrMatrix(2, 3, 1, {1}, {2}, {0, 1, 1})), std::invalid_argument);
+}
+
+TEST(Reordering, PermutedMatrixComputesTheSameProduct) {
+  CsrMatrix a = shuffledBanded(120, 2, 3);
+  for (Method m : {Method::None, Method::Rcm, Method::CacheBlocks, Method::RcmCacheBlocks}) {
+    Permutation p = reorder(a, m);
+    CsrMatrix b = permute(a, p);
+    ASSERT_EQ(b.nnzs, a.nnzs);
+    for (int i = 0; i < b.n; i++)
+      ASSERT_TRUE(std::is_sorted(b.col_ind.begin() + b.row_ptr[i], b.col_ind.begin() + b.row_ptr[i + 1]));
+
+    std::vector<double> x(a.m), xp(a.m), exp(a.n), y(a.n), yp(a.n);
+    for (int j = 0; j < a.m; j++)
+      x[j] = 1 + j % 7;
+    for (int j = 0; j < a.m; j++)
+      xp[j] = x[p.cols[j]];
+    cpu::spmv(a.view(), x.data(), exp.data());
+    cpu::spmv(b.view(), xp.data(), yp.data());
+    for (int i = 0; i < a.n; i++)
+      y[p.rows[i]] = yp[i];
+    EXPECT_EQ(y, exp) << to_string(m);
+  }
+}
+
+TEST(Reordering, FirstTouchColumnsReduceBlocksTouched) {
+  // each row reads two columns which are far apart, but shared with the
+  // neighbouring rows
+  int n = 256, blockSize = 16;
+  DokMatrix d(n, 2 * n);
+  for (int i = 0; i < n; i++) {
+    d.set(i, 2 * ((i / 2) * 7 % n), 1);
+    d.set(i, 2 * ((i / 2) * 13 % n) + 1, 1);
+  }
+  CsrMatrix a(d);
+  Permutation p = reorder(a, Method::CacheBlocks);
+  ASSERT_TRUE(isPermutation(p.cols, a.m));
+  ASSERT_TRUE(isPermutation(p.rows, a.n));
+  // the two columns of each row are now in the same block
+  EXPECT_GT(blocksTouched(a, blockSize), 3 * n / 2);
+  EXPECT_EQ(blocksTouched(permute(a, p), blockSize), n);
+  EXPECT_THROW(reorder(a, Method::Rcm), std::invalid_argument);
+}
+
+TEST(Reordering, MethodNames) {
+  for (Method m : {Method::None, Method::Rcm, Method::CacheBlocks, Method::RcmCacheBlocks})
+    EXPECT_EQ(parseMethod(to_string(m)), m);
+  EXPECT_THROW(parseMethod("amd"), std::invalid_argument);
+}
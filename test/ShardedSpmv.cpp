@@ -0,0 +1,99 @@
+#include <ShardedSpmv.hpp>
+#include <CpuSpmv.hpp>
+#include <FakeDfe.hpp>
+#include <IO.hpp>
+#include <SparseMatrix.hpp>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::spmv;
+using cask::test::FakeDfe;
+using cask::test::skewedMatrix;
+
+TEST(ShardedSpmv, ShardsAreBalancedByNonzeros) {
+  CsrMatrix a = skewedMatrix(1000, 20);
+  std::vector<int> splits = shardRowSplits(a, 4);
+  ASSERT_EQ(splits.size(), 5u);
+  EXPECT_EQ(splits.front(), 0);
+  EXPECT_EQ(splits.back(), a.n);
+  // the dense rows are spread over fewer rows per shard
+  EXPECT_LT(splits[1] - splits[0], a.n / 4);
+  int64_t total = a.nnzs + a.n, largest = 0;
+  for (int s = 0; s < 4; s++) {
+    int64_t work = a.row_ptr[splits[s + 1]] - a.row_ptr[splits[s]] + splits[s + 1] - splits[s];
+    largest = std::max(largest, work);
+  }
+  EXPECT_LT(largest, total / 4 + 50);
+
+  // fewer rows than shards leave the last shards empty
+  CsrMatrix small = skewedMatrix(2, 20);
+  EXPECT_EQ(shardRowSplits(small, 4), (std::vector<int>{0, 1, 2, 2, 2}));
+}
+
+TEST(ShardedSpmv, MultipliesOnAllDevices) {
+  CsrMatrix a = skewedMatrix(600, 20);
+  Vector x(a.m), exp(a.n);
+  for (int j = 0; j < a.m; j++)
+    x[j] = 1 + j % 7;
+  cpu::spmv(a.view(), x.data.data(), exp.data.data());
+
+  std::vector<std::unique_ptr<FakeDfe>> devices;
+  std::vector<CsrMatrix> shards(3);
+  std::vector<runtime::GeneratedSpmvImplementation> impls;
+  for (int d = 0; d < 3; d++) {
+    devices.emplace_back(new FakeDfe(2, 1));
+    impls.push_back(devices.back()->impl(400));
+  }
+  ShardedSpmv s(impls);
+  s.preprocess(a);
+  const std::vector<int>& splits = s.getRowSplits();
+  ASSERT_EQ(splits.size(), 4u);
+  for (int d = 0; d < 3; d++) {
+    shards[d] = a.view().sliceRows(splits[d], splits[d + 1] - splits[d]).toCsr();
+    devices[d]->matrix = &shards[d];
+  }
+
+  EXPECT_EQ(s.spmv(x).data, exp.data);
+  Vector y(a.n);
+  s.multiply(x.data.data(), y.data.data());
+  EXPECT_EQ(y.data, exp.data);
+  for (const auto& d : devices)
+    EXPECT_EQ(d->runs, 2);
+
+  // a shard larger than its implementation is multiplied in row passes
+  FakeDfe one(2, 1);
+  ShardedSpmv tooSmall(std::vector<runtime::GeneratedSpmvImplementation>{one.impl(200)});
+  tooSmall.preprocess(a);
+  EXPECT_EQ(tooSmall.shard(0).numRowPasses(), 3);
+}
+
+TEST(ShardedSpmv, EstimatesOfTheSlowestShard) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  std::vector<std::unique_ptr<Spmv>> shards;
+  for (int s = 0; s < 2; s++)
+    shards.emplace_back(new SkipEmptyRowsSpmv(16, 2, 2, a.n, 1));
+  ShardedSpmv sharded(std::move(shards));
+  sharded.analyse(a);
+
+  const std::vector<int>& splits = sharded.getRowSplits();
+  double cycles = 0, flops = 0;
+  for (int s = 0; s < 2; s++) {
+    SkipEmptyRowsSpmv shard(16, 2, 2, a.n, 1);
+    shard.analyse(a.view().sliceRows(splits[s], splits[s + 1] - splits[s]));
+    EXPECT_EQ(sharded.shard(s).getEstimatedClockCycles(), shard.getEstimatedClockCycles());
+    cycles = std::max(cycles, shard.getEstimatedClockCycles());
+    flops += shard.getGFlopsCount();
+  }
+  EXPECT_EQ(sharded.getEstimatedClockCycles(), cycles);
+  model::Max4Model max4;
+  EXPECT_DOUBLE_EQ(sharded.getEstimatedGFlops(max4), flops * max4.frequency() / cycles);
+  EXPECT_DOUBLE_EQ(flops, 2.0 * a.nnzs / 1E9);
+
+  SkipEmptyRowsSpmv single(16, 2, 2, a.n, 1);
+  single.analyse(a);
+  EXPECT_GT(sharded.getEstimatedGFlops(max4), single.getEstimatedGFlops(max4));
+}
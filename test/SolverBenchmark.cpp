@@ -0,0 +1,66 @@
+#include <SolverBenchmark.hpp>
+#include <IO.hpp>
+#include <SparseMatrix.hpp>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::benchmark;
+
+TEST(SolverBenchmark, AllVariantsSolveTheSameSystem) {
+  SymCsrMatrix a = io::readSymMatrix("test/systems/tinysym.mtx");
+  std::vector<double> rhs = io::readVector("test/systems/tinysym_b.mtx").data;
+  const std::vector<SolverVariant>& registry = solverRegistry();
+  ASSERT_GE(registry.size(), 8u);
+
+  std::vector<SolverRun> runs;
+  for (const auto& v : registry) {
+    SolverRun r = runSolver(v, a, rhs, "tinysym", 2);
+    EXPECT_GE(r.setupSeconds, 0);
+    EXPECT_GT(r.solveSeconds, 0);
+    EXPECT_EQ(r.n, 4);
+    EXPECT_EQ(r.nnzs, a.nnzs);
+    // the ILU(0) of the stored triangle is not exact (see CGSymWithILUPC)
+    if (v.preconditioner != "ilu0") {
+      EXPECT_TRUE(r.converged) << v.name();
+      EXPECT_LT(r.relativeResidual, 1E-5) << v.name();
+      EXPECT_DOUBLE_EQ(r.secondsToTolerance(), r.setupSeconds + r.solveSeconds);
+    }
+    runs.push_back(r);
+  }
+
+  std::stringstream s;
+  writeJson(runs, s);
+  std::string json = s.str();
+  EXPECT_EQ(json.front(), '[');
+  EXPECT_NE(json.find("\"solver\":\"pipelined_cg\",\"preconditioner\":\"ilu0\""), std::string::npos);
+  EXPECT_EQ(std::count(json.begin(), json.end(), '{'), int(runs.size()));
+}
+
+TEST(SolverBenchmark, RegistersVariants) {
+  SolverVariant diverges;
+  diverges.solver = "stalled";
+  diverges.preconditioner = "none";
+  diverges.setup = [](const SymCsrMatrix&) -> SolveFunction {
+    return [](const double*, double*, int& iterations) {
+      iterations = 7;
+      return false;
+    };
+  };
+  registerSolver(diverges);
+  EXPECT_EQ(solverRegistry().back().name(), "stalled/none");
+  EXPECT_THROW(registerSolver(diverges), std::invalid_argument);
+
+  SymCsrMatrix a = io::readSymMatrix("test/systems/tinysym.mtx");
+  std::vector<double> rhs(a.n, 1.0);
+  SolverRun r = runSolver(diverges, a, rhs, "tinysym");
+  EXPECT_FALSE(r.converged);
+  EXPECT_EQ(r.iterations, 7);
+  EXPECT_LT(r.secondsToTolerance(), 0);
+  EXPECT_DOUBLE_EQ(r.relativeResidual, 1.0);
+  EXPECT_THROW(runSolver(diverges, a, std::vector<double>(a.n + 1), "tinysym"), std::invalid_argument);
+}
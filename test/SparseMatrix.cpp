@@ -1,4 +1,7 @@
 #include <SparseMatrix.hpp>
+#include <IO.hpp>
+#include <Parallel.hpp>
+#include <cmath>
 #include <gtest/gtest.h>
 #include <vector>
 
@@ -190,6 +193,61 @@ TEST_F(TestSparseMatrix, CsrDotProduct) {
   ASSERT_EQ(m.dot(b), e);
 }
 
+namespace {
+cask::Vector testVector(int n) {
+  cask::Vector x(n);
+  for (int i = 0; i < n; i++)
+    x[i] = 1.0 + (i % 7) * 0.25;
+  return x;
+}
+}
+
+TEST_F(TestSparseMatrix, CsrDotMatchesDok) {
+  for (auto path : {"test/test-benchmark/psmigr_2.mtx", "test/matrices/test_long_row.mtx",
+                    "test/matrices/test_some_empty_rows.mtx"}) {
+    cask::CsrMatrix a = cask::io::readMatrix(path);
+    cask::Vector x = testVector(a.m);
+    cask::Vector exp = a.toDok().dot(x);
+    cask::Vector got = a.dot(x);
+    ASSERT_EQ(got.size(), exp.size());
+    for (int i = 0; i < got.size(); i++)
+      ASSERT_NEAR(got[i], exp[i], 1E-10 * std::max(1.0, std::abs(exp[i]))) << path << " row " << i;
+  }
+}
+
+TEST_F(TestSparseMatrix, SymCsrDotMatchesExplicit) {
+  cask::SymCsrMatrix a = cask::io::readSymMatrix("test/test-benchmark/OPF_3754.mtx");
+  cask::CsrMatrix e = cask::io::readMatrix("test/test-benchmark/OPF_3754.mtx");
+  cask::Vector x = testVector(a.n);
+  cask::Vector exp = e.dot(x);
+  cask::Vector got = a.dot(x);
+  for (int i = 0; i < got.size(); i++)
+    ASSERT_NEAR(got[i], exp[i], 1E-10 * std::max(1.0, std::abs(exp[i]))) << " row " << i;
+}
+
+TEST_F(TestSparseMatrix, MergePathSearch) {
+  cask::CsrMatrix a{cask::DokMatrix{
+      1, 1, 1, 1,
+      0, 0, 0, 0,
+      0, 1, 0, 0,
+      1, 1, 0, 0}};
+  // merge path of 4 rows and 7 nonzeros
+  int row;
+  int64_t nz;
+  cask::cpu::mergePathSearch(0, a.view(), row, nz);
+  EXPECT_EQ(row, 0);
+  EXPECT_EQ(nz, 0);
+  cask::cpu::mergePathSearch(3, a.view(), row, nz);
+  EXPECT_EQ(row, 0);
+  EXPECT_EQ(nz, 3);
+  cask::cpu::mergePathSearch(5, a.view(), row, nz);
+  EXPECT_EQ(row, 1);
+  EXPECT_EQ(nz, 4);
+  cask::cpu::mergePathSearch(11, a.view(), row, nz);
+  EXPECT_EQ(row, 4);
+  EXPECT_EQ(nz, 7);
+}
+
 TEST_F(TestVector, VectorSubtract) {
   cask::Vector a{1, 6, 9, 4};
   cask::Vector b{3, 4, 5, 7};
@@ -201,3 +259,187 @@ TEST_F(TestVector, VectorNorm) {
   cask::Vector a{1, 2, 3, 1, 1};
   ASSERT_EQ(a.norm(), 4);
 }
+
+TEST(CsrView, SliceRows) {
+  cask::CsrMatrix a{cask::DokMatrix{
+      1, 2, 0, 0,
+      0, 3, 0, 0,
+      0, 0, 0, 0,
+      4, 0, 5, 6}};
+  cask::CsrView rows = a.view().sliceRows(1, 3);
+  EXPECT_EQ(rows.n, 3);
+  EXPECT_EQ(rows.nnzs, 4);
+  EXPECT_EQ(rows.offset(), 2);
+  EXPECT_EQ(rows.values, a.values.data());
+  EXPECT_EQ(rows.toCsr(), a.sliceRows(1, 3));
+}
+
+TEST(CsrMatrix, TakesOverMovedBuffers) {
+  std::vector<double> values{1, 2, 3};
+  std::vector<int> colInd{0, 2, 1}, rowPtr{0, 2, 3};
+  const double* storage = values.data();
+  cask::CsrMatrix a(2, 3, 3, std::move(values), std::move(colInd), std::move(rowPtr));
+  EXPECT_EQ(a.values.data(), storage);
+  EXPECT_EQ(a, cask::CsrMatrix(2, {1, 0, 2, 0, 3, 0}));
+
+  // lvalues are copied
+  std::vector<double> copied{4};
+  cask::CsrMatrix b(1, 1, 1, copied, {0}, {0, 1});
+  EXPECT_NE(b.values.data(), copied.data());
+
+  EXPECT_THROW(a.sliceRows(1, 2), std::invalid_argument);
+}
+
+TEST_F(TestVector, MovesTemporaries) {
+  std::vector<double> d{5, 7, 9};
+  const double* storage = d.data();
+  cask::Vector a(std::move(d));
+  EXPECT_EQ(a.data.data(), storage);
+
+  cask::Vector b{1, 2, 3};
+  cask::Vector c = std::move(a) - b;
+  EXPECT_EQ(c.data.data(), storage);
+  EXPECT_EQ(c, (cask::Vector{4, 5, 6}));
+  EXPECT_EQ((c - b) - b, (cask::Vector{2, 1, 0}));
+  EXPECT_EQ(c, (cask::Vector{4, 5, 6}));
+  EXPECT_THROW(cask::Vector(2) - b, std::invalid_argument);
+}
+
+TEST_F(TestVector, Blas1MatchesScalarLoops) {
+  // the sizes cover the vector tails and the parallel chunks
+  for (int n : {0, 1, 7, 17, 1000, int(3 * cask::cpu::minParallelEntries + 5)}) {
+    cask::Vector x(n), y(n);
+    for (int i = 0; i < n; i++) {
+      x[i] = 1 + i % 13 * 0.25;
+      y[i] = 2 - i % 7 * 0.5;
+    }
+    double dot = 0, dist = 0;
+    for (int i = 0; i < n; i++) {
+      dot += x[i] * y[i];
+      dist += (x[i] - y[i]) * (x[i] - y[i]);
+    }
+    double tol = 1E-12 * (1 + n);
+    EXPECT_NEAR(x.dot(y), dot, tol) << n;
+    EXPECT_NEAR(x.distance(y), std::sqrt(dist), tol) << n;
+    EXPECT_NEAR(x.norm(), std::sqrt(x.dot(x)), tol) << n;
+
+    cask::Vector z = y;
+    z.axpy(2, x);
+    cask::Vector w = y;
+    w.axpby(2, x, -1);
+    std::vector<double> r = y.data;
+    double rr = cask::cpu::residualFromProduct(n, x.data.data(), r.data());
+    double exp = 0;
+    for (int i = 0; i < n; i++) {
+      ASSERT_EQ(z[i], y[i] + 2 * x[i]) << n;
+      ASSERT_EQ(w[i], 2 * x[i] - y[i]) << n;
+      ASSERT_EQ(r[i], x[i] - y[i]) << n;
+      exp += r[i] * r[i];
+    }
+    EXPECT_NEAR(rr, exp, tol) << n;
+  }
+  cask::Vector a{1, 2, 3};
+  EXPECT_THROW(a.dot(cask::Vector(2)), std::invalid_argument);
+  EXPECT_THROW(a.axpy(1, cask::Vector(4)), std::invalid_argument);
+}
+
+TEST_F(TestVector, Blas1IsReproducible) {
+  int n = 5 * cask::cpu::minParallelEntries;
+  cask::Vector x(n);
+  for (int i = 0; i < n; i++)
+    x[i] = 1.0 / (1 + i);
+  double first = x.norm();
+  for (int k = 0; k < 3; k++)
+    ASSERT_EQ(x.norm(), first);
+  // and serially, up to the order of the additions
+  cask::parallel::ThreadLimit one(1);
+  EXPECT_NEAR(x.norm(), first, 1E-14);
+}
+
+TEST(BlockedCsrMatrix, StoresNonEmptyBlockRows) {
+  cask::CsrMatrix a{cask::DokMatrix{
+      1, 2, 0, 0, 3,
+      0, 0, 0, 0, 0,
+      0, 0, 4, 5, 0,
+      6, 0, 0, 0, 7}};
+  cask::BlockedCsrMatrix b(a, 2);
+  EXPECT_EQ(b.nBlocks, 3);
+  EXPECT_EQ(b.nnzs, a.nnzs);
+  EXPECT_EQ(b.block_ptr, (std::vector<int>{0, 2, 3, 5}));
+  EXPECT_EQ(b.rows, (std::vector<int>{0, 3, 2, 0, 3}));
+  EXPECT_EQ(b.row_ptr, (std::vector<int>{0, 2, 3, 5, 6, 7}));
+  EXPECT_EQ(b.col_ind, (std::vector<int>{0, 1, 0, 0, 1, 0, 0}));
+  EXPECT_EQ(b.values, (std::vector<double>{1, 2, 6, 4, 5, 3, 7}));
+  EXPECT_EQ(b.blockNnzs(1), 2);
+
+  // blocks as CSR matrices, with all rows and a narrower last block
+  std::vector<cask::CsrMatrix> blocks = a.sliceColumns(2);
+  ASSERT_EQ(blocks.size(), 3u);
+  EXPECT_EQ(blocks[0], cask::CsrMatrix(4, {1, 2, 0, 0, 0, 0, 6, 0}));
+  EXPECT_EQ(blocks[2], cask::CsrMatrix(4, {3, 0, 0, 7}));
+  EXPECT_EQ(blocks[2].m, 1);
+  EXPECT_THROW(b.block(3), std::invalid_argument);
+  EXPECT_THROW(cask::BlockedCsrMatrix(a, 0), std::invalid_argument);
+}
+
+TEST(BlockedCsrMatrix, DotMatchesCsr) {
+  for (auto path : {"test/test-benchmark/psmigr_2.mtx", "test/matrices/test_some_empty_rows.mtx"}) {
+    cask::CsrMatrix a = cask::io::readMatrix(path);
+    cask::Vector x = testVector(a.m);
+    cask::Vector exp = a.dot(x);
+    for (int blockSize : {1, 7, 256, a.m + 1}) {
+      // a range of rows, whose row_ptr does not start at 0
+      cask::CsrView rows = a.view().sliceRows(a.n / 3, a.n - a.n / 3);
+      cask::BlockedCsrMatrix b(rows, blockSize);
+      cask::Vector got(rows.n);
+      cask::cpu::blockedSpmv(b, x.data.data(), got.data.data());
+      for (int i = 0; i < rows.n; i++)
+        ASSERT_NEAR(got[i], exp[a.n / 3 + i], 1E-10 * std::max(1.0, std::abs(exp[a.n / 3 + i])))
+            << path << " block size " << blockSize << " row " << i;
+    }
+  }
+}
+
+TEST(SellMatrix, SortsRowsWithinWindows) {
+  cask::CsrMatrix a{cask::DokMatrix{5, {
+      1, 0, 0, 0,
+      2, 3, 4, 0,
+      0, 0, 0, 0,
+      5, 6, 0, 0,
+      0, 0, 0, 7}}};
+  cask::SellMatrix s(a, 2, 4);
+  EXPECT_EQ(s.nChunks, 3);
+  // rows 0 - 3 sorted by length, row 4 in a window of its own
+  EXPECT_EQ(s.rows, (std::vector<int>{1, 3, 0, 2, 4}));
+  EXPECT_EQ(s.chunk_len, (std::vector<int>{3, 1, 1}));
+  EXPECT_EQ(s.chunk_ptr, (std::vector<int64_t>{0, 6, 8, 10}));
+  EXPECT_EQ(s.values, (std::vector<double>{2, 5, 3, 6, 4, 0, 1, 0, 7, 0}));
+  EXPECT_EQ(s.col_ind, (std::vector<int>{0, 0, 1, 1, 2, 0, 0, 0, 3, 0}));
+  EXPECT_DOUBLE_EQ(s.fillRatio(), 0.7);
+
+  // sliced ELLPACK keeps the order of the rows
+  cask::SellMatrix ell(a, 2, 1);
+  EXPECT_EQ(ell.rows, (std::vector<int>{0, 1, 2, 3, 4}));
+  EXPECT_EQ(ell.chunk_len, (std::vector<int>{3, 2, 1}));
+  EXPECT_THROW(cask::SellMatrix(a, 0, 1), std::invalid_argument);
+  EXPECT_THROW(cask::SellMatrix(a, 65, 1), std::invalid_argument);
+}
+
+TEST(SellMatrix, DotMatchesCsr) {
+  for (auto path : {"test/test-benchmark/psmigr_2.mtx", "test/matrices/test_some_empty_rows.mtx",
+                    "test/matrices/test_long_row.mtx"}) {
+    cask::CsrMatrix a = cask::io::readMatrix(path);
+    cask::Vector x = testVector(a.m);
+    cask::Vector exp = a.dot(x);
+    for (int c : {cask::cpu::sellChunkHeight(), 8, 4, 3, 1})
+      for (int sigma : {1, 32, a.n}) {
+        cask::SellMatrix s(a, c, sigma);
+        EXPECT_EQ(s.nnzs, a.nnzs);
+        cask::Vector got(a.n);
+        cask::cpu::sellSpmv(s, x.data.data(), got.data.data());
+        for (int i = 0; i < a.n; i++)
+          ASSERT_NEAR(got[i], exp[i], 1E-10 * std::max(1.0, std::abs(exp[i])))
+              << path << " C = " << c << " sigma = " << sigma << " row " << i;
+      }
+  }
+}
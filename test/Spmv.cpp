@@ -0,0 +1,1103 @@
+#include <Spmv.hpp>
+#include <Cg.hpp>
+#include <IO.hpp>
+#include <SparseMatrix.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <sstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+using namespace cask;
+using namespace cask::spmv;
+
+namespace {
+int64_t bytesWritten = 0;
+int writes = 0;
+
+void countingWrite(
+    const int64_t size_bytes_cpu,
+    const int64_t*,
+    const int64_t*,
+    const uint8_t*,
+    const char*) {
+  bytesWritten += size_bytes_cpu;
+  writes++;
+}
+
+runtime::GeneratedSpmvImplementation countingImpl(int numPipes) {
+  return runtime::GeneratedSpmvImplementation(
+      0, runtime::spmvRunMock, countingWrite, runtime::spmvReadMock,
+      1 << 20, numPipes, 1024, 8, false, 1);
+}
+
+void resetCounters() {
+  bytesWritten = 0;
+  writes = 0;
+}
+
+// a device with one DRAM per memory controller, on which the design writes
+// x[0] * (first row of partition + row) for every row of a partition
+struct FakeDevice {
+  static std::mutex m;
+  static std::vector<std::vector<uint8_t>> dram;
+  static int numPipes, numControllers;
+  // if set, run() multiplies this matrix by the vector in DRAM; otherwise
+  // row r of the output is x[0] * r
+  static const CsrMatrix* matrix;
+  static int64_t bytesWritten;
+
+  static int controller(const int64_t* sizes) {
+    for (int c = 0; c < numControllers; c++)
+      if (sizes[c] != 0)
+        return c;
+    return 0;
+  }
+
+  static uint8_t* at(int ctrl, int64_t address, int64_t size) {
+    auto& d = dram[ctrl];
+    if (d.size() < size_t(address + size))
+      d.resize(address + size);
+    return &d[address];
+  }
+
+  static void write(const int64_t size, const int64_t* sizes, const int64_t* addrs,
+      const uint8_t* data, const char*) {
+    std::lock_guard<std::mutex> lock(m);
+    int c = controller(sizes);
+    std::memcpy(at(c, addrs[c], size), data, size);
+    bytesWritten += size;
+  }
+
+  static void read(const int64_t size, const int64_t* sizes, const int64_t* addrs,
+      uint8_t* data, const char*) {
+    std::lock_guard<std::mutex> lock(m);
+    int c = controller(sizes);
+    std::memcpy(data, at(c, addrs[c], size), size);
+  }
+
+  static void run(int64_t, int64_t, int64_t,
+      const int64_t*, const int32_t*, const int64_t*,
+      const int32_t*, const int32_t* nrows, const int64_t* outAddrs,
+      const int32_t*, const int32_t*, const int64_t* vAddrs) {
+    std::lock_guard<std::mutex> lock(m);
+    int firstRow = 0;
+    for (int p = 0; p < numPipes; p++) {
+      int c = p / (numPipes / numControllers);
+      int m = matrix ? matrix->m : 1;
+      std::vector<double> x(m);
+      std::memcpy(x.data(), at(c, vAddrs[p], m * sizeof(double)), m * sizeof(double));
+      int paddedRows = utils::ceilDivide(nrows[p], 48) * 48;
+      double* out = reinterpret_cast<double*>(at(c, outAddrs[p], paddedRows * sizeof(double)));
+      for (int r = 0; r < paddedRows; r++) {
+        out[r] = r < nrows[p] ? x[0] * (firstRow + r) : -1;
+        if (matrix && r < nrows[p]) {
+          int row = firstRow + r;
+          out[r] = 0;
+          for (int k = matrix->row_ptr[row]; k < matrix->row_ptr[row + 1]; k++)
+            out[r] += matrix->values[k] * x[matrix->col_ind[k]];
+        }
+      }
+      firstRow += nrows[p];
+    }
+  }
+
+  static runtime::GeneratedSpmvImplementation impl(int _numPipes, int _numControllers,
+      ValueFormat format = ValueFormat::Fp64) {
+    numPipes = _numPipes;
+    numControllers = _numControllers;
+    dram.assign(numControllers, std::vector<uint8_t>());
+    matrix = nullptr;
+    bytesWritten = 0;
+    return runtime::GeneratedSpmvImplementation(
+        0, run, write, read, 1 << 20, numPipes, 16, 2, false, numControllers, format);
+  }
+};
+
+std::mutex FakeDevice::m;
+std::vector<std::vector<uint8_t>> FakeDevice::dram;
+int FakeDevice::numPipes, FakeDevice::numControllers;
+const CsrMatrix* FakeDevice::matrix;
+int64_t FakeDevice::bytesWritten;
+
+CsrMatrix identity(int n) {
+  std::vector<double> values(n, 1);
+  std::vector<int> colInd(n), rowPtr(n + 1);
+  for (int i = 0; i <= n; i++) {
+    rowPtr[i] = i;
+    if (i < n)
+      colInd[i] = i;
+  }
+  return CsrMatrix(n, n, n, values, colInd, rowPtr);
+}
+
+//  1 0 | 3 0 | 0 8
+//  0 0 | 0 0 | 0 0
+//  0 4 | 0 0 | 0 0
+//  5 0 | 6 7 | 0 0
+CsrMatrix blockedMatrix() {
+  return CsrMatrix(4, 6, 7,
+      {1, 3, 8, 4, 5, 6, 7},
+      {0, 2, 5, 1, 0, 2, 3},
+      {0, 3, 3, 4, 7});
+}
+
+// the entries of a reduced precision stream, decoded; block[i] is the block
+// of entry i
+template<typename V>
+std::vector<indptr_value> unpack(const Partition& p, const std::vector<int>& block) {
+  auto e = reinterpret_cast<const packed_entry<V>*>(p.m_packed_indptr_values.data());
+  std::vector<indptr_value> entries;
+  for (size_t i = 0; i < block.size(); i++) {
+    int scale = V::scaled ? p.m_block_scales[block[i]] : 0;
+    entries.emplace_back(V::decode(e[i].value, scale), e[i].indptr);
+  }
+  return entries;
+}
+
+// a diagonally dominant, so well conditioned, tridiagonal matrix; its values
+// are not exact in reduced precision
+CsrMatrix tridiagonal(int n) {
+  DokMatrix a(n, n);
+  for (int i = 0; i < n; i++) {
+    a.set(i, i, 3 + 0.37 * (i % 7) / 7);
+    if (i > 0) {
+      double v = -1 - 0.013 * (i % 11);
+      a.set(i, i - 1, v);
+      a.set(i - 1, i, v);
+    }
+  }
+  return CsrMatrix(a);
+}
+}
+
+TEST(Spmv, DoBlockingStreams) {
+  Spmv s(2, 2, 1, 4, 1);
+  Partition p = s.do_blocking(blockedMatrix(), 2, 2);
+  EXPECT_EQ(p.nBlocks, 3);
+  EXPECT_EQ(p.n, 4);
+  // row end offsets of each block
+  EXPECT_EQ(p.m_colptr, (std::vector<int>{1, 1, 2, 3, 1, 1, 1, 3, 1, 1, 1, 1}));
+  // each block is padded to a multiple of the input width
+  std::vector<double> values{1, 4, 5, 0, 3, 6, 7, 0, 8, 0};
+  std::vector<int> indptr{0, 1, 0, 0, 0, 0, 1, 0, 1, 0};
+  ASSERT_EQ(p.m_indptr_values.size(), values.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    EXPECT_EQ(p.m_indptr_values[i].value, values[i]) << i;
+    EXPECT_EQ(p.m_indptr_values[i].indptr, indptr[i]) << i;
+  }
+  EXPECT_EQ(p.emptyCycles, 0);
+  EXPECT_EQ(p.reductionCycles, 12);
+  EXPECT_EQ(p.vector_load_cycles, 2);
+  EXPECT_EQ(p.paddingCycles, 44);
+}
+
+TEST(Spmv, DoBlockingReducedPrecisionStreams) {
+  CsrMatrix a = blockedMatrix();
+  for (double& v : a.values)
+    v *= 0.3;
+  Spmv s(2, 2, 1, 4, 1);
+  Partition exp = s.do_blocking(a, 2, 2);
+  std::vector<int> block{0, 0, 0, 0, 1, 1, 1, 1, 2, 2};
+  ASSERT_EQ(exp.m_indptr_values.size(), block.size());
+
+  for (ValueFormat f : {ValueFormat::Fp32, ValueFormat::Bf16, ValueFormat::Fixed16}) {
+    Partition p = s.do_blocking(a, 2, 2, f);
+    EXPECT_TRUE(p.m_indptr_values.empty()) << to_string(f);
+    EXPECT_EQ(p.m_colptr, exp.m_colptr) << to_string(f);
+    EXPECT_EQ(p.totalCycles, exp.totalCycles) << to_string(f);
+    EXPECT_EQ(p.m_indptr_values_unpaddedLength, exp.m_indptr_values_unpaddedLength);
+    EXPECT_EQ(p.indptrValuesBytes(), int64_t(block.size()) * bytesPerNnz(f)) << to_string(f);
+  }
+  EXPECT_EQ(bytesPerNnz(ValueFormat::Fp64), 12);
+  EXPECT_EQ(bytesPerNnz(ValueFormat::Fp32), 8);
+  EXPECT_EQ(bytesPerNnz(ValueFormat::Bf16), 6);
+
+  std::vector<indptr_value> fp32 = unpack<Fp32Value>(s.do_blocking(a, 2, 2, ValueFormat::Fp32), block);
+  Partition fixed = s.do_blocking(a, 2, 2, ValueFormat::Fixed16);
+  ASSERT_EQ(fixed.m_block_scales.size(), 3u);
+  std::vector<indptr_value> bf16 = unpack<Bf16Value>(s.do_blocking(a, 2, 2, ValueFormat::Bf16), block);
+  std::vector<indptr_value> fixed16 = unpack<Fixed16Value>(fixed, block);
+  for (size_t i = 0; i < block.size(); i++) {
+    double v = exp.m_indptr_values[i].value;
+    EXPECT_EQ(fp32[i].value, double(float(v))) << i;
+    EXPECT_LE(std::abs(bf16[i].value - v), std::ldexp(std::abs(v), -8)) << i;
+    EXPECT_LE(std::abs(fixed16[i].value - v), std::ldexp(0.5, fixed.m_block_scales[block[i]])) << i;
+    EXPECT_EQ(fp32[i].indptr, exp.m_indptr_values[i].indptr) << i;
+    EXPECT_EQ(bf16[i].indptr, exp.m_indptr_values[i].indptr) << i;
+    EXPECT_EQ(fixed16[i].indptr, exp.m_indptr_values[i].indptr) << i;
+  }
+  EXPECT_EQ(parseValueFormat("bf16"), ValueFormat::Bf16);
+  EXPECT_THROW(parseValueFormat("fp8"), std::invalid_argument);
+}
+
+TEST(Spmv, EstimatedBandwidthScalesWithValueFormat) {
+  model::Max4Model device;
+  double fp64 = Spmv(1024, 8, 4, 1000, 1).getEstimatedHardwareModel(device, 1000).memoryBandwidth;
+  double fp32 = Spmv(1024, 8, 4, 1000, 1, ValueFormat::Fp32).getEstimatedHardwareModel(device, 1000).memoryBandwidth;
+  double bf16 = Spmv(1024, 8, 4, 1000, 1, ValueFormat::Bf16).getEstimatedHardwareModel(device, 1000).memoryBandwidth;
+  EXPECT_DOUBLE_EQ(fp32 / fp64, 8.0 / 12);
+  EXPECT_DOUBLE_EQ(bf16 / fp64, 6.0 / 12);
+}
+
+TEST(Spmv, IndexCoding) {
+  EXPECT_EQ(offsetBits(2), 1);
+  EXPECT_EQ(offsetBits(1024), 10);
+  EXPECT_EQ(offsetBits(5120), 13);
+  EXPECT_FALSE(IndexCoding(32, 5120).usesDeltas());
+  EXPECT_FALSE(IndexCoding(13, 5120).usesDeltas());
+  EXPECT_THROW(IndexCoding(1, 16), std::invalid_argument);
+
+  IndexCoding c(3, 16);
+  ASSERT_TRUE(c.usesDeltas());
+  bool escaped;
+  EXPECT_EQ(c.encode(5, 0, escaped), 5u);
+  EXPECT_FALSE(escaped);
+  EXPECT_EQ(c.encode(12, 5, escaped), c.escapeCode());
+  EXPECT_TRUE(escaped);
+  EXPECT_EQ(c.encode(3, 5, escaped), c.escapeCode());
+  EXPECT_TRUE(escaped);
+
+  std::vector<uint8_t> bits(8, 0xFF);
+  writeBits(bits, 3, 0x2A5, 11);
+  writeBits(bits, 14, 0, 5);
+  EXPECT_EQ(readBits(bits, 3, 11), 0x2A5u);
+  EXPECT_EQ(readBits(bits, 14, 5), 0u);
+  EXPECT_EQ(readBits(bits, 0, 3), 7u);
+  EXPECT_EQ(readBits(bits, 19, 45), (uint64_t(1) << 45) - 1);
+}
+
+namespace {
+// the cycles of each input a row touches, read one input at a time
+int readCycles(const std::vector<int32_t>& rowEnds, int inputWidth) {
+  int cycles = 0, crtPos = 0;
+  for (size_t i = 0; i < rowEnds.size(); i++) {
+    int toread = rowEnds[i] - (i > 0 ? rowEnds[i - 1] : 0);
+    do {
+      int canread = std::min(inputWidth - crtPos, toread);
+      crtPos = (crtPos + canread) % inputWidth;
+      cycles++;
+      toread -= canread;
+    } while (toread > 0);
+  }
+  return cycles;
+}
+
+struct CountCycles {
+  const std::vector<int32_t>& rowEnds;
+  int cycles;
+
+  template<typename Width>
+  void operator()(Width w) {
+    cycles = countRowCycles(rowEnds.data(), rowEnds.size(), w);
+  }
+};
+}
+
+TEST(Spmv, ClosedFormCycleCounts) {
+  // runs of empty rows, rows within an input and rows across several
+  std::vector<int32_t> rowEnds;
+  int32_t end = 0;
+  for (int i = 0; i < 500; i++) {
+    end += (i % 7 == 0 || i % 11 == 0) ? 0 : (i * 37) % 41;
+    rowEnds.push_back(end);
+  }
+  for (int w = 1; w <= maxFixedInputWidth + 4; w++) {
+    int expected = readCycles(rowEnds, w);
+    CountCycles count{rowEnds, 0};
+    withInputWidth(w, count);
+    EXPECT_EQ(count.cycles, expected) << "input width " << w;
+    EXPECT_EQ(countRowCycles(rowEnds.data(), rowEnds.size(), InputWidth{uint32_t(w)}), expected);
+
+    // as analyse_blocking() counts them, empty rows aside
+    BlockStatistics s;
+    for (size_t i = 0; i < rowEnds.size(); i++) {
+      int length = rowEnds[i] - (i > 0 ? rowEnds[i - 1] : 0);
+      if (length > 0)
+        s.addRow(i, length, w);
+    }
+    EXPECT_EQ(s.cycles + int(rowEnds.size()) - s.nonEmptyRows, expected) << "input width " << w;
+    EXPECT_EQ(s.nnzs, end);
+  }
+  EXPECT_EQ(countRowCycles(rowEnds.data(), 0, FixedInputWidth<4>()), 0);
+
+  std::vector<int32_t> v(5, 1);
+  utils::align(v, 32);
+  EXPECT_EQ(v, std::vector<int32_t>({1, 1, 1, 1, 1, 0, 0, 0}));
+  utils::align(v, 32);
+  EXPECT_EQ(v.size(), 8u);
+}
+
+TEST(Spmv, DoBlockingDeltaCodedIndices) {
+  // two blocks of 16 columns: the jumps from 0 to 12 and back to 1 (a new
+  // row) in the first block do not fit 3 bit deltas, nor does the first
+  // offset 9 of row 1 in the second block
+  CsrMatrix a(2, 32, 7,
+      {1, 2, 3, 4, 5, 6, 7},
+      {0, 2, 12, 1, 7, 25, 26},
+      {0, 3, 7});
+  Spmv s(16, 2, 1, 2, 1);
+  Partition exp = s.do_blocking(a, 16, 2);
+  Partition p = s.do_blocking(a, 16, 2, ValueFormat::Fp64, 3);
+  EXPECT_TRUE(p.m_indptr_values.empty());
+  EXPECT_EQ(p.m_colptr, exp.m_colptr);
+  EXPECT_EQ(p.totalCycles, exp.totalCycles);
+  int64_t entries = exp.m_indptr_values.size();
+  EXPECT_EQ(p.indptrValuesBytes(), utils::ceilDivide(entries * 67, 8));
+  EXPECT_EQ(p.m_escapes, (std::vector<int32_t>{12, 9}));
+  EXPECT_EQ(p.escapes, 2);
+  EXPECT_EQ(s.analyse_blocking(a, 16, 2, 3).escapes, 2);
+
+  // decodes the offsets: deltas restart at each row of a block, listed by
+  // the segment of each entry (block 0: rows 0, 1 and padding, block 1: row 1)
+  IndexCoding c(3, 16);
+  std::vector<int> segment{0, 0, 0, 1, 1, 2, 3, 3};
+  ASSERT_EQ(entries, int64_t(segment.size()));
+  std::vector<int32_t> escapes = p.m_escapes;
+  size_t nextEscape = 0;
+  int previous = 0;
+  for (int64_t i = 0; i < entries; i++) {
+    if (i > 0 && segment[i] != segment[i - 1])
+      previous = 0;
+    uint64_t value = readBits(p.m_packed_indptr_values, i * 67, 64);
+    uint32_t code = readBits(p.m_packed_indptr_values, i * 67 + 64, 3);
+    int offset = code == c.escapeCode() ? escapes[nextEscape++] : previous + code;
+    double v;
+    std::memcpy(&v, &value, sizeof(v));
+    EXPECT_EQ(v, exp.m_indptr_values[i].value) << i;
+    EXPECT_EQ(offset, exp.m_indptr_values[i].indptr) << i;
+    previous = offset;
+  }
+}
+
+TEST(Spmv, EstimatedCostOfNarrowIndices) {
+  model::Max4Model device;
+  auto wide = Spmv(1024, 8, 4, 1000, 1).getEstimatedHardwareModel(device, 1000);
+  // offsets up to 1024 fit 10 bits, no decoding is needed
+  auto narrow = Spmv(1024, 8, 4, 1000, 1, ValueFormat::Fp64, 10).getEstimatedHardwareModel(device, 1000);
+  auto deltas = Spmv(1024, 8, 4, 1000, 1, ValueFormat::Fp64, 6).getEstimatedHardwareModel(device, 1000);
+  EXPECT_DOUBLE_EQ(narrow.memoryBandwidth / wide.memoryBandwidth, 74.0 / 96);
+  EXPECT_DOUBLE_EQ(deltas.memoryBandwidth / wide.memoryBandwidth, 70.0 / 96);
+  EXPECT_EQ(narrow.ru.luts, wide.ru.luts);
+  EXPECT_GT(deltas.ru.luts, wide.ru.luts);
+}
+
+TEST(Spmv, DoBlockingSkipEmptyRows) {
+  SkipEmptyRowsSpmv s(2, 2, 1, 4, 1);
+  Partition p = s.do_blocking(blockedMatrix(), 2, 2);
+  // only the inner blocks are encoded
+  int32_t emptyRun = 2 | (1 << 31);
+  EXPECT_EQ(p.m_colptr, (std::vector<int>{1, 1, 2, 3, 1, emptyRun, 3, 1, 1, 1, 1}));
+  EXPECT_EQ(p.m_colptr_unpaddedLength, 11);
+  EXPECT_EQ(p.emptyCycles, 1);
+  EXPECT_EQ(p.reductionCycles, 11);
+}
+
+TEST(Spmv, DoBlockingFromBlockedCsr) {
+  CsrMatrix a = io::readMatrix("test/matrices/OPF_3754.mtx");
+  CsrView rows = a.view().sliceRows(100, 1000);
+  BlockedCsrMatrix blocked(rows, 64);
+  Spmv s(64, 4, 1, a.n, 1);
+  SkipEmptyRowsSpmv skip(64, 4, 1, a.n, 1);
+  for (Spmv* spmv : std::vector<Spmv*>{&s, &skip})
+    for (ValueFormat f : {ValueFormat::Fp64, ValueFormat::Fp32, ValueFormat::Fixed16})
+      for (int indexBits : {32, 6}) {
+        Partition exp = spmv->do_blocking(rows, 64, 4, f, indexBits);
+        Partition p = spmv->do_blocking(blocked, 4, f, indexBits);
+        std::string what = to_string(f) + " " + std::to_string(indexBits);
+        EXPECT_EQ(p.m_colptr, exp.m_colptr) << what;
+        EXPECT_EQ(p.m_packed_indptr_values, exp.m_packed_indptr_values) << what;
+        EXPECT_EQ(p.m_block_scales, exp.m_block_scales) << what;
+        EXPECT_EQ(p.m_escapes, exp.m_escapes) << what;
+        ASSERT_EQ(p.m_indptr_values.size(), exp.m_indptr_values.size()) << what;
+        for (size_t i = 0; i < exp.m_indptr_values.size(); i++) {
+          EXPECT_EQ(p.m_indptr_values[i].value, exp.m_indptr_values[i].value) << what;
+          EXPECT_EQ(p.m_indptr_values[i].indptr, exp.m_indptr_values[i].indptr) << what;
+        }
+        EXPECT_EQ(p.totalCycles, exp.totalCycles) << what;
+        EXPECT_EQ(p.reductionCycles, exp.reductionCycles) << what;
+        EXPECT_EQ(p.emptyCycles, exp.emptyCycles) << what;
+        EXPECT_EQ(p.escapes, exp.escapes) << what;
+      }
+}
+
+TEST(Spmv, PreprocessSplitsRowsAcrossPipes) {
+  CsrMatrix a = io::readMatrix("test/matrices/test_some_empty_rows.mtx");
+  Spmv s(1024, 8, 3, a.n, 1);
+  s.preprocess(a);
+  const std::vector<Partition>& parts = s.getPartitions();
+  ASSERT_EQ(parts.size(), 3u);
+  const std::vector<int>& splits = s.getRowSplits();
+  ASSERT_EQ(splits.size(), 4u);
+  EXPECT_EQ(splits.front(), 0);
+  EXPECT_EQ(splits.back(), a.n);
+  for (size_t i = 0; i < parts.size(); i++) {
+    int start = splits[i];
+    int nRows = splits[i + 1] - start;
+    ASSERT_GT(nRows, 0);
+    Partition exp = s.do_blocking(a.view().sliceRows(start, nRows), 1024, 8);
+    EXPECT_EQ(parts[i].n, nRows);
+    EXPECT_EQ(parts[i].totalCycles, exp.totalCycles);
+    EXPECT_EQ(parts[i].m_colptr, exp.m_colptr);
+    EXPECT_EQ(parts[i].m_indptr_values.size(), exp.m_indptr_values.size());
+  }
+}
+
+TEST(Spmv, BalancedRowSplits) {
+  EXPECT_EQ(balancedRowSplits({1, 1, 1, 1, 1, 1}, 3), (std::vector<int>{0, 2, 4, 6}));
+  EXPECT_EQ(balancedRowSplits({9, 1, 1, 1, 1, 1, 1, 1, 1, 1}, 2), (std::vector<int>{0, 1, 10}));
+  // every range has a row, even when weights are zero
+  EXPECT_EQ(balancedRowSplits({0, 0, 0, 5}, 4), (std::vector<int>{0, 1, 2, 3, 4}));
+  // ranges are filled greedily, up to the optimal weight
+  EXPECT_EQ(balancedRowSplits({3, 0, 0, 0}, 2), (std::vector<int>{0, 3, 4}));
+  EXPECT_THROW(balancedRowSplits({1, 1}, 3), std::invalid_argument);
+}
+
+TEST(Spmv, BalancedPartitionsOfSkewedMatrix) {
+  // the first rows hold most of the nonzeros
+  int n = 400;
+  DokMatrix d(n, n);
+  for (int i = 0; i < n; i++)
+    for (int j = 0; j < (i < 40 ? 200 : 2); j++)
+      d.set(i, (i + j * 3) % n, 1);
+  CsrMatrix a(d);
+
+  SkipEmptyRowsSpmv even(64, 4, 4, n, 1), balanced(64, 4, 4, n, 1);
+  even.setRowPartitioning(RowPartitioning::Even);
+  even.analyse(a);
+  balanced.analyse(a);
+  EXPECT_EQ(even.getRowSplits(), (std::vector<int>{0, 100, 200, 300, 400}));
+  EXPECT_LT(balanced.getEstimatedClockCycles(), 0.6 * even.getEstimatedClockCycles());
+  EXPECT_LT(balanced.getRowSplits()[1], 40);
+
+  // the device uses the same splits as the model
+  SkipEmptyRowsSpmv s(64, 4, 4, n, 1);
+  s.preprocess(a);
+  EXPECT_EQ(s.getRowSplits(), balanced.getRowSplits());
+  EXPECT_EQ(s.getEstimatedClockCycles(), balanced.getEstimatedClockCycles());
+  BlockingCache cache(a);
+  SkipEmptyRowsSpmv cached(64, 4, 4, n, 1);
+  cached.analyse(cache);
+  EXPECT_EQ(cached.getRowSplits(), balanced.getRowSplits());
+}
+
+TEST(Spmv, MatrixStaysResidentAcrossMultiplications) {
+  CsrMatrix a = io::readMatrix("test/matrices/test_some_empty_rows.mtx");
+  Spmv s(countingImpl(2));
+  s.preprocess(a);
+  EXPECT_FALSE(s.isMatrixLoaded());
+
+  Vector x(a.m);
+  resetCounters();
+  s.spmv(x);
+  int64_t firstBytes = bytesWritten;
+  // the streams of both partitions, then the vector they share
+  EXPECT_EQ(writes, 2);
+  EXPECT_TRUE(s.isMatrixLoaded());
+  ASSERT_EQ(s.getDeviceLayout().size(), 2u);
+
+  // later multiplications only write the (padded) vector, once per controller
+  resetCounters();
+  s.spmv(x);
+  int64_t vectorBytes = utils::ceilDivide(a.m, 1024) * 1024 * sizeof(double);
+  vectorBytes = utils::ceilDivide(vectorBytes, 384) * 384;
+  EXPECT_EQ(writes, 1);
+  EXPECT_EQ(bytesWritten, vectorBytes);
+  EXPECT_LT(bytesWritten, firstBytes);
+
+  int64_t matrixBytes = s.getDramLayout().matrixEnd[0];
+  for (const auto& l : s.getDeviceLayout()) {
+    EXPECT_EQ(l.vSize, vectorBytes);
+    EXPECT_EQ(l.vStartAddress, matrixBytes);
+    EXPECT_GE(l.outStartAddr, matrixBytes + vectorBytes * Spmv::numVectorBuffers);
+    EXPECT_EQ(l.indptrValuesStartAddress % 384, 0);
+    EXPECT_LE(l.escapesStartAddress + l.escapesSize, matrixBytes);
+  }
+  EXPECT_THROW(s.spmv(Vector(a.m + 1)), std::invalid_argument);
+}
+
+TEST(Spmv, MatrixIsReloadedWhenReplaced) {
+  CsrMatrix a = io::readMatrix("test/matrices/test_some_empty_rows.mtx");
+  runtime::GeneratedSpmvImplementation impl = countingImpl(1);
+  Spmv s1(impl), s2(impl);
+  s1.preprocess(a);
+  s2.preprocess(a);
+  Vector x(a.m);
+
+  s1.spmv(x);
+  s2.spmv(x);
+  // both share the device, which now holds the matrix of s2
+  EXPECT_FALSE(s1.isMatrixLoaded());
+  EXPECT_TRUE(s2.isMatrixLoaded());
+
+  resetCounters();
+  s1.spmv(x);
+  EXPECT_EQ(writes, 2);
+
+  s1.preprocess(a);
+  EXPECT_FALSE(s1.isMatrixLoaded());
+}
+
+TEST(Spmv, StreamsAreWrittenInOneWritePerController) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  std::vector<std::vector<uint8_t>> written;
+  std::vector<int64_t> addresses;
+  runtime::GeneratedSpmvImplementation impl = countingImpl(2);
+  impl.write = [&](const int64_t size, const int64_t*, const int64_t* addrs, const uint8_t* data, const char*) {
+    written.push_back(std::vector<uint8_t>(data, data + size));
+    addresses.push_back(addrs[0]);
+  };
+  Spmv s(impl);
+  s.preprocess(a);
+  std::vector<Partition> before = s.getPartitions();
+  s.loadMatrix();
+
+  // the indptr / values and colptr streams of both partitions, from 0
+  const std::vector<Partition>& ps = s.getPartitions();
+  ASSERT_EQ(written.size(), 1u);
+  EXPECT_EQ(addresses[0], 0);
+  EXPECT_EQ(int64_t(written[0].size()), s.getDramLayout().matrixEnd[0]);
+  EXPECT_EQ(written[0].size() % 384, 0u);
+  for (size_t i = 0; i < ps.size(); i++) {
+    const PartitionWriteResult& l = s.getDeviceLayout()[i];
+    const uint8_t* values = reinterpret_cast<const uint8_t*>(ps[i].m_indptr_values.data());
+    const uint8_t* colptr = reinterpret_cast<const uint8_t*>(ps[i].m_colptr.data());
+    EXPECT_TRUE(std::equal(values, values + ps[i].m_indptr_values.size() * sizeof(indptr_value),
+                           &written[0][l.indptrValuesStartAddress]));
+    EXPECT_TRUE(std::equal(colptr, colptr + ps[i].m_colptr.size() * sizeof(int), &written[0][l.colptrStartAddress]));
+    EXPECT_EQ(ps[i].m_colptr, before[i].m_colptr);
+    EXPECT_EQ(ps[i].m_indptr_values.size(), before[i].m_indptr_values.size());
+  }
+}
+
+// the DRAM of each controller of FakeDevice, padded with zeros to size bytes
+std::vector<std::vector<uint8_t>> fakeDram(size_t size) {
+  std::vector<std::vector<uint8_t>> dram = FakeDevice::dram;
+  for (auto& d : dram)
+    d.resize(std::max(size, d.size()));
+  return dram;
+}
+
+TEST(Spmv, PreprocessToDeviceWritesTheStreamsOfPreprocess) {
+  struct Config {
+    std::string path;
+    int cacheSize, inputWidth, pipes, controllers;
+    ValueFormat format;
+    int indexBits;
+    bool skipEmpty;
+  };
+  std::vector<Config> configs{
+    {"test/matrices/bfwb62.mtx", 16, 2, 2, 1, ValueFormat::Fp64, 32, false},
+    {"test/matrices/test_some_empty_rows.mtx", 4, 3, 4, 2, ValueFormat::Fixed16, 32, true},
+    // delta coded indices, with escapes, in entries of 19 bits
+    {"test/matrices/bfwb62.mtx", 16, 3, 3, 1, ValueFormat::Bf16, 3, true},
+    {"test/matrices/test_long_row.mtx", 16, 2, 2, 2, ValueFormat::Fp32, 5, false},
+    // fewer rows than pipes
+    {"test/matrices/test_some_empty_rows.mtx", 16, 2, 64, 2, ValueFormat::Fp64, 32, true},
+  };
+  for (const Config& c : configs) {
+    CsrMatrix a = io::readMatrix(c.path);
+    auto make = [&]() {
+      std::unique_ptr<Spmv> s(c.skipEmpty ?
+          new SkipEmptyRowsSpmv(c.cacheSize, c.inputWidth, c.pipes, a.n, c.controllers, c.format, c.indexBits) :
+          new Spmv(c.cacheSize, c.inputWidth, c.pipes, a.n, c.controllers, c.format, c.indexBits));
+      s->impl.write = FakeDevice::write;
+      return s;
+    };
+    FakeDevice::impl(c.pipes, c.controllers);
+    std::unique_ptr<Spmv> exp = make();
+    exp->preprocess(a);
+    exp->loadMatrix();
+    std::vector<std::vector<uint8_t>> expDram = FakeDevice::dram;
+
+    // down to a row at a time
+    for (int64_t chunk : {int64_t(1), int64_t(7), int64_t(1) << 22}) {
+      std::string what = c.path + " in chunks of " + std::to_string(chunk) + " with " +
+          std::to_string(c.pipes) + " pipes";
+      FakeDevice::impl(c.pipes, c.controllers);
+      std::unique_ptr<Spmv> got = make();
+      got->preprocessToDevice(a, chunk);
+      EXPECT_TRUE(got->isMatrixLoaded()) << what;
+
+      size_t size = 0;
+      for (size_t i = 0; i < expDram.size(); i++)
+        size = std::max(size, std::max(expDram[i].size(), FakeDevice::dram[i].size()));
+      std::vector<std::vector<uint8_t>> gotDram = fakeDram(size);
+      FakeDevice::dram = expDram;
+      EXPECT_TRUE(gotDram == fakeDram(size)) << what;
+
+      ASSERT_EQ(got->getDeviceLayout().size(), exp->getDeviceLayout().size()) << what;
+      for (size_t i = 0; i < exp->getDeviceLayout().size(); i++) {
+        const PartitionWriteResult& e = exp->getDeviceLayout()[i];
+        const PartitionWriteResult& g = got->getDeviceLayout()[i];
+        EXPECT_EQ(g.indptrValuesSize, e.indptrValuesSize) << what;
+        EXPECT_EQ(g.colptrStartAddress, e.colptrStartAddress) << what;
+        EXPECT_EQ(g.colptrSize, e.colptrSize) << what;
+        EXPECT_EQ(g.scalesSize, e.scalesSize) << what;
+        EXPECT_EQ(g.escapesSize, e.escapesSize) << what;
+        EXPECT_EQ(g.outStartAddr, e.outStartAddr) << what;
+        EXPECT_EQ(g.outSize, e.outSize) << what;
+      }
+      EXPECT_EQ(got->getEstimatedClockCycles(), exp->getEstimatedClockCycles()) << what;
+      EXPECT_EQ(got->getRowSplits(), exp->getRowSplits()) << what;
+      // no streams are kept on the host, but their sizes are known
+      for (size_t i = 0; i < exp->getPartitions().size(); i++) {
+        const Partition& p = got->getPartitions()[i];
+        EXPECT_TRUE(p.m_colptr.empty() && p.m_indptr_values.empty() && p.m_packed_indptr_values.empty()) << what;
+        EXPECT_EQ(p.streamBytes(), exp->getPartitions()[i].streamBytes()) << what;
+      }
+    }
+  }
+}
+
+TEST(Spmv, PreprocessToDeviceRejectsReordering) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  Spmv s(16, 2, 2, a.n, 1);
+  s.setReordering(reordering::Method::Rcm);
+  EXPECT_THROW(s.preprocessToDevice(a), std::invalid_argument);
+  s.setReordering(reordering::Method::None);
+  EXPECT_THROW(s.preprocessToDevice(a, 0), std::invalid_argument);
+}
+
+TEST(Spmv, BatchedMultiplication) {
+  CsrMatrix a = io::readMatrix("test/matrices/test_some_empty_rows.mtx");
+  Spmv s(countingImpl(2));
+  s.preprocess(a);
+  s.loadMatrix();
+
+  std::vector<Vector> xs(5, Vector(a.m));
+  resetCounters();
+  std::vector<Vector> ys = s.spmm(xs);
+  ASSERT_EQ(ys.size(), xs.size());
+  for (const auto& y : ys)
+    EXPECT_EQ(y.size(), a.n);
+  // one vector write per controller for each right hand side
+  EXPECT_EQ(writes, 5);
+
+  EXPECT_TRUE(s.spmm(std::vector<Vector>{}).empty());
+  xs.push_back(Vector(a.m + 1));
+  EXPECT_THROW(s.spmm(xs), std::invalid_argument);
+}
+
+TEST(Spmv, ResultsAreReadAtPartitionOffsets) {
+  // partitions both smaller and larger than a burst, on several controllers
+  int configs[][3] = {{20, 6, 3}, {500, 6, 2}, {97, 4, 4}, {300, 3, 1}};
+  for (auto& c : configs) {
+    Spmv s(FakeDevice::impl(c[1], c[2]));
+    s.preprocess(identity(c[0]));
+    std::vector<Vector> xs{Vector(c[0]), Vector(c[0]), Vector(c[0]), Vector(c[0])};
+    for (size_t j = 0; j < xs.size(); j++)
+      xs[j][0] = j + 1;
+
+    Vector y = s.spmv(xs[1]);
+    ASSERT_EQ(y.size(), c[0]);
+    for (int i = 0; i < c[0]; i++)
+      ASSERT_EQ(y[i], 2.0 * i) << c[0] << " rows, row " << i;
+
+    std::vector<Vector> ys = s.spmm(xs);
+    for (size_t j = 0; j < ys.size(); j++)
+      for (int i = 0; i < c[0]; i++)
+        ASSERT_EQ(ys[j][i], (j + 1.0) * i) << c[0] << " rows, vector " << j << " row " << i;
+  }
+}
+
+TEST(Spmv, PerformanceReportOfEachPartition) {
+  int n = 500;
+  Spmv s(FakeDevice::impl(4, 2));
+  s.preprocess(identity(n));
+  s.spmv(Vector(n));
+
+  const PerformanceReport& r = s.getPerformanceReport();
+  ASSERT_EQ(r.partitions.size(), 4u);
+  ASSERT_EQ(r.controllers.size(), 2u);
+  int64_t written = 0, read = 0;
+  int rows = 0;
+  for (size_t i = 0; i < r.partitions.size(); i++) {
+    const Partition& p = s.getPartitions()[i];
+    const PartitionReport& pr = r.partitions[i];
+    EXPECT_EQ(pr.pipe, int(i));
+    EXPECT_EQ(pr.controller, int(i) / 2);
+    EXPECT_EQ(pr.totalCycles, p.totalCycles);
+    EXPECT_EQ(pr.reductionCycles, p.reductionCycles);
+    EXPECT_EQ(pr.paddingCycles, p.paddingCycles);
+    EXPECT_EQ(pr.emptyCycles, p.emptyCycles);
+    EXPECT_GE(pr.streamBytes, p.indptrValuesBytes());
+    EXPECT_DOUBLE_EQ(pr.kernelSeconds, p.totalCycles / s.getFrequency());
+    // the partitions of a controller share the vector of the first
+    EXPECT_EQ(pr.vectorBytes, i % 2 == 0 ? s.getDeviceLayout()[i].vSize : 0);
+    EXPECT_GE(pr.resultBytes, int64_t(p.n * sizeof(double)));
+    EXPECT_GE(pr.vectorWriteSeconds, 0);
+    written += pr.vectorBytes;
+    read += pr.resultBytes;
+    rows += pr.rows;
+  }
+  EXPECT_EQ(rows, n);
+  EXPECT_EQ(r.controllers[0].bytesWritten + r.controllers[1].bytesWritten, written);
+  EXPECT_EQ(r.controllers[0].bytesRead + r.controllers[1].bytesRead, read);
+  EXPECT_DOUBLE_EQ(r.estimatedGflops, s.getEstimatedGFlops(s.getDeviceModel()));
+  EXPECT_FALSE(r.bottleneck().empty());
+
+  std::stringstream json;
+  r.writeJson(json);
+  EXPECT_NE(json.str().find("\"emptyCycles\""), std::string::npos);
+  EXPECT_NE(json.str().find("\"bottleneck\":\"" + r.bottleneck() + "\""), std::string::npos);
+}
+
+TEST(Spmv, CalibratedEstimates) {
+  model::Calibration c;
+  c.addRun(0, 1);
+  EXPECT_EQ(c.runs, 0);
+  c.addRun(1, 2);
+  c.addRun(2, 4);
+  EXPECT_DOUBLE_EQ(c.cycleScale, 2);
+  c.addTransfer(3E9, 1);
+  c.addTransfer(1E9, 1);
+  EXPECT_DOUBLE_EQ(c.hostBandwidth, 2);
+
+  // a design which is not memory bound runs twice as slow
+  CsrMatrix a = tridiagonal(300);
+  Spmv s(1024, 1, 1, a.n, 1);
+  s.analyse(a);
+  model::Max4Model device;
+  double gflops = s.getEstimatedGFlops(device);
+  s.setCalibration(c);
+  EXPECT_DOUBLE_EQ(s.getEstimatedGFlops(device), gflops / 2);
+}
+
+TEST(Spmv, ReorderedMultiplication) {
+  // a band matrix with shuffled rows and columns
+  int n = 200;
+  std::vector<int> shuffle(n);
+  for (int i = 0; i < n; i++)
+    shuffle[i] = i * 77 % n;
+  DokMatrix d(n, n);
+  for (int i = 0; i < n; i++)
+    for (int j = std::max(0, i - 2); j <= std::min(n - 1, i + 2); j++)
+      d.set(shuffle[i], shuffle[j], 1 + (i + j) % 3);
+  CsrMatrix a(d);
+  Vector x(n), exp(n);
+  for (int i = 0; i < n; i++)
+    x[i] = 1 + i % 5;
+  cpu::spmv(a.view(), x.data.data(), exp.data.data());
+
+  Spmv s(FakeDevice::impl(4, 2));
+  s.setReordering(reordering::Method::Rcm);
+  s.preprocess(a);
+  ASSERT_EQ(int(s.getPermutation().rows.size()), n);
+  // the device holds the reordered matrix
+  CsrMatrix reordered = reordering::permute(a, s.getPermutation());
+  FakeDevice::matrix = &reordered;
+  EXPECT_EQ(s.spmv(x).data, exp.data);
+  std::vector<Vector> ys = s.spmm({x, x});
+  EXPECT_EQ(ys[1].data, exp.data);
+  Vector y(n);
+  s.multiply(x.data.data(), y.data.data());
+  EXPECT_EQ(y.data, exp.data);
+  const MultiplyTimes& t = s.getMultiplyTimes();
+  EXPECT_GT(t.uploadSeconds, 0);
+  EXPECT_GT(t.kernelSeconds, 0);
+  EXPECT_GT(t.readbackSeconds, 0);
+
+  // fewer blocks are touched per row, so fewer cycles are needed
+  SkipEmptyRowsSpmv original(16, 2, 2, n, 1), rcm(16, 2, 2, n, 1);
+  rcm.setReordering(reordering::Method::Rcm);
+  BlockingCache cache(a);
+  original.analyse(cache);
+  rcm.analyse(cache);
+  EXPECT_TRUE(original.getPermutation().rows.empty());
+  EXPECT_LT(rcm.getEstimatedClockCycles(), original.getEstimatedClockCycles());
+}
+
+TEST(Spmv, AnalyseMatchesPreprocess) {
+  for (auto path : {"test/matrices/test_some_empty_rows.mtx", "test/matrices/test_long_row.mtx",
+                    "test/matrices/bfwb62.mtx"}) {
+    CsrMatrix a = io::readMatrix(path);
+    // cache size, input width, pipes, index bits
+    int configs[][4] = {{16, 3, 2, 32}, {4, 2, 3, 32}, {1024, 8, 1, 32}, {1024, 8, 2, 6}, {16, 3, 2, 3}};
+    for (auto& c : configs) {
+      SkipEmptyRowsSpmv exp(c[0], c[1], c[2], a.n, 1, ValueFormat::Fp64, c[3]);
+      SkipEmptyRowsSpmv got(c[0], c[1], c[2], a.n, 1, ValueFormat::Fp64, c[3]);
+      exp.preprocess(a);
+      got.analyse(a);
+      EXPECT_EQ(got.getEstimatedClockCycles(), exp.getEstimatedClockCycles()) << path;
+      for (size_t i = 0; i < exp.getPartitions().size(); i++) {
+        const Partition& p = exp.getPartitions()[i];
+        const Partition& q = got.getPartitions()[i];
+        EXPECT_EQ(q.totalCycles, p.totalCycles) << path << " partition " << i;
+        EXPECT_EQ(q.reductionCycles, p.reductionCycles) << path << " partition " << i;
+        EXPECT_EQ(q.emptyCycles, p.emptyCycles) << path << " partition " << i;
+        EXPECT_EQ(q.paddingCycles, p.paddingCycles) << path << " partition " << i;
+        EXPECT_EQ(q.m_colptr_unpaddedLength, p.m_colptr_unpaddedLength) << path << " partition " << i;
+        EXPECT_EQ(q.m_indptr_values_unpaddedLength, p.m_indptr_values_unpaddedLength) << path << " partition " << i;
+        EXPECT_EQ(q.escapes, p.escapes) << path << " partition " << i;
+        EXPECT_EQ(q.escapes, int64_t(p.m_escapes.size())) << path << " partition " << i;
+        EXPECT_TRUE(q.m_colptr.empty());
+        EXPECT_TRUE(q.m_indptr_values.empty());
+      }
+    }
+  }
+}
+
+TEST(Spmv, AnalysedMatrixCannotBeMultiplied) {
+  CsrMatrix a = io::readMatrix("test/matrices/test_some_empty_rows.mtx");
+  Spmv s(countingImpl(1));
+  s.analyse(a);
+  EXPECT_THROW(s.spmv(Vector(a.m)), std::runtime_error);
+}
+
+TEST(Spmv, AnalyseWithBlockingCache) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  BlockingCache cache(a);
+  // cache size, input width, pipes, controllers, index bits
+  int configs[][5] = {{16, 3, 2, 1, 32}, {16, 3, 2, 2, 32}, {16, 2, 3, 1, 32}, {4, 2, 3, 3, 32},
+                      {1024, 8, 1, 1, 32}, {1024, 8, 2, 1, 5}, {16, 3, 2, 1, 5}};
+  for (auto& c : configs) {
+    SkipEmptyRowsSpmv exp(c[0], c[1], c[2], a.n, c[3], ValueFormat::Fp64, c[4]);
+    SkipEmptyRowsSpmv got(c[0], c[1], c[2], a.n, c[3], ValueFormat::Fp64, c[4]);
+    exp.analyse(a);
+    got.analyse(cache);
+    ASSERT_EQ(got.getPartitions().size(), exp.getPartitions().size());
+    EXPECT_EQ(got.getEstimatedClockCycles(), exp.getEstimatedClockCycles());
+    for (size_t i = 0; i < exp.getPartitions().size(); i++) {
+      EXPECT_EQ(got.getPartitions()[i].totalCycles, exp.getPartitions()[i].totalCycles);
+      EXPECT_EQ(got.getPartitions()[i].emptyCycles, exp.getPartitions()[i].emptyCycles);
+      EXPECT_EQ(got.getPartitions()[i].m_colptr_unpaddedLength, exp.getPartitions()[i].m_colptr_unpaddedLength);
+      EXPECT_EQ(got.getPartitions()[i].escapes, exp.getPartitions()[i].escapes);
+    }
+  }
+
+  // the blocked structure is computed once per block size
+  EXPECT_EQ(cache.rowLengths(16), cache.rowLengths(16));
+  std::shared_ptr<const BlockRowLengths> l = cache.rowLengths(16);
+  EXPECT_EQ(l->nBlocks, utils::ceilDivide(a.m, 16));
+  EXPECT_EQ(std::accumulate(l->lengths.begin(), l->lengths.end(), 0), a.nnzs);
+}
+
+TEST(Spmv, SavedAnalysesAreReused) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  std::string path = analysisCachePath("test_analysis_cache", a);
+  // cache size, input width, pipes, index bits
+  int configs[][4] = {{16, 3, 2, 32}, {4, 2, 3, 32}, {1024, 8, 2, 5}};
+  {
+    BlockingCache cache(a);
+    EXPECT_EQ(cache.load(path), 0u);
+    for (auto& c : configs) {
+      SkipEmptyRowsSpmv s(c[0], c[1], c[2], a.n, 1, ValueFormat::Fp64, c[3]);
+      s.analyse(cache);
+    }
+    EXPECT_EQ(cache.computedPartitions(), 3u);
+    cache.save(path);
+  }
+
+  BlockingCache cache(a);
+  EXPECT_EQ(cache.load(path), 3u);
+  for (auto& c : configs) {
+    SkipEmptyRowsSpmv exp(c[0], c[1], c[2], a.n, 1, ValueFormat::Fp64, c[3]);
+    SkipEmptyRowsSpmv got(c[0], c[1], c[2], a.n, 1, ValueFormat::Fp64, c[3]);
+    exp.analyse(a);
+    got.analyse(cache);
+    EXPECT_EQ(got.getEstimatedClockCycles(), exp.getEstimatedClockCycles());
+    EXPECT_EQ(got.getEscapeBandwidth(), exp.getEscapeBandwidth());
+    ASSERT_EQ(got.getPartitions().size(), exp.getPartitions().size());
+    for (size_t i = 0; i < exp.getPartitions().size(); i++) {
+      EXPECT_EQ(got.getPartitions()[i].reductionCycles, exp.getPartitions()[i].reductionCycles);
+      EXPECT_EQ(got.getPartitions()[i].m_indptr_values_unpaddedLength,
+                exp.getPartitions()[i].m_indptr_values_unpaddedLength);
+    }
+  }
+  EXPECT_EQ(cache.computedPartitions(), 0u);
+
+  // the values do not change the structure, any entry does
+  CsrMatrix scaled = a;
+  scaled.values[0] *= 2;
+  EXPECT_EQ(structureHash(scaled), structureHash(a));
+  CsrMatrix other = io::readMatrix("test/matrices/test_some_empty_rows.mtx");
+  EXPECT_NE(structureHash(other), structureHash(a));
+  BlockingCache otherCache(other);
+  EXPECT_EQ(otherCache.load(path), 0u);
+
+  std::remove(path.c_str());
+  ::rmdir("test_analysis_cache");
+}
+
+TEST(Spmv, LoaderPicksFastestImplementation) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  auto impl = [](int id, int maxRows, int numPipes, int cacheSize, int inputWidth) {
+    return new runtime::GeneratedSpmvImplementation(
+        id, runtime::spmvRunMock, runtime::spmvWriteMock, runtime::spmvReadMock,
+        maxRows, numPipes, cacheSize, inputWidth, false, 1);
+  };
+  std::unique_ptr<runtime::GeneratedSpmvImplementation> slow(impl(0, 1024, 1, 1024, 1));
+  std::unique_ptr<runtime::GeneratedSpmvImplementation> fast(impl(1, 1 << 20, 2, 1024, 2));
+  std::unique_ptr<runtime::GeneratedSpmvImplementation> small(impl(2, 1024, 2, 1024, 2));
+  std::unique_ptr<runtime::GeneratedSpmvImplementation> tooSmall(impl(3, a.n - 1, 4, 1024, 4));
+
+  // the smallest max rows does not make the fastest implementation
+  runtime::SpmvImplementationLoader loader({slow.get(), fast.get(), tooSmall.get()});
+  EXPECT_EQ(loader.architectureWithParams(a.n), slow.get());
+  EXPECT_EQ(loader.fastestFor(a), fast.get());
+
+  // of equally fast ones, the smallest
+  runtime::SpmvImplementationLoader ties({fast.get(), small.get()});
+  EXPECT_EQ(ties.fastestFor(a), small.get());
+
+  // without one of enough rows, the rows are multiplied in passes
+  runtime::SpmvImplementationLoader passes({tooSmall.get()});
+  EXPECT_EQ(passes.fastestFor(a), tooSmall.get());
+  runtime::SpmvImplementationLoader none{std::vector<runtime::GeneratedSpmvImplementation*>()};
+  EXPECT_EQ(none.fastestFor(a), nullptr);
+}
+
+TEST(Spmv, CgWithResidentMatrix) {
+  // the lower triangle of the 1D Laplacian
+  int n = 300;
+  DokMatrix l(n, n);
+  for (int i = 0; i < n; i++) {
+    l.set(i, i, 2);
+    if (i > 0)
+      l.set(i, i - 1, -1);
+  }
+  SymCsrMatrix a{CsrMatrix{l}};
+  CsrMatrix full = a.explicitSymmetric();
+  ASSERT_EQ(full, CsrMatrix{l.explicitSymmetric()});
+
+  Vector exp(n), b(n);
+  for (int i = 0; i < n; i++)
+    exp[i] = 1 + i % 4;
+  cpu::spmv(full.view(), exp.data.data(), b.data.data());
+
+  Spmv s(FakeDevice::impl(4, 2));
+  FakeDevice::matrix = &full;
+  solvers::Cg cg(s);
+  cg.tolerance = 1e-8;
+  cg.preprocess(a);
+  int64_t matrixBytes = FakeDevice::bytesWritten;
+
+  Vector x = cg.solve(b);
+  EXPECT_TRUE(cg.converged);
+  for (int i = 0; i < n; i++)
+    EXPECT_NEAR(x[i], exp[i], 1e-6) << i;
+
+  // only the vector is written for each multiplication, one copy per controller
+  int64_t vectorBytes = utils::align(n * int(sizeof(double)), 384) * 2;
+  int64_t multiplications = (FakeDevice::bytesWritten - matrixBytes) / vectorBytes;
+  EXPECT_EQ(multiplications * vectorBytes, FakeDevice::bytesWritten - matrixBytes);
+  EXPECT_LE(multiplications, cg.iterations + 5);
+
+  solvers::Cg notPreprocessed(s);
+  EXPECT_THROW(notPreprocessed.solve(b), std::runtime_error);
+}
+
+TEST(Spmv, CgRefinesReducedPrecisionSolves) {
+  int n = 300;
+  CsrMatrix a = tridiagonal(n);
+  Vector exp(n), b(n);
+  for (int i = 0; i < n; i++)
+    exp[i] = 1 + i % 4;
+  cpu::spmv(a.view(), exp.data.data(), b.data.data());
+
+  Spmv fp64(FakeDevice::impl(4, 2));
+  fp64.preprocess(a);
+  fp64.loadMatrix();
+  int64_t fp64Bytes = FakeDevice::bytesWritten;
+
+  // the device multiplies by the matrix rounded to bf16
+  CsrMatrix rounded = a;
+  for (double& v : rounded.values)
+    v = Bf16Value::decode(Bf16Value::encode(v, 0), 0);
+  Spmv s(FakeDevice::impl(4, 2, ValueFormat::Bf16));
+  FakeDevice::matrix = &rounded;
+  solvers::Cg cg(s);
+  cg.tolerance = 1e-10;
+  cg.preprocess(a);
+  EXPECT_LT(FakeDevice::bytesWritten, fp64Bytes);
+
+  Vector x = cg.solve(b);
+  EXPECT_TRUE(cg.converged);
+  EXPECT_GE(cg.refinements, 2);
+  for (int i = 0; i < n; i++)
+    EXPECT_NEAR(x[i], exp[i], 1e-9) << i;
+}
+
+TEST(Spmv, SymmetricDesignsStreamTheLowerTriangle) {
+  SymCsrMatrix a = io::readSymMatrix("test/matrices/OPF_3754.mtx");
+  CsrMatrix full = a.explicitSymmetric();
+  Spmv explicitSpmv(1024, 4, 2, a.n, 1);
+  explicitSpmv.analyse(full);
+  Spmv sym(1024, 4, 2, a.n, 1, ValueFormat::Fp64, 32, true);
+  sym.analyse(a.matrix.view());
+
+  int64_t explicitBytes = 0, symBytes = 0;
+  for (const auto& p : explicitSpmv.getPartitions())
+    explicitBytes += p.indptrValuesBytes();
+  for (const auto& p : sym.getPartitions()) {
+    symBytes += p.indptrValuesBytes();
+    EXPECT_GT(p.reflectedSize, 0);
+  }
+  EXPECT_LT(symBytes, 0.6 * explicitBytes);
+  EXPECT_EQ(sym.getPartitions()[1].firstRow, sym.getPartitions()[0].n);
+  // the device still multiplies both triangles
+  EXPECT_DOUBLE_EQ(sym.getGFlopsCount(), explicitSpmv.getGFlopsCount());
+
+  model::Max4Model device;
+  EXPECT_GT(sym.getEstimatedHardwareModel(device, a.n).ru.luts,
+            explicitSpmv.getEstimatedHardwareModel(device, a.n).ru.luts);
+}
+
+TEST(Spmv, SymmetricDesignsRejectFullMatrices) {
+  SymCsrMatrix a = io::readSymMatrix("test/matrices/bfwb62.mtx");
+  Spmv sym(64, 4, 2, a.n, 1, ValueFormat::Fp64, 32, true);
+  EXPECT_THROW(sym.analyse(a.explicitSymmetric()), std::invalid_argument);
+  sym.setReordering(reordering::Method::Rcm);
+  EXPECT_THROW(sym.analyse(a.matrix.view()), std::invalid_argument);
+}
+
+TEST(Spmv, DramReductionPadsSmallMatrices) {
+  CsrMatrix a = io::readMatrix("test/matrices/bfwb62.mtx");
+  FakeDevice::impl(2, 1);
+  runtime::GeneratedSpmvImplementation impl(
+      0, FakeDevice::run, FakeDevice::write, FakeDevice::read, 1 << 20, 2, 16, 2, true, 1);
+  Spmv dram(impl);
+  dram.preprocess(a);
+  // the empty rows are partitioned, and cost their cycles
+  EXPECT_EQ(dram.getRowSplits().back(), minRowsWithDramReduction);
+  Spmv bram(FakeDevice::impl(2, 1));
+  bram.analyse(a);
+  EXPECT_GT(dram.getEstimatedClockCycles(), bram.getEstimatedClockCycles());
+
+  // row r of the fake result is x[0] * r, only the rows of a are returned
+  Vector x(a.m);
+  x[0] = 2;
+  Vector y = dram.spmv(x);
+  ASSERT_EQ(y.size(), a.n);
+  for (int i = 0; i < a.n; i++)
+    EXPECT_EQ(y[i], 2 * i) << i;
+  std::vector<double> out(a.n);
+  dram.multiply(x.data.data(), out.data());
+  EXPECT_EQ(out, y.data);
+}
+
+TEST(Spmv, RowPassesOfAtMostMaxRows) {
+  CsrMatrix a = io::readMatrix("test/matrices/OPF_3754.mtx");
+  Spmv s(64, 4, 4, 4000, 2);
+  s.analyse(a);
+  ASSERT_EQ(s.numRowPasses(), 4);
+  const std::vector<int>& splits = s.getRowSplits();
+  ASSERT_EQ(splits.size(), 17u);
+  for (int pass = 0; pass < 4; pass++) {
+    EXPECT_LE(splits[4 * (pass + 1)] - splits[4 * pass], 4000);
+    for (int i = 4 * pass; i < 4 * (pass + 1); i++)
+      EXPECT_EQ(s.getPartitions()[i].firstRow, splits[i]);
+  }
+
+  // the passes run one after the other
+  Spmv single(64, 4, 4, a.n, 2);
+  single.analyse(a);
+  EXPECT_GT(s.getEstimatedClockCycles(), single.getEstimatedClockCycles());
+}
@@ -0,0 +1,149 @@
+#include <Trace.hpp>
+#include <Parallel.hpp>
+#include <Spmv.hpp>
+#include <SparseMatrix.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <gtest/gtest.h>
+
+using namespace cask;
+
+namespace {
+
+// enables tracing for the duration of a test, without earlier events
+struct Tracing {
+  Tracing() {
+    trace::clear();
+    trace::enable();
+  }
+  ~Tracing() {
+    trace::enable(false);
+    trace::clear();
+  }
+};
+
+int64_t countEvents(const std::string& name) {
+  trace::CounterId id = trace::intern(name);
+  std::vector<trace::Event> events = trace::events();
+  return std::count_if(events.begin(), events.end(),
+                       [&](const trace::Event& e) { return e.id == id; });
+}
+
+}
+
+TEST(Trace, InternedIdsAreStable) {
+  trace::CounterId a = trace::intern("test:a");
+  EXPECT_EQ(trace::intern("test:a"), a);
+  EXPECT_NE(trace::intern("test:b"), a);
+  EXPECT_EQ(trace::name(a), "test:a");
+  EXPECT_THROW(trace::name(1u << 30), std::invalid_argument);
+}
+
+TEST(Trace, NothingIsRecordedWhenDisabled) {
+  trace::clear();
+  ASSERT_FALSE(trace::enabled());
+  {
+    CASK_TRACE_SCOPE("test:disabled");
+    CASK_TRACE_COUNTER("test:disabledCounter", 1);
+  }
+  EXPECT_TRUE(trace::events().empty());
+}
+
+TEST(Trace, ScopesAndCountersOfAllThreads) {
+  Tracing t;
+  parallel::ThreadPool::global().run(64, [](int i) {
+    CASK_TRACE_SCOPE("test:task", i);
+    CASK_TRACE_COUNTER("test:value", i);
+  });
+  std::vector<trace::Event> events = trace::events();
+  trace::CounterId task = trace::intern("test:task");
+  std::set<double> args;
+  for (const auto& e : events) {
+    if (e.id != task)
+      continue;
+    EXPECT_EQ(e.type, 'X');
+    EXPECT_GE(e.duration, 0);
+    args.insert(e.value);
+  }
+  EXPECT_EQ(args.size(), 64u);
+  EXPECT_EQ(countEvents("test:value"), 64);
+
+  std::vector<trace::PhaseSummary> phases = trace::summary();
+  auto p = std::find_if(phases.begin(), phases.end(),
+                        [](const trace::PhaseSummary& s) { return s.name == "test:task"; });
+  ASSERT_NE(p, phases.end());
+  EXPECT_EQ(p->count, 64);
+  // counters are not phases
+  EXPECT_TRUE(std::none_of(phases.begin(), phases.end(),
+                           [](const trace::PhaseSummary& s) { return s.name == "test:value"; }));
+}
+
+TEST(Trace, RingBufferKeepsTheLatestEvents) {
+  Tracing t;
+  for (int64_t i = 0; i < trace::eventsPerThread + 10; i++)
+    CASK_TRACE_COUNTER("test:ring", i);
+  std::vector<trace::Event> events = trace::events();
+  ASSERT_EQ(int64_t(events.size()), trace::eventsPerThread);
+  EXPECT_EQ(events.front().value, 10);
+  EXPECT_EQ(events.back().value, trace::eventsPerThread + 9);
+}
+
+TEST(Trace, ChromeTraceIsValidJson) {
+  Tracing t;
+  {
+    CASK_TRACE_SCOPE("test:\"quoted\"", 3);
+  }
+  CASK_TRACE_COUNTER("test:counter", 0.5);
+  std::stringstream s;
+  trace::writeChromeTrace(s);
+  boost::property_tree::ptree tree;
+  boost::property_tree::read_json(s, tree);
+  auto& events = tree.get_child("traceEvents");
+  ASSERT_EQ(events.size(), 2u);
+  auto first = events.begin()->second;
+  EXPECT_EQ(first.get<std::string>("name"), "test:\"quoted\"");
+  EXPECT_EQ(first.get<std::string>("ph"), "X");
+  EXPECT_EQ(first.get<double>("args.value"), 3);
+  EXPECT_EQ((++events.begin())->second.get<std::string>("ph"), "C");
+
+  std::stringstream summary;
+  trace::writeSummary(summary);
+  boost::property_tree::read_json(summary, tree);
+}
+
+TEST(Trace, SpmvPhasesOfEachPartition) {
+  // an identity matrix, on a device which does not compute anything
+  int n = 100;
+  DokMatrix d(n, n);
+  for (int i = 0; i < n; i++)
+    d.set(i, i, 1);
+  CsrMatrix a(d);
+  runtime::GeneratedSpmvImplementation impl(
+      0, runtime::spmvRunMock, runtime::spmvWriteMock, runtime::spmvReadMock,
+      1 << 20, 4, 16, 2, false, 2);
+  spmv::Spmv s(impl);
+
+  Tracing t;
+  s.preprocess(a);
+  // the timings and estimates are only printed if verbose
+  testing::internal::CaptureStdout();
+  s.spmv(Vector(n));
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+  EXPECT_EQ(countEvents("spmv:preprocess"), 1);
+  EXPECT_EQ(countEvents("spmv:partition"), 4);
+  // the matrix and the vector are written once per controller
+  EXPECT_EQ(countEvents("spmv:writeMatrix"), 2);
+  EXPECT_EQ(countEvents("spmv:writeVector"), 2);
+  EXPECT_EQ(countEvents("spmv:run"), 1);
+  EXPECT_EQ(countEvents("spmv:readResult"), 4);
+  EXPECT_EQ(countEvents("spmv:gflops"), 1);
+  EXPECT_EQ(countEvents("spmv:cycles"), 1);
+
+  testing::internal::CaptureStdout();
+  s.spmm(std::vector<Vector>(2, Vector(n)));
+  EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+  EXPECT_EQ(countEvents("spmm:gflops"), 1);
+}
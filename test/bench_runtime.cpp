@@ -0,0 +1,265 @@
+// Microbenchmarks of the host side of the runtime: matrix I/O, conversions,
+// partitioning and the CPU kernels, over the matrices of a benchmark
+// directory (test/test-benchmark by default, or --matrices=<dir>). Results
+// are reported in JSON unless another --benchmark_format is given.
+#include <Spmv.hpp>
+#include <CpuSpmv.hpp>
+#include <IO.hpp>
+#include <FileUtils.hpp>
+#include <MatrixProfile.hpp>
+#include <SparseMatrix.hpp>
+#include <SparseLinearSolvers.hpp>
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace cask;
+
+namespace {
+
+// the parameters of the design the partitioning benchmarks model
+const int cacheSize = 1024, inputWidth = 8, numPipes = 4;
+
+struct BenchMatrix {
+  std::string path, name;
+  int64_t fileBytes;
+  bool symmetric;
+  CsrMatrix csr;
+  // for the blocks of the partitioning benchmarks, computed once
+  spmv::MatrixProfile profile;
+};
+
+// bytes read by a CSR kernel: values, column indices and row pointers
+int64_t csrBytes(const CsrMatrix& a) {
+  return int64_t(a.nnzs) * (sizeof(double) + sizeof(int)) + int64_t(a.n + 1) * sizeof(int);
+}
+
+void setRates(benchmark::State& state, int64_t bytes, int64_t nnzs) {
+  state.SetBytesProcessed(state.iterations() * bytes);
+  state.counters["nnz/s"] = benchmark::Counter(
+      double(state.iterations()) * nnzs, benchmark::Counter::kIsRate);
+}
+
+// exposes the cycle count of the compute stage
+class CycleCounter : public spmv::Spmv {
+ public:
+  CycleCounter() : Spmv(cacheSize, inputWidth, 1, 1, 1) {}
+  int count(int32_t* rowEnds, int n) {
+    return countComputeCycles(rowEnds, n, inputWidth);
+  }
+};
+
+void readMatrixParse(benchmark::State& state, const BenchMatrix* m) {
+  for (auto _ : state)
+    benchmark::DoNotOptimize(io::readCsrMatrix(m->path, true));
+  setRates(state, m->fileBytes, m->csr.nnzs);
+}
+
+void readMatrixCached(benchmark::State& state, const BenchMatrix* m) {
+  io::readMatrix(m->path);  // builds the cache if needed
+  for (auto _ : state)
+    benchmark::DoNotOptimize(io::readMatrix(m->path));
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+}
+
+void dokToCsr(benchmark::State& state, const BenchMatrix* m) {
+  DokMatrix dok = m->csr.toDok();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(CsrMatrix(dok));
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+}
+
+void sliceRows(benchmark::State& state, const BenchMatrix* m) {
+  const CsrMatrix& a = m->csr;
+  int rows = a.n / numPipes;
+  for (auto _ : state)
+    for (int p = 0; p < numPipes; p++)
+      benchmark::DoNotOptimize(a.sliceRows(p * rows, p == numPipes - 1 ? a.n - p * rows : rows));
+  setRates(state, csrBytes(a), a.nnzs);
+}
+
+void sliceColumns(benchmark::State& state, const BenchMatrix* m) {
+  for (auto _ : state)
+    benchmark::DoNotOptimize(m->csr.sliceColumns(cacheSize));
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+}
+
+void blockedCsr(benchmark::State& state, const BenchMatrix* m) {
+  for (auto _ : state)
+    benchmark::DoNotOptimize(BlockedCsrMatrix(m->csr, cacheSize));
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+}
+
+void doBlocking(benchmark::State& state, const BenchMatrix* m) {
+  spmv::Spmv s(cacheSize, inputWidth, 1, m->csr.n, 1);
+  CsrView a = m->csr.view();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(s.do_blocking(a, cacheSize, inputWidth));
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+}
+
+void matrixProfile(benchmark::State& state, const BenchMatrix* m) {
+  for (auto _ : state)
+    benchmark::DoNotOptimize(spmv::MatrixProfile(m->csr, cacheSize));
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+  // the structure the partitioning benchmarks run on
+  state.counters["bandwidth"] = m->profile.bandwidth();
+  state.counters["emptyRowRuns"] = m->profile.emptyRowRuns;
+  state.counters["occupiedBlocks"] = m->profile.occupiedBlocks();
+}
+
+void preprocess(benchmark::State& state, const BenchMatrix* m) {
+  spmv::SkipEmptyRowsSpmv s(cacheSize, inputWidth, numPipes, m->csr.n, 1);
+  for (auto _ : state) {
+    s.preprocess(m->csr);
+    benchmark::DoNotOptimize(s.getPartitions().data());
+  }
+  setRates(state, csrBytes(m->csr), m->csr.nnzs);
+}
+
+void countComputeCycles(benchmark::State& state, const BenchMatrix* m) {
+  CycleCounter c;
+  spmv::Partition p = c.do_blocking(m->csr.view(), cacheSize, inputWidth);
+  // a block row end per row and block
+  std::vector<int32_t> rowEnds = p.m_colptr;
+  int n = m->csr.n;
+  for (auto _ : state) {
+    int64_t cycles = 0;
+    for (int b = 0; b < p.nBlocks; b++)
+      cycles += c.count(&rowEnds[int64_t(b) * n], n);
+    benchmark::DoNotOptimize(cycles);
+  }
+  setRates(state, rowEnds.size() * sizeof(int32_t), m->csr.nnzs);
+}
+
+void cpuSpmv(benchmark::State& state, const BenchMatrix* m) {
+  const CsrMatrix& a = m->csr;
+  std::vector<double> x(a.m, 1.0), y(a.n);
+  CsrView v = a.view();
+  for (auto _ : state) {
+    cpu::spmv(v, x.data(), y.data());
+    benchmark::DoNotOptimize(y.data());
+  }
+  setRates(state, csrBytes(a) + int64_t(a.n + a.m) * sizeof(double), a.nnzs);
+}
+
+void cpuBlockedSpmv(benchmark::State& state, const BenchMatrix* m) {
+  const CsrMatrix& a = m->csr;
+  std::vector<double> x(a.m, 1.0), y(a.n);
+  BlockedCsrMatrix b(a, cacheSize);
+  for (auto _ : state) {
+    cpu::blockedSpmv(b, x.data(), y.data());
+    benchmark::DoNotOptimize(y.data());
+  }
+  setRates(state, csrBytes(a) + int64_t(a.n + a.m) * sizeof(double), a.nnzs);
+}
+
+void cpuSellSpmv(benchmark::State& state, const BenchMatrix* m) {
+  const CsrMatrix& a = m->csr;
+  std::vector<double> x(a.m, 1.0), y(a.n);
+  SellMatrix s(a, cpu::sellChunkHeight(), 256);
+  for (auto _ : state) {
+    cpu::sellSpmv(s, x.data(), y.data());
+    benchmark::DoNotOptimize(y.data());
+  }
+  state.counters["fill"] = s.fillRatio();
+  setRates(state, csrBytes(a) + int64_t(a.n + a.m) * sizeof(double), a.nnzs);
+}
+
+// nonzeros are those of the stored lower triangle, per iteration
+void pcg(benchmark::State& state, const BenchMatrix* m) {
+  SymCsrMatrix a = io::readSymMatrix(m->path);
+  int n = a.n;
+  std::vector<double> rhs(n, 1.0), x(n);
+  sparse_linear_solvers::IdentityPreconditioner precon(n);
+  sparse_linear_solvers::CgWorkspace w;
+  int64_t iterations = 0;
+  for (auto _ : state) {
+    std::fill(x.begin(), x.end(), 0.0);
+    int it = 0;
+    sparse_linear_solvers::pcg(a.matrix, precon, w, rhs.data(), x.data(), it);
+    iterations += it + 1;
+  }
+  state.SetBytesProcessed(iterations * csrBytes(a.matrix));
+  state.counters["nnz/s"] = benchmark::Counter(double(iterations) * a.matrix.nnzs, benchmark::Counter::kIsRate);
+  state.counters["iterations"] = double(iterations) / state.iterations();
+}
+
+// the .mtx matrices of the directory, in name order
+std::vector<std::unique_ptr<BenchMatrix>> loadMatrices(const std::string& dir) {
+  std::vector<std::string> paths;
+  for (const auto& p : file_utils::child_files(dir))
+    if (boost::filesystem::path(p).extension() == ".mtx")
+      paths.push_back(p);
+  std::sort(paths.begin(), paths.end());
+
+  std::vector<std::unique_ptr<BenchMatrix>> matrices;
+  for (const auto& p : paths) {
+    std::unique_ptr<BenchMatrix> m(new BenchMatrix());
+    m->path = p;
+    m->name = boost::filesystem::path(p).filename().string();
+    m->fileBytes = boost::filesystem::file_size(p);
+    m->symmetric = io::readHeader(p).isSymmetric();
+    m->csr = io::readMatrix(p);
+    m->profile = spmv::MatrixProfile(m->csr, cacheSize);
+    matrices.push_back(std::move(m));
+  }
+  return matrices;
+}
+
+}
+
+int main(int argc, char** argv) {
+  std::string dir = CASK_SOURCE_DIR "/test/test-benchmark";
+  bool hasFormat = false;
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    std::string a = argv[i];
+    if (a.compare(0, 11, "--matrices=") == 0) {
+      dir = a.substr(11);
+      continue;
+    }
+    hasFormat = hasFormat || a.compare(0, 19, "--benchmark_format=") == 0;
+    args.push_back(argv[i]);
+  }
+  static char json[] = "--benchmark_format=json";
+  if (!hasFormat)
+    args.push_back(json);
+  int nArgs = args.size();
+  benchmark::Initialize(&nArgs, args.data());
+  if (benchmark::ReportUnrecognizedArguments(nArgs, args.data()))
+    return 1;
+
+  std::vector<std::unique_ptr<BenchMatrix>> matrices = loadMatrices(dir);
+  typedef void (*Bench)(benchmark::State&, const BenchMatrix*);
+  const std::pair<const char*, Bench> benchmarks[] = {
+    {"readMatrix/parse", readMatrixParse},
+    {"readMatrix/cached", readMatrixCached},
+    {"DokToCsr", dokToCsr},
+    {"sliceRows", sliceRows},
+    {"sliceColumns", sliceColumns},
+    {"BlockedCsrMatrix", blockedCsr},
+    {"do_blocking", doBlocking},
+    {"MatrixProfile", matrixProfile},
+    {"preprocess", preprocess},
+    {"countComputeCycles", countComputeCycles},
+    {"cpu::spmv", cpuSpmv},
+    {"cpu::blockedSpmv", cpuBlockedSpmv},
+    {"cpu::sellSpmv", cpuSellSpmv},
+  };
+  for (const auto& b : benchmarks)
+    for (const auto& m : matrices)
+      benchmark::RegisterBenchmark((std::string(b.first) + "/" + m->name).c_str(), b.second, m.get())
+          ->Unit(benchmark::kMillisecond);
+  for (const auto& m : matrices)
+    if (m->symmetric)
+      benchmark::RegisterBenchmark(("pcg/" + m->name).c_str(), pcg, m.get())
+          ->Unit(benchmark::kMillisecond);
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
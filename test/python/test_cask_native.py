@@ -0,0 +1,68 @@
+"""Smoke test of the cask_native Python module, run by CTest when pybind11
+is found; skipped without NumPy and SciPy."""
+
+import unittest
+
+try:
+    import numpy as np
+    import scipy.sparse
+except ImportError:
+    np = None
+
+import cask_native
+
+
+def banded(n):
+    return scipy.sparse.diags(
+        [np.full(n - 1, -1.0), np.full(n, 4.0), np.full(n - 1, -1.0)],
+        [-1, 0, 1], format='csr')
+
+
+@unittest.skipIf(np is None, 'NumPy and SciPy are needed')
+class TestCaskNative(unittest.TestCase):
+
+    def setUp(self):
+        self.ctx = cask_native.Context()
+        self.a = banded(100)
+        self.x = np.arange(1, 101, dtype=np.float64)
+
+    def test_cpu_spmv(self):
+        np.testing.assert_allclose(cask_native.cpu_spmv(self.a, self.x), self.a.dot(self.x))
+        with self.assertRaises(ValueError):
+            cask_native.cpu_spmv(self.a, self.x[:-1])
+        with self.assertRaises(ValueError):
+            cask_native.cpu_spmv(self.a.tocoo(), self.x)
+
+    def test_preprocess(self):
+        spmv = self.ctx.preprocess(self.a)
+        self.assertEqual((spmv.rows, spmv.cols, spmv.nnzs), (100, 100, self.a.nnz))
+        self.assertGreaterEqual(self.ctx.estimate_clock_cycles(self.a), 0)
+        self.assertEqual(spmv.multiply(self.x).shape, (100,))
+
+    def test_multiply_into_does_not_convert(self):
+        spmv = self.ctx.preprocess(self.a)
+        y = np.zeros(100)
+        spmv.multiply_into(self.x, y)
+        # the output would be written to a copy of these
+        with self.assertRaises(TypeError):
+            spmv.multiply_into(self.x, np.zeros(100, dtype=np.float32))
+        with self.assertRaises(TypeError):
+            spmv.multiply_into(self.x, np.zeros(200)[::2])
+        readonly = np.zeros(100)
+        readonly.setflags(write=False)
+        with self.assertRaises(ValueError):
+            spmv.multiply_into(self.x, readonly)
+        with self.assertRaises(ValueError):
+            spmv.multiply_into(self.x, np.zeros(99))
+
+    def test_explore(self):
+        params = {'num_pipes': {'start': 1, 'stop': 1}, 'cache_size': {'start': 1024, 'stop': 1024},
+                  'input_width': 8, 'num_controllers': 1}
+        results = self.ctx.explore({'banded': self.a}, params)
+        self.assertEqual(len(results), 1)
+        self.assertEqual(results[0]['matrices'], ['banded'])
+        self.assertIn('architecture_params', results[0])
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -18,9 +18,9 @@ using namespace std;
 
 int test(string path, int implId) {
   std::cout << "File: " << path << std::endl;
-  cask::io::MmReader<double> m(path);
-  auto eigenMatrix = cask::converters::tripletToEigen(m.mmreadMatrix(path));
-  int cols = eigenMatrix->cols();
+  auto csrMatrix = cask::io::readMatrix(path);
+  cask::converters::EigenCsrMap eigenMatrix = cask::converters::asEigen(csrMatrix);
+  int cols = csrMatrix.m;
 
   std::cout << "Param MatrixPath " << path << std::endl;
 
@@ -28,15 +28,14 @@ int test(string path, int implId) {
   for (int i = 0; i < cols; i++) x[i] = (double)i * 0.25;
 
   cask::runtime::SpmvImplementationLoader implLoader;
-  // TODO find the best architecture somehow
-  int maxRows = eigenMatrix->rows();
   cask::runtime::GeneratedSpmvImplementation* deviceImpl =
     implId == -1 ?
-    implLoader.architectureWithParams(maxRows) :
+    implLoader.fastestFor(csrMatrix) :
     implLoader.architectureWithId(implId);
 
   cask::spmv::Spmv a(*deviceImpl);
-  auto csrMatrix = cask::io::readMatrix(path);
+  // the frontend parses the timings and estimates of the run
+  a.setVerbose(true);
   a.preprocess(csrMatrix);
   // TODO need a consistent way to handle params
   //cout << a->getParams();
@@ -44,11 +43,27 @@ int test(string path, int implId) {
 
   Eigen::VectorXd ex(cols);
   for (int i = 0; i < cols; i++) ex[i] = (double)i * 0.25;
-  Eigen::VectorXd exp = *eigenMatrix * ex;
+  Eigen::VectorXd exp = eigenMatrix * ex;
 
   auto mismatches =
       cask::test::check(got.data, cask::converters::eigenVectorToStdVector(exp));
 
+  // the batched mode must agree with single multiplications
+  const int batchSize = 4;
+  std::vector<cask::Vector> xs;
+  for (int j = 0; j < batchSize; j++) {
+    cask::Vector xj(cols);
+    for (int i = 0; i < cols; i++) xj[i] = x[i] * (j + 1);
+    xs.push_back(xj);
+  }
+  std::vector<cask::Vector> ys = a.spmm(xs);
+  for (int j = 0; j < batchSize; j++) {
+    Eigen::VectorXd expj = exp * (j + 1);
+    auto batchMismatches =
+        cask::test::check(ys[j].data, cask::converters::eigenVectorToStdVector(expj));
+    mismatches.insert(mismatches.end(), batchMismatches.begin(), batchMismatches.end());
+  }
+
   if (mismatches.empty()) {
     std::cout << "Test passed!" << std::endl;
     return 0;
@@ -140,10 +140,10 @@ namespace cask {
     int runTest(
         std::string path,
         cask::sparse_linear_solvers::Solver& solver) {
-      cask::io::MmReader<double> m(path);
-      auto eigenMatrix = cask::converters::tripletToEigen(m.mmreadMatrix(path));
-      return test(eigenMatrix->rows(),
-          EigenMatrixGenerator{*eigenMatrix},
+      cask::CsrMatrix a = cask::io::readCsrMatrix(path);
+      Md eigenMatrix(cask::converters::asEigen(a));
+      return test(eigenMatrix.rows(),
+          EigenMatrixGenerator{eigenMatrix},
           cask::test::SimpleVectorGenerator{},
           solver);
     }
@@ -152,12 +152,12 @@ namespace cask {
         std::string path,
         std::string vectorPath,
         cask::sparse_linear_solvers::Solver& solver) {
-      cask::io::MmReader<double> m(path);
-      auto eigenMatrix = cask::converters::tripletToEigen(m.mmreadMatrix(path));
+      cask::CsrMatrix a = cask::io::readCsrMatrix(path);
+      Md eigenMatrix(cask::converters::asEigen(a));
       cask::io::MmReader<double> mv(vectorPath);
       auto eigenVector = cask::converters::stdvectorToEigen(mv.readVector());
-      return test(eigenMatrix->rows(),
-          EigenMatrixGenerator{*eigenMatrix},
+      return test(eigenMatrix.rows(),
+          EigenMatrixGenerator{eigenMatrix},
           EigenVectorGenerator{eigenVector},
           solver);
     }